@@ -0,0 +1,494 @@
+#define _POSIX_C_SOURCE 200809L
+#include "archive.h"
+#include "scan.h"
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ARCHIVE_MAGIC "MLARCH01"
+#define ARCHIVE_BLOCK_MAGIC 0x4B4C4231u
+#define ARCHIVE_INT_COLUMNS ARCHIVE_COL_TECH_DATA
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_letters;
+} ArchiveFileHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    int32_t min_id;
+    int32_t max_id;
+    int32_t min_tick;
+    int32_t max_tick;
+    uint32_t payload_size;
+    uint32_t column_offsets[ARCHIVE_COLUMNS];
+} ArchiveBlockHeader;
+
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+typedef struct {
+    int id;
+    size_t position;
+} IdPosition;
+
+static int buffer_reserve(ByteBuffer *buffer, size_t extra) {
+    if (buffer->size + extra <= buffer->capacity) {
+        return 1;
+    }
+    size_t new_capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (new_capacity < buffer->size + extra) {
+        new_capacity *= 2;
+    }
+    unsigned char *new_data = (unsigned char*)realloc(buffer->data, new_capacity);
+    if (!new_data) {
+        return 0;
+    }
+    buffer->data = new_data;
+    buffer->capacity = new_capacity;
+    return 1;
+}
+
+static int put_varint(ByteBuffer *buffer, uint64_t value) {
+    if (!buffer_reserve(buffer, 10)) {
+        return 0;
+    }
+    while (value >= 0x80) {
+        buffer->data[buffer->size++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    buffer->data[buffer->size++] = (unsigned char)value;
+    return 1;
+}
+
+static const unsigned char* get_varint(const unsigned char *p, const unsigned char *end, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char byte = *p++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static int32_t letter_column(const Letter *letter, int column) {
+    switch (column) {
+        case ARCHIVE_COL_ID: return letter->id;
+        case ARCHIVE_COL_FROM: return letter->from_office;
+        case ARCHIVE_COL_TO: return letter->to_office;
+        case ARCHIVE_COL_CURRENT: return letter->current_office;
+        case ARCHIVE_COL_PRIORITY: return letter->priority;
+        case ARCHIVE_COL_FLAGS: return (int32_t)letter->type | ((int32_t)letter->state << 2);
+        case ARCHIVE_COL_CREATED: return letter->created_tick;
+        case ARCHIVE_COL_DELIVERED: return letter->delivered_tick;
+        case ARCHIVE_COL_HOPS: return letter->hops;
+    }
+    return 0;
+}
+
+static int32_t closing_tick(const Letter *letter) {
+    return letter->delivered_tick >= 0 ? letter->delivered_tick : letter->created_tick;
+}
+
+static int compare_id_positions(const void *a, const void *b) {
+    int x = ((const IdPosition*)a)->id;
+    int y = ((const IdPosition*)b)->id;
+    return (x > y) - (x < y);
+}
+
+FILE* archive_writer_open(const char *path) {
+    if (!path) {
+        return NULL;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return NULL;
+    }
+    ArchiveFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = 1;
+    header.block_letters = ARCHIVE_BLOCK_LETTERS;
+    if (fwrite(&header, sizeof(header), 1, file) != 1 || fflush(file) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+static StatusCode write_one_block(FILE *file, const Letter *letters, size_t count, IdPosition *order, ByteBuffer *payload) {
+    for (size_t i = 0; i < count; i++) {
+        order[i].id = letters[i].id;
+        order[i].position = i;
+    }
+    qsort(order, count, sizeof(IdPosition), compare_id_positions);
+
+    ArchiveBlockHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = ARCHIVE_BLOCK_MAGIC;
+    header.count = (uint32_t)count;
+    header.min_id = order[0].id;
+    header.max_id = order[count - 1].id;
+    header.min_tick = letters[0].created_tick;
+    header.max_tick = closing_tick(&letters[0]);
+
+    payload->size = 0;
+    for (int column = 0; column < ARCHIVE_INT_COLUMNS; column++) {
+        header.column_offsets[column] = (uint32_t)payload->size;
+        int64_t previous = 0;
+        for (size_t i = 0; i < count; i++) {
+            int64_t value = letter_column(&letters[order[i].position], column);
+            if (!put_varint(payload, zigzag(value - previous))) {
+                return ERROR_MEMORY_ALLOCATION;
+            }
+            previous = value;
+        }
+    }
+
+    header.column_offsets[ARCHIVE_COL_TECH_DATA] = (uint32_t)payload->size;
+    for (size_t i = 0; i < count; i++) {
+        const Letter *letter = &letters[order[i].position];
+        size_t length = strnlen(letter->tech_data, TECH_DATA_SIZE - 1);
+        if (!put_varint(payload, length) || !buffer_reserve(payload, length)) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        memcpy(payload->data + payload->size, letter->tech_data, length);
+        payload->size += length;
+
+        if (letter->created_tick < header.min_tick) {
+            header.min_tick = letter->created_tick;
+        }
+        if (closing_tick(letter) > header.max_tick) {
+            header.max_tick = closing_tick(letter);
+        }
+    }
+    header.payload_size = (uint32_t)payload->size;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(payload->data, 1, payload->size, file) != payload->size) {
+        return ERROR_FILE_OPERATION;
+    }
+    return SUCCESS;
+}
+
+StatusCode archive_write_block(FILE *file, const Letter *letters, size_t count) {
+    if (!file || (!letters && count > 0)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    if (count == 0) {
+        return SUCCESS;
+    }
+
+    size_t block = count < ARCHIVE_BLOCK_LETTERS ? count : ARCHIVE_BLOCK_LETTERS;
+    IdPosition *order = (IdPosition*)malloc(block * sizeof(IdPosition));
+    if (!order) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    ByteBuffer payload = {NULL, 0, 0};
+
+    StatusCode status = SUCCESS;
+    for (size_t start = 0; start < count && status == SUCCESS; start += block) {
+        size_t chunk = count - start < block ? count - start : block;
+        status = write_one_block(file, letters + start, chunk, order, &payload);
+    }
+    if (status == SUCCESS && fflush(file) != 0) {
+        status = ERROR_FILE_OPERATION;
+    }
+
+    free(payload.data);
+    free(order);
+    return status;
+}
+
+StatusCode archive_open(ArchiveReader *reader, const char *path) {
+    if (!reader || !path) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return ERROR_FILE_OPERATION;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ArchiveFileHeader)) {
+        close(fd);
+        return ERROR_FILE_OPERATION;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return ERROR_FILE_OPERATION;
+    }
+    reader->fd = fd;
+    reader->base = (const unsigned char*)base;
+    reader->length = (size_t)st.st_size;
+
+    if (memcmp(reader->base, ARCHIVE_MAGIC, 8) != 0) {
+        archive_close(reader);
+        return ERROR_FILE_OPERATION;
+    }
+
+    size_t capacity = 0;
+    size_t offset = sizeof(ArchiveFileHeader);
+    while (offset + sizeof(ArchiveBlockHeader) <= reader->length) {
+        ArchiveBlockHeader header;
+        memcpy(&header, reader->base + offset, sizeof(header));
+        if (header.magic != ARCHIVE_BLOCK_MAGIC || header.count == 0 ||
+            offset + sizeof(header) + header.payload_size > reader->length) {
+            break;
+        }
+
+        if (reader->num_blocks >= capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            ArchiveBlockRef *blocks = (ArchiveBlockRef*)realloc(reader->blocks, capacity * sizeof(ArchiveBlockRef));
+            if (!blocks) {
+                archive_close(reader);
+                return ERROR_MEMORY_ALLOCATION;
+            }
+            reader->blocks = blocks;
+        }
+        ArchiveBlockRef *ref = &reader->blocks[reader->num_blocks++];
+        ref->offset = offset;
+        ref->count = header.count;
+        ref->min_id = header.min_id;
+        ref->max_id = header.max_id;
+        ref->min_tick = header.min_tick;
+        ref->max_tick = header.max_tick;
+        reader->num_letters += header.count;
+        offset += sizeof(header) + header.payload_size;
+    }
+    return SUCCESS;
+}
+
+void archive_close(ArchiveReader *reader) {
+    if (!reader) {
+        return;
+    }
+
+    if (reader->base) {
+        munmap((void*)reader->base, reader->length);
+    }
+    if (reader->fd >= 0) {
+        close(reader->fd);
+    }
+    free(reader->blocks);
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = -1;
+}
+
+static int decode_column(const ArchiveReader *reader, const ArchiveBlockRef *ref, int column, int32_t *out) {
+    ArchiveBlockHeader header;
+    memcpy(&header, reader->base + ref->offset, sizeof(header));
+    const unsigned char *payload = reader->base + ref->offset + sizeof(header);
+    const unsigned char *end = payload + header.payload_size;
+    if (header.column_offsets[column] >= header.payload_size) {
+        return 0;
+    }
+
+    const unsigned char *p = payload + header.column_offsets[column];
+    int64_t value = 0;
+    for (uint32_t i = 0; i < ref->count; i++) {
+        uint64_t raw;
+        p = get_varint(p, end, &raw);
+        if (!p) {
+            return 0;
+        }
+        value += unzigzag(raw);
+        out[i] = (int32_t)value;
+    }
+    return 1;
+}
+
+static const unsigned char* tech_data_column(const ArchiveReader *reader, const ArchiveBlockRef *ref, const unsigned char **end) {
+    ArchiveBlockHeader header;
+    memcpy(&header, reader->base + ref->offset, sizeof(header));
+    const unsigned char *payload = reader->base + ref->offset + sizeof(header);
+    *end = payload + header.payload_size;
+    return payload + header.column_offsets[ARCHIVE_COL_TECH_DATA];
+}
+
+static const unsigned char* read_tech_data(const unsigned char *p, const unsigned char *end, char *out) {
+    uint64_t length;
+    p = get_varint(p, end, &length);
+    if (!p || length >= TECH_DATA_SIZE || p + length > end) {
+        return NULL;
+    }
+    if (out) {
+        memcpy(out, p, length);
+        out[length] = '\0';
+    }
+    return p + length;
+}
+
+static void letter_from_columns(int32_t *const *columns, size_t i, Letter *letter) {
+    letter->id = columns[ARCHIVE_COL_ID][i];
+    letter->from_office = columns[ARCHIVE_COL_FROM][i];
+    letter->to_office = columns[ARCHIVE_COL_TO][i];
+    letter->current_office = columns[ARCHIVE_COL_CURRENT][i];
+    letter->priority = columns[ARCHIVE_COL_PRIORITY][i];
+    letter->type = (LetterType)(columns[ARCHIVE_COL_FLAGS][i] & 3);
+    letter->state = (LetterState)(columns[ARCHIVE_COL_FLAGS][i] >> 2);
+    letter->created_tick = columns[ARCHIVE_COL_CREATED][i];
+    letter->delivered_tick = columns[ARCHIVE_COL_DELIVERED][i];
+    letter->hops = columns[ARCHIVE_COL_HOPS][i];
+}
+
+static int decode_block(const ArchiveReader *reader, const ArchiveBlockRef *ref, int32_t *scratch, int32_t **columns) {
+    for (int column = 0; column < ARCHIVE_INT_COLUMNS; column++) {
+        columns[column] = scratch + (size_t)column * ref->count;
+        if (!decode_column(reader, ref, column, columns[column])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+StatusCode archive_lookup(const ArchiveReader *reader, int letter_id, Letter *out) {
+    if (!reader || !out) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    for (size_t b = 0; b < reader->num_blocks; b++) {
+        const ArchiveBlockRef *ref = &reader->blocks[b];
+        if (letter_id < ref->min_id || letter_id > ref->max_id) {
+            continue;
+        }
+
+        int32_t *scratch = (int32_t*)malloc((size_t)ref->count * ARCHIVE_INT_COLUMNS * sizeof(int32_t));
+        int32_t *columns[ARCHIVE_INT_COLUMNS];
+        if (!scratch) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        columns[ARCHIVE_COL_ID] = scratch;
+        if (!decode_column(reader, ref, ARCHIVE_COL_ID, scratch)) {
+            free(scratch);
+            return ERROR_FILE_OPERATION;
+        }
+
+        size_t lo = 0, hi = ref->count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (scratch[mid] < letter_id) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == ref->count || scratch[lo] != letter_id) {
+            free(scratch);
+            continue;
+        }
+
+        StatusCode status = ERROR_FILE_OPERATION;
+        if (decode_block(reader, ref, scratch, columns)) {
+            const unsigned char *end;
+            const unsigned char *p = tech_data_column(reader, ref, &end);
+            for (size_t i = 0; i < lo && p; i++) {
+                p = read_tech_data(p, end, NULL);
+            }
+            if (p && read_tech_data(p, end, out->tech_data)) {
+                letter_from_columns(columns, lo, out);
+                status = SUCCESS;
+            }
+        }
+        free(scratch);
+        return status;
+    }
+    return ERROR_INVALID_ID;
+}
+
+typedef enum {
+    SCAN_OFFICE,
+    SCAN_TIME
+} ScanKind;
+
+static size_t archive_scan(const ArchiveReader *reader, ScanKind kind, int a, int b, ArchiveVisitor visit, void *context) {
+    if (!reader || !visit) {
+        return 0;
+    }
+
+    size_t matched = 0;
+    int keep_going = 1;
+    for (size_t block = 0; block < reader->num_blocks && keep_going; block++) {
+        const ArchiveBlockRef *ref = &reader->blocks[block];
+        if (kind == SCAN_TIME && (ref->max_tick < a || ref->min_tick > b)) {
+            continue;
+        }
+
+        int32_t *scratch = (int32_t*)malloc((size_t)ref->count * ARCHIVE_INT_COLUMNS * sizeof(int32_t));
+        unsigned char *marks = (unsigned char*)calloc(ref->count, 1);
+        int32_t *columns[ARCHIVE_INT_COLUMNS];
+        if (!scratch || !marks) {
+            free(scratch);
+            free(marks);
+            break;
+        }
+        if (!decode_block(reader, ref, scratch, columns)) {
+            free(scratch);
+            free(marks);
+            continue;
+        }
+        if (kind == SCAN_OFFICE) {
+            scan_mark_range(columns[ARCHIVE_COL_FROM], ref->count, a, a, marks);
+            scan_mark_range(columns[ARCHIVE_COL_TO], ref->count, a, a, marks);
+        } else {
+            scan_mark_range(columns[ARCHIVE_COL_CREATED], ref->count, INT_MIN, b, marks);
+        }
+
+        const unsigned char *end;
+        const unsigned char *p = tech_data_column(reader, ref, &end);
+        for (size_t i = 0; i < ref->count && p && keep_going; i++) {
+            int match = marks[i];
+            if (match && kind == SCAN_TIME) {
+                int32_t delivered = columns[ARCHIVE_COL_DELIVERED][i];
+                match = (delivered >= 0 ? delivered : columns[ARCHIVE_COL_CREATED][i]) >= a;
+            }
+            if (!match) {
+                p = read_tech_data(p, end, NULL);
+                continue;
+            }
+
+            Letter letter;
+            p = read_tech_data(p, end, letter.tech_data);
+            if (!p) {
+                break;
+            }
+            letter_from_columns(columns, i, &letter);
+            matched++;
+            keep_going = visit(&letter, context);
+        }
+        free(scratch);
+        free(marks);
+    }
+    return matched;
+}
+
+size_t archive_scan_office(const ArchiveReader *reader, int office_id, ArchiveVisitor visit, void *context) {
+    return archive_scan(reader, SCAN_OFFICE, office_id, 0, visit, context);
+}
+
+size_t archive_scan_time(const ArchiveReader *reader, int from_tick, int to_tick, ArchiveVisitor visit, void *context) {
+    return archive_scan(reader, SCAN_TIME, from_tick, to_tick, visit, context);
+}
@@ -0,0 +1,52 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include "funcs.h"
+
+#define ARCHIVE_BLOCK_LETTERS 4096
+
+typedef enum {
+    ARCHIVE_COL_ID,
+    ARCHIVE_COL_FROM,
+    ARCHIVE_COL_TO,
+    ARCHIVE_COL_CURRENT,
+    ARCHIVE_COL_PRIORITY,
+    ARCHIVE_COL_FLAGS,
+    ARCHIVE_COL_CREATED,
+    ARCHIVE_COL_DELIVERED,
+    ARCHIVE_COL_HOPS,
+    ARCHIVE_COL_TECH_DATA,
+    ARCHIVE_COLUMNS
+} ArchiveColumn;
+
+typedef struct {
+    size_t offset;
+    uint32_t count;
+    int32_t min_id;
+    int32_t max_id;
+    int32_t min_tick;
+    int32_t max_tick;
+} ArchiveBlockRef;
+
+typedef struct ArchiveReader {
+    int fd;
+    const unsigned char *base;
+    size_t length;
+    ArchiveBlockRef *blocks;
+    size_t num_blocks;
+    size_t num_letters;
+} ArchiveReader;
+
+typedef int (*ArchiveVisitor)(const Letter *letter, void *context);
+
+FILE* archive_writer_open(const char *path);
+StatusCode archive_write_block(FILE *file, const Letter *letters, size_t count);
+
+StatusCode archive_open(ArchiveReader *reader, const char *path);
+void archive_close(ArchiveReader *reader);
+StatusCode archive_lookup(const ArchiveReader *reader, int letter_id, Letter *out);
+size_t archive_scan_office(const ArchiveReader *reader, int office_id, ArchiveVisitor visit, void *context);
+size_t archive_scan_time(const ArchiveReader *reader, int from_tick, int to_tick, ArchiveVisitor visit, void *context);
+
+#endif
@@ -0,0 +1,492 @@
+#define _POSIX_C_SOURCE 199309L
+#include "funcs.h"
+#include "workload.h"
+#include "scan.h"
+
+#define BENCH_MIN_EXPONENT 2
+#define BENCH_MAX_EXPONENT 7
+#define BENCH_BATCH 1000
+#define BENCH_MAX_RUNS 64
+
+typedef struct {
+    size_t size;
+    WorkloadRng rng;
+    MailSystem system;
+    Heap heap;
+    BucketQueue buckets;
+    QueueKind queue_kind;
+    int *ids;
+    int *priorities;
+    int *scratch_ids;
+    int *scratch_priorities;
+    int num_offices;
+} BenchContext;
+
+typedef struct {
+    const char *name;
+    const char *complexity;
+    double growth;
+    int (*setup)(BenchContext *ctx);
+    size_t (*run)(BenchContext *ctx);
+    size_t (*memory)(size_t size);
+} Benchmark;
+
+typedef struct {
+    int warmup;
+    int repeats;
+    double budget_seconds;
+    size_t memory_limit;
+    int max_exponent;
+    const char *output;
+    const char *only;
+} BenchOptions;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_context_free(BenchContext *ctx) {
+    cleanup_system(&ctx->system);
+    delete_heap(&ctx->heap);
+    delete_bucket_queue(&ctx->buckets);
+    free(ctx->ids);
+    free(ctx->priorities);
+    free(ctx->scratch_ids);
+    free(ctx->scratch_priorities);
+    ctx->ids = NULL;
+    ctx->priorities = NULL;
+    ctx->scratch_ids = NULL;
+    ctx->scratch_priorities = NULL;
+}
+
+static int fill_heap(BenchContext *ctx) {
+    ctx->heap = create_heap(INITIAL_CAPACITY);
+    for (size_t i = 0; i < ctx->size; i++) {
+        push_heap(&ctx->heap, (int)(i + 1));
+    }
+    return ctx->heap.size == ctx->size;
+}
+
+static int skewed_priority(BenchContext *ctx) {
+    double u = workload_rng_uniform(&ctx->rng);
+    return (int)(DEFAULT_MAX_PRIORITY * u * u * u);
+}
+
+static int fill_buckets(BenchContext *ctx) {
+    ctx->buckets = create_bucket_queue(DEFAULT_MAX_PRIORITY + 1);
+    for (size_t i = 0; i < ctx->size; i++) {
+        push_bucket_queue(&ctx->buckets, skewed_priority(ctx), (int)(i + 1));
+    }
+    return ctx->buckets.size == ctx->size;
+}
+
+static int build_offices(BenchContext *ctx, int num_offices, int capacity) {
+    SystemConfig config;
+    default_system_config(&config);
+    config.queue_kind = ctx->queue_kind;
+    init_system_with_config(&ctx->system, &config);
+    ctx->system.quiet = 1;
+    ctx->num_offices = num_offices;
+    for (int id = 1; id <= num_offices; id++) {
+        int neighbour = id - 1;
+        if (add_office(&ctx->system, id, capacity, &neighbour, id > 1 ? 1 : 0) != SUCCESS) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int build_letters(BenchContext *ctx, int num_offices) {
+    int capacity = (int)(ctx->size / num_offices) * 4 + 16;
+    if (!build_offices(ctx, num_offices, capacity)) {
+        return 0;
+    }
+    for (size_t i = 0; i < ctx->size; i++) {
+        int from = workload_rng_range(&ctx->rng, 1, num_offices);
+        int to = workload_rng_range(&ctx->rng, 1, num_offices);
+        int priority = workload_rng_range(&ctx->rng, 0, 31);
+        if (add_letter(&ctx->system, REGULAR, priority, from, to, "bench") != SUCCESS) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int setup_heap(BenchContext *ctx) {
+    return fill_heap(ctx);
+}
+
+static size_t run_heap_push_pop(BenchContext *ctx) {
+    for (int i = 0; i < BENCH_BATCH; i++) {
+        push_heap(&ctx->heap, workload_rng_range(&ctx->rng, 1, (int)ctx->size));
+        pop_heap(&ctx->heap);
+    }
+    return BENCH_BATCH;
+}
+
+static size_t run_remove_from_heap(BenchContext *ctx) {
+    size_t ops = ctx->size >= 100000 ? 1 : 100000 / ctx->size;
+    for (size_t i = 0; i < ops; i++) {
+        int value = ctx->heap.data[workload_rng_next(&ctx->rng) % ctx->heap.size];
+        remove_letter_from_heap(&ctx->heap, value);
+        push_heap(&ctx->heap, value);
+    }
+    return ops;
+}
+
+static int setup_buckets(BenchContext *ctx) {
+    return fill_buckets(ctx);
+}
+
+static size_t run_bucket_push_pop(BenchContext *ctx) {
+    for (int i = 0; i < BENCH_BATCH; i++) {
+        push_bucket_queue(&ctx->buckets, skewed_priority(ctx), workload_rng_range(&ctx->rng, 1, (int)ctx->size));
+        pop_bucket_queue(&ctx->buckets);
+    }
+    return BENCH_BATCH;
+}
+
+static int setup_find_office(BenchContext *ctx) {
+    return build_offices(ctx, (int)ctx->size, 1);
+}
+
+static size_t run_find_office(BenchContext *ctx) {
+    volatile int sink = 0;
+    size_t ops = ctx->size >= 100000 ? 100 : BENCH_BATCH;
+    for (size_t i = 0; i < ops; i++) {
+        PostOffice *office = find_office(&ctx->system, workload_rng_range(&ctx->rng, 1, ctx->num_offices));
+        sink += office ? office->capacity : 0;
+    }
+    (void)sink;
+    return ops;
+}
+
+static int setup_letters(BenchContext *ctx) {
+    return build_letters(ctx, 16);
+}
+
+static int setup_bucket_letters(BenchContext *ctx) {
+    ctx->queue_kind = QUEUE_BUCKET;
+    return build_letters(ctx, 16);
+}
+
+static size_t run_find_letter(BenchContext *ctx) {
+    volatile int sink = 0;
+    size_t ops = ctx->size >= 100000 ? 100 : BENCH_BATCH;
+    for (size_t i = 0; i < ops; i++) {
+        Letter *letter = find_letter(&ctx->system, workload_rng_range(&ctx->rng, 1, (int)ctx->size));
+        sink += letter ? letter->priority : 0;
+    }
+    (void)sink;
+    return ops;
+}
+
+static int setup_sort(BenchContext *ctx) {
+    ctx->ids = malloc(ctx->size * sizeof(int));
+    ctx->priorities = malloc(ctx->size * sizeof(int));
+    ctx->scratch_ids = malloc(ctx->size * sizeof(int));
+    ctx->scratch_priorities = malloc(ctx->size * sizeof(int));
+    if (!ctx->ids || !ctx->priorities || !ctx->scratch_ids || !ctx->scratch_priorities) {
+        return 0;
+    }
+    for (size_t i = 0; i < ctx->size; i++) {
+        ctx->ids[i] = (int)(i + 1);
+        ctx->priorities[i] = workload_rng_range(&ctx->rng, 0, 1000);
+    }
+    return 1;
+}
+
+static size_t run_sort(BenchContext *ctx) {
+    memcpy(ctx->scratch_ids, ctx->ids, ctx->size * sizeof(int));
+    memcpy(ctx->scratch_priorities, ctx->priorities, ctx->size * sizeof(int));
+    sort_by_priority(ctx->scratch_ids, ctx->scratch_priorities, NULL, ctx->size);
+    return 1;
+}
+
+static size_t run_add_letter(BenchContext *ctx) {
+    size_t ops = 0;
+    for (int i = 0; i < BENCH_BATCH; i++) {
+        int from = workload_rng_range(&ctx->rng, 1, ctx->num_offices);
+        int to = workload_rng_range(&ctx->rng, 1, ctx->num_offices);
+        if (add_letter(&ctx->system, REGULAR, i % 32, from, to, "bench") == SUCCESS) {
+            ops++;
+        }
+    }
+    return ops ? ops : 1;
+}
+
+static int setup_add_letter(BenchContext *ctx) {
+    if (!build_letters(ctx, 16)) {
+        return 0;
+    }
+    for (int k = 0; k < ctx->system.office_count; k++) {
+        PostOffice *office = &ctx->system.offices[k];
+        office->capacity = 1 << 30;
+    }
+    return 1;
+}
+
+static size_t run_process_transfer(BenchContext *ctx) {
+    process_letters_transfer(&ctx->system);
+    return 1;
+}
+
+static size_t run_priority_transfer(BenchContext *ctx) {
+    transfer_priority_letters(&ctx->system);
+    return 1;
+}
+
+static size_t run_network_tick(BenchContext *ctx) {
+    process_network_tick(&ctx->system);
+    return 1;
+}
+
+static int setup_scan(BenchContext *ctx) {
+    ctx->ids = malloc(ctx->size * sizeof(int));
+    if (!ctx->ids) {
+        return 0;
+    }
+    for (size_t i = 0; i < ctx->size; i++) {
+        ctx->ids[i] = (int)(i + 1);
+    }
+    return 1;
+}
+
+static size_t run_scan_find(BenchContext *ctx, ScanLevel level) {
+    volatile int sink = 0;
+    ScanLevel previous = scan_level();
+    scan_set_level(level);
+    size_t ops = ctx->size >= 100000 ? 100 : BENCH_BATCH;
+    for (size_t i = 0; i < ops; i++) {
+        sink += scan_find_int(ctx->ids, ctx->size, workload_rng_range(&ctx->rng, 1, (int)ctx->size));
+    }
+    scan_set_level(previous);
+    (void)sink;
+    return ops;
+}
+
+static size_t run_scan_find_scalar(BenchContext *ctx) {
+    return run_scan_find(ctx, SCAN_SCALAR);
+}
+
+static size_t run_scan_find_native(BenchContext *ctx) {
+    return run_scan_find(ctx, SCAN_AVX2);
+}
+
+static size_t heap_memory(size_t size) {
+    return size * sizeof(int) * 2;
+}
+
+static size_t office_memory(size_t size) {
+    return size * (sizeof(PostOffice) + MAX_CONNECTIONS * sizeof(int) + INITIAL_CAPACITY * sizeof(int));
+}
+
+static size_t letter_memory(size_t size) {
+    return size * (sizeof(Letter) * 2 + sizeof(int) * 2);
+}
+
+static size_t sort_memory(size_t size) {
+    return size * sizeof(int) * 4;
+}
+
+static size_t transfer_memory(size_t size) {
+    return letter_memory(size) + size * (sizeof(int) * 4 + sizeof(PostOffice*) * 2);
+}
+
+static const Benchmark BENCHMARKS[] = {
+    {"push_heap/pop_heap", "O(log n)", 10.0, setup_heap, run_heap_push_pop, heap_memory},
+    {"push/pop_bucket_queue", "O(1)", 10.0, setup_buckets, run_bucket_push_pop, heap_memory},
+    {"remove_letter_from_heap", "O(n)", 10.0, setup_heap, run_remove_from_heap, heap_memory},
+    {"find_office", "O(1)", 10.0, setup_find_office, run_find_office, office_memory},
+    {"find_letter", "O(1)", 10.0, setup_letters, run_find_letter, letter_memory},
+    {"sort_by_priority", "O(n^2)", 100.0, setup_sort, run_sort, sort_memory},
+    {"add_letter", "O(offices)", 10.0, setup_add_letter, run_add_letter, letter_memory},
+    {"process_letters_transfer", "per tick", 100.0, setup_letters, run_process_transfer, transfer_memory},
+    {"transfer_priority_letters", "per tick", 100.0, setup_letters, run_priority_transfer, transfer_memory},
+    {"process_network_tick", "O(active)", 10.0, setup_letters, run_network_tick, transfer_memory},
+    {"process_transfer [bucket]", "per tick", 10.0, setup_bucket_letters, run_process_transfer, transfer_memory},
+    {"priority_transfer [bucket]", "per tick", 10.0, setup_bucket_letters, run_priority_transfer, transfer_memory},
+    {"scan_find_int [scalar]", "O(n)", 10.0, setup_scan, run_scan_find_scalar, sort_memory},
+    {"scan_find_int [native]", "O(n)", 10.0, setup_scan, run_scan_find_native, sort_memory}
+};
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, double fraction) {
+    int rank = (int)(fraction * count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > count) {
+        rank = count;
+    }
+    return sorted[rank - 1];
+}
+
+static void json_begin_result(FILE *json, int *first, const Benchmark *bench, size_t size) {
+    fprintf(json, "%s\n    {\"name\": \"%s\", \"complexity\": \"%s\", \"size\": %zu",
+            *first ? "" : ",", bench->name, bench->complexity, size);
+    *first = 0;
+}
+
+static double run_benchmark(const Benchmark *bench, size_t size, const BenchOptions *options, FILE *json, int *first) {
+    if (bench->memory(size) > options->memory_limit) {
+        printf("%-28s %10zu  skipped (memory limit)\n", bench->name, size);
+        json_begin_result(json, first, bench, size);
+        fprintf(json, ", \"skipped\": \"memory\"}");
+        return -1.0;
+    }
+
+    BenchContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.size = size;
+    workload_rng_seed(&ctx.rng, 12345 + size);
+    init_system(&ctx.system);
+
+    double started = now_seconds();
+    if (!bench->setup(&ctx)) {
+        printf("%-28s %10zu  setup failed\n", bench->name, size);
+        json_begin_result(json, first, bench, size);
+        fprintf(json, ", \"skipped\": \"setup\"}");
+        bench_context_free(&ctx);
+        return -1.0;
+    }
+    double setup_seconds = now_seconds() - started;
+
+    for (int i = 0; i < options->warmup; i++) {
+        bench->run(&ctx);
+    }
+
+    double samples[BENCH_MAX_RUNS];
+    int runs = 0;
+    size_t ops = 0;
+    double run_total = 0.0;
+    while (runs < options->repeats) {
+        double begin = now_seconds();
+        ops = bench->run(&ctx);
+        double elapsed = now_seconds() - begin;
+        samples[runs++] = elapsed * 1e9 / ops;
+        run_total += elapsed;
+        if (runs >= 3 && run_total > options->budget_seconds) {
+            break;
+        }
+    }
+    bench_context_free(&ctx);
+
+    qsort(samples, runs, sizeof(double), compare_doubles);
+    double median = percentile(samples, runs, 0.50);
+    double p99 = percentile(samples, runs, 0.99);
+
+    printf("%-28s %10zu  median %14.1f ns/op  p99 %14.1f ns/op  runs %2d  setup %.3fs\n",
+           bench->name, size, median, p99, runs, setup_seconds);
+    json_begin_result(json, first, bench, size);
+    fprintf(json, ", \"ops_per_run\": %zu, \"runs\": %d, \"warmup\": %d, \"median_ns_per_op\": %.1f, "
+            "\"p99_ns_per_op\": %.1f, \"min_ns_per_op\": %.1f, \"setup_seconds\": %.6f}",
+            ops, runs, options->warmup, median, p99, samples[0], setup_seconds);
+
+    return setup_seconds + run_total * (options->warmup + runs) / runs;
+}
+
+static void run_suite(const BenchOptions *options, FILE *json) {
+    int first = 1;
+    time_t now = time(NULL);
+    char time_str[64];
+    strftime(time_str, sizeof(time_str), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+    fprintf(json, "{\n  \"suite\": \"mail-system\",\n  \"timestamp\": \"%s\",\n", time_str);
+#ifdef __VERSION__
+    fprintf(json, "  \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+    fprintf(json, "  \"warmup\": %d,\n  \"repeats\": %d,\n  \"budget_seconds\": %.3f,\n  \"results\": [",
+            options->warmup, options->repeats, options->budget_seconds);
+
+    for (size_t b = 0; b < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); b++) {
+        const Benchmark *bench = &BENCHMARKS[b];
+        if (options->only && strcmp(options->only, bench->name) != 0) {
+            continue;
+        }
+
+        double previous_cost = 0.0;
+        double growth = bench->growth;
+        size_t size = 1;
+        for (int e = 0; e < BENCH_MIN_EXPONENT; e++) {
+            size *= 10;
+        }
+        for (int e = BENCH_MIN_EXPONENT; e <= options->max_exponent; e++, size *= 10) {
+            if (previous_cost > 0.0 && previous_cost * growth > options->budget_seconds * 10) {
+                printf("%-28s %10zu  skipped (predicted %.0fs)\n", bench->name, size, previous_cost * growth);
+                json_begin_result(json, &first, bench, size);
+                fprintf(json, ", \"skipped\": \"budget\", \"predicted_seconds\": %.1f}", previous_cost * growth);
+                continue;
+            }
+            double cost = run_benchmark(bench, size, options, json, &first);
+            if (cost < 0.0) {
+                break;
+            }
+            if (previous_cost > 0.0) {
+                growth = cost / previous_cost;
+                if (growth < bench->growth) {
+                    growth = bench->growth;
+                }
+            }
+            previous_cost = cost;
+        }
+    }
+    fprintf(json, "\n  ]\n}\n");
+}
+
+static void print_usage(const char *program) {
+    printf("Usage: %s [output=FILE] [warmup=N] [repeats=N] [budget=SECONDS] [max_size=10^N] "
+           "[memory_mb=N] [only=NAME]\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options;
+    options.warmup = 2;
+    options.repeats = 15;
+    options.budget_seconds = 2.0;
+    options.memory_limit = (size_t)1024 * 1024 * 1024;
+    options.max_exponent = BENCH_MAX_EXPONENT;
+    options.output = "bench_results.json";
+    options.only = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = strchr(argv[i], '=');
+        if (!value) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        value++;
+        if (strncmp(argv[i], "output=", 7) == 0) options.output = value;
+        else if (strncmp(argv[i], "warmup=", 7) == 0) options.warmup = atoi(value);
+        else if (strncmp(argv[i], "repeats=", 8) == 0) options.repeats = atoi(value);
+        else if (strncmp(argv[i], "budget=", 7) == 0) options.budget_seconds = atof(value);
+        else if (strncmp(argv[i], "memory_mb=", 10) == 0) options.memory_limit = (size_t)atoi(value) * 1024 * 1024;
+        else if (strncmp(argv[i], "only=", 5) == 0) options.only = value;
+        else if (strncmp(argv[i], "max_size=10^", 12) == 0) options.max_exponent = atoi(argv[i] + 12);
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.repeats < 1) options.repeats = 1;
+    if (options.repeats > BENCH_MAX_RUNS) options.repeats = BENCH_MAX_RUNS;
+    if (options.warmup < 0) options.warmup = 0;
+    if (options.max_exponent > BENCH_MAX_EXPONENT) options.max_exponent = BENCH_MAX_EXPONENT;
+
+    FILE *json = fopen(options.output, "w");
+    if (!json) {
+        printf("Error opening output file: %s\n", options.output);
+        return 1;
+    }
+    run_suite(&options, json);
+    fclose(json);
+    printf("Results written to %s\n", options.output);
+    return 0;
+}
@@ -0,0 +1,233 @@
+#define _POSIX_C_SOURCE 200809L
+#include "executor.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#define EXECUTOR_CACHE_LINE 64
+
+typedef struct {
+    size_t begin;
+    size_t end;
+} ExecutorRange;
+
+typedef struct {
+    long top;
+    char pad0[EXECUTOR_CACHE_LINE - sizeof(long)];
+    long bottom;
+    char pad1[EXECUTOR_CACHE_LINE - sizeof(long)];
+    ExecutorRange ranges[EXECUTOR_DEQUE_CAPACITY];
+} WorkDeque;
+
+typedef struct {
+    Executor *executor;
+    int index;
+} WorkerArgs;
+
+struct Executor {
+    int num_threads;
+    pthread_t *threads;
+    WorkerArgs *args;
+    WorkDeque *deques;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    unsigned long generation;
+    int shutdown;
+    ExecutorFn fn;
+    void *context;
+    size_t grain;
+    size_t remaining;
+    int busy;
+};
+
+static int deque_push(WorkDeque *deque, ExecutorRange range) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= EXECUTOR_DEQUE_CAPACITY) {
+        return 0;
+    }
+    deque->ranges[bottom % EXECUTOR_DEQUE_CAPACITY] = range;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+static int deque_take(WorkDeque *deque, ExecutorRange *range) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    if (top > bottom) {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    *range = deque->ranges[bottom % EXECUTOR_DEQUE_CAPACITY];
+    if (top == bottom) {
+        int won = __atomic_compare_exchange_n(&deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return won;
+    }
+    return 1;
+}
+
+static int deque_steal(WorkDeque *deque, ExecutorRange *range) {
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) {
+        return 0;
+    }
+    *range = deque->ranges[top % EXECUTOR_DEQUE_CAPACITY];
+    return __atomic_compare_exchange_n(&deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static void execute_range(Executor *executor, int index, ExecutorRange range) {
+    while (range.end - range.begin > executor->grain) {
+        ExecutorRange upper;
+        upper.begin = range.begin + (range.end - range.begin) / 2;
+        upper.end = range.end;
+        if (!deque_push(&executor->deques[index], upper)) {
+            break;
+        }
+        range.end = upper.begin;
+    }
+    executor->fn(executor->context, range.begin, range.end);
+    __atomic_sub_fetch(&executor->remaining, range.end - range.begin, __ATOMIC_ACQ_REL);
+}
+
+static int steal_work(Executor *executor, int index, unsigned int *seed, ExecutorRange *range) {
+    *seed = *seed * 1103515245u + 12345u;
+    int start = (int)((*seed >> 16) % (unsigned int)executor->num_threads);
+    for (int i = 0; i < executor->num_threads; i++) {
+        int victim = (start + i) % executor->num_threads;
+        if (victim != index && deque_steal(&executor->deques[victim], range)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void run_worker(Executor *executor, int index) {
+    unsigned int seed = (unsigned int)index * 2654435761u + 1u;
+    while (__atomic_load_n(&executor->remaining, __ATOMIC_ACQUIRE) > 0) {
+        ExecutorRange range;
+        if (deque_take(&executor->deques[index], &range) || steal_work(executor, index, &seed, &range)) {
+            execute_range(executor, index, range);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+static void* worker_main(void *arg) {
+    WorkerArgs *args = (WorkerArgs*)arg;
+    Executor *executor = args->executor;
+    unsigned long seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&executor->lock);
+        while (!executor->shutdown && executor->generation == seen) {
+            pthread_cond_wait(&executor->wake, &executor->lock);
+        }
+        seen = executor->generation;
+        int shutdown = executor->shutdown;
+        pthread_mutex_unlock(&executor->lock);
+        if (shutdown) {
+            break;
+        }
+
+        run_worker(executor, args->index);
+        __atomic_sub_fetch(&executor->busy, 1, __ATOMIC_ACQ_REL);
+    }
+    return NULL;
+}
+
+Executor* executor_create(int num_threads) {
+    if (num_threads < 1 || num_threads > EXECUTOR_MAX_THREADS) {
+        return NULL;
+    }
+
+    Executor *executor = (Executor*)calloc(1, sizeof(Executor));
+    if (!executor) {
+        return NULL;
+    }
+    executor->num_threads = num_threads;
+    executor->deques = (WorkDeque*)calloc(num_threads, sizeof(WorkDeque));
+    executor->threads = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+    executor->args = (WorkerArgs*)calloc(num_threads, sizeof(WorkerArgs));
+    if (!executor->deques || !executor->threads || !executor->args) {
+        free(executor->deques);
+        free(executor->threads);
+        free(executor->args);
+        free(executor);
+        return NULL;
+    }
+    pthread_mutex_init(&executor->lock, NULL);
+    pthread_cond_init(&executor->wake, NULL);
+
+    for (int i = 1; i < num_threads; i++) {
+        executor->args[i].executor = executor;
+        executor->args[i].index = i;
+        if (pthread_create(&executor->threads[i], NULL, worker_main, &executor->args[i]) != 0) {
+            executor->num_threads = i;
+            executor_destroy(executor);
+            return NULL;
+        }
+    }
+    return executor;
+}
+
+void executor_destroy(Executor *executor) {
+    if (!executor) {
+        return;
+    }
+
+    pthread_mutex_lock(&executor->lock);
+    executor->shutdown = 1;
+    pthread_cond_broadcast(&executor->wake);
+    pthread_mutex_unlock(&executor->lock);
+    for (int i = 1; i < executor->num_threads; i++) {
+        pthread_join(executor->threads[i], NULL);
+    }
+    pthread_cond_destroy(&executor->wake);
+    pthread_mutex_destroy(&executor->lock);
+    free(executor->deques);
+    free(executor->threads);
+    free(executor->args);
+    free(executor);
+}
+
+int executor_threads(const Executor *executor) {
+    return executor ? executor->num_threads : 1;
+}
+
+void executor_for(Executor *executor, size_t count, size_t grain, ExecutorFn fn, void *context) {
+    if (count == 0 || !fn) {
+        return;
+    }
+    if (grain == 0) {
+        grain = 1;
+    }
+    if (!executor || executor->num_threads == 1 || count <= grain) {
+        fn(context, 0, count);
+        return;
+    }
+
+    executor->fn = fn;
+    executor->context = context;
+    executor->grain = grain;
+    __atomic_store_n(&executor->remaining, count, __ATOMIC_RELEASE);
+    __atomic_store_n(&executor->busy, executor->num_threads - 1, __ATOMIC_RELEASE);
+    ExecutorRange all = {0, count};
+    deque_push(&executor->deques[0], all);
+
+    pthread_mutex_lock(&executor->lock);
+    executor->generation++;
+    pthread_cond_broadcast(&executor->wake);
+    pthread_mutex_unlock(&executor->lock);
+
+    run_worker(executor, 0);
+    while (__atomic_load_n(&executor->busy, __ATOMIC_ACQUIRE) > 0) {
+        sched_yield();
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <stddef.h>
+
+#define EXECUTOR_DEQUE_CAPACITY 256
+#define EXECUTOR_MAX_THREADS 64
+
+typedef void (*ExecutorFn)(void *context, size_t begin, size_t end);
+
+typedef struct Executor Executor;
+
+Executor* executor_create(int num_threads);
+void executor_destroy(Executor *executor);
+int executor_threads(const Executor *executor);
+void executor_for(Executor *executor, size_t count, size_t grain, ExecutorFn fn, void *context);
+
+#endif
@@ -1,8 +1,461 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
 #include "funcs.h"
+#include "archive.h"
+#include "scan.h"
+#include "statusview.h"
+#include "executor.h"
+#include "image.h"
+#include <limits.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+static unsigned long long stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+#if MAIL_STATS
+typedef struct StatsBlock {
+    SystemStats stats;
+    unsigned reset_epoch;
+    struct StatsBlock *next;
+} StatsBlock;
+
+static StatsBlock *stats_blocks = NULL;
+static int stats_systems = 0;
+static unsigned stats_generation = 0;
+static unsigned stats_reset_epoch = 0;
+static __thread StatsBlock *thread_stats_block = NULL;
+static __thread unsigned thread_stats_generation = 0;
+static SystemStats stats_fallback;
+
+static SystemStats* thread_stats(void) {
+    unsigned generation = __atomic_load_n(&stats_generation, __ATOMIC_ACQUIRE);
+    if (!thread_stats_block || thread_stats_generation != generation) {
+        StatsBlock *block = (StatsBlock*)calloc(1, sizeof(StatsBlock));
+        if (!block) {
+            return &stats_fallback;
+        }
+        block->reset_epoch = __atomic_load_n(&stats_reset_epoch, __ATOMIC_ACQUIRE);
+        block->next = __atomic_load_n(&stats_blocks, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&stats_blocks, &block->next, block, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        }
+        thread_stats_block = block;
+        thread_stats_generation = generation;
+    }
+
+    unsigned epoch = __atomic_load_n(&stats_reset_epoch, __ATOMIC_ACQUIRE);
+    if (thread_stats_block->reset_epoch != epoch) {
+        memset(&thread_stats_block->stats, 0, sizeof(thread_stats_block->stats));
+        __atomic_store_n(&thread_stats_block->reset_epoch, epoch, __ATOMIC_RELEASE);
+    }
+    return &thread_stats_block->stats;
+}
+
+static int stats_block_current(const StatsBlock *block) {
+    return __atomic_load_n(&block->reset_epoch, __ATOMIC_ACQUIRE) == __atomic_load_n(&stats_reset_epoch, __ATOMIC_ACQUIRE);
+}
+
+static void stats_attach(void) {
+    __atomic_add_fetch(&stats_systems, 1, __ATOMIC_ACQ_REL);
+}
+
+static void stats_detach(void) {
+    if (__atomic_sub_fetch(&stats_systems, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    StatsBlock *block = __atomic_exchange_n(&stats_blocks, NULL, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&stats_generation, 1, __ATOMIC_RELEASE);
+    while (block) {
+        StatsBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    thread_stats_block = NULL;
+}
+
+static void stats_add(StatCounter counter, unsigned long long amount) {
+    unsigned long long *slot = &thread_stats()->counters[counter];
+    __atomic_store_n(slot, __atomic_load_n(slot, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+#define STAT_ADD(counter, amount) stats_add((counter), (amount))
+#define STAT_INC(counter) stats_add((counter), 1)
+#define STAT_TIMER_START(name) unsigned long long name = stats_now_ns()
+#define STAT_TICK_END(kind, name) histogram_record(&thread_stats()->ticks[(kind)], stats_now_ns() - (name))
+#else
+#define stats_attach() ((void)0)
+#define stats_detach() ((void)0)
+#define STAT_ADD(counter, amount) ((void)(amount))
+#define STAT_INC(counter) ((void)0)
+#define STAT_TIMER_START(name) ((void)0)
+#define STAT_TICK_END(kind, name) ((void)0)
+#endif
+
+static void trace_record(MailSystem *system, const char *format, ...) {
+    if (!system->trace_file || system->trace_depth > 0) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vfprintf(system->trace_file, format, args);
+    va_end(args);
+}
+
+static int trace_text_length(const char *text) {
+    return (int)strnlen(text, TECH_DATA_SIZE - 1);
+}
+
+static void trace_office(MailSystem *system, const char *record, int id, int capacity, const int *connections, int num_conn) {
+    if (!system->trace_file || system->trace_depth > 0) {
+        return;
+    }
+    flockfile(system->trace_file);
+    fprintf(system->trace_file, "%s %d %d %d", record, id, capacity, connections ? num_conn : 0);
+    for (int i = 0; connections && i < num_conn; i++) {
+        fprintf(system->trace_file, " %d", connections[i]);
+    }
+    fputc('\n', system->trace_file);
+    funlockfile(system->trace_file);
+}
+
+static void* resize_array(MailSystem *system, void *data, size_t old_size, size_t new_size) {
+    if (!system_image_contains(system->image, data)) {
+        return realloc(data, new_size);
+    }
+    void *copy = malloc(new_size);
+    if (copy) {
+        memcpy(copy, data, old_size < new_size ? old_size : new_size);
+    }
+    return copy;
+}
+
+static void free_array(MailSystem *system, void *data) {
+    if (!system_image_contains(system->image, data)) {
+        free(data);
+    }
+}
+
+static void mark_phase(MailSystem *system, TickPhase phase) {
+    if (system->profile_ticks) {
+        unsigned long long now = stats_now_ns();
+        system->tick_phases[phase] += now - system->phase_mark;
+        system->phase_mark = now;
+    }
+}
+
+static int office_has_room(const PostOffice *office) {
+    if (office->current_letters < office->capacity) {
+        return 1;
+    }
+    STAT_INC(STAT_CAPACITY_REJECTIONS);
+    return 0;
+}
+
+static int schedule_before(const ScheduleEntry *a, const ScheduleEntry *b) {
+    if (a->key != b->key) {
+        return a->key < b->key;
+    }
+    if (a->priority != b->priority) {
+        return a->priority > b->priority;
+    }
+    return a->letter_id < b->letter_id;
+}
+
+static int schedule_reserve(ScheduleQueue *q) {
+    if (q->size >= q->capacity) {
+        size_t new_capacity = q->capacity == 0 ? 16 : q->capacity * 2;
+        ScheduleEntry *new_entries = (ScheduleEntry*)realloc(q->entries, new_capacity * sizeof(ScheduleEntry));
+        if (!new_entries) {
+            return 0;
+        }
+        q->entries = new_entries;
+        q->capacity = new_capacity;
+    }
+    return 1;
+}
+
+static int schedule_push(ScheduleQueue *q, ScheduleEntry entry) {
+    if (!schedule_reserve(q)) {
+        return 0;
+    }
+    size_t index = q->size++;
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!schedule_before(&entry, &q->entries[parent])) {
+            break;
+        }
+        q->entries[index] = q->entries[parent];
+        index = parent;
+    }
+    q->entries[index] = entry;
+    return 1;
+}
+
+static ScheduleEntry schedule_pop(ScheduleQueue *q) {
+    ScheduleEntry top = q->entries[0];
+    ScheduleEntry last = q->entries[--q->size];
+    size_t index = 0;
+    while (1) {
+        size_t child = 2 * index + 1;
+        if (child >= q->size) {
+            break;
+        }
+        if (child + 1 < q->size && schedule_before(&q->entries[child + 1], &q->entries[child])) {
+            child++;
+        }
+        if (!schedule_before(&q->entries[child], &last)) {
+            break;
+        }
+        q->entries[index] = q->entries[child];
+        index = child;
+    }
+    if (q->size > 0) {
+        q->entries[index] = last;
+    }
+    return top;
+}
+
+static int schedule_class(const Scheduler *scheduler, const Letter *letter) {
+    return scheduler->policy == POLICY_WEIGHTED_FAIR ? (int)letter->type : 0;
+}
+
+static ScheduleEntry schedule_entry(const Scheduler *scheduler, const Letter *letter) {
+    ScheduleEntry entry;
+    entry.priority = letter->priority;
+    entry.letter_id = letter->id;
+    switch (scheduler->policy) {
+        case POLICY_AGING:
+            entry.key = (long long)letter->created_tick - (long long)letter->priority * scheduler->aging_ticks;
+            break;
+        case POLICY_EARLIEST_DEADLINE:
+            entry.key = (long long)letter->created_tick + scheduler->deadline_ticks[letter->type];
+            break;
+        default:
+            entry.key = -(long long)letter->priority;
+            break;
+    }
+    return entry;
+}
+
+static void schedule_enqueue(MailSystem *system, const Letter *letter, ScheduleEntry entry) {
+    Scheduler *scheduler = &system->scheduler;
+    int cls = schedule_class(scheduler, letter);
+    if (scheduler->classes[cls].size == 0 && scheduler->virtual_finish[cls] < scheduler->virtual_time) {
+        scheduler->virtual_finish[cls] = scheduler->virtual_time;
+    }
+    if (!schedule_push(&scheduler->classes[cls], entry)) {
+        scheduler->rebuild = 1;
+    }
+}
+
+static void schedule_letter(MailSystem *system, const Letter *letter) {
+    if (system->scheduler.policy == POLICY_STRICT_PRIORITY) {
+        return;
+    }
+    schedule_enqueue(system, letter, schedule_entry(&system->scheduler, letter));
+}
+
+static int schedule_park(MailSystem *system, PostOffice *office, ScheduleEntry entry) {
+    if (!schedule_reserve(&office->parked)) {
+        return 0;
+    }
+    office->parked.entries[office->parked.size++] = entry;
+    system->scheduler.num_parked++;
+    return 1;
+}
+
+static void unpark_office(MailSystem *system, PostOffice *office) {
+    ScheduleQueue *parked = &office->parked;
+    size_t count = parked->size;
+    if (count == 0) {
+        return;
+    }
+    parked->size = 0;
+    system->scheduler.num_parked -= count;
+    for (size_t i = 0; i < count; i++) {
+        const Letter *letter = find_letter(system, parked->entries[i].letter_id);
+        if (letter && letter->state == IN_TRANSIT) {
+            schedule_enqueue(system, letter, parked->entries[i]);
+        }
+    }
+}
+
+static void wake_in_neighbours(MailSystem *system, const PostOffice *office) {
+    for (int i = 0; i < office->num_in_connections; i++) {
+        PostOffice *source = find_office(system, office->in_connections[i]);
+        if (source) {
+            unpark_office(system, source);
+        }
+    }
+}
+
+static void wake_departed(MailSystem *system, const Letter *letter) {
+    if (system->scheduler.num_parked > 0) {
+        PostOffice *previous = find_office(system, letter->current_office);
+        if (previous) {
+            unpark_office(system, previous);
+        }
+    }
+}
+
+static int schedule_rebuild(MailSystem *system) {
+    Scheduler *scheduler = &system->scheduler;
+    for (int k = 0; k < system->office_count; k++) {
+        system->offices[k].parked.size = 0;
+    }
+    scheduler->num_parked = 0;
+    for (int cls = 0; cls < LETTER_TYPE_COUNT; cls++) {
+        scheduler->classes[cls].size = 0;
+    }
+    for (size_t i = 0; i < system->letters_size; i++) {
+        const Letter *letter = &system->letters[i];
+        if (letter->state == IN_TRANSIT &&
+            !schedule_push(&scheduler->classes[schedule_class(scheduler, letter)], schedule_entry(scheduler, letter))) {
+            return 0;
+        }
+    }
+    scheduler->rebuild = 0;
+    return 1;
+}
+
+StatusCode release_parked_letters(MailSystem *system) {
+    if (!system) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    if (system->scheduler.num_parked > 0) {
+        for (int k = 0; k < system->office_count; k++) {
+            unpark_office(system, &system->offices[k]);
+        }
+    }
+    if (system->scheduler.rebuild && !schedule_rebuild(system)) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    return SUCCESS;
+}
+
+static int schedule_pick_class(const Scheduler *scheduler) {
+    int best = -1;
+    for (int cls = 0; cls < LETTER_TYPE_COUNT; cls++) {
+        if (scheduler->classes[cls].size == 0) {
+            continue;
+        }
+        if (best < 0 || scheduler->virtual_finish[cls] <= scheduler->virtual_finish[best]) {
+            best = cls;
+        }
+    }
+    return best;
+}
+
+static size_t schedule_compact(MailSystem *system, ScheduleQueue *q) {
+    size_t kept = 0;
+    for (size_t i = 0; i < q->size; i++) {
+        const Letter *letter = find_letter(system, q->entries[i].letter_id);
+        if (letter && letter->state == IN_TRANSIT) {
+            q->entries[kept++] = q->entries[i];
+        }
+    }
+    size_t dropped = q->size - kept;
+    q->size = kept;
+    return dropped;
+}
+
+static void schedule_purge(MailSystem *system) {
+    Scheduler *scheduler = &system->scheduler;
+    size_t queued = scheduler->num_parked;
+    for (int cls = 0; cls < LETTER_TYPE_COUNT; cls++) {
+        queued += scheduler->classes[cls].size;
+    }
+    if (queued <= 2 * system->state_counts[IN_TRANSIT] + 64) {
+        return;
+    }
+
+    for (int cls = 0; cls < LETTER_TYPE_COUNT; cls++) {
+        ScheduleQueue *q = &scheduler->classes[cls];
+        schedule_compact(system, q);
+        size_t kept = q->size;
+        q->size = 0;
+        for (size_t i = 0; i < kept; i++) {
+            schedule_push(q, q->entries[i]);
+        }
+    }
+    for (int k = 0; scheduler->num_parked > 0 && k < system->office_count; k++) {
+        scheduler->num_parked -= schedule_compact(system, &system->offices[k].parked);
+    }
+}
+
+static void trace_letter(MailSystem *system, int letter_id, int office_id) {
+    PathTrace *trace = &system->path_trace;
+    if (!trace->entries) {
+        return;
+    }
+
+    PathTraceEntry *entry = &trace->entries[trace->head];
+    entry->letter_id = letter_id;
+    entry->office_id = office_id;
+    entry->tick = system->current_tick;
+    trace->head = (trace->head + 1) % trace->capacity;
+    if (trace->count < trace->capacity) {
+        trace->count++;
+    }
+}
+
+static void record_hop(MailSystem *system, Letter *letter, int office_id) {
+    letter->current_office = office_id;
+    letter->hops++;
+    trace_letter(system, letter->id, office_id);
+}
+
+static void set_letter_state(MailSystem *system, Letter *letter, LetterState state) {
+    if (letter->state == state) {
+        return;
+    }
+    system->state_counts[letter->state]--;
+    system->state_counts[state]++;
+    letter->state = state;
+}
+
+static void adjust_occupancy(MailSystem *system, PostOffice *office, int delta) {
+    int was_full = office->current_letters >= office->capacity;
+    office->current_letters += delta;
+    system->total_occupancy += delta;
+    if (was_full && office->current_letters < office->capacity && system->scheduler.num_parked > 0) {
+        wake_in_neighbours(system, office);
+    }
+}
+
+static void record_delivery(MailSystem *system, Letter *letter) {
+    set_letter_state(system, letter, DELIVERED);
+    letter->delivered_tick = system->current_tick;
+    STAT_INC(STAT_DELIVERIES);
+
+    if (!system->delivery_stats) {
+        system->delivery_stats = (DeliveryStats*)calloc(1, sizeof(DeliveryStats));
+        if (!system->delivery_stats) {
+            return;
+        }
+    }
+
+    DeliveryStats *stats = system->delivery_stats;
+    DeliveryHistograms *groups[3];
+    groups[0] = &stats->overall;
+    groups[1] = &stats->by_type[letter->type == URGENT ? URGENT : REGULAR];
+    groups[2] = &stats->by_priority[priority_class(letter->priority)];
+
+    unsigned long long latency = (unsigned long long)(letter->delivered_tick - letter->created_tick);
+    for (int i = 0; i < 3; i++) {
+        histogram_record(&groups[i]->latency, latency);
+        histogram_record(&groups[i]->hops, (unsigned long long)letter->hops);
+    }
+}
 
 Heap create_heap(size_t initial_capacity) {
     Heap heap;
     heap.data = NULL;
+    heap.keys = NULL;
     heap.size = 0;
     heap.capacity = 0;
     
@@ -15,6 +468,15 @@ Heap create_heap(size_t initial_capacity) {
     return heap;
 }
 
+Heap create_keyed_heap(size_t initial_capacity) {
+    Heap heap = create_heap(initial_capacity);
+    heap.keys = (int*)malloc((initial_capacity > 0 ? initial_capacity : 1) * sizeof(int));
+    if (!heap.keys) {
+        delete_heap(&heap);
+    }
+    return heap;
+}
+
 void delete_heap(Heap *h) {
     if (!h) {
         return;
@@ -24,10 +486,19 @@ void delete_heap(Heap *h) {
         free(h->data);
         h->data = NULL;
     }
+    free(h->keys);
+    h->keys = NULL;
     h->size = 0;
     h->capacity = 0;
 }
 
+size_t heap_bytes(const Heap *h) {
+    if (!h) {
+        return 0;
+    }
+    return h->capacity * sizeof(int) * (h->keys ? 2 : 1);
+}
+
 int is_empty_heap(const Heap *h) {
     return !h || h->size == 0;
 }
@@ -46,10 +517,88 @@ int peek_heap(const Heap *h) {
     return h->data[0];
 }
 
-void push_heap(Heap *h, int value) {
+// keyed heaps put the larger key first and break ties on the smaller value
+static int heap_before(const Heap *h, size_t a, size_t b) {
+    if (h->keys && h->keys[a] != h->keys[b]) {
+        return h->keys[a] > h->keys[b];
+    }
+    return h->data[a] < h->data[b];
+}
+
+static void heap_swap(Heap *h, size_t a, size_t b) {
+    int temp = h->data[a];
+    h->data[a] = h->data[b];
+    h->data[b] = temp;
+    if (h->keys) {
+        temp = h->keys[a];
+        h->keys[a] = h->keys[b];
+        h->keys[b] = temp;
+    }
+}
+
+static void heap_move(Heap *h, size_t to, size_t from) {
+    h->data[to] = h->data[from];
+    if (h->keys) {
+        h->keys[to] = h->keys[from];
+    }
+}
+
+static void heap_sift_up(Heap *h, size_t index) {
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!heap_before(h, index, parent)) {
+            break;
+        }
+        heap_swap(h, index, parent);
+        index = parent;
+    }
+}
+
+static void heap_sift_down(Heap *h, size_t index) {
+    while (1) {
+        size_t left = 2 * index + 1;
+        size_t right = 2 * index + 2;
+        size_t smallest = index;
+        
+        if (left < h->size && heap_before(h, left, smallest)) {
+            smallest = left;
+        }
+        if (right < h->size && heap_before(h, right, smallest)) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        heap_swap(h, index, smallest);
+        index = smallest;
+    }
+}
+
+static int heap_resize(Heap *h, size_t new_capacity) {
+    int *new_data = (int*)realloc(h->data, new_capacity * sizeof(int));
+    if (!new_data) {
+        return 0;
+    }
+    h->data = new_data;
+    if (h->keys) {
+        int *new_keys = (int*)realloc(h->keys, new_capacity * sizeof(int));
+        if (!new_keys) {
+            if (new_capacity > h->capacity) {
+                return 0;
+            }
+        } else {
+            h->keys = new_keys;
+        }
+    }
+    h->capacity = new_capacity;
+    return 1;
+}
+
+void push_heap_keyed(Heap *h, int value, int key) {
     if (!h) {
         return;
     }
+    STAT_INC(STAT_HEAP_PUSH);
     
     if (h->size >= h->capacity) {
         size_t new_capacity;
@@ -58,61 +607,41 @@ void push_heap(Heap *h, int value) {
         } else {
             new_capacity = h->capacity * 2;
         }
-        int *new_data = (int*)realloc(h->data, new_capacity * sizeof(int));
-        if (!new_data) {
+        if (!heap_resize(h, new_capacity)) {
             return;
         }
-        h->data = new_data;
-        h->capacity = new_capacity;
     }
     h->data[h->size] = value;
-    size_t index = h->size;
+    if (h->keys) {
+        h->keys[h->size] = key;
+    }
     h->size++;
+    heap_sift_up(h, h->size - 1);
+}
 
-    while (index > 0) {
-        size_t parent = (index - 1) / 2;
-        if (h->data[index] >= h->data[parent]) {
-            break;
-        }
-        
-        int temp = h->data[index];
-        h->data[index] = h->data[parent];
-        h->data[parent] = temp;
-        index = parent;
+void push_heap(Heap *h, int value) {
+    push_heap_keyed(h, value, 0);
+}
+
+// only compact_system shrinks, halving while a quarter full, so pushes and pops never reallocate downwards
+static size_t hysteresis_capacity(size_t capacity, size_t size, size_t minimum) {
+    while (capacity / 2 >= minimum && size <= capacity / 4) {
+        capacity /= 2;
     }
+    return capacity;
 }
 
 int pop_heap(Heap *h) {
     if (!h || is_empty_heap(h)) {
         return -1;
     }
+    STAT_INC(STAT_HEAP_POP);
     
     int root = h->data[0];
     h->size--;
     if (h->size > 0) {
-        h->data[0] = h->data[h->size];
-        
-        size_t index = 0;
-        while (1) {
-            size_t left = 2 * index + 1;
-            size_t right = 2 * index + 2;
-            size_t smallest = index;
-            
-            if (left < h->size && h->data[left] < h->data[smallest]) {
-                smallest = left;
-            }
-            if (right < h->size && h->data[right] < h->data[smallest]) {
-                smallest = right;
-            }
-            if (smallest == index) {
-                break;
-            }
-
-            int temp = h->data[index];
-            h->data[index] = h->data[smallest];
-            h->data[smallest] = temp;
-            index = smallest;
-        }
+        heap_move(h, 0, h->size);
+        heap_sift_down(h, 0);
     }
     return root;
 }
@@ -121,548 +650,3740 @@ int remove_letter_from_heap(Heap *heap, int letter_id) {
     if (!heap) {
         return 0;
     }
+    STAT_INC(STAT_HEAP_REMOVE);
     
-    Heap temp_heap = create_heap(heap->capacity);
-    int found = 0;
-    
-    while (!is_empty_heap(heap)) {
-        int current_id = pop_heap(heap);
-        if (current_id == letter_id) {
-            found = 1;
+    int index = scan_find_int(heap->data, heap->size, letter_id);
+    if (index < 0) {
+        return 0;
+    }
+    heap->size--;
+    if ((size_t)index < heap->size) {
+        heap_move(heap, index, heap->size);
+        if (index > 0 && heap_before(heap, index, (index - 1) / 2)) {
+            heap_sift_up(heap, index);
         } else {
-            push_heap(&temp_heap, current_id);
+            heap_sift_down(heap, index);
         }
     }
-    
-    while (!is_empty_heap(&temp_heap)) {
-        push_heap(heap, pop_heap(&temp_heap));
-    }
-    delete_heap(&temp_heap);
-    return found;
+    return 1;
 }
 
-PostOffice* find_office(const MailSystem *system, int office_id) {
-    if (!system) {
-        return NULL;
+const int* heap_view(const Heap *h, size_t *count) {
+    if (count) {
+        *count = h ? h->size : 0;
     }
+    return h ? h->data : NULL;
+}
 
-    PostOffice *current = system->offices;
-    while (current) {
-        if (current->id == office_id) {
-            return current;
-        }
-        current = current->next;
-    }
-    return NULL;
+// frontier is a heap of positions in the heap array, ordered the same way as the entries stored there
+static int frontier_less(const HeapIterator *it, size_t a, size_t b) {
+    return heap_before(it->heap, it->frontier[a], it->frontier[b]);
 }
 
-StatusCode add_office(MailSystem *system, int id, int capacity, int* connections, int num_conn) {
-    if (!system || id < 0 || capacity <= 0) {
-        return ERROR_INVALID_ID;
+static int frontier_reserve(HeapIterator *it, size_t needed) {
+    if (needed <= it->capacity) {
+        return 1;
     }
-    if (find_office(system, id)) {
-        return ERROR_DUPLICATE_OFFICE;
+    size_t new_capacity = it->capacity * 2;
+    size_t *new_frontier = (size_t*)malloc(new_capacity * sizeof(size_t));
+    if (!new_frontier) {
+        return 0;
+    }
+    memcpy(new_frontier, it->frontier, it->size * sizeof(size_t));
+    if (it->frontier != it->inline_frontier) {
+        free(it->frontier);
     }
+    it->frontier = new_frontier;
+    it->capacity = new_capacity;
+    return 1;
+}
 
-    PostOffice *new_office = (PostOffice*)malloc(sizeof(PostOffice));
-    if (!new_office) {
-        return ERROR_MEMORY_ALLOCATION;
+static void frontier_push(HeapIterator *it, size_t index) {
+    size_t i = it->size++;
+    it->frontier[i] = index;
+    while (i > 0 && frontier_less(it, i, (i - 1) / 2)) {
+        size_t parent = (i - 1) / 2;
+        size_t temp = it->frontier[i];
+        it->frontier[i] = it->frontier[parent];
+        it->frontier[parent] = temp;
+        i = parent;
     }
-    
-    new_office->id = id;
+}
+
+static size_t frontier_pop(HeapIterator *it) {
+    size_t root = it->frontier[0];
+    it->frontier[0] = it->frontier[--it->size];
+    size_t i = 0;
+    while (1) {
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        size_t smallest = i;
+        if (left < it->size && frontier_less(it, left, smallest)) {
+            smallest = left;
+        }
+        if (right < it->size && frontier_less(it, right, smallest)) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        size_t temp = it->frontier[i];
+        it->frontier[i] = it->frontier[smallest];
+        it->frontier[smallest] = temp;
+        i = smallest;
+    }
+    return root;
+}
+
+void heap_iterator_begin(HeapIterator *it, const Heap *h) {
+    if (!it) {
+        return;
+    }
+    it->heap = h;
+    it->frontier = it->inline_frontier;
+    it->size = 0;
+    it->capacity = HEAP_ITERATOR_INLINE;
+    if (h && h->size > 0) {
+        it->frontier[it->size++] = 0;
+    }
+}
+
+int heap_iterator_next(HeapIterator *it, int *value) {
+    if (!it || it->size == 0) {
+        return 0;
+    }
+    if (!frontier_reserve(it, it->size + 1)) {
+        return -1;
+    }
+    size_t index = frontier_pop(it);
+    size_t left = 2 * index + 1;
+    if (left < it->heap->size) {
+        frontier_push(it, left);
+    }
+    if (left + 1 < it->heap->size) {
+        frontier_push(it, left + 1);
+    }
+    if (value) {
+        *value = it->heap->data[index];
+    }
+    return 1;
+}
+
+void heap_iterator_end(HeapIterator *it) {
+    if (!it) {
+        return;
+    }
+    if (it->frontier != it->inline_frontier) {
+        free(it->frontier);
+    }
+    it->frontier = it->inline_frontier;
+    it->size = 0;
+}
+
+static int bucket_level(const BucketQueue *q, int priority) {
+    if (priority < 0) {
+        return 0;
+    }
+    return priority < q->num_levels ? priority : q->num_levels - 1;
+}
+
+static unsigned long long bucket_bit(int level) {
+    return 1ULL << (BUCKET_QUEUE_MAX_LEVELS - 1 - level);
+}
+
+BucketQueue create_bucket_queue(int num_levels) {
+    BucketQueue q;
+    q.levels = NULL;
+    q.num_levels = num_levels > BUCKET_QUEUE_MAX_LEVELS ? BUCKET_QUEUE_MAX_LEVELS : num_levels;
+    q.occupied = 0;
+    q.size = 0;
+    return q;
+}
+
+void delete_bucket_queue(BucketQueue *q) {
+    if (!q) {
+        return;
+    }
+
+    if (q->levels) {
+        for (int i = 0; i < q->num_levels; i++) {
+            free(q->levels[i].data);
+        }
+        free(q->levels);
+        q->levels = NULL;
+    }
+    q->occupied = 0;
+    q->size = 0;
+}
+
+size_t size_bucket_queue(const BucketQueue *q) {
+    return q ? q->size : 0;
+}
+
+int peek_bucket_queue(const BucketQueue *q) {
+    if (!q || q->size == 0) {
+        return -1;
+    }
+    int level = BUCKET_QUEUE_MAX_LEVELS - 1 - __builtin_ctzll(q->occupied);
+    const BucketLevel *bucket = &q->levels[level];
+    return bucket->data[bucket->head];
+}
+
+void push_bucket_queue(BucketQueue *q, int priority, int value) {
+    if (!q || q->num_levels <= 0) {
+        return;
+    }
+    STAT_INC(STAT_HEAP_PUSH);
+
+    if (!q->levels) {
+        q->levels = (BucketLevel*)calloc(q->num_levels, sizeof(BucketLevel));
+        if (!q->levels) {
+            return;
+        }
+    }
+    int level = bucket_level(q, priority);
+    BucketLevel *bucket = &q->levels[level];
+    if (bucket->size >= bucket->capacity) {
+        size_t new_capacity = bucket->capacity == 0 ? 4 : bucket->capacity * 2;
+        int *new_data = (int*)malloc(new_capacity * sizeof(int));
+        if (!new_data) {
+            return;
+        }
+        for (size_t i = 0; i < bucket->size; i++) {
+            new_data[i] = bucket->data[(bucket->head + i) % bucket->capacity];
+        }
+        free(bucket->data);
+        bucket->data = new_data;
+        bucket->head = 0;
+        bucket->capacity = new_capacity;
+    }
+    bucket->data[(bucket->head + bucket->size) % bucket->capacity] = value;
+    bucket->size++;
+    q->occupied |= bucket_bit(level);
+    q->size++;
+}
+
+int pop_bucket_queue(BucketQueue *q) {
+    if (!q || q->size == 0) {
+        return -1;
+    }
+    STAT_INC(STAT_HEAP_POP);
+
+    int level = BUCKET_QUEUE_MAX_LEVELS - 1 - __builtin_ctzll(q->occupied);
+    BucketLevel *bucket = &q->levels[level];
+    int value = bucket->data[bucket->head];
+    bucket->head = (bucket->head + 1) % bucket->capacity;
+    bucket->size--;
+    if (bucket->size == 0) {
+        q->occupied &= ~bucket_bit(level);
+    }
+    q->size--;
+    return value;
+}
+
+int remove_from_bucket_queue(BucketQueue *q, int priority, int value) {
+    if (!q || q->size == 0) {
+        return 0;
+    }
+    STAT_INC(STAT_HEAP_REMOVE);
+
+    int level = bucket_level(q, priority);
+    BucketLevel *bucket = &q->levels[level];
+    if (bucket->size == 0) {
+        return 0;
+    }
+    size_t first = bucket->capacity - bucket->head < bucket->size ? bucket->capacity - bucket->head : bucket->size;
+    int found = scan_find_int(bucket->data + bucket->head, first, value);
+    size_t i;
+    if (found >= 0) {
+        i = (size_t)found;
+    } else {
+        found = scan_find_int(bucket->data, bucket->size - first, value);
+        if (found < 0) {
+            return 0;
+        }
+        i = first + (size_t)found;
+    }
+    if (i < bucket->size / 2) {
+        for (size_t j = i; j > 0; j--) {
+            bucket->data[(bucket->head + j) % bucket->capacity] = bucket->data[(bucket->head + j - 1) % bucket->capacity];
+        }
+        bucket->head = (bucket->head + 1) % bucket->capacity;
+    } else {
+        for (size_t j = i; j + 1 < bucket->size; j++) {
+            bucket->data[(bucket->head + j) % bucket->capacity] = bucket->data[(bucket->head + j + 1) % bucket->capacity];
+        }
+    }
+    bucket->size--;
+    if (bucket->size == 0) {
+        q->occupied &= ~bucket_bit(level);
+    }
+    q->size--;
+    return 1;
+}
+
+static int tournament_match(const OfficeTournament *t, int a, int b) {
+    if (a < 0 || t->head_ids[a] == 0) {
+        return b >= 0 && t->head_ids[b] != 0 ? b : -1;
+    }
+    if (b < 0 || t->head_ids[b] == 0) {
+        return a;
+    }
+    if (t->head_priorities[a] != t->head_priorities[b]) {
+        return t->head_priorities[a] > t->head_priorities[b] ? a : b;
+    }
+    return t->head_ids[a] < t->head_ids[b] ? a : b;
+}
+
+static void tournament_replay(OfficeTournament *t, int office) {
+    for (int node = (t->leaves + office) / 2; node >= 1; node /= 2) {
+        t->winners[node] = tournament_match(t, t->winners[2 * node], t->winners[2 * node + 1]);
+    }
+}
+
+static void tournament_mark_stale(OfficeTournament *t, int office) {
+    if (!t->stale[office]) {
+        t->stale[office] = 1;
+        t->dirty[t->num_dirty++] = office;
+    }
+}
+
+static void tournament_note_push(MailSystem *system, PostOffice *office, int letter_id, int priority) {
+    OfficeTournament *t = &system->tournament;
+    int k = (int)(office - system->offices);
+    if (!t->valid || t->stale[k]) {
+        return;
+    }
+    int takes_head;
+    if (system->queue_kind == QUEUE_BUCKET) {
+        // buckets are FIFO within a level, so only a higher level displaces the head
+        const BucketQueue *q = &office->letter_buckets;
+        takes_head = t->head_ids[k] == 0 || bucket_level(q, priority) > bucket_level(q, t->head_priorities[k]);
+    } else {
+        takes_head = t->head_ids[k] == 0 || priority > t->head_priorities[k] ||
+                     (priority == t->head_priorities[k] && letter_id < t->head_ids[k]);
+    }
+    if (takes_head) {
+        t->head_ids[k] = letter_id;
+        t->head_priorities[k] = priority;
+        tournament_replay(t, k);
+    }
+}
+
+static void tournament_note_remove(MailSystem *system, PostOffice *office, int letter_id) {
+    OfficeTournament *t = &system->tournament;
+    int k = (int)(office - system->offices);
+    if (t->valid && t->head_ids[k] == letter_id) {
+        tournament_mark_stale(t, k);
+    }
+}
+
+static size_t bucket_level_bytes(const BucketQueue *q, int priority) {
+    if (!q->levels) {
+        return 0;
+    }
+    return q->num_levels * sizeof(BucketLevel) + q->levels[bucket_level(q, priority)].capacity * sizeof(int);
+}
+
+static size_t office_queue_bytes(const PostOffice *office) {
+    const BucketQueue *q = &office->letter_buckets;
+    size_t bytes = heap_bytes(&office->letter_heap);
+    if (q->levels) {
+        bytes += q->num_levels * sizeof(BucketLevel);
+        for (int i = 0; i < q->num_levels; i++) {
+            bytes += q->levels[i].capacity * sizeof(int);
+        }
+    }
+    return bytes;
+}
+
+// offices with queued letters, so the network tick serves only those; rebuilt from scratch while invalid
+static void mark_office_active(MailSystem *system, PostOffice *office) {
+    ActiveOffices *active = &system->active_offices;
+    if (!active->valid || office->active) {
+        return;
+    }
+    if (active->size >= active->capacity) {
+        int new_capacity = active->capacity ? active->capacity * 2 : 16;
+        OfficeHandle *handles = (OfficeHandle*)realloc(active->handles, new_capacity * sizeof(OfficeHandle));
+        if (!handles) {
+            active->valid = 0;
+            return;
+        }
+        active->handles = handles;
+        active->capacity = new_capacity;
+    }
+    active->handles[active->size].slot = office->slot;
+    active->handles[active->size].generation = system->office_slots[office->slot].generation;
+    active->size++;
+    office->active = 1;
+}
+
+static void office_queue_push(MailSystem *system, PostOffice *office, int letter_id, int priority) {
+    if (system->queue_kind == QUEUE_BUCKET) {
+        size_t before = bucket_level_bytes(&office->letter_buckets, priority);
+        push_bucket_queue(&office->letter_buckets, priority, letter_id);
+        system->queue_bytes += bucket_level_bytes(&office->letter_buckets, priority) - before;
+    } else {
+        size_t before = heap_bytes(&office->letter_heap);
+        push_heap_keyed(&office->letter_heap, letter_id, priority);
+        system->queue_bytes += heap_bytes(&office->letter_heap) - before;
+    }
+    tournament_note_push(system, office, letter_id, priority);
+    mark_office_active(system, office);
+}
+
+static int office_queue_remove(MailSystem *system, PostOffice *office, int letter_id, int priority) {
+    if (system->queue_kind == QUEUE_BUCKET) {
+        if (!remove_from_bucket_queue(&office->letter_buckets, priority, letter_id)) {
+            return 0;
+        }
+    } else {
+        size_t before = heap_bytes(&office->letter_heap);
+        if (!remove_letter_from_heap(&office->letter_heap, letter_id)) {
+            return 0;
+        }
+        system->queue_bytes -= before - heap_bytes(&office->letter_heap);
+    }
+    tournament_note_remove(system, office, letter_id);
+    return 1;
+}
+
+static int office_queue_pop(MailSystem *system, PostOffice *office) {
+    int letter_id;
+    if (system->queue_kind == QUEUE_BUCKET) {
+        letter_id = pop_bucket_queue(&office->letter_buckets);
+    } else {
+        size_t before = heap_bytes(&office->letter_heap);
+        letter_id = pop_heap(&office->letter_heap);
+        system->queue_bytes -= before - heap_bytes(&office->letter_heap);
+    }
+    tournament_note_remove(system, office, letter_id);
+    return letter_id;
+}
+
+static size_t office_queue_size(const MailSystem *system, const PostOffice *office) {
+    if (system->queue_kind == QUEUE_BUCKET) {
+        return size_bucket_queue(&office->letter_buckets);
+    }
+    return size_heap(&office->letter_heap);
+}
+
+static int letter_before(const Letter *a, const Letter *b) {
+    return !b || a->priority > b->priority || (a->priority == b->priority && a->id < b->id);
+}
+
+static Letter* best_letter_in(MailSystem *system, const int *letter_ids, size_t count, Letter *best) {
+    for (size_t i = 0; i < count; i++) {
+        Letter *letter = find_letter(system, letter_ids[i]);
+        if (letter && letter->state == IN_TRANSIT && letter_before(letter, best)) {
+            best = letter;
+        }
+    }
+    return best;
+}
+
+static size_t collect_urgent_letters(MailSystem *system, PostOffice *office, int *letter_ids, size_t max_letters) {
+    size_t count = 0;
+    if (max_letters == 0) {
+        return 0;
+    }
+
+    if (system->queue_kind == QUEUE_BUCKET) {
+        const BucketQueue *q = &office->letter_buckets;
+        unsigned long long occupied = q->occupied;
+        while (occupied && count < max_letters) {
+            int level = BUCKET_QUEUE_MAX_LEVELS - 1 - __builtin_ctzll(occupied);
+            const BucketLevel *bucket = &q->levels[level];
+            for (size_t i = 0; i < bucket->size && count < max_letters; i++) {
+                letter_ids[count++] = bucket->data[(bucket->head + i) % bucket->capacity];
+            }
+            occupied &= ~bucket_bit(level);
+        }
+        return count;
+    }
+
+    HeapIterator it;
+    int letter_id;
+    heap_iterator_begin(&it, &office->letter_heap);
+    while (count < max_letters && heap_iterator_next(&it, &letter_id) > 0) {
+        const Letter *letter = find_letter(system, letter_id);
+        if (letter && letter->state == IN_TRANSIT) {
+            letter_ids[count++] = letter_id;
+        }
+    }
+    heap_iterator_end(&it);
+    return count;
+}
+
+static Letter* office_queue_best(MailSystem *system, PostOffice *office) {
+    int letter_id;
+    return collect_urgent_letters(system, office, &letter_id, 1) ? find_letter(system, letter_id) : NULL;
+}
+
+size_t office_urgent_letters(MailSystem *system, int office_id, int *letter_ids, size_t max_letters) {
+    if (!system || !letter_ids) {
+        return 0;
+    }
+    PostOffice *office = find_office(system, office_id);
+    if (!office) {
+        return 0;
+    }
+    return collect_urgent_letters(system, office, letter_ids, max_letters);
+}
+
+static void free_tournament(OfficeTournament *t) {
+    for (int k = 0; k < t->leaves && t->cursors; k++) {
+        free(t->cursors[k].ids);
+    }
+    free(t->winners);
+    free(t->head_ids);
+    free(t->head_priorities);
+    free(t->stale);
+    free(t->dirty);
+    free(t->cursors);
+    free(t->walked);
+    memset(t, 0, sizeof(*t));
+}
+
+static int tournament_build(MailSystem *system) {
+    OfficeTournament *t = &system->tournament;
+    int leaves = 1;
+    while (leaves < system->office_count) {
+        leaves *= 2;
+    }
+    if (leaves != t->leaves) {
+        free_tournament(t);
+        t->winners = (int*)malloc(2 * leaves * sizeof(int));
+        t->head_ids = (int*)malloc(leaves * sizeof(int));
+        t->head_priorities = (int*)malloc(leaves * sizeof(int));
+        t->stale = (unsigned char*)malloc(leaves);
+        t->dirty = (int*)malloc(leaves * sizeof(int));
+        t->cursors = (TournamentCursor*)calloc(leaves, sizeof(TournamentCursor));
+        t->walked = (int*)malloc(leaves * sizeof(int));
+        t->leaves = leaves;
+        if (!t->winners || !t->head_ids || !t->head_priorities || !t->stale || !t->dirty || !t->cursors || !t->walked) {
+            free_tournament(t);
+            return 0;
+        }
+    }
+
+    for (int k = 0; k < leaves; k++) {
+        Letter *best = k < system->office_count ? office_queue_best(system, &system->offices[k]) : NULL;
+        t->head_ids[k] = best ? best->id : 0;
+        t->head_priorities[k] = best ? best->priority : 0;
+        t->stale[k] = 0;
+        t->winners[leaves + k] = k < system->office_count ? k : -1;
+    }
+    for (int node = leaves - 1; node >= 1; node--) {
+        t->winners[node] = tournament_match(t, t->winners[2 * node], t->winners[2 * node + 1]);
+    }
+    t->num_dirty = 0;
+    t->num_walked = 0;
+    t->valid = 1;
+    return 1;
+}
+
+static int tournament_begin(MailSystem *system) {
+    OfficeTournament *t = &system->tournament;
+    if (!t->valid) {
+        return tournament_build(system);
+    }
+    for (int i = 0; i < t->num_dirty; i++) {
+        int k = t->dirty[i];
+        Letter *best = office_queue_best(system, &system->offices[k]);
+        t->head_ids[k] = best ? best->id : 0;
+        t->head_priorities[k] = best ? best->priority : 0;
+        t->stale[k] = 0;
+        tournament_replay(t, k);
+    }
+    t->num_dirty = 0;
+    return 1;
+}
+
+// moves an office's leaf to its next letter in service order for the rest of the walk
+static void tournament_advance(MailSystem *system, int office) {
+    OfficeTournament *t = &system->tournament;
+    TournamentCursor *cursor = &t->cursors[office];
+    if (cursor->limit == 0) {
+        t->walked[t->num_walked++] = office;
+        cursor->next = 1;
+    }
+    if (cursor->next >= cursor->count && cursor->count == cursor->limit) {
+        size_t limit = cursor->limit ? cursor->limit * 2 : 8;
+        int *ids = (int*)realloc(cursor->ids, limit * sizeof(int));
+        if (ids) {
+            cursor->ids = ids;
+            cursor->limit = limit;
+            cursor->count = collect_urgent_letters(system, &system->offices[office], ids, limit);
+        }
+    }
+
+    Letter *next = cursor->next < cursor->count ? find_letter(system, cursor->ids[cursor->next++]) : NULL;
+    t->head_ids[office] = next ? next->id : 0;
+    t->head_priorities[office] = next ? next->priority : 0;
+    tournament_replay(t, office);
+}
+
+static void tournament_end_walk(OfficeTournament *t) {
+    for (int i = 0; i < t->num_walked; i++) {
+        int k = t->walked[i];
+        free(t->cursors[k].ids);
+        memset(&t->cursors[k], 0, sizeof(TournamentCursor));
+        if (t->valid) {
+            tournament_mark_stale(t, k);
+        }
+    }
+    t->num_walked = 0;
+}
+
+size_t next_urgent_letters(MailSystem *system, int *letter_ids, size_t max_letters) {
+    if (!system || !letter_ids || !tournament_begin(system)) {
+        return 0;
+    }
+    OfficeTournament *t = &system->tournament;
+    size_t count = 0;
+    int k;
+    while (count < max_letters && (k = t->winners[1]) >= 0) {
+        letter_ids[count++] = t->head_ids[k];
+        tournament_advance(system, k);
+    }
+    tournament_end_walk(t);
+    return count;
+}
+
+typedef struct {
+    int office;
+    size_t begin;
+    size_t end;
+} QueueChunk;
+
+static size_t build_queue_chunks(const MailSystem *system, QueueChunk **out) {
+    size_t count = 0;
+    for (int k = 0; k < system->office_count; k++) {
+        size_t size = system->offices[k].letter_heap.size;
+        count += (size + ROUTING_CHUNK_LETTERS - 1) / ROUTING_CHUNK_LETTERS;
+    }
+    *out = NULL;
+    if (count == 0) {
+        return 0;
+    }
+
+    QueueChunk *chunks = (QueueChunk*)malloc(count * sizeof(QueueChunk));
+    if (!chunks) {
+        return 0;
+    }
+    size_t index = 0;
+    for (int k = 0; k < system->office_count; k++) {
+        size_t size = system->offices[k].letter_heap.size;
+        for (size_t begin = 0; begin < size; begin += ROUTING_CHUNK_LETTERS) {
+            chunks[index].office = k;
+            chunks[index].begin = begin;
+            chunks[index].end = begin + ROUTING_CHUNK_LETTERS < size ? begin + ROUTING_CHUNK_LETTERS : size;
+            index++;
+        }
+    }
+    *out = chunks;
+    return count;
+}
+
+static size_t chunk_grain(const MailSystem *system, size_t count) {
+    size_t tasks = (size_t)executor_threads(system->executor) * 8;
+    return count / tasks > 0 ? count / tasks : 1;
+}
+
+static size_t office_hash(int office_id, size_t capacity) {
+    return (size_t)((unsigned int)office_id * 2654435761u) & (capacity - 1);
+}
+
+static int office_table_lookup(const MailSystem *system, int office_id, size_t *probes) {
+    if (!system->office_table) {
+        (*probes)++;
+        return -1;
+    }
+
+    size_t mask = system->office_table_capacity - 1;
+    for (size_t i = office_hash(office_id, system->office_table_capacity);; i = (i + 1) & mask) {
+        (*probes)++;
+        const OfficeIndexEntry *entry = &system->office_table[i];
+        if (entry->slot < 0) {
+            return -1;
+        }
+        if (entry->id == office_id) {
+            return entry->slot;
+        }
+    }
+}
+
+static void office_table_place(OfficeIndexEntry *table, size_t capacity, int office_id, int slot) {
+    size_t i = office_hash(office_id, capacity);
+    while (table[i].slot >= 0) {
+        i = (i + 1) & (capacity - 1);
+    }
+    table[i].id = office_id;
+    table[i].slot = slot;
+}
+
+static int office_table_insert(MailSystem *system, int office_id, int slot) {
+    if ((size_t)(system->office_count + 1) * 2 > system->office_table_capacity) {
+        size_t new_capacity = system->office_table_capacity ? system->office_table_capacity * 2 : 16;
+        OfficeIndexEntry *new_table = (OfficeIndexEntry*)malloc(new_capacity * sizeof(OfficeIndexEntry));
+        if (!new_table) {
+            return 0;
+        }
+        for (size_t i = 0; i < new_capacity; i++) {
+            new_table[i].slot = -1;
+        }
+        for (size_t i = 0; i < system->office_table_capacity; i++) {
+            if (system->office_table[i].slot >= 0) {
+                office_table_place(new_table, new_capacity, system->office_table[i].id, system->office_table[i].slot);
+            }
+        }
+        free_array(system, system->office_table);
+        system->office_table = new_table;
+        system->office_table_capacity = new_capacity;
+    }
+    office_table_place(system->office_table, system->office_table_capacity, office_id, slot);
+    return 1;
+}
+
+static void office_table_erase(MailSystem *system, int office_id) {
+    size_t mask = system->office_table_capacity - 1;
+    size_t i = office_hash(office_id, system->office_table_capacity);
+    while (system->office_table[i].id != office_id || system->office_table[i].slot < 0) {
+        i = (i + 1) & mask;
+    }
+
+    size_t hole = i;
+    for (size_t j = (hole + 1) & mask; system->office_table[j].slot >= 0; j = (j + 1) & mask) {
+        size_t home = office_hash(system->office_table[j].id, system->office_table_capacity);
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            system->office_table[hole] = system->office_table[j];
+            hole = j;
+        }
+    }
+    system->office_table[hole].slot = -1;
+}
+
+static int acquire_office_slot(MailSystem *system) {
+    if (system->free_office_slot >= 0) {
+        int slot = system->free_office_slot;
+        system->free_office_slot = system->office_slots[slot].next_free;
+        return slot;
+    }
+    if (system->office_slots_size >= system->office_slots_capacity) {
+        int new_capacity = system->office_slots_capacity ? system->office_slots_capacity * 2 : INITIAL_CAPACITY;
+        OfficeSlot *new_slots = (OfficeSlot*)resize_array(system, system->office_slots,
+                                                          system->office_slots_capacity * sizeof(OfficeSlot),
+                                                          new_capacity * sizeof(OfficeSlot));
+        if (!new_slots) {
+            return -1;
+        }
+        system->office_slots = new_slots;
+        system->office_slots_capacity = new_capacity;
+    }
+    int slot = system->office_slots_size++;
+    system->office_slots[slot].dense = -1;
+    system->office_slots[slot].generation = 0;
+    system->office_slots[slot].next_free = -1;
+    return slot;
+}
+
+static void release_office_slot(MailSystem *system, int slot) {
+    system->office_slots[slot].dense = -1;
+    system->office_slots[slot].generation++;
+    system->office_slots[slot].next_free = system->free_office_slot;
+    system->free_office_slot = slot;
+}
+
+PostOffice* find_office(const MailSystem *system, int office_id) {
+    if (!system) {
+        return NULL;
+    }
+
+    STAT_INC(STAT_FIND_OFFICE);
+    size_t probes = 0;
+    int slot = office_table_lookup(system, office_id, &probes);
+    STAT_ADD(STAT_FIND_OFFICE_PROBES, probes);
+    if (slot < 0) {
+        return NULL;
+    }
+    return &system->offices[system->office_slots[slot].dense];
+}
+
+OfficeHandle get_office_handle(const MailSystem *system, int office_id) {
+    OfficeHandle handle;
+    handle.slot = -1;
+    handle.generation = 0;
+
+    PostOffice *office = find_office(system, office_id);
+    if (office) {
+        handle.slot = office->slot;
+        handle.generation = system->office_slots[office->slot].generation;
+    }
+    return handle;
+}
+
+PostOffice* resolve_office(const MailSystem *system, OfficeHandle handle) {
+    if (!system || handle.slot < 0 || handle.slot >= system->office_slots_size) {
+        return NULL;
+    }
+
+    const OfficeSlot *slot = &system->office_slots[handle.slot];
+    if (slot->generation != handle.generation || slot->dense < 0) {
+        return NULL;
+    }
+    return &system->offices[slot->dense];
+}
+
+static void mark_topology_changed(MailSystem *system) {
+    system->topology_dirty = 1;
+    system->scheduler.wake_all = 1;
+    system->tournament.valid = 0;
+}
+
+static void invalidate_region(RegionalRoutes *regions, int region) {
+    RegionTable *table = &regions->tables[region];
+    table->intra_valid = 0;
+    table->exits_valid = 0;
+    table->gateway_valid = 0;
+}
+
+static void region_edge_changed(RegionalRoutes *regions, int source, int target) {
+    int region = regions->region_of[source];
+    RegionTable *table = &regions->tables[region];
+    table->gateway_valid = 0;
+    if (region == regions->region_of[target]) {
+        table->intra_valid = 0;
+    } else {
+        table->exits_valid = 0;
+        regions->distances_epoch++;
+    }
+}
+
+static void mark_edge_changed(MailSystem *system, PostOffice *source, int target_id) {
+    system->topology_dirty = 1;
+    unpark_office(system, source);
+
+    const PostOffice *target = find_office(system, target_id);
+    if (system->regions.valid && target) {
+        region_edge_changed(&system->regions, (int)(source - system->offices), (int)(target - system->offices));
+    }
+}
+
+static int grow_region_tables(RegionalRoutes *regions) {
+    int n = regions->num_regions + 1;
+    RegionTable *tables = (RegionTable*)realloc(regions->tables, (n + 1) * sizeof(RegionTable));
+    if (tables) {
+        regions->tables = tables;
+        memset(&tables[n - 1], 0, 2 * sizeof(RegionTable));
+    }
+    int *distances = (int*)realloc(regions->region_distances, ((size_t)n * n + 1) * sizeof(int));
+    if (distances) {
+        regions->region_distances = distances;
+    }
+    int *next = (int*)realloc(regions->region_next, ((size_t)n * n + 1) * sizeof(int));
+    if (next) {
+        regions->region_next = next;
+    }
+    int *row_epoch = (int*)realloc(regions->row_epoch, (n + 1) * sizeof(int));
+    if (row_epoch) {
+        regions->row_epoch = row_epoch;
+    }
+    if (!tables || !distances || !next || !row_epoch) {
+        return -1;
+    }
+
+    regions->num_regions = n;
+    for (int r = 0; r < n; r++) {
+        regions->row_epoch[r] = -1;
+        regions->tables[r].gateway_valid = 0;
+    }
+    return n - 1;
+}
+
+static void region_join(MailSystem *system, PostOffice *office, const int *connections, int num_conn) {
+    RegionalRoutes *regions = &system->regions;
+    if (!regions->valid) {
+        return;
+    }
+    int dense = (int)(office - system->offices);
+    if (dense >= regions->office_capacity) {
+        int new_capacity = regions->office_capacity * 2 > dense ? regions->office_capacity * 2 : dense + 1;
+        int *region_of = (int*)realloc(regions->region_of, (new_capacity + 1) * sizeof(int));
+        if (region_of) {
+            regions->region_of = region_of;
+        }
+        int *local_index = (int*)realloc(regions->local_index, (new_capacity + 1) * sizeof(int));
+        if (local_index) {
+            regions->local_index = local_index;
+        }
+        if (!region_of || !local_index) {
+            regions->valid = 0;
+            return;
+        }
+        regions->office_capacity = new_capacity;
+    }
+
+    int region_size = 1;
+    while (region_size * region_size < system->office_count) {
+        region_size++;
+    }
+    int best = -1;
+    for (int i = 0; i < num_conn; i++) {
+        const PostOffice *neighbour = find_office(system, connections[i]);
+        if (!neighbour || neighbour == office) {
+            continue;
+        }
+        int r = regions->region_of[neighbour - system->offices];
+        const RegionTable *table = &regions->tables[r];
+        if (table->label < -1 && table->num_offices < 2 * region_size &&
+            (best < 0 || table->num_offices < regions->tables[best].num_offices)) {
+            best = r;
+        }
+    }
+    for (int r = 0; best < 0 && r < regions->num_regions; r++) {
+        if (regions->tables[r].num_offices == 0 && regions->tables[r].label < -1) {
+            best = r;
+        }
+    }
+    if (best < 0) {
+        best = grow_region_tables(regions);
+        if (best < 0) {
+            regions->valid = 0;
+            return;
+        }
+        regions->tables[best].label = -2 - regions->next_auto_region++;
+    }
+
+    RegionTable *table = &regions->tables[best];
+    if (table->num_offices >= table->capacity) {
+        int new_capacity = table->capacity ? table->capacity * 2 : 4;
+        int *offices = (int*)realloc(table->offices, new_capacity * sizeof(int));
+        if (!offices) {
+            regions->valid = 0;
+            return;
+        }
+        table->offices = offices;
+        table->capacity = new_capacity;
+    }
+    office->auto_region = -2 - table->label;
+    regions->region_of[dense] = best;
+    regions->local_index[dense] = table->num_offices;
+    table->offices[table->num_offices++] = dense;
+    invalidate_region(regions, best);
+}
+
+static void region_leave(MailSystem *system, const PostOffice *office) {
+    RegionalRoutes *regions = &system->regions;
+    if (!regions->valid) {
+        return;
+    }
+    int dense = (int)(office - system->offices);
+    for (int i = 0; i < office->num_in_connections; i++) {
+        const PostOffice *source = find_office(system, office->in_connections[i]);
+        if (source && source != office) {
+            region_edge_changed(regions, (int)(source - system->offices), dense);
+        }
+    }
+    for (int i = 0; i < office->num_connections; i++) {
+        const PostOffice *target = find_office(system, office->connections[i]);
+        if (target && regions->region_of[target - system->offices] != regions->region_of[dense]) {
+            regions->distances_epoch++;
+            break;
+        }
+    }
+
+    int region = regions->region_of[dense];
+    RegionTable *table = &regions->tables[region];
+    int local = regions->local_index[dense];
+    int moved = table->offices[--table->num_offices];
+    table->offices[local] = moved;
+    regions->local_index[moved] = local;
+    invalidate_region(regions, region);
+}
+
+static void region_move(MailSystem *system, int from, int to) {
+    RegionalRoutes *regions = &system->regions;
+    if (!regions->valid) {
+        return;
+    }
+    regions->region_of[to] = regions->region_of[from];
+    regions->local_index[to] = regions->local_index[from];
+    regions->tables[regions->region_of[to]].offices[regions->local_index[to]] = to;
+
+    const PostOffice *office = &system->offices[to];
+    for (int i = 0; i < office->num_in_connections; i++) {
+        const PostOffice *source = find_office(system, office->in_connections[i]);
+        if (source) {
+            regions->tables[regions->region_of[source - system->offices]].exits_valid = 0;
+        }
+    }
+}
+
+static int office_link_index(const PostOffice *office, int target_id) {
+    return scan_find_int(office->connections, office->num_connections, target_id);
+}
+
+static size_t office_connection_bytes(const PostOffice *office) {
+    return (office->connections ? MAX_CONNECTIONS * sizeof(int) : 0) +
+           (office->links ? MAX_CONNECTIONS * sizeof(LinkState) : 0) +
+           office->in_connections_capacity * sizeof(int);
+}
+
+static int add_in_connection(MailSystem *system, PostOffice *office, int source_id) {
+    if (office->num_in_connections >= office->in_connections_capacity) {
+        int new_capacity = office->in_connections_capacity ? office->in_connections_capacity * 2 : 4;
+        int *new_in = (int*)realloc(office->in_connections, new_capacity * sizeof(int));
+        if (!new_in) {
+            return 0;
+        }
+        system->connection_bytes += (new_capacity - office->in_connections_capacity) * sizeof(int);
+        office->in_connections = new_in;
+        office->in_connections_capacity = new_capacity;
+    }
+    office->in_connections[office->num_in_connections++] = source_id;
+    return 1;
+}
+
+static void remove_in_connection(PostOffice *office, int source_id) {
+    int i = scan_find_int(office->in_connections, office->num_in_connections, source_id);
+    if (i >= 0) {
+        office->in_connections[i] = office->in_connections[--office->num_in_connections];
+    }
+}
+
+static void remove_out_connection(MailSystem *system, PostOffice *office, int target_id) {
+    int i = office_link_index(office, target_id);
+    if (i < 0) {
+        return;
+    }
+    for (int j = i; j < office->num_connections - 1; j++) {
+        office->connections[j] = office->connections[j + 1];
+        office->links[j] = office->links[j + 1];
+    }
+    office->num_connections--;
+    
+    if (office->num_connections == 0) {
+        system->connection_bytes -= MAX_CONNECTIONS * (sizeof(int) + sizeof(LinkState));
+        free(office->connections);
+        free(office->links);
+        office->connections = NULL;
+        office->links = NULL;
+    }
+}
+
+static int append_connection(MailSystem *system, PostOffice *office, int target_id) {
+    if (!office->connections) {
+        office->connections = (int*)malloc(MAX_CONNECTIONS * sizeof(int));
+        if (!office->connections) {
+            return 0;
+        }
+        system->connection_bytes += MAX_CONNECTIONS * sizeof(int);
+    }
+    if (!office->links) {
+        office->links = (LinkState*)malloc(MAX_CONNECTIONS * sizeof(LinkState));
+        if (!office->links) {
+            return 0;
+        }
+        system->connection_bytes += MAX_CONNECTIONS * sizeof(LinkState);
+    }
+
+    PostOffice *target_office = find_office(system, target_id);
+    if (!target_office) {
+        system->dangling_connections++;
+    } else if (!add_in_connection(system, target_office, office->id)) {
+        return 0;
+    }
+
+    LinkState *link = &office->links[office->num_connections];
+    link->bandwidth = system->link_bandwidth;
+    link->latency = system->link_latency;
+    link->weight = DEFAULT_LINK_WEIGHT;
+    link->used_tick = -1;
+    link->used = 0;
+    office->connections[office->num_connections++] = target_id;
+    mark_edge_changed(system, office, target_id);
+    return 1;
+}
+
+static void detach_office_edges(MailSystem *system, PostOffice *office) {
+    for (int i = 0; i < office->num_in_connections; i++) {
+        PostOffice *source = find_office(system, office->in_connections[i]);
+        if (source && source != office) {
+            remove_out_connection(system, source, office->id);
+        }
+    }
+    for (int i = 0; i < office->num_connections; i++) {
+        PostOffice *target = find_office(system, office->connections[i]);
+        if (!target) {
+            system->dangling_connections--;
+        } else if (target != office) {
+            remove_in_connection(target, office->id);
+        }
+    }
+    system->connection_bytes -= office_connection_bytes(office);
+    free(office->connections);
+    free(office->links);
+    free(office->in_connections);
+    office->connections = NULL;
+    office->links = NULL;
+    office->in_connections = NULL;
+    office->num_connections = 0;
+    office->num_in_connections = 0;
+    office->in_connections_capacity = 0;
+}
+
+static int adopt_dangling_connections(MailSystem *system, PostOffice *office) {
+    for (int k = 0; k < system->office_count && system->dangling_connections > 0; k++) {
+        const PostOffice *source = &system->offices[k];
+        size_t edges = scan_count_int(source->connections, source->num_connections, office->id);
+        for (size_t i = 0; i < edges; i++) {
+            if (!add_in_connection(system, office, source->id)) {
+                return 0;
+            }
+            system->dangling_connections--;
+        }
+        if (edges > 0 && system->regions.valid) {
+            region_edge_changed(&system->regions, k, (int)(office - system->offices));
+        }
+    }
+    return 1;
+}
+
+static int memory_admits(MailSystem *system, size_t bytes) {
+    if (system->memory_budget == 0) {
+        return 1;
+    }
+    MemoryFootprint footprint;
+    measure_memory(system, &footprint);
+    if (footprint.total + bytes <= system->memory_budget) {
+        return 1;
+    }
+    system->budget_rejections++;
+
+    char log_msg[256];
+    sprintf(log_msg, "Memory budget exceeded: %zu bytes in use, %zu requested, budget %zu", footprint.total, bytes, system->memory_budget);
+    log_message(system, log_msg);
+    return 0;
+}
+
+static size_t office_admission_bytes(const MailSystem *system, int num_conn) {
+    size_t bytes = system->queue_kind == QUEUE_HEAP ? INITIAL_CAPACITY * sizeof(int) : 0;
+    if (num_conn > 0) {
+        bytes += MAX_CONNECTIONS * (sizeof(int) + sizeof(LinkState));
+    }
+    if (system->office_count >= system->office_capacity) {
+        bytes += (system->office_capacity ? system->office_capacity : INITIAL_CAPACITY) * sizeof(PostOffice);
+    }
+    if (system->free_office_slot < 0 && system->office_slots_size >= system->office_slots_capacity) {
+        bytes += (system->office_slots_capacity ? system->office_slots_capacity : INITIAL_CAPACITY) * sizeof(OfficeSlot);
+    }
+    if ((size_t)(system->office_count + 1) * 2 > system->office_table_capacity) {
+        bytes += (system->office_table_capacity ? system->office_table_capacity * 2 : 16) * sizeof(OfficeIndexEntry);
+    }
+    return bytes;
+}
+
+StatusCode add_office(MailSystem *system, int id, int capacity, int* connections, int num_conn) {
+    if (!system || id < 0 || capacity <= 0) {
+        return ERROR_INVALID_ID;
+    }
+    trace_office(system, "office", id, capacity, connections, num_conn);
+    if (num_conn > MAX_CONNECTIONS || (num_conn > 0 && !connections)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    if (find_office(system, id)) {
+        return ERROR_DUPLICATE_OFFICE;
+    }
+    if (!memory_admits(system, office_admission_bytes(system, num_conn))) {
+        return ERROR_MEMORY_BUDGET;
+    }
+
+    if (system->office_count >= system->office_capacity) {
+        int new_capacity = system->office_capacity ? system->office_capacity * 2 : INITIAL_CAPACITY;
+        PostOffice *new_offices = (PostOffice*)realloc(system->offices, new_capacity * sizeof(PostOffice));
+        if (!new_offices) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        system->offices = new_offices;
+        system->office_capacity = new_capacity;
+    }
+    int slot = acquire_office_slot(system);
+    if (slot < 0) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    if (!office_table_insert(system, id, slot)) {
+        release_office_slot(system, slot);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    PostOffice *new_office = &system->offices[system->office_count];
+    new_office->id = id;
     new_office->capacity = capacity;
     new_office->current_letters = 0;
     new_office->num_connections = 0;
-    new_office->letter_heap = create_heap(INITIAL_CAPACITY);
-    new_office->next = system->offices;
-    system->offices = new_office;
+    new_office->connections = NULL;
+    new_office->links = NULL;
+    new_office->in_connections = NULL;
+    new_office->num_in_connections = 0;
+    new_office->in_connections_capacity = 0;
+    new_office->service_rate = system->service_rate;
+    new_office->letter_heap = system->queue_kind == QUEUE_HEAP ? create_keyed_heap(INITIAL_CAPACITY) : create_heap(0);
+    new_office->letter_buckets = create_bucket_queue(system->queue_kind == QUEUE_BUCKET ? system->queue_levels : 0);
+    memset(&new_office->parked, 0, sizeof(new_office->parked));
+    system->queue_bytes += office_queue_bytes(new_office);
+    new_office->slot = slot;
+    new_office->region = -1;
+    new_office->auto_region = -1;
+    new_office->active = 0;
+    system->office_slots[slot].dense = system->office_count;
+    system->office_count++;
+    mark_topology_changed(system);
+    region_join(system, new_office, connections, num_conn);
+    
+    int attached = adopt_dangling_connections(system, new_office);
+    for (int i = 0; i < num_conn && attached; i++) {
+        attached = append_connection(system, new_office, connections[i]);
+        if (!attached) {
+            break;
+        }
+        
+        PostOffice *target_office = find_office(system, connections[i]);
+        if (target_office && target_office->num_connections < MAX_CONNECTIONS && office_link_index(target_office, id) < 0) {
+            append_connection(system, target_office, id);
+        }
+    }
+    if (!attached) {
+        region_leave(system, new_office);
+        detach_office_edges(system, new_office);
+        system->office_count--;
+        office_table_erase(system, id);
+        release_office_slot(system, slot);
+        system->queue_bytes -= office_queue_bytes(new_office);
+        delete_heap(&new_office->letter_heap);
+        delete_bucket_queue(&new_office->letter_buckets);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    char log_msg[256];
+    sprintf(log_msg, "Added office %d with capacity %d", id, capacity);
+    log_message(system, log_msg);
+    return SUCCESS;
+}
+
+static int* nearest_neighbour_table(MailSystem *system, PostOffice *hub, const int *letter_ids, size_t count) {
+    int *owner = (int*)malloc(system->office_count * sizeof(int));
+    int *queue = (int*)malloc(system->office_count * sizeof(int));
+    unsigned char *wanted = (unsigned char*)calloc(system->office_count, 1);
+    if (!owner || !queue || !wanted) {
+        free(owner);
+        free(queue);
+        free(wanted);
+        return NULL;
+    }
+    for (int k = 0; k < system->office_count; k++) {
+        owner[k] = -1;
+    }
+
+    size_t pending = 0;
+    for (size_t i = 0; i < count; i++) {
+        const Letter *letter = find_letter(system, letter_ids[i]);
+        PostOffice *destination = letter ? find_office(system, letter->to_office) : NULL;
+        if (destination && destination != hub && !wanted[destination - system->offices]) {
+            wanted[destination - system->offices] = 1;
+            pending++;
+        }
+    }
+
+    int head = 0, tail = 0;
+    owner[hub - system->offices] = -2;
+    for (int j = 0; j < hub->num_connections; j++) {
+        PostOffice *neighbour = find_office(system, hub->connections[j]);
+        if (neighbour && owner[neighbour - system->offices] == -1) {
+            owner[neighbour - system->offices] = j;
+            queue[tail++] = (int)(neighbour - system->offices);
+        }
+    }
+    while (head < tail && pending > 0) {
+        const PostOffice *office = &system->offices[queue[head++]];
+        if (wanted[office - system->offices]) {
+            pending--;
+        }
+        for (int j = 0; j < office->num_connections; j++) {
+            PostOffice *next = find_office(system, office->connections[j]);
+            if (next && owner[next - system->offices] == -1) {
+                owner[next - system->offices] = owner[office - system->offices];
+                queue[tail++] = (int)(next - system->offices);
+            }
+        }
+    }
+    free(queue);
+    free(wanted);
+    return owner;
+}
+
+static PostOffice* roomiest_neighbour(PostOffice **neighbours, int count) {
+    PostOffice *best = NULL;
+    for (int j = 0; j < count; j++) {
+        PostOffice *candidate = neighbours[j];
+        if (candidate && candidate->current_letters < candidate->capacity &&
+            (!best || candidate->capacity - candidate->current_letters > best->capacity - best->current_letters)) {
+            best = candidate;
+        }
+    }
+    return best;
+}
+
+static void rehome_letters(MailSystem *system, PostOffice *hub) {
+    size_t count = office_queue_size(system, hub);
+    int *letter_ids = (int*)malloc((count ? count : 1) * sizeof(int));
+    PostOffice **neighbours = (PostOffice**)malloc((hub->num_connections ? hub->num_connections : 1) * sizeof(PostOffice*));
+    int *owner = NULL;
+    if (letter_ids && neighbours) {
+        for (size_t i = 0; i < count; i++) {
+            letter_ids[i] = office_queue_pop(system, hub);
+        }
+        for (int j = 0; j < hub->num_connections; j++) {
+            neighbours[j] = find_office(system, hub->connections[j]);
+            if (neighbours[j] == hub) {
+                neighbours[j] = NULL;
+            }
+        }
+        owner = nearest_neighbour_table(system, hub, letter_ids, count);
+    }
+
+    size_t rehomed = 0, undeliverable = 0;
+    for (size_t i = 0; i < count; i++) {
+        int letter_id = letter_ids ? letter_ids[i] : office_queue_pop(system, hub);
+        Letter *letter = find_letter(system, letter_id);
+        if (!letter) {
+            continue;
+        }
+
+        PostOffice *target = NULL;
+        if (letter->from_office != hub->id && letter->to_office != hub->id && neighbours && letter_ids) {
+            PostOffice *destination = find_office(system, letter->to_office);
+            int via = owner && destination ? owner[destination - system->offices] : -1;
+            if (via >= 0 && neighbours[via] && office_has_room(neighbours[via])) {
+                target = neighbours[via];
+            } else {
+                target = roomiest_neighbour(neighbours, hub->num_connections);
+            }
+        }
+
+        if (!target) {
+            set_letter_state(system, letter, UNDELIVERED);
+            undeliverable++;
+            continue;
+        }
+        office_queue_push(system, target, letter->id, letter->priority);
+        adjust_occupancy(system, target, 1);
+        record_hop(system, letter, target->id);
+        STAT_INC(STAT_TRANSFERS);
+        rehomed++;
+    }
+    free(owner);
+    free(neighbours);
+    free(letter_ids);
+
+    if (count > 0) {
+        char log_msg[256];
+        sprintf(log_msg, "Office %d removal: %zu letters rehomed, %zu marked as undeliverable", hub->id, rehomed, undeliverable);
+        log_message(system, log_msg);
+    }
+}
+
+StatusCode remove_office(MailSystem *system, int office_id) {
+    if (!system) {
+        return ERROR_INVALID_ID;
+    }
+    trace_record(system, "remove_office %d\n", office_id);
+    
+    PostOffice *current = find_office(system, office_id);
+    if (!current) {
+        return ERROR_OFFICE_NOT_FOUND;
+    }
+
+    unpark_office(system, current);
+    rehome_letters(system, current);
+    region_leave(system, current);
+    detach_office_edges(system, current);
+
+    system->total_occupancy -= current->current_letters;
+    system->queue_bytes -= office_queue_bytes(current);
+    delete_heap(&current->letter_heap);
+    delete_bucket_queue(&current->letter_buckets);
+    free(current->parked.entries);
+    office_table_erase(system, office_id);
+    release_office_slot(system, current->slot);
+
+    int dense = (int)(current - system->offices);
+    int last = system->office_count - 1;
+    if (dense != last) {
+        system->offices[dense] = system->offices[last];
+        system->office_slots[system->offices[dense].slot].dense = dense;
+        region_move(system, last, dense);
+    }
+    system->office_count--;
+    mark_topology_changed(system);
+    
+    char log_msg[256];
+    sprintf(log_msg, "Removed office %d", office_id);
+    log_message(system, log_msg);
+    return SUCCESS;
+}
+
+StatusCode add_connection(MailSystem *system, int from_office, int to_office, int weight) {
+    if (!system || weight <= 0 || from_office == to_office) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    trace_record(system, "connect %d %d %d\n", from_office, to_office, weight);
+
+    PostOffice *office = find_office(system, from_office);
+    if (!office || !find_office(system, to_office)) {
+        return ERROR_OFFICE_NOT_FOUND;
+    }
+    int link_index = office_link_index(office, to_office);
+    if (link_index >= 0 && office->links[link_index].weight == weight) {
+        return SUCCESS;
+    }
+    if (link_index < 0) {
+        if (office->num_connections >= MAX_CONNECTIONS) {
+            return ERROR_INVALID_PARAMETER;
+        }
+        if (!append_connection(system, office, to_office)) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        link_index = office->num_connections - 1;
+    }
+    office->links[link_index].weight = weight;
+    mark_edge_changed(system, office, to_office);
+    
+    char log_msg[256];
+    sprintf(log_msg, "Connected office %d -> office %d (weight %d)", from_office, to_office, weight);
+    log_message(system, log_msg);
+    return SUCCESS;
+}
+
+StatusCode remove_connection(MailSystem *system, int from_office, int to_office) {
+    if (!system) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    trace_record(system, "disconnect %d %d\n", from_office, to_office);
+
+    PostOffice *office = find_office(system, from_office);
+    if (!office) {
+        return ERROR_OFFICE_NOT_FOUND;
+    }
+    if (office_link_index(office, to_office) < 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    mark_edge_changed(system, office, to_office);
+    remove_out_connection(system, office, to_office);
+    PostOffice *target_office = find_office(system, to_office);
+    if (target_office) {
+        remove_in_connection(target_office, from_office);
+    } else {
+        system->dangling_connections--;
+    }
+    
+    char log_msg[256];
+    sprintf(log_msg, "Disconnected office %d -> office %d", from_office, to_office);
+    log_message(system, log_msg);
+    return SUCCESS;
+}
+
+static void topology_lock(MailSystem *system) {
+    while (__atomic_exchange_n(&system->topology_lock, 1, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+static void topology_unlock(MailSystem *system) {
+    __atomic_store_n(&system->topology_lock, 0, __ATOMIC_RELEASE);
+}
+
+static StatusCode queue_topology_change(MailSystem *system, TopologyChange change) {
+    topology_lock(system);
+    if (system->topology_changes_size >= system->topology_changes_capacity) {
+        size_t new_capacity = system->topology_changes_capacity == 0 ? 16 : system->topology_changes_capacity * 2;
+        TopologyChange *new_changes = (TopologyChange*)realloc(system->topology_changes, new_capacity * sizeof(TopologyChange));
+        if (!new_changes) {
+            topology_unlock(system);
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        system->topology_changes = new_changes;
+        system->topology_changes_capacity = new_capacity;
+    }
+    system->topology_changes[system->topology_changes_size++] = change;
+    topology_unlock(system);
+    return SUCCESS;
+}
+
+StatusCode queue_add_office(MailSystem *system, int id, int capacity, const int *connections, int num_conn) {
+    if (!system || id < 0 || capacity <= 0) {
+        return ERROR_INVALID_ID;
+    }
+    if (num_conn < 0 || num_conn > MAX_CONNECTIONS || (num_conn > 0 && !connections)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    trace_office(system, "queue_office", id, capacity, connections, num_conn);
+
+    TopologyChange change;
+    memset(&change, 0, sizeof(change));
+    change.kind = TOPOLOGY_ADD_OFFICE;
+    change.office_id = id;
+    change.capacity = capacity;
+    change.num_connections = num_conn;
+    if (num_conn > 0) {
+        change.connections = (int*)malloc(num_conn * sizeof(int));
+        if (!change.connections) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        memcpy(change.connections, connections, num_conn * sizeof(int));
+    }
+    StatusCode status = queue_topology_change(system, change);
+    if (status != SUCCESS) {
+        free(change.connections);
+    }
+    return status;
+}
+
+StatusCode queue_remove_office(MailSystem *system, int office_id) {
+    if (!system || office_id < 0) {
+        return ERROR_INVALID_ID;
+    }
+    trace_record(system, "queue_remove_office %d\n", office_id);
+
+    TopologyChange change;
+    memset(&change, 0, sizeof(change));
+    change.kind = TOPOLOGY_REMOVE_OFFICE;
+    change.office_id = office_id;
+    return queue_topology_change(system, change);
+}
+
+StatusCode queue_add_connection(MailSystem *system, int from_office, int to_office, int weight) {
+    if (!system || weight <= 0 || from_office == to_office) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    trace_record(system, "queue_connect %d %d %d\n", from_office, to_office, weight);
+
+    TopologyChange change;
+    memset(&change, 0, sizeof(change));
+    change.kind = TOPOLOGY_ADD_CONNECTION;
+    change.office_id = from_office;
+    change.target_id = to_office;
+    change.weight = weight;
+    return queue_topology_change(system, change);
+}
+
+StatusCode queue_remove_connection(MailSystem *system, int from_office, int to_office) {
+    if (!system) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    trace_record(system, "queue_disconnect %d %d\n", from_office, to_office);
+
+    TopologyChange change;
+    memset(&change, 0, sizeof(change));
+    change.kind = TOPOLOGY_REMOVE_CONNECTION;
+    change.office_id = from_office;
+    change.target_id = to_office;
+    return queue_topology_change(system, change);
+}
+
+static int compare_ints(const void *a, const void *b) {
+    int left = *(const int*)a;
+    int right = *(const int*)b;
+    return (left > right) - (left < right);
+}
+
+Letter* find_letter(MailSystem *system, int letter_id) {
+    if (!system) {
+        return NULL;
+    }
+
+    STAT_INC(STAT_FIND_LETTER);
+    STAT_INC(STAT_FIND_LETTER_PROBES);
+    if (letter_id <= 0 || (size_t)letter_id >= system->letter_index_capacity) {
+        return NULL;
+    }
+    int slot = system->letter_index[letter_id];
+    if (slot < 0) {
+        return NULL;
+    }
+    return &system->letters[slot];
+}
+
+static int reserve_letter_index(MailSystem *system, int letter_id) {
+    if ((size_t)letter_id < system->letter_index_capacity) {
+        return 1;
+    }
+
+    size_t new_capacity = system->letter_index_capacity ? system->letter_index_capacity * 2 : 16;
+    while (new_capacity <= (size_t)letter_id) {
+        new_capacity *= 2;
+    }
+    int *new_index = (int*)resize_array(system, system->letter_index, system->letter_index_capacity * sizeof(int),
+                                        new_capacity * sizeof(int));
+    if (!new_index) {
+        return 0;
+    }
+    for (size_t i = system->letter_index_capacity; i < new_capacity; i++) {
+        new_index[i] = -1;
+    }
+    system->letter_index = new_index;
+    system->letter_index_capacity = new_capacity;
+    return 1;
+}
+
+static void shrink_letter_storage(MailSystem *system) {
+    size_t target = hysteresis_capacity(system->letters_capacity, system->letters_size, LETTER_STORE_MIN_CAPACITY);
+    if (target >= system->letters_capacity) {
+        return;
+    }
+    Letter *letters = (Letter*)resize_array(system, system->letters, system->letters_capacity * sizeof(Letter),
+                                            target * sizeof(Letter));
+    if (letters) {
+        system->letters = letters;
+        system->letters_capacity = target;
+    }
+}
+
+static int reserve_letter_storage(MailSystem *system) {
+    if (!reserve_letter_index(system, system->next_letter_id)) {
+        return 0;
+    }
+    if (system->letters_size >= system->letters_capacity) {
+        size_t new_capacity = system->letters_capacity == 0 ? LETTER_STORE_MIN_CAPACITY : system->letters_capacity * 2;
+        Letter *new_letters = (Letter*)resize_array(system, system->letters, system->letters_capacity * sizeof(Letter),
+                                                    new_capacity * sizeof(Letter));
+        if (!new_letters) {
+            return 0;
+        }
+        system->letters = new_letters;
+        system->letters_capacity = new_capacity;
+    }
+    return 1;
+}
+
+static size_t letter_admission_bytes(const MailSystem *system, const PostOffice *office, int priority) {
+    size_t bytes = 0;
+    if (system->letters_size >= system->letters_capacity) {
+        bytes += (system->letters_capacity ? system->letters_capacity : LETTER_STORE_MIN_CAPACITY) * sizeof(Letter);
+    }
+    if ((size_t)system->next_letter_id >= system->letter_index_capacity) {
+        size_t new_capacity = system->letter_index_capacity ? system->letter_index_capacity * 2 : 16;
+        while (new_capacity <= (size_t)system->next_letter_id) {
+            new_capacity *= 2;
+        }
+        bytes += (new_capacity - system->letter_index_capacity) * sizeof(int);
+    }
+    if (system->queue_kind == QUEUE_BUCKET) {
+        const BucketQueue *q = &office->letter_buckets;
+        const BucketLevel *level = q->levels ? &q->levels[bucket_level(q, priority)] : NULL;
+        if (!level) {
+            bytes += q->num_levels * sizeof(BucketLevel) + 4 * sizeof(int);
+        } else if (level->size >= level->capacity) {
+            bytes += (level->capacity ? level->capacity : 4) * sizeof(int);
+        }
+    } else if (office->letter_heap.size >= office->letter_heap.capacity) {
+        bytes += office->letter_heap.capacity ? heap_bytes(&office->letter_heap) : 2 * sizeof(int);
+    }
+    return bytes;
+}
+
+static size_t connection_growth_bytes(const PostOffice *source, const PostOffice *target) {
+    if (source->num_connections >= MAX_CONNECTIONS || office_link_index(source, target->id) >= 0) {
+        return 0;
+    }
+    size_t bytes = (source->connections ? 0 : MAX_CONNECTIONS * sizeof(int)) +
+                   (source->links ? 0 : MAX_CONNECTIONS * sizeof(LinkState));
+    if (target->num_in_connections >= target->in_connections_capacity) {
+        bytes += (target->in_connections_capacity ? target->in_connections_capacity : 4) * sizeof(int);
+    }
+    return bytes;
+}
+
+StatusCode add_letter(MailSystem *system, LetterType type, int priority, int from_office, int to_office, const char* tech_data) {
+    if (!system || !tech_data || priority < 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    trace_record(system, "letter %d %d %d %d %d %.*s\n", (int)type, priority, from_office, to_office,
+                 trace_text_length(tech_data), trace_text_length(tech_data), tech_data);
+    
+    PostOffice *from_office_ptr = find_office(system, from_office);
+    PostOffice *to_office_ptr = find_office(system, to_office);
+    if (!from_office_ptr || !to_office_ptr) {
+        return ERROR_OFFICE_NOT_FOUND;
+    }
+    size_t admission = letter_admission_bytes(system, from_office_ptr, priority);
+    if (system->auto_connect && office_link_index(from_office_ptr, to_office) < 0) {
+        admission += connection_growth_bytes(from_office_ptr, to_office_ptr) + connection_growth_bytes(to_office_ptr, from_office_ptr);
+    }
+    if (!memory_admits(system, admission)) {
+        return ERROR_MEMORY_BUDGET;
+    }
+
+    if (system->auto_connect && office_link_index(from_office_ptr, to_office) < 0) {
+        if (from_office_ptr->num_connections < MAX_CONNECTIONS && append_connection(system, from_office_ptr, to_office)) {
+            char log_msg[256];
+            sprintf(log_msg, "Auto-created connection: office %d -> office %d", from_office, to_office);
+            log_message(system, log_msg);
+        }
+        
+        if (to_office_ptr->num_connections < MAX_CONNECTIONS && office_link_index(to_office_ptr, from_office) < 0 &&
+            append_connection(system, to_office_ptr, from_office)) {
+            char log_msg[256];
+            sprintf(log_msg, "Auto-created connection: office %d -> office %d", to_office, from_office);
+            log_message(system, log_msg);
+        }
+    }
+
+    if (!reserve_letter_storage(system)) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    
+    Letter *new_letter = &system->letters[system->letters_size];
+    new_letter->id = system->next_letter_id++;
+    new_letter->type = type;
+    new_letter->state = IN_TRANSIT;
+    new_letter->priority = priority;
+    new_letter->from_office = from_office;
+    new_letter->to_office = to_office;
+    new_letter->current_office = from_office;
+    new_letter->created_tick = system->current_tick;
+    new_letter->delivered_tick = -1;
+    new_letter->hops = 0;
+    strncpy(new_letter->tech_data, tech_data, sizeof(new_letter->tech_data) - 1);
+    new_letter->tech_data[sizeof(new_letter->tech_data) - 1] = '\0';
+    
+    if (!office_has_room(from_office_ptr)) {
+        return ERROR_OFFICE_FULL;
+    }
+    
+    office_queue_push(system, from_office_ptr, new_letter->id, new_letter->priority);
+    adjust_occupancy(system, from_office_ptr, 1);
+    system->letter_index[new_letter->id] = (int)system->letters_size;
+    system->letters_size++;
+    system->state_counts[IN_TRANSIT]++;
+    schedule_letter(system, new_letter);
+    trace_letter(system, new_letter->id, from_office);
+    
+    char log_msg[256];
+    sprintf(log_msg, "Added letter %d from office %d to office %d", new_letter->id, from_office, to_office);
+    log_message(system, log_msg);
+    return SUCCESS;
+}
+
+StatusCode transfer_letter_to_office(MailSystem *system, int letter_id, int from_office_id, int to_office_id) {
+    if (!system) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    trace_record(system, "transfer %d %d %d\n", letter_id, from_office_id, to_office_id);
+    
+    PostOffice *from_office = find_office(system, from_office_id);
+    PostOffice *target_office = find_office(system, to_office_id);
+    if (!target_office) {
+        return ERROR_OFFICE_NOT_FOUND;
+    }
+    
+    if (!office_has_room(target_office)) {
+        return ERROR_OFFICE_FULL;
+    }
+    
+    Letter *letter = find_letter(system, letter_id);
+    int priority = letter ? letter->priority : 0;
+    if (from_office && office_queue_remove(system, from_office, letter_id, priority)) {
+        adjust_occupancy(system, from_office, -1);
+    }
+    
+    office_queue_push(system, target_office, letter_id, priority);
+    adjust_occupancy(system, target_office, 1);
+    
+    if (letter) {
+        wake_departed(system, letter);
+        record_hop(system, letter, to_office_id);
+    }
+    STAT_INC(STAT_TRANSFERS);
+    
+    char log_msg[256];
+    sprintf(log_msg, "Letter %d transferred from office %d to office %d", letter_id, from_office_id, to_office_id);
+    log_message(system, log_msg);
+    return SUCCESS;
+}
+
+StatusCode export_letter(MailSystem *system, int letter_id, Letter *out) {
+    if (!system || !out) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    trace_record(system, "export %d\n", letter_id);
+
+    Letter *letter = find_letter(system, letter_id);
+    if (!letter) {
+        return ERROR_INVALID_ID;
+    }
+    PostOffice *office = find_office(system, letter->current_office);
+    if (letter->state != IN_TRANSIT || !office ||
+        !office_queue_remove(system, office, letter_id, letter->priority)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    adjust_occupancy(system, office, -1);
+    *out = *letter;
+
+    size_t slot = (size_t)system->letter_index[letter_id];
+    size_t last = system->letters_size - 1;
+    if (slot != last) {
+        system->letters[slot] = system->letters[last];
+        system->letter_index[system->letters[slot].id] = (int)slot;
+    }
+    system->letter_index[letter_id] = -1;
+    system->letters_size--;
+    system->state_counts[IN_TRANSIT]--;
+
+    char log_msg[256];
+    sprintf(log_msg, "Letter %d exported from office %d", letter_id, out->current_office);
+    log_message(system, log_msg);
+    return SUCCESS;
+}
+
+StatusCode import_letter(MailSystem *system, const Letter *letter, int *letter_id) {
+    if (!system || !letter || letter->state != IN_TRANSIT || letter->priority < 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    trace_record(system, "import %d %d %d %d %d %d %d %d %d %d %.*s\n", (int)letter->type, (int)letter->state, letter->priority,
+                 letter->from_office, letter->to_office, letter->current_office, letter->created_tick, letter->hops,
+                 letter->delivered_tick, trace_text_length(letter->tech_data), trace_text_length(letter->tech_data), letter->tech_data);
+
+    PostOffice *office = find_office(system, letter->current_office);
+    if (!office) {
+        return ERROR_OFFICE_NOT_FOUND;
+    }
+    if (!office_has_room(office)) {
+        return ERROR_OFFICE_FULL;
+    }
+    if (!memory_admits(system, letter_admission_bytes(system, office, letter->priority))) {
+        return ERROR_MEMORY_BUDGET;
+    }
+    if (!reserve_letter_storage(system)) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    Letter *imported = &system->letters[system->letters_size];
+    *imported = *letter;
+    imported->id = system->next_letter_id++;
+    office_queue_push(system, office, imported->id, imported->priority);
+    adjust_occupancy(system, office, 1);
+    system->letter_index[imported->id] = (int)system->letters_size;
+    system->letters_size++;
+    system->state_counts[IN_TRANSIT]++;
+    schedule_letter(system, imported);
+    trace_letter(system, imported->id, office->id);
+    if (letter_id) {
+        *letter_id = imported->id;
+    }
+
+    char log_msg[256];
+    sprintf(log_msg, "Imported letter %d at office %d (to office %d)", imported->id, office->id, imported->to_office);
+    log_message(system, log_msg);
+    return SUCCESS;
+}
+
+typedef struct {
+    int distance;
+    int office;
+} RouteHeapEntry;
+
+static void free_routes(RoutingTable *routes) {
+    for (int r = 0; r < routes->num_rows; r++) {
+        free(routes->rows[r]);
+    }
+    free(routes->rows);
+    free(routes->row_of);
+    free(routes->row_target);
+    free(routes->offsets);
+    free(routes->sources);
+    free(routes->weights);
+    memset(routes, 0, sizeof(*routes));
+}
+
+static int compare_entries(const void *a, const void *b) {
+    int left = ((const TopologyEntry*)a)->id;
+    int right = ((const TopologyEntry*)b)->id;
+    return (left > right) - (left < right);
+}
+
+static void free_topology(TopologySnapshot *snapshot) {
+    free(snapshot->office_ids);
+    free(snapshot->by_id);
+    free(snapshot->offsets);
+    free(snapshot->targets);
+    free(snapshot->target_index);
+    free(snapshot->weights);
+    free(snapshot);
+}
+
+static TopologySnapshot* build_topology(const MailSystem *system) {
+    TopologySnapshot *snapshot = (TopologySnapshot*)calloc(1, sizeof(TopologySnapshot));
+    if (!snapshot) {
+        return NULL;
+    }
+    int count = system->office_count;
+    int num_edges = 0;
+    for (int k = 0; k < count; k++) {
+        num_edges += system->offices[k].num_connections;
+    }
+    snapshot->office_count = count;
+    snapshot->office_ids = (int*)malloc((count + 1) * sizeof(int));
+    snapshot->by_id = (TopologyEntry*)malloc((count + 1) * sizeof(TopologyEntry));
+    snapshot->offsets = (int*)malloc((count + 1) * sizeof(int));
+    snapshot->targets = (int*)malloc((num_edges + 1) * sizeof(int));
+    snapshot->target_index = (int*)malloc((num_edges + 1) * sizeof(int));
+    snapshot->weights = (int*)malloc((num_edges + 1) * sizeof(int));
+    if (!snapshot->office_ids || !snapshot->by_id || !snapshot->offsets || !snapshot->targets ||
+        !snapshot->target_index || !snapshot->weights) {
+        free_topology(snapshot);
+        return NULL;
+    }
+
+    snapshot->offsets[0] = 0;
+    for (int k = 0; k < count; k++) {
+        const PostOffice *office = &system->offices[k];
+        int first = snapshot->offsets[k];
+        snapshot->office_ids[k] = office->id;
+        snapshot->by_id[k].id = office->id;
+        snapshot->by_id[k].index = k;
+        for (int j = 0; j < office->num_connections; j++) {
+            const PostOffice *target = find_office(system, office->connections[j]);
+            snapshot->targets[first + j] = office->connections[j];
+            snapshot->target_index[first + j] = target ? (int)(target - system->offices) : -1;
+            snapshot->weights[first + j] = office->links[j].weight;
+        }
+        snapshot->offsets[k + 1] = first + office->num_connections;
+    }
+    qsort(snapshot->by_id, count, sizeof(TopologyEntry), compare_entries);
+    return snapshot;
+}
+
+static int snapshot_index(const TopologySnapshot *snapshot, int office_id, int hint) {
+    if (hint >= 0 && hint < snapshot->office_count && snapshot->office_ids[hint] == office_id) {
+        return hint;
+    }
+    TopologyEntry key = {office_id, 0};
+    const TopologyEntry *found = (const TopologyEntry*)bsearch(&key, snapshot->by_id, snapshot->office_count,
+                                                               sizeof(TopologyEntry), compare_entries);
+    return found ? found->index : -1;
+}
+
+static void reclaim_topology(MailSystem *system, int force) {
+    unsigned long long oldest = ULLONG_MAX;
+    for (int i = 0; i < TOPOLOGY_READER_SLOTS; i++) {
+        unsigned long long announced = __atomic_load_n(&system->topology_readers[i], __ATOMIC_SEQ_CST);
+        if (announced != 0 && announced - 1 < oldest) {
+            oldest = announced - 1;
+        }
+    }
+
+    TopologySnapshot **link = &system->retired_topology;
+    while (*link) {
+        TopologySnapshot *snapshot = *link;
+        if (force || snapshot->epoch < oldest) {
+            *link = snapshot->next_retired;
+            free_topology(snapshot);
+        } else {
+            link = &snapshot->next_retired;
+        }
+    }
+}
+
+static TopologySnapshot* publish_topology(MailSystem *system) {
+    if (system->topology && !system->topology_dirty) {
+        return system->topology;
+    }
+    TopologySnapshot *snapshot = build_topology(system);
+    if (!snapshot) {
+        return NULL;
+    }
+    snapshot->epoch = system->topology_epoch + 1;
+    TopologySnapshot *previous = __atomic_exchange_n(&system->topology, snapshot, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&system->topology_epoch, snapshot->epoch, __ATOMIC_SEQ_CST);
+    if (previous) {
+        previous->next_retired = system->retired_topology;
+        system->retired_topology = previous;
+    }
+    system->topology_dirty = 0;
+    return snapshot;
+}
+
+static TopologySnapshot* routing_topology(MailSystem *system) {
+    return system->engine_topology ? system->engine_topology : publish_topology(system);
+}
+
+size_t apply_topology_changes(MailSystem *system) {
+    if (!system) {
+        return 0;
+    }
+
+    topology_lock(system);
+    TopologyChange *changes = system->topology_changes;
+    size_t count = system->topology_changes_size;
+    system->topology_changes = NULL;
+    system->topology_changes_size = 0;
+    system->topology_changes_capacity = 0;
+    topology_unlock(system);
+
+    size_t applied = 0;
+    for (size_t i = 0; i < count; i++) {
+        const TopologyChange *change = &changes[i];
+        StatusCode status = ERROR_INVALID_PARAMETER;
+        switch (change->kind) {
+            case TOPOLOGY_ADD_OFFICE:
+                status = add_office(system, change->office_id, change->capacity, change->connections, change->num_connections);
+                break;
+            case TOPOLOGY_REMOVE_OFFICE:
+                status = remove_office(system, change->office_id);
+                break;
+            case TOPOLOGY_ADD_CONNECTION:
+                status = add_connection(system, change->office_id, change->target_id, change->weight);
+                break;
+            case TOPOLOGY_REMOVE_CONNECTION:
+                status = remove_connection(system, change->office_id, change->target_id);
+                break;
+        }
+        if (status == SUCCESS) {
+            applied++;
+        } else {
+            char log_msg[256];
+            sprintf(log_msg, "Topology change for office %d rejected (status %d)", change->office_id, status);
+            log_message(system, log_msg);
+        }
+        free(change->connections);
+    }
+    free(changes);
+
+    publish_topology(system);
+    reclaim_topology(system, 0);
+    return applied;
+}
+
+TopologySnapshot* acquire_topology(MailSystem *system, int *slot) {
+    if (slot) {
+        *slot = -1;
+    }
+    if (!system || !slot) {
+        return NULL;
+    }
+    for (int i = 0; i < TOPOLOGY_READER_SLOTS; i++) {
+        unsigned long long idle = 0;
+        if (!__atomic_compare_exchange_n(&system->topology_readers[i], &idle, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        unsigned long long epoch = __atomic_load_n(&system->topology_epoch, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&system->topology_readers[i], epoch + 1, __ATOMIC_SEQ_CST);
+        TopologySnapshot *snapshot = __atomic_load_n(&system->topology, __ATOMIC_SEQ_CST);
+        if (!snapshot) {
+            __atomic_store_n(&system->topology_readers[i], 0, __ATOMIC_RELEASE);
+            return NULL;
+        }
+        *slot = i;
+        return snapshot;
+    }
+    return NULL;
+}
+
+void release_topology(MailSystem *system, int slot) {
+    if (system && slot >= 0 && slot < TOPOLOGY_READER_SLOTS) {
+        __atomic_store_n(&system->topology_readers[slot], 0, __ATOMIC_RELEASE);
+    }
+}
+
+const int* topology_neighbours(const TopologySnapshot *snapshot, int office_id, int *count) {
+    if (count) {
+        *count = 0;
+    }
+    if (!snapshot) {
+        return NULL;
+    }
+    int index = snapshot_index(snapshot, office_id, -1);
+    if (index < 0) {
+        return NULL;
+    }
+    if (count) {
+        *count = snapshot->offsets[index + 1] - snapshot->offsets[index];
+    }
+    return &snapshot->targets[snapshot->offsets[index]];
+}
+
+// the distance cache is engine-private and tagged with the snapshot epoch, so published snapshots stay read-only
+static int build_routes(MailSystem *system, const TopologySnapshot *snapshot) {
+    RoutingTable *routes = &system->routes;
+    free_routes(routes);
+    int count = snapshot->office_count;
+    int num_edges = snapshot->offsets[count];
+    routes->offsets = (int*)calloc(count + 1, sizeof(int));
+    routes->sources = (int*)malloc((num_edges + 1) * sizeof(int));
+    routes->weights = (int*)malloc((num_edges + 1) * sizeof(int));
+    routes->row_of = (int*)malloc((count + 1) * sizeof(int));
+    routes->row_target = (int*)malloc(ROUTE_CACHE_ROWS * sizeof(int));
+    routes->rows = (int**)calloc(ROUTE_CACHE_ROWS, sizeof(int*));
+    if (!routes->offsets || !routes->sources || !routes->weights || !routes->row_of || !routes->row_target || !routes->rows) {
+        free_routes(routes);
+        return 0;
+    }
+
+    for (int e = 0; e < num_edges; e++) {
+        if (snapshot->target_index[e] >= 0) {
+            routes->offsets[snapshot->target_index[e] + 1]++;
+        }
+    }
+    for (int k = 0; k < count; k++) {
+        routes->offsets[k + 1] += routes->offsets[k];
+        routes->row_of[k] = routes->offsets[k];
+    }
+    for (int k = 0; k < count; k++) {
+        for (int e = snapshot->offsets[k]; e < snapshot->offsets[k + 1]; e++) {
+            int target = snapshot->target_index[e];
+            if (target >= 0) {
+                int edge = routes->row_of[target]++;
+                routes->sources[edge] = k;
+                routes->weights[edge] = snapshot->weights[e];
+            }
+        }
+    }
+    for (int k = 0; k < count; k++) {
+        routes->row_of[k] = -1;
+    }
+    routes->office_count = count;
+    routes->epoch = snapshot->epoch;
+    routes->valid = 1;
+    return 1;
+}
+
+static RoutingTable* snapshot_routes(MailSystem *system, const TopologySnapshot *snapshot) {
+    RoutingTable *routes = &system->routes;
+    if ((!routes->valid || routes->epoch != snapshot->epoch) && !build_routes(system, snapshot)) {
+        return NULL;
+    }
+    return routes;
+}
+
+static void route_heap_push(RouteHeapEntry *heap, int *size, RouteHeapEntry entry) {
+    int index = (*size)++;
+    while (index > 0 && heap[(index - 1) / 2].distance > entry.distance) {
+        heap[index] = heap[(index - 1) / 2];
+        index = (index - 1) / 2;
+    }
+    heap[index] = entry;
+}
+
+static RouteHeapEntry route_heap_pop(RouteHeapEntry *heap, int *size) {
+    RouteHeapEntry top = heap[0];
+    RouteHeapEntry last = heap[--(*size)];
+    int index = 0;
+    while (2 * index + 1 < *size) {
+        int child = 2 * index + 1;
+        if (child + 1 < *size && heap[child + 1].distance < heap[child].distance) {
+            child++;
+        }
+        if (heap[child].distance >= last.distance) {
+            break;
+        }
+        heap[index] = heap[child];
+        index = child;
+    }
+    if (*size > 0) {
+        heap[index] = last;
+    }
+    return top;
+}
+
+static int fill_route_row(const RoutingTable *routes, int destination, int *distances) {
+    RouteHeapEntry *heap = (RouteHeapEntry*)malloc((routes->offsets[routes->office_count] + 1) * sizeof(RouteHeapEntry));
+    if (!heap) {
+        return 0;
+    }
+    for (int k = 0; k < routes->office_count; k++) {
+        distances[k] = INT_MAX;
+    }
+    int size = 0;
+    distances[destination] = 0;
+    RouteHeapEntry start = {0, destination};
+    route_heap_push(heap, &size, start);
+    while (size > 0) {
+        RouteHeapEntry entry = route_heap_pop(heap, &size);
+        if (entry.distance != distances[entry.office]) {
+            continue;
+        }
+        for (int e = routes->offsets[entry.office]; e < routes->offsets[entry.office + 1]; e++) {
+            int source = routes->sources[e];
+            if (routes->weights[e] > INT_MAX - entry.distance - 1) {
+                continue;
+            }
+            int distance = entry.distance + routes->weights[e];
+            if (distance < distances[source]) {
+                distances[source] = distance;
+                RouteHeapEntry next = {distance, source};
+                route_heap_push(heap, &size, next);
+            }
+        }
+    }
+    free(heap);
+    return 1;
+}
+
+static int claim_route_row(RoutingTable *routes) {
+    if (routes->num_rows < ROUTE_CACHE_ROWS) {
+        routes->rows[routes->num_rows] = (int*)malloc((routes->office_count + 1) * sizeof(int));
+        if (!routes->rows[routes->num_rows]) {
+            return -1;
+        }
+        return routes->num_rows++;
+    }
+    int row = routes->next_victim;
+    routes->next_victim = (row + 1) % ROUTE_CACHE_ROWS;
+    routes->row_of[routes->row_target[row]] = -1;
+    return row;
+}
+
+static const int* route_row(MailSystem *system, const TopologySnapshot *snapshot, int target) {
+    RoutingTable *routes = target >= 0 ? snapshot_routes(system, snapshot) : NULL;
+    if (!routes) {
+        return NULL;
+    }
+    if (routes->row_of[target] >= 0) {
+        return routes->rows[routes->row_of[target]];
+    }
+
+    int row = claim_route_row(routes);
+    if (row < 0 || !fill_route_row(routes, target, routes->rows[row])) {
+        return NULL;
+    }
+    routes->row_of[target] = row;
+    routes->row_target[row] = target;
+    return routes->rows[row];
+}
+
+typedef struct {
+    const RoutingTable *routes;
+    const int *targets;
+    int **rows;
+} RouteRowFill;
+
+static void fill_route_rows(void *context, size_t begin, size_t end) {
+    RouteRowFill *fill = (RouteRowFill*)context;
+    for (size_t i = begin; i < end; i++) {
+        fill->rows[i] = (int*)malloc((fill->routes->office_count + 1) * sizeof(int));
+        if (fill->rows[i] && !fill_route_row(fill->routes, fill->targets[i], fill->rows[i])) {
+            free(fill->rows[i]);
+            fill->rows[i] = NULL;
+        }
+    }
+}
+
+static void prefetch_route_rows(MailSystem *system, const int *letter_ids, int count) {
+    TopologySnapshot *snapshot = system->routing == ROUTING_FLAT ? routing_topology(system) : NULL;
+    RoutingTable *routes = snapshot ? snapshot_routes(system, snapshot) : NULL;
+    if (!routes) {
+        return;
+    }
+
+    unsigned char *wanted = (unsigned char*)calloc(routes->office_count + 1, 1);
+    int *targets = (int*)malloc(ROUTE_CACHE_ROWS * sizeof(int));
+    int **rows = (int**)calloc(ROUTE_CACHE_ROWS, sizeof(int*));
+    int num_targets = 0;
+    for (int i = 0; wanted && targets && rows && i < count && num_targets < ROUTE_CACHE_ROWS; i++) {
+        const Letter *letter = find_letter(system, letter_ids[i]);
+        PostOffice *destination = letter ? find_office(system, letter->to_office) : NULL;
+        if (!destination || letter->current_office == letter->to_office) {
+            continue;
+        }
+        int target = snapshot_index(snapshot, destination->id, (int)(destination - system->offices));
+        if (target >= 0 && routes->row_of[target] < 0 && !wanted[target]) {
+            wanted[target] = 1;
+            targets[num_targets++] = target;
+        }
+    }
+
+    if (num_targets > 1) {
+        RouteRowFill fill = {routes, targets, rows};
+        executor_for(system->executor, (size_t)num_targets, 1, fill_route_rows, &fill);
+        for (int i = 0; i < num_targets; i++) {
+            int row = rows[i] ? claim_route_row(routes) : -1;
+            if (row < 0) {
+                free(rows[i]);
+                continue;
+            }
+            free(routes->rows[row]);
+            routes->rows[row] = rows[i];
+            routes->row_of[targets[i]] = row;
+            routes->row_target[row] = targets[i];
+        }
+    }
+    free(wanted);
+    free(targets);
+    free(rows);
+}
+
+static void free_region_tables(RegionalRoutes *regions) {
+    for (int r = 0; r < regions->num_regions; r++) {
+        free(regions->tables[r].offices);
+        free(regions->tables[r].distances);
+        free(regions->tables[r].gateways);
+        free(regions->tables[r].exits);
+    }
+    free(regions->tables);
+    free(regions->region_of);
+    free(regions->local_index);
+    free(regions->region_distances);
+    free(regions->region_next);
+    free(regions->row_epoch);
+    memset(regions, 0, sizeof(*regions));
+}
+
+static int add_distances(int a, int b) {
+    if (a == INT_MAX || b == INT_MAX || a > INT_MAX - 1 - b) {
+        return INT_MAX;
+    }
+    return a + b;
+}
+
+static void partition_regions(MailSystem *system, int *queue) {
+    int count = system->office_count;
+    int region_size = 1;
+    while (region_size * region_size < count) {
+        region_size++;
+    }
+    int next_region = 0;
+    for (int k = 0; k < count; k++) {
+        if (system->offices[k].auto_region >= next_region) {
+            next_region = system->offices[k].auto_region + 1;
+        }
+    }
+
+    for (int k = 0; k < count; k++) {
+        if (system->offices[k].region >= 0 || system->offices[k].auto_region >= 0) {
+            continue;
+        }
+        int head = 0, tail = 0, members = 1;
+        system->offices[k].auto_region = next_region;
+        queue[tail++] = k;
+        while (head < tail && members < region_size) {
+            const PostOffice *office = &system->offices[queue[head++]];
+            for (int pass = 0; pass < 2 && members < region_size; pass++) {
+                const int *edges = pass == 0 ? office->connections : office->in_connections;
+                int num_edges = pass == 0 ? office->num_connections : office->num_in_connections;
+                for (int j = 0; j < num_edges && members < region_size; j++) {
+                    PostOffice *next = find_office(system, edges[j]);
+                    if (next && next->region < 0 && next->auto_region < 0) {
+                        next->auto_region = next_region;
+                        queue[tail++] = (int)(next - system->offices);
+                        members++;
+                    }
+                }
+            }
+        }
+        next_region++;
+    }
+    system->regions.next_auto_region = next_region;
+}
+
+static int region_label(const PostOffice *office) {
+    return office->region >= 0 ? office->region : -2 - office->auto_region;
+}
+
+static int build_regions(MailSystem *system) {
+    RegionalRoutes *regions = &system->regions;
+    free_region_tables(regions);
+    int count = system->office_count;
+    int *ids = (int*)malloc((count + 1) * sizeof(int));
+    regions->region_of = (int*)malloc((count + 1) * sizeof(int));
+    regions->local_index = (int*)malloc((count + 1) * sizeof(int));
+    if (!ids || !regions->region_of || !regions->local_index) {
+        free(ids);
+        free_region_tables(regions);
+        return 0;
+    }
+
+    regions->office_capacity = count;
+    partition_regions(system, ids);
+    for (int k = 0; k < count; k++) {
+        ids[k] = region_label(&system->offices[k]);
+    }
+    qsort(ids, count, sizeof(int), compare_ints);
+    int num_regions = 0;
+    for (int k = 0; k < count; k++) {
+        if (num_regions == 0 || ids[num_regions - 1] != ids[k]) {
+            ids[num_regions++] = ids[k];
+        }
+    }
+    regions->tables = (RegionTable*)calloc(num_regions + 1, sizeof(RegionTable));
+    if (!regions->tables) {
+        free(ids);
+        free_region_tables(regions);
+        return 0;
+    }
+    regions->num_regions = num_regions;
+
+    for (int k = 0; k < count; k++) {
+        int label = region_label(&system->offices[k]);
+        const int *found = (const int*)bsearch(&label, ids, num_regions, sizeof(int), compare_ints);
+        regions->region_of[k] = (int)(found - ids);
+        regions->local_index[k] = regions->tables[regions->region_of[k]].num_offices++;
+    }
+    for (int r = 0; r < num_regions; r++) {
+        regions->tables[r].label = ids[r];
+        regions->tables[r].capacity = regions->tables[r].num_offices;
+    }
+    free(ids);
+    for (int r = 0; r < num_regions; r++) {
+        regions->tables[r].offices = (int*)malloc(regions->tables[r].num_offices * sizeof(int));
+        if (!regions->tables[r].offices) {
+            free_region_tables(regions);
+            return 0;
+        }
+    }
+    for (int k = 0; k < count; k++) {
+        regions->tables[regions->region_of[k]].offices[regions->local_index[k]] = k;
+    }
+    regions->region_distances = (int*)malloc(((size_t)num_regions * num_regions + 1) * sizeof(int));
+    regions->region_next = (int*)malloc(((size_t)num_regions * num_regions + 1) * sizeof(int));
+    regions->row_epoch = (int*)malloc((num_regions + 1) * sizeof(int));
+    if (!regions->region_distances || !regions->region_next || !regions->row_epoch) {
+        free_region_tables(regions);
+        return 0;
+    }
+    for (int r = 0; r < num_regions; r++) {
+        regions->row_epoch[r] = -1;
+    }
+    regions->valid = 1;
+    return 1;
+}
+
+static int ensure_region_intra(MailSystem *system, int region) {
+    RegionalRoutes *regions = &system->regions;
+    RegionTable *table = &regions->tables[region];
+    if (table->intra_valid) {
+        return 1;
+    }
+    int n = table->num_offices;
+    int num_edges = 0;
+    for (int i = 0; i < n; i++) {
+        num_edges += system->offices[table->offices[i]].num_connections;
+    }
+    int *distances = (int*)realloc(table->distances, (size_t)n * n * sizeof(int));
+    RouteHeapEntry *heap = (RouteHeapEntry*)malloc((num_edges + 1) * sizeof(RouteHeapEntry));
+    if (distances) {
+        table->distances = distances;
+    }
+    if (!distances || !heap) {
+        free(heap);
+        return 0;
+    }
+
+    for (int source = 0; source < n; source++) {
+        int *row = &table->distances[(size_t)source * n];
+        for (int i = 0; i < n; i++) {
+            row[i] = INT_MAX;
+        }
+        int size = 0;
+        row[source] = 0;
+        RouteHeapEntry start = {0, source};
+        route_heap_push(heap, &size, start);
+        while (size > 0) {
+            RouteHeapEntry entry = route_heap_pop(heap, &size);
+            if (entry.distance != row[entry.office]) {
+                continue;
+            }
+            const PostOffice *office = &system->offices[table->offices[entry.office]];
+            for (int j = 0; j < office->num_connections; j++) {
+                const PostOffice *next = find_office(system, office->connections[j]);
+                if (!next || regions->region_of[next - system->offices] != region) {
+                    continue;
+                }
+                int local = regions->local_index[next - system->offices];
+                int distance = add_distances(entry.distance, office->links[j].weight);
+                if (distance < row[local]) {
+                    row[local] = distance;
+                    RouteHeapEntry queued = {distance, local};
+                    route_heap_push(heap, &size, queued);
+                }
+            }
+        }
+    }
+    free(heap);
+    table->intra_valid = 1;
+    return 1;
+}
+
+static int ensure_region_exits(MailSystem *system, int region) {
+    RegionalRoutes *regions = &system->regions;
+    RegionTable *table = &regions->tables[region];
+    if (table->exits_valid) {
+        return 1;
+    }
+    table->num_exits = 0;
+    int capacity = 0;
+    for (int i = 0; i < table->num_offices; i++) {
+        capacity += system->offices[table->offices[i]].num_connections;
+    }
+    int *exits = (int*)realloc(table->exits, (size_t)(capacity + 1) * 3 * sizeof(int));
+    if (!exits) {
+        return 0;
+    }
+    table->exits = exits;
+    for (int i = 0; i < table->num_offices; i++) {
+        const PostOffice *office = &system->offices[table->offices[i]];
+        for (int j = 0; j < office->num_connections; j++) {
+            const PostOffice *next = find_office(system, office->connections[j]);
+            if (next && regions->region_of[next - system->offices] != region) {
+                int *exit = &table->exits[table->num_exits++ * 3];
+                exit[0] = i;
+                exit[1] = (int)(next - system->offices);
+                exit[2] = office->links[j].weight;
+            }
+        }
+    }
+    table->exits_valid = 1;
+    return 1;
+}
+
+static int ensure_region_row(MailSystem *system, int region) {
+    RegionalRoutes *regions = &system->regions;
+    if (regions->row_epoch[region] == regions->distances_epoch) {
+        return 1;
+    }
+    int num_regions = regions->num_regions;
+    int *distances = &regions->region_distances[(size_t)region * num_regions];
+    int *next = &regions->region_next[(size_t)region * num_regions];
+    int num_edges = 0;
+    for (int r = 0; r < num_regions; r++) {
+        if (!ensure_region_exits(system, r)) {
+            return 0;
+        }
+        num_edges += regions->tables[r].num_exits;
+    }
+    RouteHeapEntry *heap = (RouteHeapEntry*)malloc((num_edges + 1) * sizeof(RouteHeapEntry));
+    int *previous = (int*)malloc((num_regions + 1) * sizeof(int));
+    if (!heap || !previous) {
+        free(heap);
+        free(previous);
+        return 0;
+    }
+    memcpy(previous, next, num_regions * sizeof(int));
+    for (int r = 0; r < num_regions; r++) {
+        distances[r] = INT_MAX;
+        next[r] = -1;
+    }
+
+    int size = 0;
+    distances[region] = 0;
+    next[region] = region;
+    RouteHeapEntry start = {0, region};
+    route_heap_push(heap, &size, start);
+    while (size > 0) {
+        RouteHeapEntry entry = route_heap_pop(heap, &size);
+        if (entry.distance != distances[entry.office]) {
+            continue;
+        }
+        const RegionTable *table = &regions->tables[entry.office];
+        for (int e = 0; e < table->num_exits; e++) {
+            int to = regions->region_of[table->exits[e * 3 + 1]];
+            int distance = add_distances(entry.distance, table->exits[e * 3 + 2]);
+            if (distance < distances[to]) {
+                distances[to] = distance;
+                next[to] = entry.office == region ? to : next[entry.office];
+                RouteHeapEntry queued = {distance, to};
+                route_heap_push(heap, &size, queued);
+            }
+        }
+    }
+    free(heap);
+    if (regions->row_epoch[region] < 0 || memcmp(previous, next, num_regions * sizeof(int)) != 0) {
+        regions->tables[region].gateway_valid = 0;
+    }
+    free(previous);
+    regions->row_epoch[region] = regions->distances_epoch;
+    return 1;
+}
+
+static int ensure_region_gateways(MailSystem *system, int region) {
+    RegionalRoutes *regions = &system->regions;
+    RegionTable *table = &regions->tables[region];
+    if (!ensure_region_row(system, region) || !ensure_region_intra(system, region) || !ensure_region_exits(system, region)) {
+        return 0;
+    }
+    if (table->gateway_valid) {
+        return 1;
+    }
+    int n = table->num_offices;
+    int num_regions = regions->num_regions;
+    int *gateways = (int*)realloc(table->gateways, (size_t)n * num_regions * sizeof(int));
+    if (!gateways) {
+        return 0;
+    }
+    table->gateways = gateways;
+    for (int i = 0; i < n * num_regions; i++) {
+        gateways[i] = INT_MAX;
+    }
+    const int *next = &regions->region_next[(size_t)region * num_regions];
+    for (int e = 0; e < table->num_exits; e++) {
+        const int *exit = &table->exits[e * 3];
+        int entered = regions->region_of[exit[1]];
+        for (int target = 0; target < num_regions; target++) {
+            if (target == region || next[target] != entered) {
+                continue;
+            }
+            for (int v = 0; v < n; v++) {
+                int distance = add_distances(table->distances[(size_t)v * n + exit[0]], exit[2]);
+                if (distance < gateways[v * num_regions + target]) {
+                    gateways[v * num_regions + target] = distance;
+                }
+            }
+        }
+    }
+    table->gateway_valid = 1;
+    return 1;
+}
+
+static int regional_estimate(MailSystem *system, const PostOffice *office, const PostOffice *next_office, const PostOffice *destination) {
+    RegionalRoutes *regions = &system->regions;
+    if (!destination || (!regions->valid && !build_regions(system))) {
+        return INT_MAX;
+    }
+    int num_regions = regions->num_regions;
+    int region = regions->region_of[office - system->offices];
+    int next_region = regions->region_of[next_office - system->offices];
+    int target_region = regions->region_of[destination - system->offices];
+    int next_local = regions->local_index[next_office - system->offices];
+
+    if (region == target_region) {
+        if (next_region != target_region || !ensure_region_intra(system, target_region)) {
+            return INT_MAX;
+        }
+        const RegionTable *table = &regions->tables[target_region];
+        return table->distances[(size_t)next_local * table->num_offices + regions->local_index[destination - system->offices]];
+    }
+
+    if (!ensure_region_row(system, region)) {
+        return INT_MAX;
+    }
+    const int *distances = &regions->region_distances[(size_t)region * num_regions];
+    int hop = regions->region_next[(size_t)region * num_regions + target_region];
+    if (hop < 0) {
+        return INT_MAX;
+    }
+    int remaining = distances[target_region] - distances[hop];
+    if (next_region == hop) {
+        return remaining;
+    }
+    if (next_region != region || !ensure_region_gateways(system, region)) {
+        return INT_MAX;
+    }
+    return add_distances(regions->tables[region].gateways[next_local * num_regions + target_region], remaining);
+}
+
+int route_distance(MailSystem *system, int from_office, int to_office) {
+    if (!system) {
+        return -1;
+    }
+    PostOffice *from = find_office(system, from_office);
+    PostOffice *to = find_office(system, to_office);
+    if (!from || !to) {
+        return -1;
+    }
+
+    int distance;
+    if (system->routing == ROUTING_REGIONAL) {
+        distance = regional_estimate(system, from, from, to);
+    } else {
+        TopologySnapshot *snapshot = routing_topology(system);
+        const int *distances = snapshot ? route_row(system, snapshot, snapshot_index(snapshot, to->id, (int)(to - system->offices))) : NULL;
+        int source = distances ? snapshot_index(snapshot, from->id, (int)(from - system->offices)) : -1;
+        distance = source >= 0 ? distances[source] : INT_MAX;
+    }
+    return distance == INT_MAX ? -1 : distance;
+}
+
+StatusCode set_office_region(MailSystem *system, int office_id, int region) {
+    if (!system || region < 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    trace_record(system, "region %d %d\n", office_id, region);
+    PostOffice *office = find_office(system, office_id);
+    if (!office) {
+        return ERROR_OFFICE_NOT_FOUND;
+    }
+    office->region = region;
+    system->regions.valid = 0;
+    return SUCCESS;
+}
+
+static int link_has_capacity(const MailSystem *system, const LinkState *link) {
+    return link->used_tick != system->current_tick || link->used < link->bandwidth;
+}
+
+static int next_hop_link(MailSystem *system, PostOffice *office, const Letter *letter, int use_bandwidth) {
+    TopologySnapshot *snapshot = routing_topology(system);
+    int source = snapshot ? snapshot_index(snapshot, office->id, (int)(office - system->offices)) : -1;
+    if (source < 0) {
+        return -1;
+    }
+    PostOffice *destination = find_office(system, letter->to_office);
+    const int *distances = system->routing == ROUTING_FLAT && destination ?
+        route_row(system, snapshot, snapshot_index(snapshot, destination->id, (int)(destination - system->offices))) : NULL;
+    int first = snapshot->offsets[source];
+    int best_link = -1;
+    int best_cost = INT_MAX;
+    int best_room = -1;
+    for (int e = first; e < snapshot->offsets[source + 1]; e++) {
+        int j = e - first;
+        if (j >= office->num_connections || office->connections[j] != snapshot->targets[e]) {
+            continue;
+        }
+        if (use_bandwidth && !link_has_capacity(system, &office->links[j])) {
+            continue;
+        }
+        PostOffice *next_office = find_office(system, snapshot->targets[e]);
+        if (!next_office || next_office == office || !office_has_room(next_office)) {
+            continue;
+        }
+        if (next_office->id == letter->to_office) {
+            return j;
+        }
+        int remaining = INT_MAX;
+        if (system->routing == ROUTING_REGIONAL) {
+            remaining = regional_estimate(system, office, next_office, destination);
+        } else if (distances && snapshot->target_index[e] >= 0) {
+            remaining = distances[snapshot->target_index[e]];
+        }
+        int cost = add_distances(remaining, snapshot->weights[e]);
+        int room = next_office->capacity - next_office->current_letters;
+        if (best_link < 0 || cost < best_cost || (cost == best_cost && room > best_room)) {
+            best_link = j;
+            best_cost = cost;
+            best_room = room;
+        }
+    }
+    return best_link;
+}
+
+static void begin_tick(MailSystem *system, TickKind kind) {
+    trace_record(system, "tick %s\n", tick_kind_name(kind));
+    system->trace_depth++;
+    if (system->profile_ticks) {
+        memset(system->tick_phases, 0, sizeof(system->tick_phases));
+        system->phase_mark = stats_now_ns();
+    }
+    system->current_tick++;
+    apply_topology_changes(system);
+    system->engine_topology = acquire_topology(system, &system->engine_topology_slot);
+    mark_phase(system, TICK_PHASE_TOPOLOGY);
+}
+
+static void finish_tick(MailSystem *system) {
+    mark_phase(system, TICK_PHASE_TRANSFER);
+    release_topology(system, system->engine_topology_slot);
+    system->engine_topology = NULL;
+    system->engine_topology_slot = -1;
+    if (system->retire_interval > 0 && system->current_tick % system->retire_interval == 0) {
+        retire_letters(system);
+    }
+    if (system->status_view) {
+        status_view_publish(system->status_view, system);
+    }
+    mark_phase(system, TICK_PHASE_FINISH);
+    system->trace_depth--;
+}
+
+typedef struct {
+    MailSystem *system;
+    const QueueChunk *chunks;
+    int *best;
+} BestLetterScan;
+
+static void scan_best_letters(void *context, size_t begin, size_t end) {
+    BestLetterScan *scan = (BestLetterScan*)context;
+    for (size_t c = begin; c < end; c++) {
+        const QueueChunk *chunk = &scan->chunks[c];
+        const Heap *heap = &scan->system->offices[chunk->office].letter_heap;
+        Letter *best = best_letter_in(scan->system, heap->data + chunk->begin, chunk->end - chunk->begin, NULL);
+        scan->best[c] = best ? best->id : 0;
+    }
+}
+
+static int* plan_best_letters(MailSystem *system) {
+    if (!system->executor || system->queue_kind != QUEUE_HEAP || system->office_count == 0) {
+        return NULL;
+    }
+
+    QueueChunk *chunks;
+    size_t num_chunks = build_queue_chunks(system, &chunks);
+    int *chunk_best = (int*)malloc((num_chunks + 1) * sizeof(int));
+    int *planned = (int*)calloc(system->office_count, sizeof(int));
+    int *planned_letters = (int*)malloc(system->office_count * sizeof(int));
+    if (!chunk_best || !planned || !planned_letters) {
+        free(chunks);
+        free(chunk_best);
+        free(planned);
+        free(planned_letters);
+        return NULL;
+    }
+
+    BestLetterScan scan = {system, chunks, chunk_best};
+    executor_for(system->executor, num_chunks, chunk_grain(system, num_chunks), scan_best_letters, &scan);
+    for (size_t c = 0; c < num_chunks; c++) {
+        Letter *candidate = find_letter(system, chunk_best[c]);
+        int office = chunks[c].office;
+        if (candidate && letter_before(candidate, find_letter(system, planned[office]))) {
+            planned[office] = candidate->id;
+        }
+    }
+
+    int num_planned = 0;
+    for (int k = 0; k < system->office_count; k++) {
+        if (planned[k] > 0) {
+            planned_letters[num_planned++] = planned[k];
+        }
+    }
+    prefetch_route_rows(system, planned_letters, num_planned);
+    free(chunks);
+    free(chunk_best);
+    free(planned_letters);
+    return planned;
+}
+
+void process_letters_transfer(MailSystem *system) {
+    if (!system) {
+        return;
+    }
+    STAT_TIMER_START(tick_start);
+    begin_tick(system, TICK_PROCESS_TRANSFER);
     
-    if (num_conn > 0) {
-        new_office->connections = (int*)malloc(num_conn * sizeof(int));
-        if (!new_office->connections) {
-            delete_heap(&new_office->letter_heap);
-            free(new_office);
-            return ERROR_MEMORY_ALLOCATION;
+    int *planned = plan_best_letters(system);
+    mark_phase(system, TICK_PHASE_PLAN);
+    unsigned char *received = planned ? (unsigned char*)calloc(system->office_count, 1) : NULL;
+    for (int k = system->office_count - 1; k >= 0; k--) {
+        PostOffice *office = &system->offices[k];
+        Letter *letter = received && !received[k] ? find_letter(system, planned[k]) : office_queue_best(system, office);
+        if (!letter || !office_queue_remove(system, office, letter->id, letter->priority)) {
+            continue;
+        }
+        int letter_id = letter->id;
+        adjust_occupancy(system, office, -1);
+        
+        if (letter->to_office == office->id) {
+            record_delivery(system, letter);
+            
+            char log_msg[256];
+            sprintf(log_msg, "Letter %d delivered to office %d", letter_id, office->id);
+            log_message(system, log_msg);
+        } else {
+            int transferred = 0;
+            int link_index = next_hop_link(system, office, letter, 0);
+            if (link_index >= 0 &&
+                transfer_letter_to_office(system, letter_id, office->id, office->connections[link_index]) == SUCCESS) {
+                transferred = 1;
+                if (received) {
+                    received[find_office(system, office->connections[link_index]) - system->offices] = 1;
+                }
+            }
+            if (!transferred) {
+                office_queue_push(system, office, letter_id, letter->priority);
+                adjust_occupancy(system, office, 1);
+            }
+        }
+    }
+    free(planned);
+    free(received);
+    finish_tick(system);
+    STAT_TICK_END(TICK_PROCESS_TRANSFER, tick_start);
+}
+
+static int dispatch_priority_letter(MailSystem *system, PostOffice *current_office, Letter *letter) {
+    if (letter->to_office == current_office->id) {
+        if (!office_queue_remove(system, current_office, letter->id, letter->priority)) {
+            return 0;
+        }
+        record_delivery(system, letter);
+        adjust_occupancy(system, current_office, -1);
+        
+        char log_msg[256];
+        sprintf(log_msg, "Letter %d delivered to office %d (priority: %d)", letter->id, current_office->id, letter->priority);
+        log_message(system, log_msg);
+        return 1;
+    }
+
+    int link_index = next_hop_link(system, current_office, letter, 0);
+    PostOffice *best_next_office = link_index >= 0 ? find_office(system, current_office->connections[link_index]) : NULL;
+
+    if (!best_next_office || !office_queue_remove(system, current_office, letter->id, letter->priority)) {
+        return 0;
+    }
+    office_queue_push(system, best_next_office, letter->id, letter->priority);
+    adjust_occupancy(system, current_office, -1);
+    adjust_occupancy(system, best_next_office, 1);
+    record_hop(system, letter, best_next_office->id);
+    
+    char log_msg[256];
+    sprintf(log_msg, "Letter %d transferred from %d to %d (priority: %d)", letter->id, current_office->id, best_next_office->id, letter->priority);
+    log_message(system, log_msg);
+    STAT_INC(STAT_TRANSFERS);
+    return 1;
+}
+
+static void transfer_priority_buckets(MailSystem *system) {
+    unsigned long long occupied = 0;
+    for (int k = 0; k < system->office_count; k++) {
+        PostOffice *office = &system->offices[k];
+        occupied |= office->letter_buckets.occupied;
+    }
+
+    while (occupied) {
+        int level = BUCKET_QUEUE_MAX_LEVELS - 1 - __builtin_ctzll(occupied);
+        occupied &= occupied - 1;
+        for (int k = 0; k < system->office_count; k++) {
+            PostOffice *office = &system->offices[k];
+            const BucketLevel *bucket = office->letter_buckets.levels ? &office->letter_buckets.levels[level] : NULL;
+            for (size_t i = 0; bucket && i < bucket->size; i++) {
+                Letter *letter = find_letter(system, bucket->data[(bucket->head + i) % bucket->capacity]);
+                if (letter && letter->state == IN_TRANSIT && dispatch_priority_letter(system, office, letter)) {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+static void transfer_priority_heaps(MailSystem *system) {
+    OfficeTournament *t = &system->tournament;
+    if (!tournament_begin(system)) {
+        return;
+    }
+    mark_phase(system, TICK_PHASE_PLAN);
+
+    int k;
+    while (t->valid && (k = t->winners[1]) >= 0) {
+        Letter *letter = find_letter(system, t->head_ids[k]);
+        if (letter && letter->state == IN_TRANSIT && dispatch_priority_letter(system, &system->offices[k], letter)) {
+            break;
+        }
+        tournament_advance(system, k);
+    }
+    tournament_end_walk(t);
+}
+
+static void transfer_scheduled(MailSystem *system) {
+    Scheduler *scheduler = &system->scheduler;
+    if (scheduler->rebuild && !schedule_rebuild(system)) {
+        log_message(system, "Scheduler rebuild failed, falling back to strict priority");
+        if (system->queue_kind == QUEUE_BUCKET) {
+            transfer_priority_buckets(system);
+        } else {
+            transfer_priority_heaps(system);
+        }
+        return;
+    }
+    if (scheduler->wake_all) {
+        scheduler->wake_all = 0;
+        for (int k = 0; scheduler->num_parked > 0 && k < system->office_count; k++) {
+            unpark_office(system, &system->offices[k]);
+        }
+    }
+    schedule_purge(system);
+    mark_phase(system, TICK_PHASE_PLAN);
+
+    ScheduleEntry *deferred = NULL;
+    size_t deferred_size = 0;
+    size_t deferred_capacity = 0;
+    int cls;
+    while ((cls = schedule_pick_class(scheduler)) >= 0) {
+        ScheduleEntry entry = schedule_pop(&scheduler->classes[cls]);
+        Letter *letter = find_letter(system, entry.letter_id);
+        if (!letter || letter->state != IN_TRANSIT) {
+            continue;
+        }
+
+        PostOffice *office = find_office(system, letter->current_office);
+        if (office && dispatch_priority_letter(system, office, letter)) {
+            scheduler->virtual_time = scheduler->virtual_finish[cls];
+            scheduler->virtual_finish[cls] += WFQ_SCALE / scheduler->weights[cls];
+            if (letter->state == IN_TRANSIT && !schedule_push(&scheduler->classes[cls], entry)) {
+                scheduler->rebuild = 1;
+            }
+            break;
+        }
+        if (office && schedule_park(system, office, entry)) {
+            continue;
+        }
+
+        if (deferred_size >= deferred_capacity) {
+            size_t new_capacity = deferred_capacity == 0 ? 16 : deferred_capacity * 2;
+            ScheduleEntry *new_deferred = (ScheduleEntry*)realloc(deferred, new_capacity * sizeof(ScheduleEntry));
+            if (!new_deferred) {
+                if (!schedule_push(&scheduler->classes[cls], entry)) {
+                    scheduler->rebuild = 1;
+                }
+                break;
+            }
+            deferred = new_deferred;
+            deferred_capacity = new_capacity;
+        }
+        deferred[deferred_size++] = entry;
+    }
+
+    for (size_t i = 0; i < deferred_size; i++) {
+        const Letter *letter = find_letter(system, deferred[i].letter_id);
+        if (!schedule_push(&scheduler->classes[schedule_class(scheduler, letter)], deferred[i])) {
+            scheduler->rebuild = 1;
+        }
+    }
+    free(deferred);
+}
+
+void transfer_priority_letters(MailSystem *system) {
+    if (!system) {
+        return;
+    }
+    STAT_TIMER_START(tick_start);
+    begin_tick(system, TICK_PRIORITY_TRANSFER);
+
+    if (system->scheduler.policy != POLICY_STRICT_PRIORITY) {
+        transfer_scheduled(system);
+    } else if (system->queue_kind == QUEUE_BUCKET) {
+        transfer_priority_buckets(system);
+    } else {
+        transfer_priority_heaps(system);
+    }
+    finish_tick(system);
+    STAT_TICK_END(TICK_PRIORITY_TRANSFER, tick_start);
+}
+
+static int in_flight_before(const InFlightLetter *a, const InFlightLetter *b) {
+    if (a->arrival_tick != b->arrival_tick) {
+        return a->arrival_tick < b->arrival_tick;
+    }
+    return a->letter_id < b->letter_id;
+}
+
+static int in_flight_push(InFlightQueue *q, InFlightLetter entry) {
+    if (q->size >= q->capacity) {
+        size_t new_capacity = q->capacity == 0 ? 16 : q->capacity * 2;
+        InFlightLetter *new_entries = (InFlightLetter*)realloc(q->entries, new_capacity * sizeof(InFlightLetter));
+        if (!new_entries) {
+            return 0;
+        }
+        q->entries = new_entries;
+        q->capacity = new_capacity;
+    }
+    size_t index = q->size++;
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!in_flight_before(&entry, &q->entries[parent])) {
+            break;
+        }
+        q->entries[index] = q->entries[parent];
+        index = parent;
+    }
+    q->entries[index] = entry;
+    return 1;
+}
+
+static InFlightLetter in_flight_pop(InFlightQueue *q) {
+    InFlightLetter top = q->entries[0];
+    InFlightLetter last = q->entries[--q->size];
+    size_t index = 0;
+    while (1) {
+        size_t child = 2 * index + 1;
+        if (child >= q->size) {
+            break;
+        }
+        if (child + 1 < q->size && in_flight_before(&q->entries[child + 1], &q->entries[child])) {
+            child++;
+        }
+        if (!in_flight_before(&q->entries[child], &last)) {
+            break;
+        }
+        q->entries[index] = q->entries[child];
+        index = child;
+    }
+    if (q->size > 0) {
+        q->entries[index] = last;
+    }
+    return top;
+}
+
+static void land_arrivals(MailSystem *system) {
+    InFlightQueue *q = &system->in_flight;
+    while (q->size > 0 && q->entries[0].arrival_tick <= system->current_tick) {
+        InFlightLetter arrival = in_flight_pop(q);
+        Letter *letter = find_letter(system, arrival.letter_id);
+        if (!letter || letter->state != IN_TRANSIT) {
+            continue;
+        }
+
+        PostOffice *office = resolve_office(system, arrival.to_handle);
+        if (!office && (office = find_office(system, arrival.to_office)) != NULL) {
+            // the office was removed and re-added while the letter was in flight, so the new one was never charged
+            adjust_occupancy(system, office, 1);
         }
-        
-        for (int i = 0; i < num_conn; i++) {
-            new_office->connections[i] = connections[i];
-            new_office->num_connections++;
-            
-            PostOffice *target_office = find_office(system, connections[i]);
-            if (target_office && target_office->num_connections < MAX_CONNECTIONS) {
-                int connection_exists = 0;
-                for (int j = 0; j < target_office->num_connections; j++) {
-                    if (target_office->connections[j] == id) {
-                        connection_exists = 1;
-                        break;
-                    }
-                }
-                
-                if (!connection_exists) {
-                    if (!target_office->connections) {
-                        target_office->connections = (int*)malloc(MAX_CONNECTIONS * sizeof(int));
-                    }
-                    target_office->connections[target_office->num_connections++] = id;
-                }
-            }
+        if (!office) {
+            set_letter_state(system, letter, UNDELIVERED);
+            char log_msg[256];
+            sprintf(log_msg, "Letter %d marked as undeliverable (office %d removed while in flight)", letter->id, arrival.to_office);
+            log_message(system, log_msg);
+            continue;
         }
-    } else {
-        new_office->connections = NULL;
+        office_queue_push(system, office, letter->id, letter->priority);
+        wake_departed(system, letter);
+        record_hop(system, letter, office->id);
     }
-    
+}
+
+static int send_on_link(MailSystem *system, PostOffice *office, int link_index, Letter *letter) {
+    LinkState *link = &office->links[link_index];
+    InFlightLetter entry;
+    entry.arrival_tick = system->current_tick + (link->latency > 0 ? link->latency : 1);
+    entry.letter_id = letter->id;
+    entry.to_office = office->connections[link_index];
+    entry.to_handle = get_office_handle(system, entry.to_office);
+    PostOffice *target = resolve_office(system, entry.to_handle);
+    if (!target || !in_flight_push(&system->in_flight, entry)) {
+        return 0;
+    }
+
+    if (link->used_tick != system->current_tick) {
+        link->used_tick = system->current_tick;
+        link->used = 0;
+    }
+    link->used++;
+    adjust_occupancy(system, target, 1);
+    STAT_INC(STAT_TRANSFERS);
+
     char log_msg[256];
-    sprintf(log_msg, "Added office %d with capacity %d", id, capacity);
+    sprintf(log_msg, "Letter %d sent from office %d to office %d (arrives at tick %d)", letter->id, office->id, entry.to_office, entry.arrival_tick);
     log_message(system, log_msg);
-    return SUCCESS;
+    return 1;
 }
 
-StatusCode remove_office(MailSystem *system, int office_id) {
-    if (!system) {
-        return ERROR_INVALID_ID;
-    }
-    
-    PostOffice **prev = &system->offices;
-    PostOffice *current = system->offices;
-    
-    while (current) {
-        if (current->id == office_id) {
-            while (!is_empty_heap(&current->letter_heap)) {
-                int letter_id = pop_heap(&current->letter_heap);
-                Letter *letter = find_letter(system, letter_id);
-                if (letter) {
-                    if (letter->from_office == office_id || letter->to_office == office_id) {
-                        letter->state = UNDELIVERED;
-                        char log_msg[256];
-                        sprintf(log_msg, "Letter %d marked as undeliverable (office %d removed)", letter_id, office_id);
-                        log_message(system, log_msg);
-                    } else {
-                        int transferred = 0;
-                        for (int i = 0; i < current->num_connections && !transferred; i++) {
-                            int target_id = current->connections[i];
-                            if (transfer_letter_to_office(system, letter_id, office_id, target_id) == SUCCESS) {
-                                transferred = 1;
-                            }
-                        }
-                        if (!transferred) {
-                            letter->state = UNDELIVERED;
-                            char log_msg[256];
-                            sprintf(log_msg, "Letter %d marked as undeliverable (no route after office removal)", letter_id);
-                            log_message(system, log_msg);
-                        }
-                    }
-                }
+static void serve_office(MailSystem *system, PostOffice *office) {
+    int blocked[SERVICE_BATCH];
+    int urgent[SERVICE_BATCH];
+    int num_blocked = 0;
+    int served = 0;
+    int done = 0;
+
+    while (!done && served < office->service_rate && num_blocked < SERVICE_BATCH) {
+        int want = office->service_rate - served < SERVICE_BATCH ? office->service_rate - served : SERVICE_BATCH;
+        size_t count = collect_urgent_letters(system, office, urgent, (size_t)want);
+        if (count == 0) {
+            break;
+        }
+
+        for (size_t i = 0; i < count && num_blocked < SERVICE_BATCH; i++, served++) {
+            Letter *letter = find_letter(system, urgent[i]);
+            if (!letter || !office_queue_remove(system, office, letter->id, letter->priority)) {
+                done = 1;
+                break;
             }
-            PostOffice *other_office = system->offices;
-            while (other_office) {
-                if (other_office->id != office_id) {
-                    for (int i = 0; i < other_office->num_connections; i++) {
-                        if (other_office->connections[i] == office_id) {
-                            for (int j = i; j < other_office->num_connections - 1; j++) {
-                                other_office->connections[j] = other_office->connections[j + 1];
-                            }
-                            other_office->num_connections--;
-                            
-                            if (other_office->num_connections > 0) {
-                                int *new_connections = (int*)realloc(other_office->connections, other_office->num_connections * sizeof(int));
-                                if (new_connections) {
-                                    other_office->connections = new_connections;
-                                }
-                            } else {
-                                free(other_office->connections);
-                                other_office->connections = NULL;
-                            }
-                            break;
-                        }
-                    }
-                }
-                other_office = other_office->next;
+            adjust_occupancy(system, office, -1);
+
+            if (letter->to_office == office->id) {
+                record_delivery(system, letter);
+                
+                char log_msg[256];
+                sprintf(log_msg, "Letter %d delivered to office %d", letter->id, office->id);
+                log_message(system, log_msg);
+                continue;
             }
 
-            *prev = current->next;
-            delete_heap(&current->letter_heap);
-            free(current->connections);
-            free(current);
-            
-            char log_msg[256];
-            sprintf(log_msg, "Removed office %d", office_id);
-            log_message(system, log_msg);
-            return SUCCESS;
+            int link_index = next_hop_link(system, office, letter, 1);
+            if (link_index < 0 || !send_on_link(system, office, link_index, letter)) {
+                blocked[num_blocked++] = letter->id;
+            }
         }
-        prev = &current->next;
-        current = current->next;
     }
-    return ERROR_OFFICE_NOT_FOUND;
+
+    for (int i = 0; i < num_blocked; i++) {
+        Letter *letter = find_letter(system, blocked[i]);
+        office_queue_push(system, office, blocked[i], letter->priority);
+        adjust_occupancy(system, office, 1);
+    }
 }
 
-Letter* find_letter(MailSystem *system, int letter_id) {
+static void rebuild_active_offices(MailSystem *system) {
+    ActiveOffices *active = &system->active_offices;
+    active->size = 0;
+    active->valid = 1;
+    for (int k = 0; k < system->office_count; k++) {
+        PostOffice *office = &system->offices[k];
+        office->active = 0;
+        if (office_queue_size(system, office) > 0) {
+            mark_office_active(system, office);
+        }
+    }
+}
+
+void process_network_tick(MailSystem *system) {
     if (!system) {
-        return NULL;
+        return;
     }
+    STAT_TIMER_START(tick_start);
+    begin_tick(system, TICK_NETWORK_TRANSFER);
 
-    for (size_t i = 0; i < system->letters_size; i++) {
-        if (system->letters[i].id == letter_id) {
-            return &system->letters[i];
+    land_arrivals(system);
+    ActiveOffices *active = &system->active_offices;
+    if (!active->valid) {
+        rebuild_active_offices(system);
+    }
+    if (!active->valid) {
+        for (int k = 0; k < system->office_count; k++) {
+            serve_office(system, &system->offices[k]);
+        }
+    } else {
+        int count = active->size;
+        int kept = 0;
+        for (int i = 0; i < count; i++) {
+            OfficeHandle handle = active->handles[i];
+            PostOffice *office = resolve_office(system, handle);
+            if (!office) {
+                continue;
+            }
+            serve_office(system, office);
+            if (office_queue_size(system, office) > 0) {
+                active->handles[kept++] = handle;
+            } else {
+                office->active = 0;
+            }
         }
+        memmove(active->handles + kept, active->handles + count, (active->size - count) * sizeof(OfficeHandle));
+        active->size = kept + (active->size - count);
     }
-    return NULL;
+    finish_tick(system);
+    STAT_TICK_END(TICK_NETWORK_TRANSFER, tick_start);
 }
 
-StatusCode add_letter(MailSystem *system, LetterType type, int priority, int from_office, int to_office, const char* tech_data) {
-    if (!system || priority < 0 || !tech_data) {
+StatusCode set_office_service_rate(MailSystem *system, int office_id, int service_rate) {
+    if (!system || service_rate <= 0) {
         return ERROR_INVALID_PARAMETER;
     }
-    
-    PostOffice *from_office_ptr = find_office(system, from_office);
-    PostOffice *to_office_ptr = find_office(system, to_office);
-    if (!from_office_ptr || !to_office_ptr) {
+    trace_record(system, "service_rate %d %d\n", office_id, service_rate);
+
+    PostOffice *office = find_office(system, office_id);
+    if (!office) {
         return ERROR_OFFICE_NOT_FOUND;
     }
+    office->service_rate = service_rate;
+    return SUCCESS;
+}
+
+StatusCode set_link_properties(MailSystem *system, int from_office, int to_office, int bandwidth, int latency) {
+    if (!system || bandwidth <= 0 || latency <= 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    trace_record(system, "link %d %d %d %d\n", from_office, to_office, bandwidth, latency);
 
-    int connection_exists = 0;
-    for (int i = 0; i < from_office_ptr->num_connections; i++) {
-        if (from_office_ptr->connections[i] == to_office) {
-            connection_exists = 1;
-            break;
+    PostOffice *office = find_office(system, from_office);
+    if (!office) {
+        return ERROR_OFFICE_NOT_FOUND;
+    }
+    int link_index = office_link_index(office, to_office);
+    if (link_index < 0) {
+        return ERROR_OFFICE_NOT_FOUND;
+    }
+    office->links[link_index].bandwidth = bandwidth;
+    office->links[link_index].latency = latency;
+    return SUCCESS;
+}
+
+static void archive_rewind_spill(LetterArchive *archive, long committed) {
+    fclose(archive->spill_file);
+    archive->spill_file = NULL;
+    if (committed < 0 || truncate(archive->spill_path, committed) != 0) {
+        return;
+    }
+    FILE *file = fopen(archive->spill_path, "r+b");
+    if (file && fseek(file, 0, SEEK_END) != 0) {
+        fclose(file);
+        file = NULL;
+    }
+    archive->spill_file = file;
+}
+
+static StatusCode archive_spill(LetterArchive *archive) {
+    if (!archive->spill_file || archive->size == 0) {
+        return SUCCESS;
+    }
+    long committed = ftell(archive->spill_file);
+    StatusCode status = archive_write_block(archive->spill_file, archive->letters, archive->size);
+    if (status != SUCCESS) {
+        archive_rewind_spill(archive, committed);
+        return status;
+    }
+    archive->spilled += archive->size;
+    archive->size = 0;
+    return SUCCESS;
+}
+
+static StatusCode archive_append(LetterArchive *archive, const Letter *letter) {
+    if (archive->size >= archive->capacity) {
+        size_t new_capacity = archive->capacity == 0 ? 64 : archive->capacity * 2;
+        Letter *new_letters = (Letter*)realloc(archive->letters, new_capacity * sizeof(Letter));
+        if (!new_letters) {
+            return ERROR_MEMORY_ALLOCATION;
         }
+        archive->letters = new_letters;
+        archive->capacity = new_capacity;
     }
-    
-    if (!connection_exists) {
-        if (from_office_ptr->num_connections < MAX_CONNECTIONS) {
-            if (!from_office_ptr->connections) {
-                from_office_ptr->connections = (int*)malloc(MAX_CONNECTIONS * sizeof(int));
+    archive->letters[archive->size++] = *letter;
+    archive->retired_counts[letter->state]++;
+    return SUCCESS;
+}
+
+size_t retire_letters(MailSystem *system) {
+    if (!system) {
+        return 0;
+    }
+    trace_record(system, "retire\n");
+
+    LetterArchive *archive = &system->archive;
+    StatusCode spill_status = SUCCESS;
+    size_t kept = 0;
+    size_t retired = 0;
+    for (size_t i = 0; i < system->letters_size; i++) {
+        Letter *letter = &system->letters[i];
+        if (letter->state == IN_TRANSIT || archive_append(archive, letter) != SUCCESS) {
+            if (kept != i) {
+                system->letters[kept] = *letter;
+                system->letter_index[system->letters[kept].id] = (int)kept;
             }
-            from_office_ptr->connections[from_office_ptr->num_connections++] = to_office;
-            
-            char log_msg[256];
-            sprintf(log_msg, "Auto-created connection: office %d -> office %d", from_office, to_office);
-            log_message(system, log_msg);
+            kept++;
+            continue;
         }
-        
-        if (to_office_ptr->num_connections < MAX_CONNECTIONS) {
-            int reverse_connection_exists = 0;
-            for (int i = 0; i < to_office_ptr->num_connections; i++) {
-                if (to_office_ptr->connections[i] == from_office) {
-                    reverse_connection_exists = 1;
-                    break;
-                }
-            }
-            
-            if (!reverse_connection_exists) {
-                if (!to_office_ptr->connections) {
-                    to_office_ptr->connections = (int*)malloc(MAX_CONNECTIONS * sizeof(int));
-                }
-                to_office_ptr->connections[to_office_ptr->num_connections++] = from_office;
-                
-                char log_msg[256];
-                sprintf(log_msg, "Auto-created connection: office %d -> office %d", to_office, from_office);
-                log_message(system, log_msg);
-            }
+        system->letter_index[letter->id] = -1;
+        retired++;
+        if (spill_status == SUCCESS && archive->spill_threshold > 0 && archive->size >= archive->spill_threshold) {
+            spill_status = archive_spill(archive);
         }
     }
+    system->letters_size = kept;
+    shrink_letter_storage(system);
 
-    if (system->letters_size >= system->letters_capacity) {
-        size_t new_capacity = system->letters_capacity == 0 ? 10 : system->letters_capacity * 2;
-        Letter *new_letters = (Letter*)realloc(system->letters, new_capacity * sizeof(Letter));
-        if (!new_letters) {
-            return ERROR_MEMORY_ALLOCATION;
+    char log_msg[256];
+    if (spill_status != SUCCESS) {
+        sprintf(log_msg, "Archive spill failed (%d), %zu retired letters kept in memory", spill_status, archive->size);
+        log_message(system, log_msg);
+    }
+    if (retired > 0) {
+        sprintf(log_msg, "Retired %zu letters, %zu letters remain live", retired, kept);
+        log_message(system, log_msg);
+    }
+    return retired;
+}
+
+static size_t compact_heap(MailSystem *system, Heap *heap) {
+    size_t target = hysteresis_capacity(heap->capacity, heap->size, INITIAL_CAPACITY);
+    size_t before = heap_bytes(heap);
+    if (target >= heap->capacity || !heap_resize(heap, target)) {
+        return 0;
+    }
+    size_t released = before - heap_bytes(heap);
+    system->queue_bytes -= released;
+    return released;
+}
+
+static size_t compact_buckets(MailSystem *system, BucketQueue *q) {
+    size_t released = 0;
+    for (int i = 0; q->levels && i < q->num_levels; i++) {
+        BucketLevel *level = &q->levels[i];
+        if (level->size == 0 && level->capacity > 0) {
+            released += level->capacity * sizeof(int);
+            free(level->data);
+            level->data = NULL;
+            level->head = 0;
+            level->capacity = 0;
         }
-        system->letters = new_letters;
-        system->letters_capacity = new_capacity;
     }
-    
-    Letter *new_letter = &system->letters[system->letters_size];
-    new_letter->id = system->next_letter_id++;
-    new_letter->type = type;
-    new_letter->state = IN_TRANSIT;
-    new_letter->priority = priority;
-    new_letter->from_office = from_office;
-    new_letter->to_office = to_office;
-    new_letter->current_office = from_office;
-    strncpy(new_letter->tech_data, tech_data, sizeof(new_letter->tech_data) - 1);
-    new_letter->tech_data[sizeof(new_letter->tech_data) - 1] = '\0';
-    
-    if (from_office_ptr->current_letters >= from_office_ptr->capacity) {
-        return ERROR_OFFICE_FULL;
+    system->queue_bytes -= released;
+    return released;
+}
+
+size_t compact_system(MailSystem *system) {
+    if (!system) {
+        return 0;
     }
-    
-    push_heap(&from_office_ptr->letter_heap, new_letter->id);
-    from_office_ptr->current_letters++;
-    system->letters_size++;
-    
+    trace_record(system, "compact\n");
+
+    size_t released = 0;
+    for (int k = 0; k < system->office_count; k++) {
+        PostOffice *office = &system->offices[k];
+        released += system->queue_kind == QUEUE_BUCKET ? compact_buckets(system, &office->letter_buckets) :
+                                                         compact_heap(system, &office->letter_heap);
+    }
+
+    size_t letter_capacity = system->letters_capacity;
+    shrink_letter_storage(system);
+    released += (letter_capacity - system->letters_capacity) * sizeof(Letter);
+
+    InFlightQueue *in_flight = &system->in_flight;
+    size_t in_flight_capacity = hysteresis_capacity(in_flight->capacity, in_flight->size, 16);
+    if (in_flight_capacity < in_flight->capacity) {
+        InFlightLetter *entries = (InFlightLetter*)realloc(in_flight->entries, in_flight_capacity * sizeof(InFlightLetter));
+        if (entries) {
+            released += (in_flight->capacity - in_flight_capacity) * sizeof(InFlightLetter);
+            in_flight->entries = entries;
+            in_flight->capacity = in_flight_capacity;
+        }
+    }
+
+    if (system->tournament.winners) {
+        released += system->tournament.leaves * (6 * sizeof(int) + 1 + sizeof(TournamentCursor));
+        free_tournament(&system->tournament);
+    }
+
     char log_msg[256];
-    sprintf(log_msg, "Added letter %d from office %d to office %d", new_letter->id, from_office, to_office);
+    sprintf(log_msg, "Compacted system, released %zu bytes", released);
     log_message(system, log_msg);
-    return SUCCESS;
+    return released;
 }
 
-StatusCode transfer_letter_to_office(MailSystem *system, int letter_id, int from_office_id, int to_office_id) {
+StatusCode set_archive_spill(MailSystem *system, const char *path, size_t threshold) {
     if (!system) {
         return ERROR_INVALID_PARAMETER;
     }
-    
-    PostOffice *from_office = find_office(system, from_office_id);
-    PostOffice *target_office = find_office(system, to_office_id);
-    if (!target_office) {
-        return ERROR_OFFICE_NOT_FOUND;
+
+    LetterArchive *archive = &system->archive;
+    if (archive->spilled > 0) {
+        return ERROR_INVALID_PARAMETER;
     }
-    
-    if (target_office->current_letters >= target_office->capacity) {
-        return ERROR_OFFICE_FULL;
+    if (archive->spill_file) {
+        fclose(archive->spill_file);
+        archive->spill_file = NULL;
     }
-    
-    if (from_office && remove_letter_from_heap(&from_office->letter_heap, letter_id)) {
-        from_office->current_letters--;
+    free(archive->spill_path);
+    archive->spill_path = NULL;
+    archive->spill_threshold = 0;
+    if (!path) {
+        return SUCCESS;
     }
-    
-    push_heap(&target_office->letter_heap, letter_id);
-    target_office->current_letters++;
-    
-    Letter *letter = find_letter(system, letter_id);
-    if (letter) {
-        letter->current_office = to_office_id;
+
+    archive->spill_path = (char*)malloc(strlen(path) + 1);
+    if (!archive->spill_path) {
+        return ERROR_MEMORY_ALLOCATION;
     }
-    
-    char log_msg[256];
-    sprintf(log_msg, "Letter %d transferred from office %d to office %d", letter_id, from_office_id, to_office_id);
-    log_message(system, log_msg);
-    return SUCCESS;
+    strcpy(archive->spill_path, path);
+    archive->spill_file = archive_writer_open(path);
+    if (!archive->spill_file) {
+        free(archive->spill_path);
+        archive->spill_path = NULL;
+        return ERROR_FILE_OPERATION;
+    }
+    archive->spill_threshold = threshold > 0 ? threshold : 1;
+    return archive->size >= archive->spill_threshold ? archive_spill(archive) : SUCCESS;
 }
 
-void process_letters_transfer(MailSystem *system) {
-    if (!system) {
-        return;
+StatusCode set_worker_threads(MailSystem *system, int num_threads) {
+    if (!system || num_threads < 1 || num_threads > EXECUTOR_MAX_THREADS) {
+        return ERROR_INVALID_PARAMETER;
     }
-    
-    PostOffice *office = system->offices;
-    while (office) {
-        Heap temp_heap = create_heap(office->letter_heap.capacity);
-        int *letter_ids = NULL;
-        int *letter_priorities = NULL;
-        size_t count = 0;
-        
-        while (!is_empty_heap(&office->letter_heap)) {
-            int letter_id = pop_heap(&office->letter_heap);
-            Letter *letter = find_letter(system, letter_id);
-            
-            if (letter) {
-                int *temp_ids = realloc(letter_ids, (count + 1) * sizeof(int));
-                if (!temp_ids) {
-                    free(letter_priorities);
-                    free(letter_ids);
-                    return;
-                }
-                letter_ids = temp_ids;
-                int *temp_priorities = realloc(letter_priorities, (count + 1) * sizeof(int));
-                if (!temp_priorities) {
-                    free(letter_ids);
-                    free(letter_priorities);
-                    return;
-                }
-                letter_priorities = temp_priorities;
-                letter_ids[count] = letter_id;
-                letter_priorities[count] = letter->priority;
-                count++;
-            }
-            push_heap(&temp_heap, letter_id);
-        }
 
-        while (!is_empty_heap(&temp_heap)) {
-            push_heap(&office->letter_heap, pop_heap(&temp_heap));
-        }
-        delete_heap(&temp_heap);
-        sort_by_priority(letter_ids, letter_priorities, NULL, count);
-        for (size_t i = 0; i < count; i++) {
-            int letter_id = letter_ids[i];
-            Letter *letter = find_letter(system, letter_id);
-            
-            if (!letter || letter->state != IN_TRANSIT) {
-                continue;
-            }
-            if (!remove_letter_from_heap(&office->letter_heap, letter_id)) {
-                continue;
-            }
-            office->current_letters--;
-            
-            if (letter->to_office == office->id) {
-                letter->state = DELIVERED;
-                push_heap(&office->letter_heap, letter_id);
-                office->current_letters++;
-                
-                char log_msg[256];
-                sprintf(log_msg, "Letter %d delivered to office %d", letter_id, office->id);
-                log_message(system, log_msg);
-            } else {
-                int transferred = 0;
-                
-                PostOffice *target_office = find_office(system, letter->to_office);
-                if (target_office && target_office->current_letters < target_office->capacity) {
-                    if (transfer_letter_to_office(system, letter_id, office->id, letter->to_office) == SUCCESS) {
-                        transferred = 1;
-                    }
-                }
+    executor_destroy(system->executor);
+    system->executor = NULL;
+    if (num_threads == 1) {
+        return SUCCESS;
+    }
+    system->executor = executor_create(num_threads);
+    return system->executor ? SUCCESS : ERROR_MEMORY_ALLOCATION;
+}
 
-                if (!transferred && office->num_connections > 0) {
-                    for (int j = 0; j < office->num_connections && !transferred; j++) {
-                        int next_office_id = office->connections[j];
-                        PostOffice *next_office = find_office(system, next_office_id);
-                        
-                        if (next_office && next_office->current_letters < next_office->capacity) {
-                            if (transfer_letter_to_office(system, letter_id, office->id, next_office_id) == SUCCESS) {
-                                transferred = 1;
-                            }
-                        }
-                    }
-                }
-                if (!transferred) {
-                    push_heap(&office->letter_heap, letter_id);
-                    office->current_letters++;
-                }
-            }
-            break;
-        }
-        free(letter_ids);
-        free(letter_priorities);
-        office = office->next;
+StatusCode set_memory_budget(MailSystem *system, size_t bytes) {
+    if (!system) {
+        return ERROR_INVALID_PARAMETER;
     }
+    trace_record(system, "budget %zu\n", bytes);
+    system->memory_budget = bytes;
+    return SUCCESS;
 }
 
-void transfer_priority_letters(MailSystem *system) {
+StatusCode enable_status_view(MailSystem *system, const char *name) {
     if (!system) {
-        return;
+        return ERROR_INVALID_PARAMETER;
     }
 
-    int total_letters = 0;
-    int max_letters = system->letters_size * 2;
-    int *all_letter_ids = malloc(max_letters * sizeof(int));
-    int *all_letter_priorities = malloc(max_letters * sizeof(int));
-    PostOffice **letter_offices = malloc(max_letters * sizeof(PostOffice*));
-    
-    if (!all_letter_ids || !all_letter_priorities || !letter_offices) {
-        free(all_letter_ids);
-        free(all_letter_priorities);
-        free(letter_offices);
-        return;
+    if (system->status_view) {
+        status_view_close(system->status_view);
+        free(system->status_view);
+        system->status_view = NULL;
+    }
+    if (!name) {
+        return SUCCESS;
+    }
+
+    StatusView *view = (StatusView*)malloc(sizeof(StatusView));
+    if (!view) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    StatusCode status = status_view_create(view, name, system->office_count);
+    if (status != SUCCESS) {
+        free(view);
+        return status;
     }
+    system->status_view = view;
+    status_view_publish(view, system);
 
-    PostOffice *office = system->offices;
-    while (office) {
-        Heap temp_heap = create_heap(office->letter_heap.capacity);
+    char log_msg[256];
+    sprintf(log_msg, "Publishing status view to %s", name);
+    log_message(system, log_msg);
+    return SUCCESS;
+}
 
-        while (!is_empty_heap(&office->letter_heap)) {
-            int letter_id = pop_heap(&office->letter_heap);
-            Letter *letter = find_letter(system, letter_id);
-            
-            if (letter && letter->state == IN_TRANSIT) {
-                all_letter_ids[total_letters] = letter_id;
-                all_letter_priorities[total_letters] = letter->priority;
-                letter_offices[total_letters] = office;
-                total_letters++;
-            }
-            push_heap(&temp_heap, letter_id);
-        }
+StatusCode enable_trace_capture(MailSystem *system, const char *path) {
+    if (!system) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (system->trace_file) {
+        fclose(system->trace_file);
+        system->trace_file = NULL;
+    }
+    if (!path) {
+        return SUCCESS;
+    }
+    if (system->office_count > 0 || system->next_letter_id != 1 || system->current_tick != 0 ||
+        system->topology_changes_size > 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
 
-        while (!is_empty_heap(&temp_heap)) {
-            push_heap(&office->letter_heap, pop_heap(&temp_heap));
-        }
-        delete_heap(&temp_heap);
-        office = office->next;
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return ERROR_FILE_OPERATION;
     }
+    fprintf(file, "%s %d\n", TRACE_MAGIC, TRACE_VERSION);
+    fprintf(file, "config queue=%s max_priority=%d policy=%s aging=%d weights=%d,%d deadlines=%d,%d "
+            "service_rate=%d bandwidth=%d latency=%d auto_connect=%d routing=%s retire=%d threads=%d\n",
+            queue_kind_name(system->queue_kind),
+            system->queue_kind == QUEUE_BUCKET ? system->queue_levels - 1 : DEFAULT_MAX_PRIORITY,
+            scheduling_policy_name(system->scheduler.policy), system->scheduler.aging_ticks,
+            system->scheduler.weights[REGULAR], system->scheduler.weights[URGENT],
+            system->scheduler.deadline_ticks[REGULAR], system->scheduler.deadline_ticks[URGENT],
+            system->service_rate, system->link_bandwidth, system->link_latency, system->auto_connect,
+            routing_mode_name(system->routing), system->retire_interval, executor_threads(system->executor));
+    if (system->memory_budget > 0) {
+        fprintf(file, "budget %zu\n", system->memory_budget);
+    }
+    system->trace_file = file;
 
-    sort_by_priority(all_letter_ids, all_letter_priorities, letter_offices, total_letters);
-    int letters_processed = 0;
-    int max_to_process = 1;
-    
-    for (int i = 0; i < total_letters && letters_processed < max_to_process; i++) {
-        int letter_id = all_letter_ids[i];
-        PostOffice *current_office = letter_offices[i];
-        Letter *letter = find_letter(system, letter_id);
-        
-        if (!letter || letter->state != IN_TRANSIT) {
-            continue;
-        }
-        if (!remove_letter_from_heap(&current_office->letter_heap, letter_id)) {
-            continue;
-        }
+    char log_msg[256];
+    sprintf(log_msg, "Capturing trace to %s", path);
+    log_message(system, log_msg);
+    return SUCCESS;
+}
 
-        if (letter->to_office == current_office->id) {
-            letter->state = DELIVERED;
-            current_office->current_letters--;
-            
-            char log_msg[256];
-            sprintf(log_msg, "Letter %d delivered to office %d (priority: %d)", letter->id, current_office->id, letter->priority);
-            log_message(system, log_msg);
-            letters_processed++;
-            continue;
-        }
+void record_trace_seed(MailSystem *system, unsigned long long seed) {
+    if (system) {
+        trace_record(system, "seed %llu\n", seed);
+    }
+}
 
-        PostOffice *best_next_office = NULL;
-        int best_score = -1;
+StatusCode find_archived_letter(MailSystem *system, int letter_id, Letter *out) {
+    if (!system || !out) {
+        return ERROR_INVALID_PARAMETER;
+    }
 
-        PostOffice *target_office = find_office(system, letter->to_office);
-        if (target_office && target_office->current_letters < target_office->capacity) {
-            best_next_office = target_office;
-            best_score = 1000;
+    LetterArchive *archive = &system->archive;
+    for (size_t i = 0; i < archive->size; i++) {
+        if (archive->letters[i].id == letter_id) {
+            *out = archive->letters[i];
+            return SUCCESS;
         }
+    }
+    if (archive->spilled == 0 || !archive->spill_path) {
+        return ERROR_INVALID_ID;
+    }
 
-        if (!best_next_office) {
-            for (int j = 0; j < current_office->num_connections; j++) {
-                int next_office_id = current_office->connections[j];
-                PostOffice *next_office = find_office(system, next_office_id);
-                
-                if (next_office && next_office->current_letters < next_office->capacity) {
-                    int score = 0;
-
-                    for (int k = 0; k < next_office->num_connections; k++) {
-                        if (next_office->connections[k] == letter->to_office) {
-                            score += 100;
-                            break;
-                        }
-                    }
-
-                    int distance = abs(next_office->id - letter->to_office);
-                    score += (10 - distance);
-
-                    int free_capacity = next_office->capacity - next_office->current_letters;
-                    score += free_capacity;
-                    
-                    if (score > best_score) {
-                        best_score = score;
-                        best_next_office = next_office;
-                    }
-                }
+    if (!archive->reader || archive->reader_letters != archive->spilled) {
+        if (archive->reader) {
+            archive_close(archive->reader);
+        } else {
+            archive->reader = (ArchiveReader*)malloc(sizeof(ArchiveReader));
+            if (!archive->reader) {
+                return ERROR_MEMORY_ALLOCATION;
             }
         }
-
-        if (best_next_office) {
-            push_heap(&best_next_office->letter_heap, letter_id);
-            best_next_office->current_letters++;
-            letter->current_office = best_next_office->id;
-            
-            char log_msg[256];
-            sprintf(log_msg, "Letter %d transferred from %d to %d (priority: %d)", letter->id, current_office->id, best_next_office->id, letter->priority);
-            log_message(system, log_msg);
-            letters_processed++;
-        } else {
-            push_heap(&current_office->letter_heap, letter_id);
+        StatusCode status = archive_open(archive->reader, archive->spill_path);
+        if (status != SUCCESS) {
+            free(archive->reader);
+            archive->reader = NULL;
+            return status;
         }
+        archive->reader_letters = archive->spilled;
+    }
+    return archive_lookup(archive->reader, letter_id, out);
+}
+
+void default_system_config(SystemConfig *config) {
+    if (!config) {
+        return;
     }
-    free(all_letter_ids);
-    free(all_letter_priorities);
-    free(letter_offices);
+
+    config->queue_kind = QUEUE_HEAP;
+    config->max_priority = DEFAULT_MAX_PRIORITY;
+    config->policy = POLICY_STRICT_PRIORITY;
+    config->aging_ticks = 10;
+    config->weights[REGULAR] = 1;
+    config->weights[URGENT] = 3;
+    config->deadline_ticks[REGULAR] = 100;
+    config->deadline_ticks[URGENT] = 20;
+    config->service_rate = DEFAULT_SERVICE_RATE;
+    config->link_bandwidth = DEFAULT_LINK_BANDWIDTH;
+    config->link_latency = DEFAULT_LINK_LATENCY;
+    config->auto_connect = 1;
+    config->routing = ROUTING_FLAT;
+    config->worker_threads = 1;
+    config->memory_budget = 0;
 }
 
 void init_system(MailSystem *system) {
+    init_system_with_config(system, NULL);
+}
+
+void init_system_with_config(MailSystem *system, const SystemConfig *config) {
     if (!system) {
         return;
     }
 
     system->offices = NULL;
+    system->office_capacity = 0;
+    system->office_slots = NULL;
+    system->office_slots_size = 0;
+    system->office_slots_capacity = 0;
+    system->free_office_slot = -1;
+    system->office_table = NULL;
+    system->office_table_capacity = 0;
+    system->dangling_connections = 0;
     system->letters = NULL;
     system->letters_size = 0;
     system->letters_capacity = 0;
+    system->letter_index = NULL;
+    system->letter_index_capacity = 0;
     system->next_letter_id = 1;
     system->log_file = NULL;
+    system->quiet = 0;
+    system->stats_attached = 1;
+    stats_attach();
+    system->current_tick = 0;
+    system->office_count = 0;
+    system->total_occupancy = 0;
+    memset(system->state_counts, 0, sizeof(system->state_counts));
+    system->delivery_stats = NULL;
+    system->path_trace.entries = NULL;
+    system->path_trace.capacity = 0;
+    system->path_trace.head = 0;
+    system->path_trace.count = 0;
+    memset(&system->archive, 0, sizeof(system->archive));
+    system->retire_interval = 0;
+    system->queue_kind = QUEUE_HEAP;
+    system->queue_levels = 0;
+    if (config && config->queue_kind == QUEUE_BUCKET &&
+        config->max_priority >= 0 && config->max_priority < BUCKET_QUEUE_MAX_LEVELS) {
+        system->queue_kind = QUEUE_BUCKET;
+        system->queue_levels = config->max_priority + 1;
+    }
+
+    SystemConfig defaults;
+    default_system_config(&defaults);
+    if (!config) {
+        config = &defaults;
+    }
+    memset(&system->scheduler, 0, sizeof(system->scheduler));
+    system->scheduler.policy = config->policy;
+    system->scheduler.aging_ticks = config->aging_ticks > 0 ? config->aging_ticks : defaults.aging_ticks;
+    for (int t = 0; t < LETTER_TYPE_COUNT; t++) {
+        system->scheduler.weights[t] = config->weights[t] > 0 ? config->weights[t] : 1;
+        system->scheduler.deadline_ticks[t] = config->deadline_ticks[t];
+    }
+    system->service_rate = config->service_rate > 0 ? config->service_rate : DEFAULT_SERVICE_RATE;
+    system->link_bandwidth = config->link_bandwidth > 0 ? config->link_bandwidth : DEFAULT_LINK_BANDWIDTH;
+    system->link_latency = config->link_latency > 0 ? config->link_latency : DEFAULT_LINK_LATENCY;
+    memset(&system->in_flight, 0, sizeof(system->in_flight));
+    memset(&system->active_offices, 0, sizeof(system->active_offices));
+    system->auto_connect = config->auto_connect;
+    system->routing = config->routing;
+    memset(&system->regions, 0, sizeof(system->regions));
+    memset(&system->routes, 0, sizeof(system->routes));
+    memset(&system->tournament, 0, sizeof(system->tournament));
+    system->topology = NULL;
+    system->retired_topology = NULL;
+    system->engine_topology = NULL;
+    system->engine_topology_slot = -1;
+    memset(system->topology_readers, 0, sizeof(system->topology_readers));
+    system->topology_epoch = 0;
+    system->topology_dirty = 0;
+    system->topology_lock = 0;
+    system->topology_changes = NULL;
+    system->topology_changes_size = 0;
+    system->topology_changes_capacity = 0;
+    system->status_view = NULL;
+    system->executor = NULL;
+    system->trace_file = NULL;
+    system->trace_depth = 0;
+    system->profile_ticks = 0;
+    memset(system->tick_phases, 0, sizeof(system->tick_phases));
+    system->phase_mark = 0;
+    system->image = NULL;
+    system->memory_budget = config->memory_budget;
+    system->budget_rejections = 0;
+    system->queue_bytes = 0;
+    system->connection_bytes = 0;
+    if (config->worker_threads > 1) {
+        set_worker_threads(system, config->worker_threads);
+    }
+}
+
+const char* scheduling_policy_name(SchedulingPolicy policy) {
+    switch (policy) {
+        case POLICY_STRICT_PRIORITY: return "strict";
+        case POLICY_AGING: return "aging";
+        case POLICY_WEIGHTED_FAIR: return "wfq";
+        case POLICY_EARLIEST_DEADLINE: return "edf";
+    }
+    return "unknown";
+}
+
+const char* routing_mode_name(RoutingMode mode) {
+    switch (mode) {
+        case ROUTING_FLAT: return "flat";
+        case ROUTING_REGIONAL: return "regional";
+    }
+    return "unknown";
+}
+
+const char* queue_kind_name(QueueKind kind) {
+    switch (kind) {
+        case QUEUE_HEAP: return "heap";
+        case QUEUE_BUCKET: return "bucket";
+    }
+    return "unknown";
+}
+
+const char* tick_kind_name(TickKind kind) {
+    switch (kind) {
+        case TICK_PRIORITY_TRANSFER: return "priority";
+        case TICK_PROCESS_TRANSFER: return "process";
+        case TICK_NETWORK_TRANSFER: return "network";
+        case TICK_KIND_COUNT: break;
+    }
+    return "unknown";
+}
+
+const char* tick_phase_name(TickPhase phase) {
+    switch (phase) {
+        case TICK_PHASE_TOPOLOGY: return "topology";
+        case TICK_PHASE_PLAN: return "plan";
+        case TICK_PHASE_TRANSFER: return "transfer";
+        case TICK_PHASE_FINISH: return "finish";
+        case TICK_PHASE_COUNT: break;
+    }
+    return "unknown";
 }
 
 void cleanup_system(MailSystem *system) {
@@ -670,35 +4391,109 @@ void cleanup_system(MailSystem *system) {
         return;
     }
 
-    PostOffice *current_office = system->offices;
-    while (current_office) {
-        PostOffice *next = current_office->next;
+    for (int k = 0; k < system->office_count; k++) {
+        PostOffice *current_office = &system->offices[k];
         delete_heap(&current_office->letter_heap);
+        delete_bucket_queue(&current_office->letter_buckets);
         free(current_office->connections);
-        free(current_office);
-        current_office = next;
+        free(current_office->links);
+        free(current_office->in_connections);
+        free(current_office->parked.entries);
     }
+    free(system->offices);
+    free_array(system, system->office_slots);
+    free_array(system, system->office_table);
     system->offices = NULL;
+    system->office_capacity = 0;
+    system->office_slots = NULL;
+    system->office_slots_size = 0;
+    system->office_slots_capacity = 0;
+    system->free_office_slot = -1;
+    system->office_table = NULL;
+    system->office_table_capacity = 0;
+    system->dangling_connections = 0;
+    system->office_count = 0;
+    system->total_occupancy = 0;
+    system->queue_bytes = 0;
+    system->connection_bytes = 0;
+    memset(system->state_counts, 0, sizeof(system->state_counts));
     
-    free(system->letters);
+    free_array(system, system->letters);
     system->letters = NULL;
     system->letters_size = 0;
     system->letters_capacity = 0;
+    free_array(system, system->letter_index);
+    system->letter_index = NULL;
+    system->letter_index_capacity = 0;
+    if (system->archive.spill_file) {
+        fclose(system->archive.spill_file);
+    }
+    if (system->archive.reader) {
+        archive_close(system->archive.reader);
+        free(system->archive.reader);
+    }
+    free(system->archive.spill_path);
+    free(system->archive.letters);
+    memset(&system->archive, 0, sizeof(system->archive));
+    free(system->delivery_stats);
+    system->delivery_stats = NULL;
+    for (int cls = 0; cls < LETTER_TYPE_COUNT; cls++) {
+        free(system->scheduler.classes[cls].entries);
+        system->scheduler.classes[cls].entries = NULL;
+        system->scheduler.classes[cls].size = 0;
+        system->scheduler.classes[cls].capacity = 0;
+    }
+    free(system->in_flight.entries);
+    memset(&system->in_flight, 0, sizeof(system->in_flight));
+    free(system->active_offices.handles);
+    memset(&system->active_offices, 0, sizeof(system->active_offices));
+    for (size_t i = 0; i < system->topology_changes_size; i++) {
+        free(system->topology_changes[i].connections);
+    }
+    free(system->topology_changes);
+    system->topology_changes = NULL;
+    system->topology_changes_size = 0;
+    system->topology_changes_capacity = 0;
+    if (system->topology) {
+        system->topology->next_retired = system->retired_topology;
+        system->retired_topology = system->topology;
+        system->topology = NULL;
+    }
+    reclaim_topology(system, 1);
+    free_region_tables(&system->regions);
+    free_routes(&system->routes);
+    free_tournament(&system->tournament);
+    enable_path_tracing(system, 0);
+    enable_status_view(system, NULL);
+    enable_trace_capture(system, NULL);
+    set_worker_threads(system, 1);
+    system_image_release(system->image);
+    free(system->image);
+    system->image = NULL;
     if (system->log_file) {
         fclose(system->log_file);
         system->log_file = NULL;
     }
+    if (system->stats_attached) {
+        system->stats_attached = 0;
+        stats_detach();
+    }
 }
 
 void log_message(MailSystem *system, const char* message) {
     if (!system || !message) {
         return;
     }
+    if (system->quiet && !system->log_file) {
+        return;
+    }
 
     time_t now = time(NULL);
     char time_str[64];
     strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&now));
-    printf("[%s] %s\n", time_str, message);
+    if (!system->quiet) {
+        printf("[%s] %s\n", time_str, message);
+    }
     if (system->log_file) {
         fprintf(system->log_file, "[%s] %s\n", time_str, message);
         fflush(system->log_file);
@@ -732,9 +4527,9 @@ StatusCode save_letters_to_file(MailSystem *system, const char* filename) {
         return ERROR_FILE_OPERATION;
     }
     
-    fprintf(file, "Total letters: %zu\n", system->letters_size);
-    for (size_t i = 0; i < system->letters_size; i++) {
-        const Letter *l = &system->letters[i];
+    fprintf(file, "Total letters: %zu\n", system->letters_size + system->archive.size);
+    for (size_t i = 0; i < system->letters_size + system->archive.size; i++) {
+        const Letter *l = i < system->letters_size ? &system->letters[i] : &system->archive.letters[i - system->letters_size];
         fprintf(file, "Letter ID: %d, Type: %s, Status: %s, Priority: %d, From: %d, To: %d, Current: %d, Data: %s\n",
                 l->id,
                 l->type == REGULAR ? "Regular" : "Urgent",
@@ -746,6 +4541,9 @@ StatusCode save_letters_to_file(MailSystem *system, const char* filename) {
                 l->current_office,
                 l->tech_data);
     }
+    if (system->archive.spilled > 0) {
+        fprintf(file, "Letters spilled to %s: %zu\n", system->archive.spill_path, system->archive.spilled);
+    }
     fclose(file);
     
     char log_msg[256];
@@ -784,27 +4582,333 @@ void print_system_status(MailSystem *system, int auto_transfer_enabled) {
     
     printf("\nSystem status\n");
     printf("Delivery: %s\n", auto_transfer_enabled ? "on" : "off");
-    printf("Отделений: ");
+    printf("Total number of offices: %d\n", system->office_count);
+    printf("Letters held in offices: %lld\n", system->total_occupancy);
+    printf("Всего писем: %zu\n", system->letters_size + system->archive.size + system->archive.spilled);
+    printf("Live letters: %zu, Retired: %zu\n", system->letters_size, system->archive.size + system->archive.spilled);
+    printf("Letters in transit: %zu, Delivered: %zu, Undelivered: %zu\n",
+           system->state_counts[IN_TRANSIT], system->state_counts[DELIVERED], system->state_counts[UNDELIVERED]);
     
-    int office_count = 0;
-    PostOffice *office = system->offices;
-    while (office) {
-        printf("%d(%d letters) ", office->id, office->current_letters);
-        office = office->next;
-        office_count++;
+    if (system->delivery_stats && system->delivery_stats->overall.latency.total > 0) {
+        const DeliveryHistograms *overall = &system->delivery_stats->overall;
+        printf("Delivery latency (ticks): p50 %llu, p99 %llu; hops: p50 %llu, p99 %llu\n",
+               histogram_percentile(&overall->latency, 0.50),
+               histogram_percentile(&overall->latency, 0.99),
+               histogram_percentile(&overall->hops, 0.50),
+               histogram_percentile(&overall->hops, 0.99));
+    }
+}
+
+void print_office_histogram(MailSystem *system, size_t max_samples) {
+    if (!system) return;
+    
+    const char *labels[] = {"empty", "1-25%", "26-50%", "51-75%", "76-99%", "full"};
+    size_t buckets[6] = {0, 0, 0, 0, 0, 0};
+    size_t stride = 1;
+    if (max_samples > 0 && (size_t)system->office_count > max_samples) {
+        stride = (system->office_count + max_samples - 1) / max_samples;
+    }
+    
+    size_t sampled = 0;
+    for (size_t index = 0; index < (size_t)system->office_count; index += stride) {
+        const PostOffice *office = &system->offices[index];
+        int bucket;
+        if (office->current_letters <= 0) {
+            bucket = 0;
+        } else if (office->current_letters >= office->capacity) {
+            bucket = 5;
+        } else {
+            bucket = 1 + (int)((long long)office->current_letters * 4 / office->capacity);
+            if (bucket > 4) {
+                bucket = 4;
+            }
+        }
+        buckets[bucket]++;
+        sampled++;
     }
-    printf("\nTotal number of offices: %d\n", office_count);
-    printf("Всего писем: %zu\n", system->letters_size);
     
-    int in_transit = 0, delivered = 0, undelivered = 0;
+    printf("\nOffice occupancy (%zu of %d offices sampled)\n", sampled, system->office_count);
+    for (int i = 0; i < 6; i++) {
+        printf("%-7s %zu\n", labels[i], buckets[i]);
+    }
+}
+
+int check_system_aggregates(const MailSystem *system) {
+    if (!system) {
+        return 0;
+    }
+
+    long long occupancy = 0;
+    long long in_edges = 0, out_edges = 0;
+    size_t queue_bytes = 0, connection_bytes = 0;
+    for (int k = 0; k < system->office_count; k++) {
+        const PostOffice *office = &system->offices[k];
+        occupancy += office->current_letters;
+        queue_bytes += office_queue_bytes(office);
+        connection_bytes += office_connection_bytes(office);
+        const OfficeSlot *slot = &system->office_slots[office->slot];
+        if (slot->dense != k || find_office(system, office->id) != office) {
+            return 0;
+        }
+        in_edges += office->num_in_connections;
+        for (int j = 0; j < office->num_connections; j++) {
+            if (find_office(system, office->connections[j])) {
+                out_edges++;
+            }
+        }
+    }
+    if (in_edges != out_edges || queue_bytes != system->queue_bytes || connection_bytes != system->connection_bytes) {
+        return 0;
+    }
+    size_t state_counts[LETTER_STATE_COUNT] = {0, 0, 0};
+    scan_count_states(system->letters, system->letters_size, state_counts);
     for (size_t i = 0; i < system->letters_size; i++) {
-        switch (system->letters[i].state) {
-            case IN_TRANSIT: in_transit++; break;
-            case DELIVERED: delivered++; break;
-            case UNDELIVERED: undelivered++; break;
+        if (system->letter_index[system->letters[i].id] != (int)i) {
+            return 0;
+        }
+    }
+
+    if (occupancy != system->total_occupancy) {
+        return 0;
+    }
+    for (int s = 0; s < LETTER_STATE_COUNT; s++) {
+        if (state_counts[s] + system->archive.retired_counts[s] != system->state_counts[s]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int priority_class(int priority) {
+    if (priority < 10) {
+        return 0;
+    }
+    if (priority < 50) {
+        return 1;
+    }
+    if (priority < 100) {
+        return 2;
+    }
+    return 3;
+}
+
+const char* priority_class_name(int priority_class) {
+    switch (priority_class) {
+        case 0: return "priority 0-9";
+        case 1: return "priority 10-49";
+        case 2: return "priority 50-99";
+        case 3: return "priority 100+";
+    }
+    return "unknown";
+}
+
+StatusCode enable_path_tracing(MailSystem *system, size_t capacity) {
+    if (!system) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    PathTraceEntry *entries = NULL;
+    if (capacity > 0) {
+        entries = (PathTraceEntry*)malloc(capacity * sizeof(PathTraceEntry));
+        if (!entries) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+    }
+    free(system->path_trace.entries);
+    system->path_trace.entries = entries;
+    system->path_trace.capacity = capacity;
+    system->path_trace.head = 0;
+    system->path_trace.count = 0;
+    return SUCCESS;
+}
+
+size_t get_letter_path(const MailSystem *system, int letter_id, int *offices, int *ticks, size_t max_entries) {
+    if (!system || !system->path_trace.entries) {
+        return 0;
+    }
+
+    const PathTrace *trace = &system->path_trace;
+    size_t start = (trace->head + trace->capacity - trace->count) % trace->capacity;
+    size_t found = 0;
+    for (size_t i = 0; i < trace->count && found < max_entries; i++) {
+        const PathTraceEntry *entry = &trace->entries[(start + i) % trace->capacity];
+        if (entry->letter_id != letter_id) {
+            continue;
+        }
+        if (offices) {
+            offices[found] = entry->office_id;
+        }
+        if (ticks) {
+            ticks[found] = entry->tick;
+        }
+        found++;
+    }
+    return found;
+}
+
+static void print_delivery_row(FILE *out, const char *name, const DeliveryHistograms *group) {
+    if (group->latency.total == 0) {
+        fprintf(out, "%-16s %8d\n", name, 0);
+        return;
+    }
+    fprintf(out, "%-16s %8llu %8.2f %6llu %6llu %6llu %6llu %8.2f %6llu %6llu %6llu\n",
+            name, group->latency.total,
+            (double)group->latency.sum / group->latency.total,
+            histogram_percentile(&group->latency, 0.50),
+            histogram_percentile(&group->latency, 0.90),
+            histogram_percentile(&group->latency, 0.99),
+            group->latency.max,
+            (double)group->hops.sum / group->hops.total,
+            histogram_percentile(&group->hops, 0.50),
+            histogram_percentile(&group->hops, 0.99),
+            group->hops.max);
+}
+
+void print_delivery_report(MailSystem *system, FILE *out) {
+    if (!system || !out) {
+        return;
+    }
+
+    fprintf(out, "\nDelivery report (tick %d)\n", system->current_tick);
+    if (!system->delivery_stats) {
+        fprintf(out, "No letters delivered yet\n");
+        return;
+    }
+
+    const DeliveryStats *stats = system->delivery_stats;
+    fprintf(out, "%-16s %8s %8s %6s %6s %6s %6s %8s %6s %6s %6s\n",
+            "class", "count", "lat_avg", "p50", "p90", "p99", "max", "hop_avg", "p50", "p99", "max");
+    print_delivery_row(out, "all", &stats->overall);
+    print_delivery_row(out, "regular", &stats->by_type[REGULAR]);
+    print_delivery_row(out, "urgent", &stats->by_type[URGENT]);
+    for (int c = 0; c < PRIORITY_CLASS_COUNT; c++) {
+        print_delivery_row(out, priority_class_name(c), &stats->by_priority[c]);
+    }
+}
+
+const char* memory_category_name(MemoryCategory category) {
+    switch (category) {
+        case MEMORY_LETTERS: return "letters";
+        case MEMORY_TECH_DATA: return "tech_data";
+        case MEMORY_QUEUES: return "queues";
+        case MEMORY_CONNECTIONS: return "connections";
+        case MEMORY_OFFICES: return "offices";
+        case MEMORY_ROUTING: return "routing";
+        case MEMORY_LOGS: return "logs";
+        case MEMORY_OTHER: return "other";
+        case MEMORY_CATEGORY_COUNT: break;
+    }
+    return "unknown";
+}
+
+static size_t snapshot_bytes(const TopologySnapshot *snapshot) {
+    size_t count = snapshot->office_count + 1;
+    size_t edges = snapshot->offsets ? (size_t)snapshot->offsets[snapshot->office_count] + 1 : 0;
+    return sizeof(TopologySnapshot) + (2 * count + 3 * edges) * sizeof(int) + count * sizeof(TopologyEntry);
+}
+
+static size_t routes_bytes(const RoutingTable *routes) {
+    if (!routes->offsets) {
+        return 0;
+    }
+    size_t count = routes->office_count + 1;
+    return (2 * count + 2 * (routes->offsets[routes->office_count] + 1) + ROUTE_CACHE_ROWS) * sizeof(int) +
+           ROUTE_CACHE_ROWS * sizeof(int*) + routes->num_rows * count * sizeof(int);
+}
+
+void measure_memory(const MailSystem *system, MemoryFootprint *footprint) {
+    if (!footprint) {
+        return;
+    }
+    memset(footprint, 0, sizeof(*footprint));
+    if (!system) {
+        return;
+    }
+
+    size_t *bytes = footprint->bytes;
+    bytes[MEMORY_LETTERS] = system->letters_capacity * (sizeof(Letter) - TECH_DATA_SIZE) +
+                            system->letter_index_capacity * sizeof(int);
+    bytes[MEMORY_TECH_DATA] = system->letters_capacity * TECH_DATA_SIZE;
+    bytes[MEMORY_QUEUES] = system->queue_bytes;
+    bytes[MEMORY_CONNECTIONS] = system->connection_bytes;
+    bytes[MEMORY_OFFICES] = system->office_capacity * sizeof(PostOffice) +
+                            system->office_slots_capacity * sizeof(OfficeSlot) +
+                            system->office_table_capacity * sizeof(OfficeIndexEntry);
+
+    const RegionalRoutes *regions = &system->regions;
+    if (regions->tables) {
+        size_t r = regions->num_regions;
+        bytes[MEMORY_ROUTING] += (r + 1) * sizeof(RegionTable) + (2 * ((size_t)regions->office_capacity + 1) + 2 * (r * r + 1) + r + 1) * sizeof(int);
+        for (size_t i = 0; i < r; i++) {
+            const RegionTable *table = &regions->tables[i];
+            size_t n = table->num_offices;
+            bytes[MEMORY_ROUTING] += (table->capacity + (table->distances ? n * n : 0) + (table->gateways ? n * r : 0) +
+                                      (table->exits ? 3 * (size_t)(table->num_exits + 1) : 0)) * sizeof(int);
         }
     }
-    printf("Letters in transit: %d, Delivered: %d, Undelivered: %d\n", in_transit, delivered, undelivered);
+    const OfficeTournament *t = &system->tournament;
+    if (t->winners) {
+        bytes[MEMORY_ROUTING] += t->leaves * (6 * sizeof(int) + 1 + sizeof(TournamentCursor));
+    }
+    if (system->topology) {
+        bytes[MEMORY_ROUTING] += snapshot_bytes(system->topology);
+    }
+    for (const TopologySnapshot *snapshot = system->retired_topology; snapshot; snapshot = snapshot->next_retired) {
+        bytes[MEMORY_ROUTING] += snapshot_bytes(snapshot);
+    }
+    bytes[MEMORY_ROUTING] += routes_bytes(&system->routes);
+
+    bytes[MEMORY_LOGS] = system->path_trace.capacity * sizeof(PathTraceEntry) +
+                         system->archive.capacity * sizeof(Letter) +
+                         (system->delivery_stats ? sizeof(DeliveryStats) : 0);
+
+    bytes[MEMORY_OTHER] = system->in_flight.capacity * sizeof(InFlightLetter) +
+                          system->active_offices.capacity * sizeof(OfficeHandle) +
+                          system->topology_changes_capacity * sizeof(TopologyChange);
+    for (int k = 0; k < system->office_count; k++) {
+        bytes[MEMORY_OTHER] += system->offices[k].parked.capacity * sizeof(ScheduleEntry);
+    }
+    for (int cls = 0; cls < LETTER_TYPE_COUNT; cls++) {
+        bytes[MEMORY_OTHER] += system->scheduler.classes[cls].capacity * sizeof(ScheduleEntry);
+    }
+
+    for (int c = 0; c < MEMORY_CATEGORY_COUNT; c++) {
+        footprint->total += bytes[c];
+    }
+    footprint->budget = system->memory_budget;
+    footprint->rejections = system->budget_rejections;
+}
+
+void recount_memory(MailSystem *system) {
+    if (!system) {
+        return;
+    }
+    system->queue_bytes = 0;
+    system->connection_bytes = 0;
+    for (int k = 0; k < system->office_count; k++) {
+        system->queue_bytes += office_queue_bytes(&system->offices[k]);
+        system->connection_bytes += office_connection_bytes(&system->offices[k]);
+    }
+}
+
+void print_memory_report(const MailSystem *system, FILE *out) {
+    if (!system || !out) {
+        return;
+    }
+
+    MemoryFootprint footprint;
+    measure_memory(system, &footprint);
+    fprintf(out, "\nMemory footprint (tick %d)\n", system->current_tick);
+    fprintf(out, "%-16s %12s %7s\n", "category", "bytes", "share");
+    for (int c = 0; c < MEMORY_CATEGORY_COUNT; c++) {
+        fprintf(out, "%-16s %12zu %6.1f%%\n", memory_category_name((MemoryCategory)c), footprint.bytes[c],
+                footprint.total ? 100.0 * footprint.bytes[c] / footprint.total : 0.0);
+    }
+    fprintf(out, "%-16s %12zu\n", "total", footprint.total);
+    if (footprint.budget > 0) {
+        fprintf(out, "Budget: %zu bytes (%.1f%% used), rejections: %zu\n", footprint.budget,
+                100.0 * footprint.total / footprint.budget, footprint.rejections);
+    }
 }
 
 void sort_by_priority(int *ids, int *priorities, PostOffice **offices, size_t count) {
@@ -827,4 +4931,169 @@ void sort_by_priority(int *ids, int *priorities, PostOffice **offices, size_t co
             }
         }
     }
-}
\ No newline at end of file
+}
+
+static size_t histogram_index(unsigned long long value) {
+    if (value < (1ULL << HISTOGRAM_SUB_BITS)) {
+        return (size_t)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    size_t mantissa = (size_t)(value >> (exponent - HISTOGRAM_SUB_BITS)) & ((1u << HISTOGRAM_SUB_BITS) - 1);
+    return ((size_t)(exponent - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) | mantissa;
+}
+
+static unsigned long long histogram_upper_bound(size_t index) {
+    if (index < (1u << HISTOGRAM_SUB_BITS)) {
+        return index;
+    }
+    int exponent = (int)(index >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+    unsigned long long mantissa = (index & ((1u << HISTOGRAM_SUB_BITS) - 1)) | (1u << HISTOGRAM_SUB_BITS);
+    int shift = exponent - HISTOGRAM_SUB_BITS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void histogram_record(LatencyHistogram *histogram, unsigned long long value) {
+    if (!histogram) {
+        return;
+    }
+
+    histogram->counts[histogram_index(value)]++;
+    if (histogram->total == 0 || value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+    histogram->total++;
+    histogram->sum += value;
+}
+
+void histogram_merge(LatencyHistogram *into, const LatencyHistogram *from) {
+    if (!into || !from || from->total == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        into->counts[i] += from->counts[i];
+    }
+    if (into->total == 0 || from->min < into->min) {
+        into->min = from->min;
+    }
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+    into->total += from->total;
+    into->sum += from->sum;
+}
+
+unsigned long long histogram_percentile(const LatencyHistogram *histogram, double fraction) {
+    if (!histogram || histogram->total == 0) {
+        return 0;
+    }
+
+    unsigned long long rank = (unsigned long long)(fraction * histogram->total + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    unsigned long long seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            unsigned long long bound = histogram_upper_bound(i);
+            return bound > histogram->max ? histogram->max : bound;
+        }
+    }
+    return histogram->max;
+}
+
+void get_stat_counters(unsigned long long *counters) {
+    if (!counters) {
+        return;
+    }
+
+    memset(counters, 0, STAT_COUNT * sizeof(unsigned long long));
+#if MAIL_STATS
+    for (StatsBlock *block = __atomic_load_n(&stats_blocks, __ATOMIC_ACQUIRE); block; block = block->next) {
+        if (!stats_block_current(block)) {
+            continue;
+        }
+        for (int i = 0; i < STAT_COUNT; i++) {
+            counters[i] += __atomic_load_n(&block->stats.counters[i], __ATOMIC_RELAXED);
+        }
+    }
+#endif
+}
+
+void get_stats(SystemStats *stats) {
+    if (!stats) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+#if MAIL_STATS
+    for (StatsBlock *block = __atomic_load_n(&stats_blocks, __ATOMIC_ACQUIRE); block; block = block->next) {
+        if (!stats_block_current(block)) {
+            continue;
+        }
+        for (int i = 0; i < STAT_COUNT; i++) {
+            stats->counters[i] += __atomic_load_n(&block->stats.counters[i], __ATOMIC_RELAXED);
+        }
+        for (int k = 0; k < TICK_KIND_COUNT; k++) {
+            histogram_merge(&stats->ticks[k], &block->stats.ticks[k]);
+        }
+    }
+#endif
+}
+
+void reset_stats(void) {
+#if MAIL_STATS
+    __atomic_add_fetch(&stats_reset_epoch, 1, __ATOMIC_ACQ_REL);
+#endif
+}
+
+#if MAIL_STATS
+static void dump_tick_histogram(FILE *out, const char *name, const LatencyHistogram *histogram) {
+    if (histogram->total == 0) {
+        fprintf(out, "%s: no ticks\n", name);
+        return;
+    }
+    fprintf(out, "%s: %llu ticks, mean %.1f us, p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+            name, histogram->total,
+            histogram->sum / 1000.0 / histogram->total,
+            histogram_percentile(histogram, 0.50) / 1000.0,
+            histogram_percentile(histogram, 0.90) / 1000.0,
+            histogram_percentile(histogram, 0.99) / 1000.0,
+            histogram->max / 1000.0);
+}
+#endif
+
+void dump_stats(FILE *out) {
+    if (!out) {
+        return;
+    }
+
+#if MAIL_STATS
+    SystemStats *stats = (SystemStats*)malloc(sizeof(SystemStats));
+    if (!stats) {
+        return;
+    }
+    get_stats(stats);
+    const unsigned long long *c = stats->counters;
+
+    fprintf(out, "\nPerformance counters\n");
+    fprintf(out, "Heap push: %llu, pop: %llu, remove: %llu\n",
+            c[STAT_HEAP_PUSH], c[STAT_HEAP_POP], c[STAT_HEAP_REMOVE]);
+    fprintf(out, "find_office calls: %llu, mean probes: %.1f\n", c[STAT_FIND_OFFICE],
+            c[STAT_FIND_OFFICE] ? (double)c[STAT_FIND_OFFICE_PROBES] / c[STAT_FIND_OFFICE] : 0.0);
+    fprintf(out, "find_letter calls: %llu, mean probes: %.1f\n", c[STAT_FIND_LETTER],
+            c[STAT_FIND_LETTER] ? (double)c[STAT_FIND_LETTER_PROBES] / c[STAT_FIND_LETTER] : 0.0);
+    fprintf(out, "Transfers: %llu, Deliveries: %llu, Capacity rejections: %llu\n",
+            c[STAT_TRANSFERS], c[STAT_DELIVERIES], c[STAT_CAPACITY_REJECTIONS]);
+    dump_tick_histogram(out, "transfer_priority_letters", &stats->ticks[TICK_PRIORITY_TRANSFER]);
+    dump_tick_histogram(out, "process_letters_transfer", &stats->ticks[TICK_PROCESS_TRANSFER]);
+    dump_tick_histogram(out, "process_network_tick", &stats->ticks[TICK_NETWORK_TRANSFER]);
+    free(stats);
+#else
+    fprintf(out, "\nPerformance counters are disabled (built with MAIL_STATS=0)\n");
+#endif
+}
@@ -7,15 +7,72 @@
 #include <time.h>
 
 #define INITIAL_CAPACITY 10
+#define LETTER_STORE_MIN_CAPACITY 10
 #define MAX_CONNECTIONS 100
 #define TECH_DATA_SIZE 256
 
+#ifndef MAIL_STATS
+#define MAIL_STATS 1
+#endif
+
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_BUCKETS (64 << HISTOGRAM_SUB_BITS)
+
+#define LETTER_TYPE_COUNT 2
+#define LETTER_STATE_COUNT 3
+#define PRIORITY_CLASS_COUNT 4
+
+#define BUCKET_QUEUE_MAX_LEVELS 64
+#define DEFAULT_MAX_PRIORITY 31
+#define WFQ_SCALE 1000000
+
+#define DEFAULT_SERVICE_RATE 1
+#define DEFAULT_LINK_BANDWIDTH 1
+#define DEFAULT_LINK_LATENCY 1
+#define DEFAULT_LINK_WEIGHT 1
+#define ROUTE_CACHE_ROWS 256
+#define TOPOLOGY_READER_SLOTS 64
+#define SERVICE_BATCH 64
+#define HEAP_ITERATOR_INLINE 32
+#define ROUTING_CHUNK_LETTERS 1024
+
+#define TRACE_MAGIC "MAILTRACE"
+#define TRACE_VERSION 1
+
 typedef struct {
     int *data;
+    int *keys;
     size_t size;
     size_t capacity;
 } Heap;
 
+typedef struct {
+    const Heap *heap;
+    size_t *frontier;
+    size_t size;
+    size_t capacity;
+    size_t inline_frontier[HEAP_ITERATOR_INLINE];
+} HeapIterator;
+
+typedef struct {
+    int *data;
+    size_t head;
+    size_t size;
+    size_t capacity;
+} BucketLevel;
+
+typedef struct {
+    BucketLevel *levels;
+    int num_levels;
+    unsigned long long occupied;
+    size_t size;
+} BucketQueue;
+
+typedef enum {
+    QUEUE_HEAP,
+    QUEUE_BUCKET
+} QueueKind;
+
 typedef enum {
     REGULAR,
     URGENT
@@ -35,7 +92,8 @@ typedef enum {
     ERROR_OFFICE_NOT_FOUND,
     ERROR_INVALID_PARAMETER,
     ERROR_OFFICE_FULL,
-    ERROR_FILE_OPERATION
+    ERROR_FILE_OPERATION,
+    ERROR_MEMORY_BUDGET
 } StatusCode;
 
 typedef struct {
@@ -46,48 +104,473 @@ typedef struct {
     int from_office;
     int to_office;
     int current_office;
+    int created_tick;
+    int delivered_tick;
+    int hops;
     char tech_data[TECH_DATA_SIZE];
 } Letter;
 
+typedef enum {
+    STAT_HEAP_PUSH,
+    STAT_HEAP_POP,
+    STAT_HEAP_REMOVE,
+    STAT_FIND_OFFICE,
+    STAT_FIND_OFFICE_PROBES,
+    STAT_FIND_LETTER,
+    STAT_FIND_LETTER_PROBES,
+    STAT_TRANSFERS,
+    STAT_DELIVERIES,
+    STAT_CAPACITY_REJECTIONS,
+    STAT_COUNT
+} StatCounter;
+
+typedef enum {
+    TICK_PRIORITY_TRANSFER,
+    TICK_PROCESS_TRANSFER,
+    TICK_NETWORK_TRANSFER,
+    TICK_KIND_COUNT
+} TickKind;
+
+typedef enum {
+    TICK_PHASE_TOPOLOGY,
+    TICK_PHASE_PLAN,
+    TICK_PHASE_TRANSFER,
+    TICK_PHASE_FINISH,
+    TICK_PHASE_COUNT
+} TickPhase;
+
+typedef struct {
+    unsigned long long counts[HISTOGRAM_BUCKETS];
+    unsigned long long total;
+    unsigned long long sum;
+    unsigned long long min;
+    unsigned long long max;
+} LatencyHistogram;
+
+typedef enum {
+    MEMORY_LETTERS,
+    MEMORY_TECH_DATA,
+    MEMORY_QUEUES,
+    MEMORY_CONNECTIONS,
+    MEMORY_OFFICES,
+    MEMORY_ROUTING,
+    MEMORY_LOGS,
+    MEMORY_OTHER,
+    MEMORY_CATEGORY_COUNT
+} MemoryCategory;
+
+typedef struct {
+    size_t bytes[MEMORY_CATEGORY_COUNT];
+    size_t total;
+    size_t budget;
+    size_t rejections;
+} MemoryFootprint;
+
+typedef struct {
+    unsigned long long counters[STAT_COUNT];
+    LatencyHistogram ticks[TICK_KIND_COUNT];
+} SystemStats;
+
+typedef struct {
+    LatencyHistogram latency;
+    LatencyHistogram hops;
+} DeliveryHistograms;
+
+typedef struct {
+    DeliveryHistograms overall;
+    DeliveryHistograms by_type[LETTER_TYPE_COUNT];
+    DeliveryHistograms by_priority[PRIORITY_CLASS_COUNT];
+} DeliveryStats;
+
+typedef struct {
+    int letter_id;
+    int office_id;
+    int tick;
+} PathTraceEntry;
+
+typedef struct {
+    PathTraceEntry *entries;
+    size_t capacity;
+    size_t head;
+    size_t count;
+} PathTrace;
+
+typedef struct {
+    Letter *letters;
+    size_t size;
+    size_t capacity;
+    size_t spilled;
+    size_t spill_threshold;
+    char *spill_path;
+    FILE *spill_file;
+    struct ArchiveReader *reader;
+    size_t reader_letters;
+    size_t retired_counts[LETTER_STATE_COUNT];
+} LetterArchive;
+
+typedef enum {
+    ROUTING_FLAT,
+    ROUTING_REGIONAL
+} RoutingMode;
+
+typedef enum {
+    POLICY_STRICT_PRIORITY,
+    POLICY_AGING,
+    POLICY_WEIGHTED_FAIR,
+    POLICY_EARLIEST_DEADLINE
+} SchedulingPolicy;
+
+typedef struct {
+    long long key;
+    int priority;
+    int letter_id;
+} ScheduleEntry;
+
+typedef struct {
+    ScheduleEntry *entries;
+    size_t size;
+    size_t capacity;
+} ScheduleQueue;
+
+typedef struct {
+    SchedulingPolicy policy;
+    ScheduleQueue classes[LETTER_TYPE_COUNT];
+    long long virtual_finish[LETTER_TYPE_COUNT];
+    long long virtual_time;
+    int weights[LETTER_TYPE_COUNT];
+    int aging_ticks;
+    int deadline_ticks[LETTER_TYPE_COUNT];
+    size_t num_parked;
+    int wake_all;
+    int rebuild;
+} Scheduler;
+
+typedef struct {
+    QueueKind queue_kind;
+    int max_priority;
+    SchedulingPolicy policy;
+    int aging_ticks;
+    int weights[LETTER_TYPE_COUNT];
+    int deadline_ticks[LETTER_TYPE_COUNT];
+    int service_rate;
+    int link_bandwidth;
+    int link_latency;
+    int auto_connect;
+    RoutingMode routing;
+    int worker_threads;
+    size_t memory_budget;
+} SystemConfig;
+
+typedef struct {
+    int bandwidth;
+    int latency;
+    int weight;
+    int used_tick;
+    int used;
+} LinkState;
+
+typedef struct {
+    int slot;
+    unsigned int generation;
+} OfficeHandle;
+
+typedef struct {
+    int arrival_tick;
+    int letter_id;
+    int to_office;
+    OfficeHandle to_handle;
+} InFlightLetter;
+
+typedef struct {
+    InFlightLetter *entries;
+    size_t size;
+    size_t capacity;
+} InFlightQueue;
+
 typedef struct PostOffice {
     int id;
     int capacity;
     int current_letters;
     int num_connections;
+    int service_rate;
+    int slot;
+    int region;
+    int auto_region;
+    int active;
     int *connections;
+    LinkState *links;
+    int *in_connections;
+    int num_in_connections;
+    int in_connections_capacity;
     Heap letter_heap;
-    struct PostOffice *next;
+    BucketQueue letter_buckets;
+    ScheduleQueue parked;
 } PostOffice;
 
+typedef struct {
+    OfficeHandle *handles;
+    int size;
+    int capacity;
+    int valid;
+} ActiveOffices;
+
+typedef struct {
+    int dense;
+    unsigned int generation;
+    int next_free;
+} OfficeSlot;
+
+typedef struct {
+    int id;
+    int slot;
+} OfficeIndexEntry;
+
+typedef enum {
+    TOPOLOGY_ADD_OFFICE,
+    TOPOLOGY_REMOVE_OFFICE,
+    TOPOLOGY_ADD_CONNECTION,
+    TOPOLOGY_REMOVE_CONNECTION
+} TopologyChangeKind;
+
+typedef struct {
+    TopologyChangeKind kind;
+    int office_id;
+    int capacity;
+    int *connections;
+    int num_connections;
+    int target_id;
+    int weight;
+} TopologyChange;
+
+typedef struct {
+    int valid;
+    unsigned long long epoch;
+    int office_count;
+    int *offsets;
+    int *sources;
+    int *weights;
+    int *row_of;
+    int *row_target;
+    int **rows;
+    int num_rows;
+    int next_victim;
+} RoutingTable;
+
+typedef struct {
+    int id;
+    int index;
+} TopologyEntry;
+
+typedef struct TopologySnapshot {
+    unsigned long long epoch;
+    int office_count;
+    int *office_ids;
+    TopologyEntry *by_id;
+    int *offsets;
+    int *targets;
+    int *target_index;
+    int *weights;
+    struct TopologySnapshot *next_retired;
+} TopologySnapshot;
+
+typedef struct {
+    int num_offices;
+    int *offices;
+    int *distances;
+    int *gateways;
+    int *exits;
+    int num_exits;
+    int capacity;
+    int label;
+    int intra_valid;
+    int exits_valid;
+    int gateway_valid;
+} RegionTable;
+
+typedef struct {
+    int valid;
+    int num_regions;
+    int next_auto_region;
+    RegionTable *tables;
+    int office_capacity;
+    int *region_of;
+    int *local_index;
+    int *region_distances;
+    int *region_next;
+    int *row_epoch;
+    int distances_epoch;
+} RegionalRoutes;
+
+typedef struct {
+    int *ids;
+    size_t count;
+    size_t limit;
+    size_t next;
+} TournamentCursor;
+
+typedef struct {
+    int valid;
+    int leaves;
+    int *winners;
+    int *head_ids;
+    int *head_priorities;
+    unsigned char *stale;
+    int *dirty;
+    int num_dirty;
+    TournamentCursor *cursors;
+    int *walked;
+    int num_walked;
+} OfficeTournament;
+
 typedef struct {
     PostOffice *offices;
+    int office_capacity;
+    OfficeSlot *office_slots;
+    int office_slots_size;
+    int office_slots_capacity;
+    int free_office_slot;
+    OfficeIndexEntry *office_table;
+    size_t office_table_capacity;
+    int dangling_connections;
     Letter *letters;
     size_t letters_size;
     size_t letters_capacity;
+    int *letter_index;
+    size_t letter_index_capacity;
     int next_letter_id;
     FILE *log_file;
+    int quiet;
+    int current_tick;
+    int office_count;
+    long long total_occupancy;
+    size_t state_counts[LETTER_STATE_COUNT];
+    DeliveryStats *delivery_stats;
+    PathTrace path_trace;
+    LetterArchive archive;
+    int retire_interval;
+    QueueKind queue_kind;
+    int queue_levels;
+    Scheduler scheduler;
+    int service_rate;
+    int link_bandwidth;
+    int link_latency;
+    InFlightQueue in_flight;
+    ActiveOffices active_offices;
+    int auto_connect;
+    RoutingMode routing;
+    RegionalRoutes regions;
+    RoutingTable routes;
+    OfficeTournament tournament;
+    TopologySnapshot *topology;
+    TopologySnapshot *retired_topology;
+    TopologySnapshot *engine_topology;
+    int engine_topology_slot;
+    unsigned long long topology_readers[TOPOLOGY_READER_SLOTS];
+    unsigned long long topology_epoch;
+    int topology_dirty;
+    int topology_lock;
+    TopologyChange *topology_changes;
+    size_t topology_changes_size;
+    size_t topology_changes_capacity;
+    struct StatusView *status_view;
+    struct Executor *executor;
+    FILE *trace_file;
+    int trace_depth;
+    int profile_ticks;
+    unsigned long long tick_phases[TICK_PHASE_COUNT];
+    unsigned long long phase_mark;
+    struct SystemImage *image;
+    size_t memory_budget;
+    size_t budget_rejections;
+    size_t queue_bytes;
+    size_t connection_bytes;
+    int stats_attached;
 } MailSystem;
 
 Heap create_heap(size_t initial_capacity);
+// Keyed heaps order by larger key first, then smaller value; office heaps key letters by priority.
+Heap create_keyed_heap(size_t initial_capacity);
 void delete_heap(Heap *h);
+size_t heap_bytes(const Heap *h);
 int is_empty_heap(const Heap *h);
 size_t size_heap(const Heap *h);
 int peek_heap(const Heap *h);
 void push_heap(Heap *h, int value);
+void push_heap_keyed(Heap *h, int value, int key);
 int pop_heap(Heap *h);
 int remove_letter_from_heap(Heap *heap, int letter_id);
+const int* heap_view(const Heap *h, size_t *count);
+// Visits values in heap order (priority, then letter id for office heaps).
+// heap_iterator_next returns 1 per value, 0 when exhausted and -1 if the frontier cannot grow.
+void heap_iterator_begin(HeapIterator *it, const Heap *h);
+int heap_iterator_next(HeapIterator *it, int *value);
+void heap_iterator_end(HeapIterator *it);
+
+BucketQueue create_bucket_queue(int num_levels);
+void delete_bucket_queue(BucketQueue *q);
+size_t size_bucket_queue(const BucketQueue *q);
+int peek_bucket_queue(const BucketQueue *q);
+void push_bucket_queue(BucketQueue *q, int priority, int value);
+int pop_bucket_queue(BucketQueue *q);
+int remove_from_bucket_queue(BucketQueue *q, int priority, int value);
 
 PostOffice* find_office(const MailSystem *system, int office_id);
+OfficeHandle get_office_handle(const MailSystem *system, int office_id);
+PostOffice* resolve_office(const MailSystem *system, OfficeHandle handle);
 StatusCode add_office(MailSystem *system, int id, int capacity, int* connections, int num_conn);
 StatusCode remove_office(MailSystem *system, int office_id);
+StatusCode queue_add_office(MailSystem *system, int id, int capacity, const int *connections, int num_conn);
+StatusCode queue_remove_office(MailSystem *system, int office_id);
+StatusCode add_connection(MailSystem *system, int from_office, int to_office, int weight);
+StatusCode remove_connection(MailSystem *system, int from_office, int to_office);
+StatusCode queue_add_connection(MailSystem *system, int from_office, int to_office, int weight);
+StatusCode queue_remove_connection(MailSystem *system, int from_office, int to_office);
+int route_distance(MailSystem *system, int from_office, int to_office);
+StatusCode set_office_region(MailSystem *system, int office_id, int region);
+size_t apply_topology_changes(MailSystem *system);
+// The reader's epoch is announced in *slot before the snapshot is loaded; retired
+// snapshots are freed only once every announced epoch has moved past them.
+TopologySnapshot* acquire_topology(MailSystem *system, int *slot);
+void release_topology(MailSystem *system, int slot);
+const int* topology_neighbours(const TopologySnapshot *snapshot, int office_id, int *count);
 
 Letter* find_letter(MailSystem *system, int letter_id);
+// Priority must be non-negative. Bucket queues serve priorities above max_priority from the top bucket
+// in arrival order; the letter keeps its own priority, as on the heap path.
 StatusCode add_letter(MailSystem *system, LetterType type, int priority, int from_office, int to_office, const char* tech_data);
 StatusCode transfer_letter_to_office(MailSystem *system, int letter_id, int from_office_id, int to_office_id);
+size_t office_urgent_letters(MailSystem *system, int office_id, int *letter_ids, size_t max_letters);
+size_t next_urgent_letters(MailSystem *system, int *letter_ids, size_t max_letters);
+StatusCode export_letter(MailSystem *system, int letter_id, Letter *out);
+StatusCode import_letter(MailSystem *system, const Letter *letter, int *letter_id);
 void process_letters_transfer(MailSystem *system);
 void transfer_priority_letters(MailSystem *system);
+StatusCode release_parked_letters(MailSystem *system);
+void process_network_tick(MailSystem *system);
+StatusCode set_office_service_rate(MailSystem *system, int office_id, int service_rate);
+StatusCode set_link_properties(MailSystem *system, int from_office, int to_office, int bandwidth, int latency);
+size_t retire_letters(MailSystem *system);
+size_t compact_system(MailSystem *system);
+StatusCode set_archive_spill(MailSystem *system, const char *path, size_t threshold);
+StatusCode find_archived_letter(MailSystem *system, int letter_id, Letter *out);
+StatusCode enable_status_view(MailSystem *system, const char *name);
+StatusCode set_worker_threads(MailSystem *system, int num_threads);
+StatusCode set_memory_budget(MailSystem *system, size_t bytes);
+void measure_memory(const MailSystem *system, MemoryFootprint *footprint);
+void recount_memory(MailSystem *system);
+const char* memory_category_name(MemoryCategory category);
+void print_memory_report(const MailSystem *system, FILE *out);
+StatusCode enable_trace_capture(MailSystem *system, const char *path);
+void record_trace_seed(MailSystem *system, unsigned long long seed);
 
+void default_system_config(SystemConfig *config);
 void init_system(MailSystem *system);
+void init_system_with_config(MailSystem *system, const SystemConfig *config);
+const char* queue_kind_name(QueueKind kind);
+const char* scheduling_policy_name(SchedulingPolicy policy);
+const char* routing_mode_name(RoutingMode mode);
+const char* tick_kind_name(TickKind kind);
+const char* tick_phase_name(TickPhase phase);
 void cleanup_system(MailSystem *system);
 void log_message(MailSystem *system, const char* message);
 void open_log_file(MailSystem *system, const char* filename);
@@ -96,6 +579,22 @@ StatusCode save_letters_to_file(MailSystem *system, const char* filename);
 void msleep(int milliseconds);
 void print_office_connections(MailSystem *system, int office_id);
 void print_system_status(MailSystem *system, int auto_transfer_enabled);
+void print_office_histogram(MailSystem *system, size_t max_samples);
+int check_system_aggregates(const MailSystem *system);
 void sort_by_priority(int *ids, int *priorities, PostOffice **offices, size_t count);
 
+int priority_class(int priority);
+const char* priority_class_name(int priority_class);
+StatusCode enable_path_tracing(MailSystem *system, size_t capacity);
+size_t get_letter_path(const MailSystem *system, int letter_id, int *offices, int *ticks, size_t max_entries);
+void print_delivery_report(MailSystem *system, FILE *out);
+
+void histogram_record(LatencyHistogram *histogram, unsigned long long value);
+void histogram_merge(LatencyHistogram *into, const LatencyHistogram *from);
+unsigned long long histogram_percentile(const LatencyHistogram *histogram, double fraction);
+void get_stat_counters(unsigned long long *counters);
+void get_stats(SystemStats *stats);
+void reset_stats(void);
+void dump_stats(FILE *out);
+
 #endif
\ No newline at end of file
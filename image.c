@@ -0,0 +1,613 @@
+#define _POSIX_C_SOURCE 200809L
+#include "image.h"
+#include "executor.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+    FILE *file;
+    uint64_t offset;
+    ImageHeader *header;
+    ImageSection section;
+    int ok;
+} ImageWriter;
+
+static void begin_section(ImageWriter *writer, ImageSection section) {
+    static const unsigned char padding[IMAGE_ALIGNMENT];
+    uint64_t start = (writer->offset + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+    if (start > writer->offset && fwrite(padding, 1, start - writer->offset, writer->file) != start - writer->offset) {
+        writer->ok = 0;
+    }
+    writer->offset = start;
+    writer->section = section;
+    writer->header->sections[section].offset = start;
+    writer->header->sections[section].size = 0;
+}
+
+static void append_section(ImageWriter *writer, const void *data, size_t size) {
+    if (size == 0 || !writer->ok) {
+        return;
+    }
+    if (fwrite(data, 1, size, writer->file) != size) {
+        writer->ok = 0;
+        return;
+    }
+    writer->offset += size;
+    writer->header->sections[writer->section].size += size;
+}
+
+static void write_section(ImageWriter *writer, ImageSection section, const void *data, size_t size) {
+    begin_section(writer, section);
+    append_section(writer, data, size);
+}
+
+static void write_queue(ImageWriter *writer, const MailSystem *system, const PostOffice *office) {
+    if (system->queue_kind == QUEUE_HEAP) {
+        append_section(writer, office->letter_heap.data, office->letter_heap.size * sizeof(int));
+        return;
+    }
+    const BucketQueue *queue = &office->letter_buckets;
+    for (int level = 0; queue->levels && level < queue->num_levels; level++) {
+        const BucketLevel *bucket = &queue->levels[level];
+        for (size_t i = 0; i < bucket->size; i++) {
+            append_section(writer, &bucket->data[(bucket->head + i) % bucket->capacity], sizeof(int));
+        }
+    }
+}
+
+static void write_offices(ImageWriter *writer, const MailSystem *system) {
+    uint64_t connections = 0, in_connections = 0, queued = 0;
+    begin_section(writer, IMAGE_SECTION_OFFICES);
+    for (int k = 0; k < system->office_count; k++) {
+        const PostOffice *office = &system->offices[k];
+        ImageOffice record;
+        memset(&record, 0, sizeof(record));
+        record.id = office->id;
+        record.capacity = office->capacity;
+        record.current_letters = office->current_letters;
+        record.num_connections = office->num_connections;
+        record.num_in_connections = office->num_in_connections;
+        record.service_rate = office->service_rate;
+        record.slot = office->slot;
+        record.region = office->region;
+        record.auto_region = office->auto_region;
+        record.first_connection = connections;
+        record.first_in_connection = in_connections;
+        record.first_queued = queued;
+        record.num_queued = system->queue_kind == QUEUE_HEAP ? office->letter_heap.size : office->letter_buckets.size;
+        connections += office->num_connections;
+        in_connections += office->num_in_connections;
+        queued += record.num_queued;
+        append_section(writer, &record, sizeof(record));
+    }
+
+    begin_section(writer, IMAGE_SECTION_CONNECTIONS);
+    for (int k = 0; k < system->office_count; k++) {
+        append_section(writer, system->offices[k].connections, system->offices[k].num_connections * sizeof(int));
+    }
+    begin_section(writer, IMAGE_SECTION_LINKS);
+    for (int k = 0; k < system->office_count; k++) {
+        append_section(writer, system->offices[k].links, system->offices[k].num_connections * sizeof(LinkState));
+    }
+    begin_section(writer, IMAGE_SECTION_IN_CONNECTIONS);
+    for (int k = 0; k < system->office_count; k++) {
+        append_section(writer, system->offices[k].in_connections, system->offices[k].num_in_connections * sizeof(int));
+    }
+    begin_section(writer, IMAGE_SECTION_QUEUES);
+    for (int k = 0; k < system->office_count; k++) {
+        write_queue(writer, system, &system->offices[k]);
+    }
+}
+
+static void write_routes(ImageWriter *writer, const MailSystem *system) {
+    const RoutingTable *routes = &system->routes;
+    int count = routes->office_count;
+    write_section(writer, IMAGE_SECTION_ROUTE_OFFSETS, routes->offsets, (count + 1) * sizeof(int));
+    write_section(writer, IMAGE_SECTION_ROUTE_SOURCES, routes->sources, routes->offsets[count] * sizeof(int));
+    write_section(writer, IMAGE_SECTION_ROUTE_WEIGHTS, routes->weights, routes->offsets[count] * sizeof(int));
+    write_section(writer, IMAGE_SECTION_ROUTE_ROW_OF, routes->row_of, count * sizeof(int));
+    write_section(writer, IMAGE_SECTION_ROUTE_ROW_TARGET, routes->row_target, routes->num_rows * sizeof(int));
+    begin_section(writer, IMAGE_SECTION_ROUTE_ROWS);
+    for (int row = 0; row < routes->num_rows; row++) {
+        append_section(writer, routes->rows[row], count * sizeof(int));
+    }
+}
+
+static void fill_header(ImageHeader *header, const MailSystem *system) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+    header->version = IMAGE_VERSION;
+    header->letter_size = sizeof(Letter);
+    header->queue_kind = system->queue_kind;
+    header->queue_levels = system->queue_levels;
+    header->policy = system->scheduler.policy;
+    header->aging_ticks = system->scheduler.aging_ticks;
+    for (int t = 0; t < LETTER_TYPE_COUNT; t++) {
+        header->weights[t] = system->scheduler.weights[t];
+        header->deadline_ticks[t] = system->scheduler.deadline_ticks[t];
+        header->virtual_finish[t] = system->scheduler.virtual_finish[t];
+        header->scheduled[t] = system->scheduler.classes[t].size;
+    }
+    header->virtual_time = system->scheduler.virtual_time;
+    header->service_rate = system->service_rate;
+    header->link_bandwidth = system->link_bandwidth;
+    header->link_latency = system->link_latency;
+    header->auto_connect = system->auto_connect;
+    header->routing = system->routing;
+    header->retire_interval = system->retire_interval;
+    header->worker_threads = executor_threads(system->executor);
+    header->current_tick = system->current_tick;
+    header->next_letter_id = system->next_letter_id;
+    header->office_count = system->office_count;
+    header->office_slots_size = system->office_slots_size;
+    header->free_office_slot = system->free_office_slot;
+    header->dangling_connections = system->dangling_connections;
+    const RoutingTable *routes = system->topology && !system->topology_dirty ? &system->routes : NULL;
+    header->routes_valid = routes && routes->valid && routes->epoch == system->topology->epoch &&
+                           routes->office_count == system->office_count;
+    header->route_rows = header->routes_valid ? routes->num_rows : 0;
+    header->route_next_victim = header->routes_valid ? routes->next_victim : 0;
+    header->total_occupancy = system->total_occupancy;
+    for (int s = 0; s < LETTER_STATE_COUNT; s++) {
+        header->state_counts[s] = system->state_counts[s];
+    }
+    header->topology_epoch = system->topology_epoch;
+    header->office_table_capacity = system->office_table_capacity;
+    header->letters_size = system->letters_size;
+    header->letter_index_capacity = system->letter_index_capacity;
+    header->archive_spilled = system->archive.spilled;
+    header->archive_spill_threshold = system->archive.spill_threshold;
+    for (int s = 0; s < LETTER_STATE_COUNT; s++) {
+        header->retired_counts[s] = system->archive.retired_counts[s];
+    }
+}
+
+StatusCode save_system_image(MailSystem *system, const char *path) {
+    if (!system || !path || system->topology_changes_size > 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    StatusCode status = release_parked_letters(system);
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return ERROR_FILE_OPERATION;
+    }
+    ImageHeader header;
+    fill_header(&header, system);
+    ImageWriter writer = {file, sizeof(header), &header, IMAGE_SECTION_OFFICES, 1};
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        writer.ok = 0;
+    }
+
+    write_offices(&writer, system);
+    write_section(&writer, IMAGE_SECTION_OFFICE_SLOTS, system->office_slots, system->office_slots_size * sizeof(OfficeSlot));
+    write_section(&writer, IMAGE_SECTION_OFFICE_TABLE, system->office_table, system->office_table_capacity * sizeof(OfficeIndexEntry));
+    write_section(&writer, IMAGE_SECTION_LETTERS, system->letters, system->letters_size * sizeof(Letter));
+    write_section(&writer, IMAGE_SECTION_LETTER_INDEX, system->letter_index, system->letter_index_capacity * sizeof(int));
+    write_section(&writer, IMAGE_SECTION_IN_FLIGHT, system->in_flight.entries, system->in_flight.size * sizeof(InFlightLetter));
+    begin_section(&writer, IMAGE_SECTION_SCHEDULE);
+    for (int t = 0; t < LETTER_TYPE_COUNT; t++) {
+        append_section(&writer, system->scheduler.classes[t].entries, system->scheduler.classes[t].size * sizeof(ScheduleEntry));
+    }
+    if (header.routes_valid) {
+        write_routes(&writer, system);
+    }
+    write_section(&writer, IMAGE_SECTION_ARCHIVE, system->archive.letters, system->archive.size * sizeof(Letter));
+    write_section(&writer, IMAGE_SECTION_SPILL_PATH, system->archive.spill_path,
+                  system->archive.spill_path ? strlen(system->archive.spill_path) : 0);
+    write_section(&writer, IMAGE_SECTION_DELIVERY_STATS, system->delivery_stats,
+                  system->delivery_stats ? sizeof(DeliveryStats) : 0);
+
+    header.length = writer.offset;
+    if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1) {
+        writer.ok = 0;
+    }
+    if (fclose(file) != 0) {
+        writer.ok = 0;
+    }
+    if (!writer.ok) {
+        remove(path);
+        return ERROR_FILE_OPERATION;
+    }
+
+    char log_msg[256];
+    sprintf(log_msg, "Saved system image with %d offices and %zu letters to %s", system->office_count, system->letters_size, path);
+    log_message(system, log_msg);
+    return SUCCESS;
+}
+
+static StatusCode map_image(SystemImage *image, const char *path) {
+    image->fd = open(path, O_RDONLY);
+    image->base = NULL;
+    image->length = 0;
+    if (image->fd < 0) {
+        return ERROR_FILE_OPERATION;
+    }
+    struct stat info;
+    if (fstat(image->fd, &info) != 0 || (size_t)info.st_size < sizeof(ImageHeader)) {
+        system_image_release(image);
+        return ERROR_FILE_OPERATION;
+    }
+    void *base = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, image->fd, 0);
+    if (base == MAP_FAILED) {
+        system_image_release(image);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    image->base = (unsigned char*)base;
+    image->length = (size_t)info.st_size;
+
+    const ImageHeader *header = (const ImageHeader*)image->base;
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 || header->version != IMAGE_VERSION ||
+        header->letter_size != sizeof(Letter) || header->length > image->length) {
+        system_image_release(image);
+        return ERROR_FILE_OPERATION;
+    }
+    for (int s = 0; s < IMAGE_SECTIONS; s++) {
+        const ImageSectionRef *ref = &header->sections[s];
+        if (ref->offset % IMAGE_ALIGNMENT != 0 || ref->offset > header->length || ref->size > header->length - ref->offset) {
+            system_image_release(image);
+            return ERROR_FILE_OPERATION;
+        }
+    }
+    return SUCCESS;
+}
+
+static void* section_data(const SystemImage *image, ImageSection section, uint64_t count, size_t element) {
+    const ImageHeader *header = (const ImageHeader*)image->base;
+    const ImageSectionRef *ref = &header->sections[section];
+    if (ref->size != count * element || count == 0) {
+        return NULL;
+    }
+    return image->base + ref->offset;
+}
+
+static int section_holds(const SystemImage *image, ImageSection section, uint64_t first, uint64_t count, size_t element) {
+    const ImageHeader *header = (const ImageHeader*)image->base;
+    return first <= header->sections[section].size / element && count <= header->sections[section].size / element - first;
+}
+
+static int* copy_ints(const int *data, size_t count, size_t capacity) {
+    int *copy = (int*)malloc((capacity > 0 ? capacity : 1) * sizeof(int));
+    if (copy && count > 0) {
+        memcpy(copy, data, count * sizeof(int));
+    }
+    return copy;
+}
+
+static StatusCode attach_queue(MailSystem *system, PostOffice *office, const int *queued, size_t count) {
+    if (system->queue_kind == QUEUE_HEAP) {
+        for (size_t i = 0; i < count; i++) {
+            const Letter *letter = find_letter(system, queued[i]);
+            push_heap_keyed(&office->letter_heap, queued[i], letter ? letter->priority : 0);
+        }
+        return office->letter_heap.size == count && office->letter_heap.keys ? SUCCESS : ERROR_MEMORY_ALLOCATION;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const Letter *letter = find_letter(system, queued[i]);
+        push_bucket_queue(&office->letter_buckets, letter ? letter->priority : 0, queued[i]);
+    }
+    return office->letter_buckets.size == count ? SUCCESS : ERROR_MEMORY_ALLOCATION;
+}
+
+static StatusCode attach_office(MailSystem *system, const ImageOffice *record, PostOffice *office) {
+    const SystemImage *image = system->image;
+    memset(office, 0, sizeof(*office));
+    office->letter_heap = system->queue_kind == QUEUE_HEAP ? create_keyed_heap(INITIAL_CAPACITY) : create_heap(0);
+    office->letter_buckets = create_bucket_queue(system->queue_kind == QUEUE_BUCKET ? system->queue_levels : 0);
+    if (record->num_connections < 0 || record->num_connections > MAX_CONNECTIONS || record->num_in_connections < 0 ||
+        !section_holds(image, IMAGE_SECTION_CONNECTIONS, record->first_connection, record->num_connections, sizeof(int)) ||
+        !section_holds(image, IMAGE_SECTION_LINKS, record->first_connection, record->num_connections, sizeof(LinkState)) ||
+        !section_holds(image, IMAGE_SECTION_IN_CONNECTIONS, record->first_in_connection, record->num_in_connections, sizeof(int)) ||
+        !section_holds(image, IMAGE_SECTION_QUEUES, record->first_queued, record->num_queued, sizeof(int))) {
+        return ERROR_FILE_OPERATION;
+    }
+    const ImageHeader *header = (const ImageHeader*)image->base;
+    const int *connections = (const int*)(image->base + header->sections[IMAGE_SECTION_CONNECTIONS].offset) + record->first_connection;
+    const LinkState *links = (const LinkState*)(image->base + header->sections[IMAGE_SECTION_LINKS].offset) + record->first_connection;
+    const int *in_connections = (const int*)(image->base + header->sections[IMAGE_SECTION_IN_CONNECTIONS].offset) + record->first_in_connection;
+    const int *queued = (const int*)(image->base + header->sections[IMAGE_SECTION_QUEUES].offset) + record->first_queued;
+
+    office->id = record->id;
+    office->capacity = record->capacity;
+    office->current_letters = record->current_letters;
+    office->service_rate = record->service_rate;
+    office->slot = record->slot;
+    office->region = record->region;
+    office->auto_region = record->auto_region;
+    if (record->num_connections > 0) {
+        office->connections = copy_ints(connections, record->num_connections, MAX_CONNECTIONS);
+        office->links = (LinkState*)malloc(MAX_CONNECTIONS * sizeof(LinkState));
+        if (!office->connections || !office->links) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        memcpy(office->links, links, record->num_connections * sizeof(LinkState));
+        office->num_connections = record->num_connections;
+    }
+    if (record->num_in_connections > 0) {
+        office->in_connections = copy_ints(in_connections, record->num_in_connections, record->num_in_connections);
+        if (!office->in_connections) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        office->num_in_connections = record->num_in_connections;
+        office->in_connections_capacity = record->num_in_connections;
+    }
+    return attach_queue(system, office, queued, (size_t)record->num_queued);
+}
+
+static StatusCode attach_routes(MailSystem *system, const ImageHeader *header) {
+    const SystemImage *image = system->image;
+    int count = system->office_count;
+    apply_topology_changes(system);
+    if (!system->topology || system->topology->office_count != count) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    RoutingTable *routes = &system->routes;
+    const int *offsets = (const int*)section_data(image, IMAGE_SECTION_ROUTE_OFFSETS, count + 1, sizeof(int));
+    if (!offsets || offsets[count] < 0 || header->route_rows < 0 || header->route_rows > ROUTE_CACHE_ROWS) {
+        return ERROR_FILE_OPERATION;
+    }
+    const int *sources = (const int*)(image->base + header->sections[IMAGE_SECTION_ROUTE_SOURCES].offset);
+    const int *weights = (const int*)(image->base + header->sections[IMAGE_SECTION_ROUTE_WEIGHTS].offset);
+    const int *row_of = (const int*)section_data(image, IMAGE_SECTION_ROUTE_ROW_OF, count, sizeof(int));
+    const int *row_target = (const int*)(image->base + header->sections[IMAGE_SECTION_ROUTE_ROW_TARGET].offset);
+    const int *rows = (const int*)(image->base + header->sections[IMAGE_SECTION_ROUTE_ROWS].offset);
+    if (!row_of || header->sections[IMAGE_SECTION_ROUTE_SOURCES].size != offsets[count] * sizeof(int) ||
+        header->sections[IMAGE_SECTION_ROUTE_WEIGHTS].size != offsets[count] * sizeof(int) ||
+        header->sections[IMAGE_SECTION_ROUTE_ROW_TARGET].size != header->route_rows * sizeof(int) ||
+        header->sections[IMAGE_SECTION_ROUTE_ROWS].size != (uint64_t)header->route_rows * count * sizeof(int)) {
+        return ERROR_FILE_OPERATION;
+    }
+
+    routes->offsets = copy_ints(offsets, count + 1, count + 1);
+    routes->sources = copy_ints(sources, offsets[count], offsets[count] + 1);
+    routes->weights = copy_ints(weights, offsets[count], offsets[count] + 1);
+    routes->row_of = copy_ints(row_of, count, count + 1);
+    routes->row_target = copy_ints(row_target, header->route_rows, ROUTE_CACHE_ROWS);
+    routes->rows = (int**)calloc(ROUTE_CACHE_ROWS, sizeof(int*));
+    if (!routes->offsets || !routes->sources || !routes->weights || !routes->row_of || !routes->row_target || !routes->rows) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    routes->office_count = count;
+    for (int row = 0; row < header->route_rows; row++) {
+        routes->rows[row] = copy_ints(rows + (size_t)row * count, count, count + 1);
+        if (!routes->rows[row]) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        routes->num_rows = row + 1;
+    }
+    routes->next_victim = header->route_next_victim;
+    routes->epoch = system->topology->epoch;
+    routes->valid = 1;
+    return SUCCESS;
+}
+
+static StatusCode attach_letters(MailSystem *system, const ImageHeader *header) {
+    const SystemImage *image = system->image;
+    system->letters = (Letter*)section_data(image, IMAGE_SECTION_LETTERS, header->letters_size, sizeof(Letter));
+    system->letter_index = (int*)section_data(image, IMAGE_SECTION_LETTER_INDEX, header->letter_index_capacity, sizeof(int));
+    if ((!system->letters && header->letters_size > 0) || (!system->letter_index && header->letter_index_capacity > 0) ||
+        header->next_letter_id < 1) {
+        system->letters = NULL;
+        system->letter_index = NULL;
+        return ERROR_FILE_OPERATION;
+    }
+    system->letters_size = header->letters_size;
+    system->letters_capacity = header->letters_size;
+    system->letter_index_capacity = header->letter_index_capacity;
+    system->next_letter_id = header->next_letter_id;
+
+    size_t in_flight = header->sections[IMAGE_SECTION_IN_FLIGHT].size / sizeof(InFlightLetter);
+    if (in_flight > 0) {
+        system->in_flight.entries = (InFlightLetter*)malloc(in_flight * sizeof(InFlightLetter));
+        if (!system->in_flight.entries) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        memcpy(system->in_flight.entries, image->base + header->sections[IMAGE_SECTION_IN_FLIGHT].offset,
+               in_flight * sizeof(InFlightLetter));
+        system->in_flight.size = in_flight;
+        system->in_flight.capacity = in_flight;
+    }
+
+    const ScheduleEntry *scheduled = (const ScheduleEntry*)(image->base + header->sections[IMAGE_SECTION_SCHEDULE].offset);
+    if (header->sections[IMAGE_SECTION_SCHEDULE].size != (header->scheduled[REGULAR] + header->scheduled[URGENT]) * sizeof(ScheduleEntry)) {
+        return ERROR_FILE_OPERATION;
+    }
+    for (int t = 0; t < LETTER_TYPE_COUNT; t++) {
+        ScheduleQueue *queue = &system->scheduler.classes[t];
+        if (header->scheduled[t] > 0) {
+            queue->entries = (ScheduleEntry*)malloc(header->scheduled[t] * sizeof(ScheduleEntry));
+            if (!queue->entries) {
+                return ERROR_MEMORY_ALLOCATION;
+            }
+            memcpy(queue->entries, scheduled, header->scheduled[t] * sizeof(ScheduleEntry));
+            queue->size = header->scheduled[t];
+            queue->capacity = header->scheduled[t];
+        }
+        scheduled += header->scheduled[t];
+        system->scheduler.virtual_finish[t] = header->virtual_finish[t];
+    }
+    system->scheduler.virtual_time = header->virtual_time;
+    return SUCCESS;
+}
+
+static StatusCode attach_archive(MailSystem *system, const ImageHeader *header) {
+    const SystemImage *image = system->image;
+    LetterArchive *archive = &system->archive;
+    const ImageSectionRef *letters = &header->sections[IMAGE_SECTION_ARCHIVE];
+    const ImageSectionRef *path = &header->sections[IMAGE_SECTION_SPILL_PATH];
+    const ImageSectionRef *stats = &header->sections[IMAGE_SECTION_DELIVERY_STATS];
+    if (letters->size % sizeof(Letter) != 0 || (stats->size != 0 && stats->size != sizeof(DeliveryStats)) ||
+        (header->archive_spilled > 0 && path->size == 0)) {
+        return ERROR_FILE_OPERATION;
+    }
+
+    size_t count = letters->size / sizeof(Letter);
+    if (count > 0) {
+        archive->letters = (Letter*)malloc(count * sizeof(Letter));
+        if (!archive->letters) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        memcpy(archive->letters, image->base + letters->offset, count * sizeof(Letter));
+        archive->size = count;
+        archive->capacity = count;
+    }
+    archive->spilled = header->archive_spilled;
+    for (int s = 0; s < LETTER_STATE_COUNT; s++) {
+        archive->retired_counts[s] = header->retired_counts[s];
+    }
+    if (path->size > 0) {
+        archive->spill_path = (char*)malloc(path->size + 1);
+        if (!archive->spill_path) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        memcpy(archive->spill_path, image->base + path->offset, path->size);
+        archive->spill_path[path->size] = '\0';
+        archive->spill_file = fopen(archive->spill_path, "r+b");
+        if (!archive->spill_file || fseek(archive->spill_file, 0, SEEK_END) != 0) {
+            return ERROR_FILE_OPERATION;
+        }
+        archive->spill_threshold = header->archive_spill_threshold > 0 ? header->archive_spill_threshold : 1;
+    }
+
+    if (stats->size > 0) {
+        system->delivery_stats = (DeliveryStats*)malloc(sizeof(DeliveryStats));
+        if (!system->delivery_stats) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        memcpy(system->delivery_stats, image->base + stats->offset, sizeof(DeliveryStats));
+    }
+    return SUCCESS;
+}
+
+static StatusCode attach_image(MailSystem *system, const ImageHeader *header) {
+    const SystemImage *image = system->image;
+    StatusCode status = attach_letters(system, header);
+    if (status == SUCCESS) {
+        status = attach_archive(system, header);
+    }
+    if (status != SUCCESS) {
+        return status;
+    }
+
+    const ImageOffice *records = (const ImageOffice*)section_data(image, IMAGE_SECTION_OFFICES, header->office_count, sizeof(ImageOffice));
+    system->office_slots = (OfficeSlot*)section_data(image, IMAGE_SECTION_OFFICE_SLOTS, header->office_slots_size, sizeof(OfficeSlot));
+    system->office_table = (OfficeIndexEntry*)section_data(image, IMAGE_SECTION_OFFICE_TABLE, header->office_table_capacity, sizeof(OfficeIndexEntry));
+    if (header->office_count < 0 || (!records && header->office_count > 0) ||
+        (!system->office_slots && header->office_slots_size > 0) || (!system->office_table && header->office_table_capacity > 0)) {
+        system->office_slots = NULL;
+        system->office_table = NULL;
+        return ERROR_FILE_OPERATION;
+    }
+    system->office_slots_size = header->office_slots_size;
+    system->office_slots_capacity = header->office_slots_size;
+    system->free_office_slot = header->free_office_slot;
+    system->office_table_capacity = header->office_table_capacity;
+    system->dangling_connections = header->dangling_connections;
+
+    if (header->office_count > 0) {
+        system->offices = (PostOffice*)malloc(header->office_count * sizeof(PostOffice));
+        if (!system->offices) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        system->office_capacity = header->office_count;
+    }
+    for (int k = 0; k < header->office_count; k++) {
+        status = attach_office(system, &records[k], &system->offices[k]);
+        system->office_count = k + 1;
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+
+    system->current_tick = header->current_tick;
+    system->total_occupancy = header->total_occupancy;
+    for (int s = 0; s < LETTER_STATE_COUNT; s++) {
+        system->state_counts[s] = header->state_counts[s];
+    }
+    system->topology_epoch = header->topology_epoch;
+    system->retire_interval = header->retire_interval;
+    return header->routes_valid ? attach_routes(system, header) : SUCCESS;
+}
+
+StatusCode init_system_from_image(MailSystem *system, const char *path) {
+    if (!system || !path) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    init_system(system);
+
+    SystemImage *image = (SystemImage*)malloc(sizeof(SystemImage));
+    if (!image) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    StatusCode status = map_image(image, path);
+    if (status != SUCCESS) {
+        free(image);
+        return status;
+    }
+
+    const ImageHeader *header = (const ImageHeader*)image->base;
+    SystemConfig config;
+    default_system_config(&config);
+    config.queue_kind = (QueueKind)header->queue_kind;
+    config.max_priority = header->queue_levels - 1;
+    config.policy = (SchedulingPolicy)header->policy;
+    config.aging_ticks = header->aging_ticks;
+    for (int t = 0; t < LETTER_TYPE_COUNT; t++) {
+        config.weights[t] = header->weights[t];
+        config.deadline_ticks[t] = header->deadline_ticks[t];
+    }
+    config.service_rate = header->service_rate;
+    config.link_bandwidth = header->link_bandwidth;
+    config.link_latency = header->link_latency;
+    config.auto_connect = header->auto_connect;
+    config.routing = (RoutingMode)header->routing;
+    config.worker_threads = header->worker_threads;
+    cleanup_system(system);
+    init_system_with_config(system, &config);
+    system->image = image;
+    if (system->queue_kind != (QueueKind)header->queue_kind) {
+        status = ERROR_FILE_OPERATION;
+    } else {
+        status = attach_image(system, header);
+    }
+    if (status != SUCCESS) {
+        cleanup_system(system);
+        init_system(system);
+        return status;
+    }
+    recount_memory(system);
+
+    char log_msg[256];
+    sprintf(log_msg, "Attached system image %s with %d offices and %zu letters", path, system->office_count, system->letters_size);
+    log_message(system, log_msg);
+    return SUCCESS;
+}
+
+int system_image_contains(const SystemImage *image, const void *data) {
+    if (!image || !image->base || !data) {
+        return 0;
+    }
+    const unsigned char *pointer = (const unsigned char*)data;
+    return pointer >= image->base && pointer < image->base + image->length;
+}
+
+void system_image_release(SystemImage *image) {
+    if (!image) {
+        return;
+    }
+    if (image->base) {
+        munmap(image->base, image->length);
+    }
+    if (image->fd >= 0) {
+        close(image->fd);
+    }
+    image->base = NULL;
+    image->length = 0;
+    image->fd = -1;
+}
@@ -0,0 +1,109 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+#include "funcs.h"
+
+#define IMAGE_MAGIC "MLIMAGE1"
+#define IMAGE_VERSION 3
+#define IMAGE_ALIGNMENT 64
+
+typedef enum {
+    IMAGE_SECTION_OFFICES,
+    IMAGE_SECTION_OFFICE_SLOTS,
+    IMAGE_SECTION_OFFICE_TABLE,
+    IMAGE_SECTION_CONNECTIONS,
+    IMAGE_SECTION_LINKS,
+    IMAGE_SECTION_IN_CONNECTIONS,
+    IMAGE_SECTION_QUEUES,
+    IMAGE_SECTION_LETTERS,
+    IMAGE_SECTION_LETTER_INDEX,
+    IMAGE_SECTION_IN_FLIGHT,
+    IMAGE_SECTION_SCHEDULE,
+    IMAGE_SECTION_ROUTE_OFFSETS,
+    IMAGE_SECTION_ROUTE_SOURCES,
+    IMAGE_SECTION_ROUTE_WEIGHTS,
+    IMAGE_SECTION_ROUTE_ROW_OF,
+    IMAGE_SECTION_ROUTE_ROW_TARGET,
+    IMAGE_SECTION_ROUTE_ROWS,
+    IMAGE_SECTION_ARCHIVE,
+    IMAGE_SECTION_SPILL_PATH,
+    IMAGE_SECTION_DELIVERY_STATS,
+    IMAGE_SECTIONS
+} ImageSection;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} ImageSectionRef;
+
+typedef struct {
+    int32_t id;
+    int32_t capacity;
+    int32_t current_letters;
+    int32_t num_connections;
+    int32_t num_in_connections;
+    int32_t service_rate;
+    int32_t slot;
+    int32_t region;
+    int32_t auto_region;
+    uint64_t first_connection;
+    uint64_t first_in_connection;
+    uint64_t first_queued;
+    uint64_t num_queued;
+} ImageOffice;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t letter_size;
+    uint64_t length;
+    int32_t queue_kind;
+    int32_t queue_levels;
+    int32_t policy;
+    int32_t aging_ticks;
+    int32_t weights[LETTER_TYPE_COUNT];
+    int32_t deadline_ticks[LETTER_TYPE_COUNT];
+    int64_t virtual_finish[LETTER_TYPE_COUNT];
+    int64_t virtual_time;
+    uint64_t scheduled[LETTER_TYPE_COUNT];
+    int32_t service_rate;
+    int32_t link_bandwidth;
+    int32_t link_latency;
+    int32_t auto_connect;
+    int32_t routing;
+    int32_t retire_interval;
+    int32_t worker_threads;
+    int32_t current_tick;
+    int32_t next_letter_id;
+    int32_t office_count;
+    int32_t office_slots_size;
+    int32_t free_office_slot;
+    int32_t dangling_connections;
+    int32_t route_rows;
+    int32_t route_next_victim;
+    int32_t routes_valid;
+    int64_t total_occupancy;
+    uint64_t state_counts[LETTER_STATE_COUNT];
+    uint64_t topology_epoch;
+    uint64_t office_table_capacity;
+    uint64_t letters_size;
+    uint64_t letter_index_capacity;
+    uint64_t archive_spilled;
+    uint64_t archive_spill_threshold;
+    uint64_t retired_counts[LETTER_STATE_COUNT];
+    ImageSectionRef sections[IMAGE_SECTIONS];
+} ImageHeader;
+
+typedef struct SystemImage {
+    int fd;
+    unsigned char *base;
+    size_t length;
+} SystemImage;
+
+StatusCode save_system_image(MailSystem *system, const char *path);
+StatusCode init_system_from_image(MailSystem *system, const char *path);
+int system_image_contains(const SystemImage *image, const void *data);
+void system_image_release(SystemImage *image);
+
+#endif
@@ -8,7 +8,11 @@ static void print_menu(int auto_transfer_enabled) {
     printf("5. Show office connections\n");
     printf("6. System status\n");
     printf("7. %s delivery\n", auto_transfer_enabled ? "Stop" : "Start");
-    printf("8. Exit\n");
+    printf("8. Performance counters\n");
+    printf("9. Delivery report\n");
+    printf("10. Office occupancy\n");
+    printf("11. Memory footprint\n");
+    printf("12. Exit\n");
     printf("Select an option: ");
 }
 
@@ -22,6 +26,7 @@ int main(int argc, char *argv[]) {
     
     MailSystem system;
     init_system(&system);
+    system.retire_interval = 100;
     open_log_file(&system, log_file);
     
     int main_running = 1;
@@ -132,7 +137,27 @@ int main(int argc, char *argv[]) {
                 break;
             }
             
-            case 8:
+            case 8: {
+                dump_stats(stdout);
+                break;
+            }
+            
+            case 9: {
+                print_delivery_report(&system, stdout);
+                break;
+            }
+            
+            case 10: {
+                print_office_histogram(&system, 1000);
+                break;
+            }
+            
+            case 11: {
+                print_memory_report(&system, stdout);
+                break;
+            }
+            
+            case 12:
                 main_running = 0;
                 printf("Exit\n");
                 break;
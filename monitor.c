@@ -0,0 +1,100 @@
+#define _POSIX_C_SOURCE 199309L
+#include "statusview.h"
+
+static void print_usage(const char *program) {
+    printf("Usage: %s name=/SEGMENT [interval_ms=N] [count=N] [top=N]\n", program);
+}
+
+static void sleep_ms(int milliseconds) {
+    struct timespec delay;
+    delay.tv_sec = milliseconds / 1000;
+    delay.tv_nsec = (long)(milliseconds % 1000) * 1000000L;
+    nanosleep(&delay, NULL);
+}
+
+static void print_busiest(const StatusOfficeEntry *offices, int num_offices, int top) {
+    unsigned char *shown = calloc(num_offices > 0 ? num_offices : 1, 1);
+    if (!shown) {
+        return;
+    }
+    for (int rank = 0; rank < top && rank < num_offices; rank++) {
+        int best = -1;
+        for (int k = 0; k < num_offices; k++) {
+            if (!shown[k] && (best < 0 || offices[k].current_letters > offices[best].current_letters)) {
+                best = k;
+            }
+        }
+        if (best < 0 || offices[best].current_letters == 0) {
+            break;
+        }
+        shown[best] = 1;
+        printf("  office %d: %d/%d letters (region %d)\n",
+               offices[best].id, offices[best].current_letters, offices[best].capacity, offices[best].region);
+    }
+    free(shown);
+}
+
+int main(int argc, char *argv[]) {
+    const char *name = NULL;
+    int interval_ms = 1000;
+    int count = 0;
+    int top = 5;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "name=", 5) == 0) name = argv[i] + 5;
+        else if (strncmp(argv[i], "interval_ms=", 12) == 0) interval_ms = atoi(argv[i] + 12);
+        else if (strncmp(argv[i], "count=", 6) == 0) count = atoi(argv[i] + 6);
+        else if (strncmp(argv[i], "top=", 4) == 0) top = atoi(argv[i] + 4);
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!name || interval_ms < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    StatusView view;
+    if (status_view_attach(&view, name) != SUCCESS) {
+        printf("Error attaching to status view: %s\n", name);
+        return 1;
+    }
+
+    StatusOfficeEntry *offices = NULL;
+    int offices_capacity = 0;
+    int status = 0;
+    for (int poll = 0; count <= 0 || poll < count; poll++) {
+        if (poll > 0) {
+            sleep_ms(interval_ms);
+        }
+        int office_count = view.segment->office_count;
+        if (office_count > offices_capacity) {
+            StatusOfficeEntry *grown = realloc(offices, (size_t)office_count * sizeof(StatusOfficeEntry));
+            if (!grown) {
+                status = 1;
+                break;
+            }
+            offices = grown;
+            offices_capacity = office_count;
+        }
+
+        StatusSnapshot snapshot;
+        int num_offices = 0;
+        if (status_view_read(&view, &snapshot, offices, offices_capacity, &num_offices) != SUCCESS) {
+            printf("Error reading status view: %s\n", name);
+            status = 1;
+            break;
+        }
+        printf("tick %d: offices %d, occupancy %lld, in transit %llu, delivered %llu, undelivered %llu, transfers %llu\n",
+               snapshot.tick, snapshot.office_count, snapshot.total_occupancy,
+               snapshot.state_counts[IN_TRANSIT], snapshot.state_counts[DELIVERED], snapshot.state_counts[UNDELIVERED],
+               snapshot.counters[STAT_TRANSFERS]);
+        print_busiest(offices, num_offices, top);
+        fflush(stdout);
+    }
+
+    free(offices);
+    status_view_close(&view);
+    return status;
+}
@@ -0,0 +1,113 @@
+#include "trace.h"
+
+typedef struct {
+    FILE *csv;
+    ReplayTick *slowest;
+    int top;
+    int num_slowest;
+} ReplayOutput;
+
+static void print_usage(const char *program) {
+    printf("Usage: %s trace=FILE [threads=N] [top=N] [csv=FILE]\n", program);
+}
+
+static void record_tick(void *context, const ReplayTick *tick) {
+    ReplayOutput *output = (ReplayOutput*)context;
+    if (output->csv) {
+        fprintf(output->csv, "%d,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%zu,%lld\n",
+                tick->tick, tick_kind_name(tick->kind), tick->total_ns,
+                tick->phase_ns[TICK_PHASE_TOPOLOGY], tick->phase_ns[TICK_PHASE_PLAN],
+                tick->phase_ns[TICK_PHASE_TRANSFER], tick->phase_ns[TICK_PHASE_FINISH],
+                tick->transfers, tick->deliveries, tick->live_letters, tick->occupancy);
+    }
+
+    int slot = output->num_slowest;
+    if (slot == output->top) {
+        if (slot == 0 || output->slowest[slot - 1].total_ns >= tick->total_ns) {
+            return;
+        }
+        slot--;
+    } else {
+        output->num_slowest++;
+    }
+    while (slot > 0 && output->slowest[slot - 1].total_ns < tick->total_ns) {
+        output->slowest[slot] = output->slowest[slot - 1];
+        slot--;
+    }
+    output->slowest[slot] = *tick;
+}
+
+static void print_slowest(const ReplayOutput *output) {
+    if (output->num_slowest == 0) {
+        return;
+    }
+    printf("Slowest ticks:\n");
+    for (int i = 0; i < output->num_slowest; i++) {
+        const ReplayTick *tick = &output->slowest[i];
+        printf("  tick %d (%s): %.1f us [", tick->tick, tick_kind_name(tick->kind), tick->total_ns / 1000.0);
+        for (int p = 0; p < TICK_PHASE_COUNT; p++) {
+            printf("%s%s %.1f", p ? ", " : "", tick_phase_name((TickPhase)p), tick->phase_ns[p] / 1000.0);
+        }
+        printf("] transfers %llu, deliveries %llu, live letters %zu, occupancy %lld\n",
+               tick->transfers, tick->deliveries, tick->live_letters, tick->occupancy);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *trace_file = NULL;
+    const char *csv_file = NULL;
+    int threads = 0;
+    int top = 5;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "trace=", 6) == 0) trace_file = argv[i] + 6;
+        else if (strncmp(argv[i], "threads=", 8) == 0) threads = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "top=", 4) == 0) top = atoi(argv[i] + 4);
+        else if (strncmp(argv[i], "csv=", 4) == 0) csv_file = argv[i] + 4;
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!trace_file || top < 0 || threads < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    ReplayOutput output;
+    output.csv = NULL;
+    output.top = top;
+    output.num_slowest = 0;
+    output.slowest = (ReplayTick*)malloc((top + 1) * sizeof(ReplayTick));
+    if (!output.slowest) {
+        printf("Error allocating replay buffers\n");
+        return 1;
+    }
+    if (csv_file) {
+        output.csv = fopen(csv_file, "w");
+        if (!output.csv) {
+            printf("Error opening csv file: %s\n", csv_file);
+            free(output.slowest);
+            return 1;
+        }
+        fprintf(output.csv, "tick,kind,total_ns,topology_ns,plan_ns,transfer_ns,finish_ns,transfers,deliveries,live_letters,occupancy\n");
+    }
+
+    MailSystem system;
+    ReplayReport *report = (ReplayReport*)malloc(sizeof(ReplayReport));
+    StatusCode status = report ? replay_trace(trace_file, &system, threads, record_tick, &output, report) : ERROR_MEMORY_ALLOCATION;
+    if (status != SUCCESS) {
+        printf("Error replaying trace %s: %d\n", trace_file, status);
+    } else {
+        print_replay_report(stdout, report);
+        print_slowest(&output);
+    }
+
+    cleanup_system(&system);
+    if (output.csv) {
+        fclose(output.csv);
+    }
+    free(output.slowest);
+    free(report);
+    return status == SUCCESS ? 0 : 1;
+}
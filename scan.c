@@ -0,0 +1,255 @@
+#include "scan.h"
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#else
+#define SCAN_X86 0
+#endif
+
+#define LETTER_STRIDE ((int)(sizeof(Letter) / sizeof(int)))
+
+typedef struct {
+    int (*find_int)(const int *values, size_t count, int needle);
+    size_t (*count_int)(const int *values, size_t count, int needle);
+    size_t (*mark_range)(const int *values, size_t count, int lo, int hi, unsigned char *marks);
+    void (*count_states)(const Letter *letters, size_t count, size_t *counts);
+} ScanKernels;
+
+static int find_int_scalar(const int *values, size_t count, int needle) {
+    for (size_t i = 0; i < count; i++) {
+        if (values[i] == needle) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static size_t count_int_scalar(const int *values, size_t count, int needle) {
+    size_t matches = 0;
+    for (size_t i = 0; i < count; i++) {
+        matches += values[i] == needle;
+    }
+    return matches;
+}
+
+static size_t mark_range_scalar(const int *values, size_t count, int lo, int hi, unsigned char *marks) {
+    size_t matches = 0;
+    for (size_t i = 0; i < count; i++) {
+        int match = values[i] >= lo && values[i] <= hi;
+        marks[i] |= (unsigned char)match;
+        matches += match;
+    }
+    return matches;
+}
+
+static void count_states_scalar(const Letter *letters, size_t count, size_t *counts) {
+    for (size_t i = 0; i < count; i++) {
+        counts[letters[i].state]++;
+    }
+}
+
+#if SCAN_X86
+__attribute__((target("sse4.1")))
+static int find_int_sse41(const int *values, size_t count, int needle) {
+    __m128i key = _mm_set1_epi32(needle);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i hits = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(values + i)), key);
+        if (!_mm_testz_si128(hits, hits)) {
+            return (int)i + __builtin_ctz((unsigned)_mm_movemask_ps(_mm_castsi128_ps(hits)));
+        }
+    }
+    int tail = find_int_scalar(values + i, count - i, needle);
+    return tail < 0 ? -1 : (int)i + tail;
+}
+
+__attribute__((target("sse4.1")))
+static size_t count_int_sse41(const int *values, size_t count, int needle) {
+    __m128i key = _mm_set1_epi32(needle);
+    __m128i total = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        total = _mm_sub_epi32(total, _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(values + i)), key));
+    }
+    int lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, total);
+    return (size_t)lanes[0] + lanes[1] + lanes[2] + lanes[3] + count_int_scalar(values + i, count - i, needle);
+}
+
+__attribute__((target("sse4.1")))
+static size_t mark_range_sse41(const int *values, size_t count, int lo, int hi, unsigned char *marks) {
+    __m128i low = _mm_set1_epi32(lo);
+    __m128i high = _mm_set1_epi32(hi);
+    size_t matches = 0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+        __m128i inside = _mm_and_si128(_mm_cmpeq_epi32(_mm_max_epi32(v, low), v), _mm_cmpeq_epi32(_mm_min_epi32(v, high), v));
+        unsigned mask = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(inside));
+        for (int lane = 0; mask && lane < 4; lane++) {
+            marks[i + lane] |= (unsigned char)((mask >> lane) & 1);
+        }
+        matches += (size_t)__builtin_popcount(mask);
+    }
+    return matches + mark_range_scalar(values + i, count - i, lo, hi, marks + i);
+}
+
+__attribute__((target("avx2")))
+static int find_int_avx2(const int *values, size_t count, int needle) {
+    __m256i key = _mm256_set1_epi32(needle);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i hits = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(values + i)), key);
+        unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hits));
+        if (mask) {
+            return (int)i + __builtin_ctz(mask);
+        }
+    }
+    int tail = find_int_scalar(values + i, count - i, needle);
+    return tail < 0 ? -1 : (int)i + tail;
+}
+
+__attribute__((target("avx2")))
+static size_t count_int_avx2(const int *values, size_t count, int needle) {
+    __m256i key = _mm256_set1_epi32(needle);
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        total = _mm256_sub_epi32(total, _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(values + i)), key));
+    }
+    int lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, total);
+    size_t matches = 0;
+    for (int lane = 0; lane < 8; lane++) {
+        matches += (size_t)lanes[lane];
+    }
+    return matches + count_int_scalar(values + i, count - i, needle);
+}
+
+__attribute__((target("avx2")))
+static size_t mark_range_avx2(const int *values, size_t count, int lo, int hi, unsigned char *marks) {
+    __m256i low = _mm256_set1_epi32(lo);
+    __m256i high = _mm256_set1_epi32(hi);
+    size_t matches = 0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+        __m256i inside = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_max_epi32(v, low), v), _mm256_cmpeq_epi32(_mm256_min_epi32(v, high), v));
+        unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(inside));
+        for (int lane = 0; mask && lane < 8; lane++) {
+            marks[i + lane] |= (unsigned char)((mask >> lane) & 1);
+        }
+        matches += (size_t)__builtin_popcount(mask);
+    }
+    return matches + mark_range_scalar(values + i, count - i, lo, hi, marks + i);
+}
+
+__attribute__((target("avx2")))
+static void count_states_avx2(const Letter *letters, size_t count, size_t *counts) {
+    const __m256i offsets = _mm256_setr_epi32(0, LETTER_STRIDE, 2 * LETTER_STRIDE, 3 * LETTER_STRIDE,
+                                              4 * LETTER_STRIDE, 5 * LETTER_STRIDE, 6 * LETTER_STRIDE, 7 * LETTER_STRIDE);
+    __m256i totals[LETTER_STATE_COUNT];
+    for (int s = 0; s < LETTER_STATE_COUNT; s++) {
+        totals[s] = _mm256_setzero_si256();
+    }
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const int *base = (const int*)((const char*)&letters[i] + offsetof(Letter, state));
+        __m256i states = _mm256_i32gather_epi32(base, offsets, 4);
+        for (int s = 0; s < LETTER_STATE_COUNT; s++) {
+            totals[s] = _mm256_sub_epi32(totals[s], _mm256_cmpeq_epi32(states, _mm256_set1_epi32(s)));
+        }
+    }
+    for (int s = 0; s < LETTER_STATE_COUNT; s++) {
+        int lanes[8];
+        _mm256_storeu_si256((__m256i*)lanes, totals[s]);
+        for (int lane = 0; lane < 8; lane++) {
+            counts[s] += (size_t)lanes[lane];
+        }
+    }
+    count_states_scalar(letters + i, count - i, counts);
+}
+#endif
+
+static const ScanKernels scan_kernels[] = {
+    {find_int_scalar, count_int_scalar, mark_range_scalar, count_states_scalar},
+#if SCAN_X86
+    {find_int_sse41, count_int_sse41, mark_range_sse41, count_states_scalar},
+    {find_int_avx2, count_int_avx2, mark_range_avx2, count_states_avx2}
+#endif
+};
+
+static int active_level = -1;
+
+static ScanLevel supported_level(void) {
+#if SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SCAN_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SCAN_SSE41;
+    }
+#endif
+    return SCAN_SCALAR;
+}
+
+static const ScanKernels* kernels(void) {
+    int level = __atomic_load_n(&active_level, __ATOMIC_RELAXED);
+    if (level < 0) {
+        level = (int)supported_level();
+        __atomic_store_n(&active_level, level, __ATOMIC_RELAXED);
+    }
+    return &scan_kernels[level];
+}
+
+ScanLevel scan_level(void) {
+    return (ScanLevel)(kernels() - scan_kernels);
+}
+
+ScanLevel scan_set_level(ScanLevel level) {
+    ScanLevel supported = supported_level();
+    if (level > supported) {
+        level = supported;
+    }
+    __atomic_store_n(&active_level, (int)level, __ATOMIC_RELAXED);
+    return level;
+}
+
+const char* scan_level_name(ScanLevel level) {
+    switch (level) {
+        case SCAN_SCALAR: return "scalar";
+        case SCAN_SSE41: return "sse4.1";
+        case SCAN_AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+int scan_find_int(const int *values, size_t count, int needle) {
+    if (!values || count == 0) {
+        return -1;
+    }
+    return kernels()->find_int(values, count, needle);
+}
+
+size_t scan_count_int(const int *values, size_t count, int needle) {
+    if (!values || count == 0) {
+        return 0;
+    }
+    return kernels()->count_int(values, count, needle);
+}
+
+size_t scan_mark_range(const int *values, size_t count, int lo, int hi, unsigned char *marks) {
+    if (!values || !marks || count == 0) {
+        return 0;
+    }
+    return kernels()->mark_range(values, count, lo, hi, marks);
+}
+
+void scan_count_states(const Letter *letters, size_t count, size_t *counts) {
+    if (letters && counts && count > 0) {
+        kernels()->count_states(letters, count, counts);
+    }
+}
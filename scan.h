@@ -0,0 +1,21 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "funcs.h"
+
+typedef enum {
+    SCAN_SCALAR,
+    SCAN_SSE41,
+    SCAN_AVX2
+} ScanLevel;
+
+ScanLevel scan_level(void);
+ScanLevel scan_set_level(ScanLevel level);
+const char* scan_level_name(ScanLevel level);
+
+int scan_find_int(const int *values, size_t count, int needle);
+size_t scan_count_int(const int *values, size_t count, int needle);
+size_t scan_mark_range(const int *values, size_t count, int lo, int hi, unsigned char *marks);
+void scan_count_states(const Letter *letters, size_t count, size_t *counts);
+
+#endif
@@ -0,0 +1,450 @@
+#define _DEFAULT_SOURCE
+#include "shard.h"
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+ShardCluster* shard_cluster_create(int num_shards, int num_offices, int max_ticks, size_t ring_capacity) {
+    if (num_shards <= 0 || num_offices < num_shards || max_ticks <= 0 ||
+        ring_capacity == 0 || (ring_capacity & (ring_capacity - 1)) != 0) {
+        return NULL;
+    }
+
+    size_t header_bytes = align_up(sizeof(ShardCluster), SHARD_CACHE_LINE);
+    size_t status_bytes = align_up((size_t)num_shards * sizeof(ShardStatus), SHARD_CACHE_LINE);
+    size_t ticks_bytes = align_up((size_t)num_shards * max_ticks * sizeof(int), SHARD_CACHE_LINE);
+    size_t ring_bytes = align_up(sizeof(ShardRing) + ring_capacity * sizeof(Letter), SHARD_CACHE_LINE);
+    size_t mapping_size = header_bytes + status_bytes + ticks_bytes + (size_t)num_shards * num_shards * ring_bytes;
+
+    unsigned char *base = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    ShardCluster *cluster = (ShardCluster*)base;
+    cluster->num_shards = num_shards;
+    cluster->num_offices = num_offices;
+    cluster->max_ticks = max_ticks;
+    cluster->ring_capacity = ring_capacity;
+    cluster->ring_bytes = ring_bytes;
+    cluster->mapping_size = mapping_size;
+    cluster->status = (ShardStatus*)(base + header_bytes);
+    cluster->delivered_per_tick = (int*)(base + header_bytes + status_bytes);
+    cluster->rings = base + header_bytes + status_bytes + ticks_bytes;
+    for (int from = 0; from < num_shards; from++) {
+        for (int to = 0; to < num_shards; to++) {
+            shard_ring(cluster, from, to)->capacity = ring_capacity;
+        }
+    }
+    for (int s = 0; s < num_shards; s++) {
+        cluster->status[s].hops.min = ~0ULL;
+        cluster->status[s].latency.min = ~0ULL;
+        cluster->status[s].depth.min = ~0ULL;
+    }
+    return cluster;
+}
+
+void shard_cluster_destroy(ShardCluster *cluster) {
+    if (cluster) {
+        munmap(cluster, cluster->mapping_size);
+    }
+}
+
+int shard_owner(const ShardCluster *cluster, int office_id) {
+    if (!cluster || office_id <= 0 || office_id > cluster->num_offices) {
+        return -1;
+    }
+    return (int)((long long)(office_id - 1) * cluster->num_shards / cluster->num_offices);
+}
+
+ShardRing* shard_ring(ShardCluster *cluster, int from_shard, int to_shard) {
+    size_t index = (size_t)from_shard * cluster->num_shards + to_shard;
+    return (ShardRing*)(cluster->rings + index * cluster->ring_bytes);
+}
+
+void shard_abort(ShardCluster *cluster) {
+    __atomic_store_n(&cluster->aborted, 1, __ATOMIC_RELEASE);
+}
+
+int shard_barrier(ShardCluster *cluster) {
+    unsigned int generation = __atomic_load_n(&cluster->barrier_generation, __ATOMIC_ACQUIRE);
+    if (__atomic_add_fetch(&cluster->barrier_arrived, 1, __ATOMIC_ACQ_REL) == (unsigned int)cluster->num_shards) {
+        __atomic_store_n(&cluster->barrier_arrived, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&cluster->barrier_generation, generation + 1, __ATOMIC_RELEASE);
+        return !__atomic_load_n(&cluster->aborted, __ATOMIC_ACQUIRE);
+    }
+    while (__atomic_load_n(&cluster->barrier_generation, __ATOMIC_ACQUIRE) == generation) {
+        if (__atomic_load_n(&cluster->aborted, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+        sched_yield();
+    }
+    return !__atomic_load_n(&cluster->aborted, __ATOMIC_ACQUIRE);
+}
+
+int shard_ring_push(ShardRing *ring, const Letter *letter) {
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (tail - head >= ring->capacity) {
+        return 0;
+    }
+    ring->slots[tail & (ring->capacity - 1)] = *letter;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+const Letter* shard_ring_peek(ShardRing *ring) {
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return NULL;
+    }
+    return &ring->slots[head & (ring->capacity - 1)];
+}
+
+void shard_ring_pop(ShardRing *ring) {
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+size_t shard_ring_size(ShardRing *ring) {
+    return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+size_t shard_export_letters(ShardCluster *cluster, int shard, MailSystem *system) {
+    size_t exported = 0;
+    size_t i = 0;
+    while (i < system->letters_size) {
+        const Letter *letter = &system->letters[i];
+        int owner = shard_owner(cluster, letter->current_office);
+        if (letter->state != IN_TRANSIT || owner < 0 || owner == shard) {
+            i++;
+            continue;
+        }
+
+        ShardRing *ring = shard_ring(cluster, shard, owner);
+        if (shard_ring_size(ring) >= ring->capacity) {
+            i++;
+            continue;
+        }
+        Letter handoff;
+        if (export_letter(system, letter->id, &handoff) != SUCCESS) {
+            i++;
+            continue;
+        }
+        shard_ring_push(ring, &handoff);
+        exported++;
+    }
+    return exported;
+}
+
+size_t shard_import_letters(ShardCluster *cluster, int shard, MailSystem *system) {
+    size_t imported = 0;
+    for (int from = 0; from < cluster->num_shards; from++) {
+        if (from == shard) {
+            continue;
+        }
+        ShardRing *ring = shard_ring(cluster, from, shard);
+        const Letter *letter;
+        while ((letter = shard_ring_peek(ring)) != NULL) {
+            if (import_letter(system, letter, NULL) != SUCCESS) {
+                break;
+            }
+            shard_ring_pop(ring);
+            imported++;
+        }
+    }
+    return imported;
+}
+
+static void mirror_auto_connect(MailSystem *system, int from, int to) {
+    add_connection(system, from, to, DEFAULT_LINK_WEIGHT);
+    add_connection(system, to, from, DEFAULT_LINK_WEIGHT);
+}
+
+static int cluster_outstanding(const ShardCluster *cluster) {
+    int outstanding = 0;
+    for (int s = 0; s < cluster->num_shards; s++) {
+        const ShardStatus *status = &cluster->status[s];
+        if (status->failed) {
+            return -1;
+        }
+        outstanding += status->injected - status->delivered - status->undelivered;
+    }
+    return outstanding;
+}
+
+static StatusCode run_shard(ShardCluster *cluster, int shard, const WorkloadConfig *config, const char *export_path) {
+    ShardStatus *status = &cluster->status[shard];
+    int *delivered_per_tick = &cluster->delivered_per_tick[(size_t)shard * cluster->max_ticks];
+
+    WorkloadRng rng;
+    workload_rng_seed(&rng, config->seed);
+
+    SystemConfig system_config;
+    workload_system_config(config, &system_config);
+
+    MailSystem system;
+    init_system_with_config(&system, &system_config);
+    system.quiet = 1;
+
+    StatusCode result = SUCCESS;
+    if (config->trace_path) {
+        char trace_path[256];
+        snprintf(trace_path, sizeof(trace_path), "%s.shard%d", config->trace_path, shard);
+        result = enable_trace_capture(&system, trace_path);
+        record_trace_seed(&system, config->seed);
+    }
+    if (result == SUCCESS) {
+        result = build_topology(&system, config, &rng);
+    }
+    if (result == SUCCESS && config->status_name) {
+        char view_name[256];
+        snprintf(view_name, sizeof(view_name), "%s.shard%d", config->status_name, shard);
+        result = enable_status_view(&system, view_name);
+    }
+    double carry = 0.0;
+    int tick;
+    for (tick = 0; tick < config->max_ticks && result == SUCCESS; tick++) {
+        status->imported += (int)shard_import_letters(cluster, shard, &system);
+
+        if (tick < config->injection_ticks) {
+            int arrivals = workload_arrivals(config, &rng, tick, &carry);
+            for (int a = 0; a < arrivals; a++) {
+                LetterType type;
+                int priority, from, to;
+                workload_sample_letter(config, &rng, &type, &priority, &from, &to);
+                if (shard_owner(cluster, from) != shard) {
+                    if (config->auto_connect) {
+                        mirror_auto_connect(&system, from, to);
+                    }
+                    continue;
+                }
+                if (add_letter(&system, type, priority, from, to, "synthetic") != SUCCESS) {
+                    status->rejected++;
+                    continue;
+                }
+                status->injected++;
+            }
+        }
+
+        workload_engine_tick(config, &system);
+
+        int delivered_now = 0;
+        for (size_t i = 0; i < system.letters_size; i++) {
+            const Letter *letter = &system.letters[i];
+            if (letter->state == DELIVERED && letter->delivered_tick == system.current_tick) {
+                delivered_now++;
+                histogram_record(&status->hops, (unsigned long long)letter->hops);
+                histogram_record(&status->latency, (unsigned long long)(letter->delivered_tick - letter->created_tick));
+            }
+        }
+        status->undelivered = (int)system.state_counts[UNDELIVERED];
+        if (config->retire_interval > 0 && tick % config->retire_interval == 0) {
+            retire_letters(&system);
+        }
+        if (config->compact_interval > 0 && tick % config->compact_interval == 0) {
+            compact_system(&system);
+        }
+        status->delivered += delivered_now;
+        delivered_per_tick[tick] = delivered_now;
+        status->exported += (int)shard_export_letters(cluster, shard, &system);
+
+        for (int k = 0; k < system.office_count; k++) {
+            const PostOffice *office = &system.offices[k];
+            if (shard_owner(cluster, office->id) == shard) {
+                histogram_record(&status->depth, (unsigned long long)office->current_letters);
+                status->depth_sum += office->current_letters;
+                status->depth_samples++;
+            }
+        }
+        status->live = (int)system.state_counts[IN_TRANSIT];
+        status->tick = tick + 1;
+
+        if (!shard_barrier(cluster)) {
+            result = ERROR_INVALID_PARAMETER;
+            break;
+        }
+        int outstanding = cluster_outstanding(cluster);
+        if (!shard_barrier(cluster) || outstanding < 0) {
+            result = ERROR_INVALID_PARAMETER;
+            break;
+        }
+        if (tick + 1 >= config->injection_ticks && outstanding == 0) {
+            tick++;
+            break;
+        }
+    }
+    status->tick = tick;
+
+    if (result == SUCCESS && export_path) {
+        char part_path[1024];
+        snprintf(part_path, sizeof(part_path), "%s.shard%d", export_path, shard);
+        result = save_letters_to_file(&system, part_path);
+    }
+    if (result != SUCCESS) {
+        status->failed = 1;
+        shard_abort(cluster);
+    }
+    cleanup_system(&system);
+    return result;
+}
+
+static StatusCode merge_exports(const ShardCluster *cluster, const char *export_path) {
+    FILE *out = fopen(export_path, "w");
+    if (!out) {
+        return ERROR_FILE_OPERATION;
+    }
+
+    StatusCode status = SUCCESS;
+    for (int s = 0; s < cluster->num_shards; s++) {
+        char part_path[1024];
+        snprintf(part_path, sizeof(part_path), "%s.shard%d", export_path, s);
+        FILE *part = fopen(part_path, "r");
+        if (!part) {
+            status = ERROR_FILE_OPERATION;
+            continue;
+        }
+        fprintf(out, "Shard %d:\n", s);
+        char buffer[4096];
+        size_t read;
+        while ((read = fread(buffer, 1, sizeof(buffer), part)) > 0) {
+            fwrite(buffer, 1, read, out);
+        }
+        fclose(part);
+        remove(part_path);
+    }
+    fclose(out);
+    return status;
+}
+
+static void aggregate_report(const ShardCluster *cluster, WorkloadReport *report) {
+    LatencyHistogram hops, latency, depth;
+    memset(&hops, 0, sizeof(hops));
+    memset(&latency, 0, sizeof(latency));
+    memset(&depth, 0, sizeof(depth));
+    hops.min = latency.min = depth.min = ~0ULL;
+    double depth_sum = 0.0;
+    long long depth_samples = 0;
+
+    report->ticks = cluster->status[0].tick;
+    for (int s = 0; s < cluster->num_shards; s++) {
+        const ShardStatus *status = &cluster->status[s];
+        report->injected += status->injected;
+        report->rejected += status->rejected;
+        report->delivered += status->delivered;
+        report->undelivered += status->undelivered;
+        histogram_merge(&hops, &status->hops);
+        histogram_merge(&latency, &status->latency);
+        histogram_merge(&depth, &status->depth);
+        depth_sum += status->depth_sum;
+        depth_samples += status->depth_samples;
+        for (int t = 0; t < report->ticks; t++) {
+            report->delivered_per_tick[t] += cluster->delivered_per_tick[(size_t)s * cluster->max_ticks + t];
+        }
+    }
+    report->delivered_per_tick_size = (size_t)report->ticks;
+    report->stranded = report->injected - report->delivered - report->undelivered;
+
+    report->mean_hops = hops.total ? (double)hops.sum / hops.total : 0.0;
+    report->p99_hops = (int)histogram_percentile(&hops, 0.99);
+    report->mean_latency = latency.total ? (double)latency.sum / latency.total : 0.0;
+    report->p99_latency = (int)histogram_percentile(&latency, 0.99);
+    report->mean_depth = depth_samples ? depth_sum / depth_samples : 0.0;
+    report->p50_depth = (int)histogram_percentile(&depth, 0.50);
+    report->p99_depth = (int)histogram_percentile(&depth, 0.99);
+    report->max_depth = depth.total ? (int)depth.max : 0;
+}
+
+StatusCode shard_wait_workers(ShardCluster *cluster, const pid_t *workers, int num_workers) {
+    if (!cluster || (!workers && num_workers > 0)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    StatusCode status = SUCCESS;
+    int remaining = num_workers;
+    while (remaining > 0) {
+        int exit_status = 0;
+        pid_t pid = waitpid(-1, &exit_status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            shard_abort(cluster);
+            return ERROR_INVALID_PARAMETER;
+        }
+        int s = 0;
+        while (s < num_workers && workers[s] != pid) {
+            s++;
+        }
+        if (s == num_workers) {
+            continue;
+        }
+        remaining--;
+        if (!WIFEXITED(exit_status) || WEXITSTATUS(exit_status) != 0) {
+            shard_abort(cluster);
+            status = ERROR_INVALID_PARAMETER;
+        }
+    }
+    return status;
+}
+
+StatusCode run_sharded_workload(const WorkloadConfig *config, const char *export_path, WorkloadReport *report) {
+    if (!config || !report || config->num_offices <= 0 || config->max_ticks <= 0 ||
+        config->shards <= 0 || config->shards > config->num_offices) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    memset(report, 0, sizeof(*report));
+
+    ShardCluster *cluster = shard_cluster_create(config->shards, config->num_offices, config->max_ticks, SHARD_RING_CAPACITY);
+    if (!cluster) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    report->delivered_per_tick = calloc(config->max_ticks, sizeof(int));
+    if (!report->delivered_per_tick) {
+        shard_cluster_destroy(cluster);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    fflush(NULL);
+    pid_t *workers = calloc(config->shards, sizeof(pid_t));
+    StatusCode status = workers ? SUCCESS : ERROR_MEMORY_ALLOCATION;
+    int spawned = 0;
+    for (; status == SUCCESS && spawned < config->shards; spawned++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            StatusCode result = run_shard(cluster, spawned, config, export_path);
+            exit(result == SUCCESS ? 0 : 1);
+        }
+        if (pid < 0) {
+            shard_abort(cluster);
+            status = ERROR_MEMORY_ALLOCATION;
+            break;
+        }
+        workers[spawned] = pid;
+    }
+
+    StatusCode workers_status = shard_wait_workers(cluster, workers, spawned);
+    if (status == SUCCESS) {
+        status = workers_status;
+    }
+    free(workers);
+
+    if (status == SUCCESS) {
+        aggregate_report(cluster, report);
+        if (export_path) {
+            status = merge_exports(cluster, export_path);
+        }
+    }
+    shard_cluster_destroy(cluster);
+    if (status != SUCCESS) {
+        free_workload_report(report);
+    }
+    return status;
+}
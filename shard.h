@@ -0,0 +1,71 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "funcs.h"
+#include "workload.h"
+#include <sys/types.h>
+
+#define SHARD_RING_CAPACITY 1024
+#define SHARD_CACHE_LINE 64
+
+typedef struct {
+    size_t capacity;
+    char pad0[SHARD_CACHE_LINE - sizeof(size_t)];
+    size_t head;
+    char pad1[SHARD_CACHE_LINE - sizeof(size_t)];
+    size_t tail;
+    char pad2[SHARD_CACHE_LINE - sizeof(size_t)];
+    Letter slots[];
+} ShardRing;
+
+typedef struct {
+    int tick;
+    int injected;
+    int rejected;
+    int delivered;
+    int undelivered;
+    int exported;
+    int imported;
+    int live;
+    int failed;
+    double depth_sum;
+    long long depth_samples;
+    LatencyHistogram hops;
+    LatencyHistogram latency;
+    LatencyHistogram depth;
+} ShardStatus;
+
+typedef struct {
+    int num_shards;
+    int num_offices;
+    int max_ticks;
+    size_t ring_capacity;
+    size_t ring_bytes;
+    size_t mapping_size;
+    int aborted;
+    unsigned int barrier_arrived;
+    unsigned int barrier_generation;
+    ShardStatus *status;
+    int *delivered_per_tick;
+    unsigned char *rings;
+} ShardCluster;
+
+ShardCluster* shard_cluster_create(int num_shards, int num_offices, int max_ticks, size_t ring_capacity);
+void shard_cluster_destroy(ShardCluster *cluster);
+int shard_owner(const ShardCluster *cluster, int office_id);
+ShardRing* shard_ring(ShardCluster *cluster, int from_shard, int to_shard);
+int shard_barrier(ShardCluster *cluster);
+void shard_abort(ShardCluster *cluster);
+
+int shard_ring_push(ShardRing *ring, const Letter *letter);
+const Letter* shard_ring_peek(ShardRing *ring);
+void shard_ring_pop(ShardRing *ring);
+size_t shard_ring_size(ShardRing *ring);
+
+size_t shard_export_letters(ShardCluster *cluster, int shard, MailSystem *system);
+size_t shard_import_letters(ShardCluster *cluster, int shard, MailSystem *system);
+
+StatusCode shard_wait_workers(ShardCluster *cluster, const pid_t *workers, int num_workers);
+StatusCode run_sharded_workload(const WorkloadConfig *config, const char *export_path, WorkloadReport *report);
+
+#endif
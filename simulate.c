@@ -0,0 +1,178 @@
+#include "workload.h"
+#include "shard.h"
+
+static void print_usage(const char *program) {
+    printf("Usage: %s [key=value ...]\n", program);
+    printf("  seed=N offices=N topology=grid|geometric|scale-free|hub-and-spoke\n");
+    printf("  min_capacity=N max_capacity=N hub_capacity=N hubs=N radius=F links=N\n");
+    printf("  arrival=constant|poisson|bursty rate=F burst_period=N burst_length=N inject_ticks=N\n");
+    printf("  priorities=uniform|skewed|bimodal max_priority=N urgent=F\n");
+    printf("  engine=priority|process|network queue=heap|bucket policy=strict|aging|wfq|edf\n");
+    printf("  service_rate=N bandwidth=N latency=N auto_connect=0|1 routing=flat|regional\n");
+    printf("  max_ticks=N retire=N compact=N shards=N threads=N budget=BYTES export=FILE status=/SEGMENT trace=FILE csv=FILE\n");
+}
+
+static int parse_topology(const char *value, TopologyKind *kind) {
+    for (int k = TOPOLOGY_GRID; k <= TOPOLOGY_HUB_AND_SPOKE; k++) {
+        if (strcmp(value, topology_name((TopologyKind)k)) == 0) {
+            *kind = (TopologyKind)k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_arrival(const char *value, ArrivalKind *kind) {
+    for (int k = ARRIVAL_CONSTANT; k <= ARRIVAL_BURSTY; k++) {
+        if (strcmp(value, arrival_name((ArrivalKind)k)) == 0) {
+            *kind = (ArrivalKind)k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_priorities(const char *value, PriorityDistribution *dist) {
+    for (int k = PRIORITY_UNIFORM; k <= PRIORITY_BIMODAL; k++) {
+        if (strcmp(value, priority_dist_name((PriorityDistribution)k)) == 0) {
+            *dist = (PriorityDistribution)k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_engine(const char *value, EngineKind *kind) {
+    for (int k = ENGINE_PRIORITY; k <= ENGINE_NETWORK; k++) {
+        if (strcmp(value, engine_name((EngineKind)k)) == 0) {
+            *kind = (EngineKind)k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_queue(const char *value, QueueKind *kind) {
+    for (int k = QUEUE_HEAP; k <= QUEUE_BUCKET; k++) {
+        if (strcmp(value, queue_kind_name((QueueKind)k)) == 0) {
+            *kind = (QueueKind)k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_policy(const char *value, SchedulingPolicy *policy) {
+    for (int k = POLICY_STRICT_PRIORITY; k <= POLICY_EARLIEST_DEADLINE; k++) {
+        if (strcmp(value, scheduling_policy_name((SchedulingPolicy)k)) == 0) {
+            *policy = (SchedulingPolicy)k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_routing(const char *value, RoutingMode *mode) {
+    for (int k = ROUTING_FLAT; k <= ROUTING_REGIONAL; k++) {
+        if (strcmp(value, routing_mode_name((RoutingMode)k)) == 0) {
+            *mode = (RoutingMode)k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_option(WorkloadConfig *config, const char *key, const char *value) {
+    if (strcmp(key, "seed") == 0) config->seed = strtoull(value, NULL, 10);
+    else if (strcmp(key, "offices") == 0) config->num_offices = atoi(value);
+    else if (strcmp(key, "topology") == 0) return parse_topology(value, &config->topology);
+    else if (strcmp(key, "min_capacity") == 0) config->min_capacity = atoi(value);
+    else if (strcmp(key, "max_capacity") == 0) config->max_capacity = atoi(value);
+    else if (strcmp(key, "hub_capacity") == 0) config->hub_capacity = atoi(value);
+    else if (strcmp(key, "hubs") == 0) config->num_hubs = atoi(value);
+    else if (strcmp(key, "radius") == 0) config->geometric_radius = atof(value);
+    else if (strcmp(key, "links") == 0) config->scale_free_links = atoi(value);
+    else if (strcmp(key, "arrival") == 0) return parse_arrival(value, &config->arrival);
+    else if (strcmp(key, "rate") == 0) config->arrival_rate = atof(value);
+    else if (strcmp(key, "burst_period") == 0) config->burst_period = atoi(value);
+    else if (strcmp(key, "burst_length") == 0) config->burst_length = atoi(value);
+    else if (strcmp(key, "inject_ticks") == 0) config->injection_ticks = atoi(value);
+    else if (strcmp(key, "priorities") == 0) return parse_priorities(value, &config->priority_dist);
+    else if (strcmp(key, "max_priority") == 0) config->max_priority = atoi(value);
+    else if (strcmp(key, "urgent") == 0) config->urgent_fraction = atof(value);
+    else if (strcmp(key, "engine") == 0) return parse_engine(value, &config->engine);
+    else if (strcmp(key, "queue") == 0) return parse_queue(value, &config->queue_kind);
+    else if (strcmp(key, "policy") == 0) return parse_policy(value, &config->policy);
+    else if (strcmp(key, "service_rate") == 0) config->service_rate = atoi(value);
+    else if (strcmp(key, "bandwidth") == 0) config->link_bandwidth = atoi(value);
+    else if (strcmp(key, "latency") == 0) config->link_latency = atoi(value);
+    else if (strcmp(key, "auto_connect") == 0) config->auto_connect = atoi(value);
+    else if (strcmp(key, "routing") == 0) return parse_routing(value, &config->routing);
+    else if (strcmp(key, "max_ticks") == 0) config->max_ticks = atoi(value);
+    else if (strcmp(key, "retire") == 0) config->retire_interval = atoi(value);
+    else if (strcmp(key, "compact") == 0) config->compact_interval = atoi(value);
+    else if (strcmp(key, "shards") == 0) config->shards = atoi(value);
+    else if (strcmp(key, "threads") == 0) config->threads = atoi(value);
+    else if (strcmp(key, "budget") == 0) config->memory_budget = (size_t)strtoull(value, NULL, 10);
+    else if (strcmp(key, "status") == 0) config->status_name = value;
+    else if (strcmp(key, "trace") == 0) config->trace_path = value;
+    else return 0;
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    WorkloadConfig config;
+    workload_default_config(&config);
+    const char *csv_file = NULL;
+    const char *export_file = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        char key[64];
+        const char *eq = strchr(argv[i], '=');
+        if (!eq || (size_t)(eq - argv[i]) >= sizeof(key)) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        memcpy(key, argv[i], eq - argv[i]);
+        key[eq - argv[i]] = '\0';
+
+        if (strcmp(key, "csv") == 0) {
+            csv_file = eq + 1;
+        } else if (strcmp(key, "export") == 0) {
+            export_file = eq + 1;
+        } else if (!parse_option(&config, key, eq + 1)) {
+            printf("Invalid option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    WorkloadReport report;
+    StatusCode status;
+    if (config.shards > 1 || export_file) {
+        status = run_sharded_workload(&config, export_file, &report);
+    } else {
+        status = run_workload(&config, &report);
+    }
+    if (status != SUCCESS) {
+        printf("Error running workload: %d\n", status);
+        return 1;
+    }
+    print_workload_report(stdout, &config, &report);
+
+    if (csv_file) {
+        FILE *file = fopen(csv_file, "w");
+        if (!file) {
+            printf("Error opening csv file: %s\n", csv_file);
+        } else {
+            fprintf(file, "tick,delivered\n");
+            for (size_t i = 0; i < report.delivered_per_tick_size; i++) {
+                fprintf(file, "%zu,%d\n", i, report.delivered_per_tick[i]);
+            }
+            fclose(file);
+        }
+    }
+
+    free_workload_report(&report);
+    return 0;
+}
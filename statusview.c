@@ -0,0 +1,230 @@
+#define _DEFAULT_SOURCE
+#include "statusview.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static size_t segment_length(int office_capacity) {
+    return sizeof(StatusSegment) + (size_t)office_capacity * sizeof(StatusOfficeEntry);
+}
+
+static void reset_view(StatusView *view) {
+    view->name = NULL;
+    view->fd = -1;
+    view->segment = NULL;
+    view->length = 0;
+    view->writer = 0;
+}
+
+static void unmap_view(StatusView *view) {
+    if (view->segment) {
+        munmap(view->segment, view->length);
+    }
+    if (view->fd >= 0) {
+        close(view->fd);
+    }
+    view->segment = NULL;
+    view->fd = -1;
+    view->length = 0;
+}
+
+static StatusCode map_segment(StatusView *view, int office_capacity) {
+    shm_unlink(view->name);
+    int fd = shm_open(view->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        return ERROR_FILE_OPERATION;
+    }
+
+    size_t length = segment_length(office_capacity);
+    if (ftruncate(fd, (off_t)length) != 0) {
+        close(fd);
+        shm_unlink(view->name);
+        return ERROR_FILE_OPERATION;
+    }
+    void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        shm_unlink(view->name);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    view->fd = fd;
+    view->segment = (StatusSegment*)base;
+    view->length = length;
+    view->segment->version = STATUS_VIEW_VERSION;
+    view->segment->office_capacity = office_capacity;
+    return SUCCESS;
+}
+
+StatusCode status_view_create(StatusView *view, const char *name, int office_capacity) {
+    if (!view || !name || name[0] != '/') {
+        return ERROR_INVALID_PARAMETER;
+    }
+    reset_view(view);
+
+    view->name = (char*)malloc(strlen(name) + 1);
+    if (!view->name) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    strcpy(view->name, name);
+    view->writer = 1;
+
+    if (office_capacity < STATUS_VIEW_MIN_OFFICES) {
+        office_capacity = STATUS_VIEW_MIN_OFFICES;
+    }
+    StatusCode status = map_segment(view, office_capacity);
+    if (status != SUCCESS) {
+        free(view->name);
+        reset_view(view);
+    }
+    return status;
+}
+
+static int grow_segment(StatusView *view, int office_count) {
+    int office_capacity = view->segment->office_capacity;
+    while (office_capacity < office_count) {
+        office_capacity *= 2;
+    }
+
+    __atomic_store_n(&view->segment->retired, 1, __ATOMIC_RELEASE);
+    unmap_view(view);
+    return map_segment(view, office_capacity) == SUCCESS;
+}
+
+void status_view_publish(StatusView *view, const MailSystem *system) {
+    if (!view || !view->writer || !view->segment || !system) {
+        return;
+    }
+    if (system->office_count > view->segment->office_capacity && !grow_segment(view, system->office_count)) {
+        return;
+    }
+
+    StatusSegment *segment = view->segment;
+    uint32_t sequence = segment->sequence;
+    __atomic_store_n(&segment->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    segment->tick = system->current_tick;
+    segment->office_count = system->office_count;
+    segment->total_occupancy = system->total_occupancy;
+    for (int s = 0; s < LETTER_STATE_COUNT; s++) {
+        segment->state_counts[s] = system->state_counts[s];
+    }
+    get_stat_counters(segment->counters);
+    for (int k = 0; k < system->office_count; k++) {
+        const PostOffice *office = &system->offices[k];
+        StatusOfficeEntry *entry = &segment->offices[k];
+        entry->id = office->id;
+        entry->capacity = office->capacity;
+        entry->current_letters = office->current_letters;
+        entry->region = office->region;
+    }
+
+    __atomic_store_n(&segment->sequence, sequence + 2, __ATOMIC_RELEASE);
+    if (segment->magic != STATUS_VIEW_MAGIC) {
+        __atomic_store_n(&segment->magic, STATUS_VIEW_MAGIC, __ATOMIC_RELEASE);
+    }
+}
+
+StatusCode status_view_attach(StatusView *view, const char *name) {
+    if (!view || !name) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    reset_view(view);
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return ERROR_FILE_OPERATION;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(StatusSegment)) {
+        close(fd);
+        return ERROR_FILE_OPERATION;
+    }
+    void *base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    view->fd = fd;
+    view->segment = (StatusSegment*)base;
+    view->length = (size_t)info.st_size;
+    if (__atomic_load_n(&view->segment->magic, __ATOMIC_ACQUIRE) != STATUS_VIEW_MAGIC ||
+        view->segment->version != STATUS_VIEW_VERSION ||
+        segment_length(view->segment->office_capacity) > view->length) {
+        unmap_view(view);
+        return ERROR_FILE_OPERATION;
+    }
+
+    view->name = (char*)malloc(strlen(name) + 1);
+    if (!view->name) {
+        unmap_view(view);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    strcpy(view->name, name);
+    return SUCCESS;
+}
+
+StatusCode status_view_read(StatusView *view, StatusSnapshot *snapshot, StatusOfficeEntry *offices, int max_offices, int *num_offices) {
+    if (!view || !view->segment || !snapshot || (max_offices > 0 && !offices)) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    for (int attempt = 0; attempt < STATUS_VIEW_READ_RETRIES; attempt++) {
+        const StatusSegment *segment = view->segment;
+        if (__atomic_load_n(&segment->retired, __ATOMIC_ACQUIRE) && attempt + 1 < STATUS_VIEW_READ_RETRIES) {
+            StatusView next;
+            if (status_view_attach(&next, view->name) == SUCCESS) {
+                status_view_close(view);
+                *view = next;
+            } else {
+                sched_yield();
+            }
+            continue;
+        }
+
+        uint32_t before = __atomic_load_n(&segment->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;
+        }
+        snapshot->tick = segment->tick;
+        snapshot->office_count = segment->office_count;
+        snapshot->total_occupancy = segment->total_occupancy;
+        memcpy(snapshot->state_counts, segment->state_counts, sizeof(snapshot->state_counts));
+        memcpy(snapshot->counters, segment->counters, sizeof(snapshot->counters));
+        int count = snapshot->office_count;
+        if (count > segment->office_capacity) {
+            count = segment->office_capacity;
+        }
+        if (count > max_offices) {
+            count = max_offices;
+        }
+        if (count > 0) {
+            memcpy(offices, segment->offices, (size_t)count * sizeof(StatusOfficeEntry));
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&segment->sequence, __ATOMIC_RELAXED) == before) {
+            if (num_offices) {
+                *num_offices = count;
+            }
+            return SUCCESS;
+        }
+    }
+    return ERROR_FILE_OPERATION;
+}
+
+void status_view_close(StatusView *view) {
+    if (!view) {
+        return;
+    }
+    int writer = view->writer && view->segment;
+    unmap_view(view);
+    if (writer) {
+        shm_unlink(view->name);
+    }
+    free(view->name);
+    reset_view(view);
+}
@@ -0,0 +1,56 @@
+#ifndef STATUSVIEW_H
+#define STATUSVIEW_H
+
+#include <stdint.h>
+#include "funcs.h"
+
+#define STATUS_VIEW_MAGIC 0x4d41494cu
+#define STATUS_VIEW_VERSION 1
+#define STATUS_VIEW_MIN_OFFICES 64
+#define STATUS_VIEW_READ_RETRIES 1000
+
+typedef struct {
+    int id;
+    int capacity;
+    int current_letters;
+    int region;
+} StatusOfficeEntry;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;
+    uint32_t retired;
+    int office_capacity;
+    int tick;
+    int office_count;
+    long long total_occupancy;
+    unsigned long long state_counts[LETTER_STATE_COUNT];
+    unsigned long long counters[STAT_COUNT];
+    StatusOfficeEntry offices[];
+} StatusSegment;
+
+typedef struct {
+    int tick;
+    int office_count;
+    long long total_occupancy;
+    unsigned long long state_counts[LETTER_STATE_COUNT];
+    unsigned long long counters[STAT_COUNT];
+} StatusSnapshot;
+
+typedef struct StatusView {
+    char *name;
+    int fd;
+    StatusSegment *segment;
+    size_t length;
+    int writer;
+} StatusView;
+
+StatusCode status_view_create(StatusView *view, const char *name, int office_capacity);
+void status_view_publish(StatusView *view, const MailSystem *system);
+
+StatusCode status_view_attach(StatusView *view, const char *name);
+StatusCode status_view_read(StatusView *view, StatusSnapshot *snapshot, StatusOfficeEntry *offices, int max_offices, int *num_offices);
+void status_view_close(StatusView *view);
+
+#endif
@@ -1,21 +1,36 @@
 #include "funcs.h"
+#include "archive.h"
+#include "scan.h"
+#include "statusview.h"
+#include "executor.h"
+#include "workload.h"
+#include "shard.h"
+#include "trace.h"
+#include "image.h"
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
 
 // Вспомогательная функция для создания тестового почтового отделения
 PostOffice* create_test_office(int id, int capacity) {
     PostOffice* office = (PostOffice*)malloc(sizeof(PostOffice));
     if (office == NULL) return NULL;
     
+    memset(office, 0, sizeof(PostOffice));
     office->id = id;
     office->capacity = capacity;
-    office->current_letters = 0;
-    office->num_connections = 0;
-    office->connections = NULL;
-    office->letter_heap = create_heap(INITIAL_CAPACITY);
-    office->next = NULL;
+    office->service_rate = DEFAULT_SERVICE_RATE;
+    office->letter_heap = create_keyed_heap(INITIAL_CAPACITY);
+    office->letter_buckets = create_bucket_queue(0);
+    office->slot = -1;
+    office->region = -1;
+    office->auto_region = -1;
     
     return office;
 }
@@ -32,6 +47,9 @@ Letter* create_test_letter(int id, LetterType type, int priority, int from_offic
     letter->from_office = from_office;
     letter->to_office = to_office;
     letter->current_office = from_office;
+    letter->created_tick = 0;
+    letter->delivered_tick = -1;
+    letter->hops = 0;
     strncpy(letter->tech_data, data, sizeof(letter->tech_data) - 1);
     letter->tech_data[sizeof(letter->tech_data) - 1] = '\0';
     
@@ -611,6 +629,1710 @@ void test_auto_connection_creation() {
     printf("auto connection creation tests passed!\n");
 }
 
+void test_workload_topologies() {
+    printf("Testing workload topologies...\n");
+    
+    TopologyKind kinds[] = {TOPOLOGY_GRID, TOPOLOGY_RANDOM_GEOMETRIC, TOPOLOGY_SCALE_FREE, TOPOLOGY_HUB_AND_SPOKE};
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        WorkloadConfig config;
+        workload_default_config(&config);
+        config.topology = kinds[k];
+        config.num_offices = 150;
+        
+        WorkloadRng rng;
+        workload_rng_seed(&rng, 7);
+        MailSystem system;
+        init_system(&system);
+        system.quiet = 1;
+        assert(build_topology(&system, &config, &rng) == SUCCESS);
+        
+        int office_count = 0;
+        for (int k = 0; k < system.office_count; k++) {
+            PostOffice *office = &system.offices[k];
+            office_count++;
+            assert(office->num_connections <= MAX_CONNECTIONS);
+            for (int i = 0; i < office->num_connections; i++) {
+                // Каждая связь должна быть двусторонней
+                PostOffice *neighbour = find_office(&system, office->connections[i]);
+                assert(neighbour != NULL);
+                int back_edge = 0;
+                for (int j = 0; j < neighbour->num_connections; j++) {
+                    if (neighbour->connections[j] == office->id) {
+                        back_edge = 1;
+                    }
+                }
+                assert(back_edge == 1);
+            }
+        }
+        assert(office_count == 150);
+        printf("  %s: OK\n", topology_name(kinds[k]));
+        cleanup_system(&system);
+    }
+    
+    printf("workload topologies tests passed!\n");
+}
+
+void test_workload_reproducible() {
+    printf("Testing workload reproducibility...\n");
+    
+    WorkloadConfig config;
+    workload_default_config(&config);
+    config.topology = TOPOLOGY_SCALE_FREE;
+    config.num_offices = 40;
+    config.injection_ticks = 30;
+    config.arrival = ARRIVAL_BURSTY;
+    config.max_ticks = 500;
+    
+    WorkloadReport first, second;
+    assert(run_workload(&config, &first) == SUCCESS);
+    assert(run_workload(&config, &second) == SUCCESS);
+    
+    assert(first.injected > 0);
+    assert(first.injected == first.delivered + first.undelivered + first.stranded);
+    assert(first.ticks == second.ticks);
+    assert(first.injected == second.injected);
+    assert(first.delivered == second.delivered);
+    assert(first.p99_latency == second.p99_latency);
+    assert(first.max_depth == second.max_depth);
+    for (size_t i = 0; i < first.delivered_per_tick_size; i++) {
+        assert(first.delivered_per_tick[i] == second.delivered_per_tick[i]);
+    }
+    
+    free_workload_report(&first);
+    free_workload_report(&second);
+    printf("workload reproducibility tests passed!\n");
+}
+
+void test_stats_counters() {
+    printf("Testing performance counters...\n");
+    
+    LatencyHistogram histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    for (unsigned long long v = 1; v <= 1000; v++) {
+        histogram_record(&histogram, v);
+    }
+    assert(histogram.total == 1000);
+    assert(histogram.min == 1 && histogram.max == 1000);
+    unsigned long long p50 = histogram_percentile(&histogram, 0.50);
+    unsigned long long p99 = histogram_percentile(&histogram, 0.99);
+    assert(p50 >= 500 && p50 <= 500 + 500 / 16);
+    assert(p99 >= 990 && p99 <= 1000);
+    
+    reset_stats();
+    MailSystem system;
+    init_system(&system);
+    system.quiet = 1;
+    add_office(&system, 1, 10, NULL, 0);
+    add_office(&system, 2, 1, NULL, 0);
+    add_letter(&system, REGULAR, 5, 1, 2, "Stats");
+    add_letter(&system, REGULAR, 5, 2, 1, "Fills office 2");
+    assert(add_letter(&system, REGULAR, 5, 2, 1, "Rejected") == ERROR_OFFICE_FULL);
+    process_letters_transfer(&system);
+    transfer_priority_letters(&system);
+    
+    SystemStats stats;
+    get_stats(&stats);
+#if MAIL_STATS
+    assert(stats.counters[STAT_HEAP_PUSH] >= 2);
+    assert(stats.counters[STAT_FIND_OFFICE] > 0);
+    assert(stats.counters[STAT_FIND_OFFICE_PROBES] >= stats.counters[STAT_FIND_OFFICE]);
+    assert(stats.counters[STAT_FIND_LETTER] > 0);
+    assert(stats.counters[STAT_CAPACITY_REJECTIONS] > 0);
+    assert(stats.ticks[TICK_PROCESS_TRANSFER].total == 1);
+    assert(stats.ticks[TICK_PRIORITY_TRANSFER].total == 1);
+#endif
+    dump_stats(stdout);
+    
+    reset_stats();
+    get_stats(&stats);
+    assert(stats.counters[STAT_HEAP_PUSH] == 0);
+    assert(stats.ticks[TICK_PROCESS_TRANSFER].total == 0);
+    
+    // После сброса счётчики потока начинаются с нуля, а не со старых значений
+    add_letter(&system, REGULAR, 5, 1, 2, "After reset");
+    get_stats(&stats);
+#if MAIL_STATS
+    assert(stats.counters[STAT_HEAP_PUSH] == 1);
+    assert(stats.ticks[TICK_PROCESS_TRANSFER].total == 0);
+#endif
+    
+    cleanup_system(&system);
+    printf("performance counters tests passed!\n");
+}
+
+void test_delivery_tracking() {
+    printf("Testing delivery latency and hop tracking...\n");
+    
+    MailSystem system;
+    init_system(&system);
+    system.quiet = 1;
+    assert(enable_path_tracing(&system, 16) == SUCCESS);
+    
+    add_office(&system, 1, 10, NULL, 0);
+    add_office(&system, 2, 10, NULL, 0);
+    assert(add_letter(&system, URGENT, 20, 1, 2, "Tracked") == SUCCESS);
+    
+    Letter *letter = find_letter(&system, 1);
+    assert(letter->created_tick == 0);
+    assert(letter->delivered_tick == -1);
+    assert(letter->hops == 0);
+    
+    for (int i = 0; i < 3 && letter->state != DELIVERED; i++) {
+        transfer_priority_letters(&system);
+    }
+    assert(letter->state == DELIVERED);
+    assert(letter->hops == 1);
+    assert(letter->delivered_tick == 2);
+    assert(system.current_tick == 2);
+    
+    int offices[8];
+    int ticks[8];
+    size_t path_length = get_letter_path(&system, 1, offices, ticks, 8);
+    assert(path_length == 2);
+    assert(offices[0] == 1 && ticks[0] == 0);
+    assert(offices[1] == 2 && ticks[1] == 1);
+    
+    assert(system.delivery_stats != NULL);
+    assert(system.delivery_stats->overall.latency.total == 1);
+    assert(system.delivery_stats->by_type[URGENT].latency.total == 1);
+    assert(system.delivery_stats->by_type[REGULAR].latency.total == 0);
+    assert(system.delivery_stats->by_priority[priority_class(20)].hops.max == 1);
+    assert(histogram_percentile(&system.delivery_stats->overall.latency, 0.99) == 2);
+    print_delivery_report(&system, stdout);
+    
+    cleanup_system(&system);
+    printf("delivery latency and hop tracking tests passed!\n");
+}
+
+void test_system_aggregates() {
+    printf("Testing incremental system aggregates...\n");
+    
+    MailSystem system;
+    init_system(&system);
+    system.quiet = 1;
+    
+    add_office(&system, 1, 10, NULL, 0);
+    add_office(&system, 2, 10, NULL, 0);
+    add_office(&system, 3, 10, NULL, 0);
+    assert(system.office_count == 3);
+    
+    add_letter(&system, REGULAR, 5, 1, 2, "A");
+    add_letter(&system, URGENT, 50, 1, 3, "B");
+    add_letter(&system, REGULAR, 1, 2, 3, "C");
+    add_letter(&system, REGULAR, 1, 3, 1, "D");
+    assert(system.state_counts[IN_TRANSIT] == 4);
+    assert(system.total_occupancy == 4);
+    assert(check_system_aggregates(&system));
+    
+    for (int i = 0; i < 4; i++) {
+        transfer_priority_letters(&system);
+        assert(check_system_aggregates(&system));
+        process_letters_transfer(&system);
+        assert(check_system_aggregates(&system));
+    }
+    assert(system.state_counts[DELIVERED] > 0);
+    
+    transfer_letter_to_office(&system, 4, 3, 2);
+    assert(check_system_aggregates(&system));
+    
+    remove_office(&system, 2);
+    assert(system.office_count == 2);
+    assert(check_system_aggregates(&system));
+    assert(system.state_counts[IN_TRANSIT] + system.state_counts[DELIVERED] + system.state_counts[UNDELIVERED] == system.letters_size);
+    
+    print_system_status(&system, 0);
+    print_office_histogram(&system, 1);
+    
+    cleanup_system(&system);
+    assert(system.office_count == 0);
+    printf("incremental system aggregates tests passed!\n");
+}
+
+void test_letter_retirement() {
+    printf("Testing letter retirement and compaction...\n");
+    
+    MailSystem system;
+    init_system(&system);
+    system.quiet = 1;
+    const char *spill_filename = "test_archive_spill.bin";
+    assert(set_archive_spill(&system, spill_filename, 2) == SUCCESS);
+    
+    add_office(&system, 1, 10, NULL, 0);
+    add_office(&system, 2, 10, NULL, 0);
+    add_letter(&system, REGULAR, 5, 1, 2, "Delivered soon");
+    add_letter(&system, REGULAR, 1, 2, 2, "Already at destination");
+    add_letter(&system, URGENT, 7, 1, 2, "Stays in transit");
+    
+    process_letters_transfer(&system);
+    Letter *delivered = find_letter(&system, 2);
+    assert(delivered != NULL && delivered->state == DELIVERED);
+    
+    // Доставленные письма больше не занимают место в отделении
+    PostOffice *office2 = find_office(&system, 2);
+    assert(office2->current_letters == (int)size_heap(&office2->letter_heap));
+    
+    size_t in_transit_before = system.state_counts[IN_TRANSIT];
+    size_t retired = retire_letters(&system);
+    assert(retired == system.state_counts[DELIVERED] + system.state_counts[UNDELIVERED]);
+    assert(system.letters_size == in_transit_before);
+    assert(find_letter(&system, 2) == NULL);
+    assert(check_system_aggregates(&system));
+    
+    Letter archived;
+    assert(find_archived_letter(&system, 2, &archived) == SUCCESS);
+    assert(archived.id == 2 && archived.state == DELIVERED);
+    assert(strcmp(archived.tech_data, "Already at destination") == 0);
+    assert(find_archived_letter(&system, 999, &archived) == ERROR_INVALID_ID);
+    
+    for (size_t i = 0; i < system.letters_size; i++) {
+        assert(find_letter(&system, system.letters[i].id) == &system.letters[i]);
+    }
+    
+    system.retire_interval = 1;
+    for (int i = 0; i < 5 && system.state_counts[IN_TRANSIT] > 0; i++) {
+        process_letters_transfer(&system);
+    }
+    assert(system.letters_size == system.state_counts[IN_TRANSIT]);
+    assert(system.archive.spilled >= 2);
+    assert(find_archived_letter(&system, 1, &archived) == SUCCESS || find_letter(&system, 1) != NULL);
+    assert(check_system_aggregates(&system));
+    
+    cleanup_system(&system);
+    remove(spill_filename);
+    printf("letter retirement and compaction tests passed!\n");
+}
+
+void test_retirement_spill_failure() {
+    printf("Testing retirement when the archive spill fails...\n");
+    
+    MailSystem system;
+    init_system(&system);
+    system.quiet = 1;
+    const char *spill_filename = "test_archive_spill_fail.bin";
+    assert(set_archive_spill(&system, spill_filename, 1) == SUCCESS);
+    add_office(&system, 1, 10, NULL, 0);
+    add_letter(&system, REGULAR, 5, 1, 1, "First");
+    process_letters_transfer(&system);
+    assert(find_letter(&system, 1)->state == DELIVERED);
+    
+    // Файл спилла не может расти: письмо всё равно уходит в архив и остаётся в памяти
+    struct rlimit saved, limited;
+    assert(getrlimit(RLIMIT_FSIZE, &saved) == 0);
+    void (*saved_handler)(int) = signal(SIGXFSZ, SIG_IGN);
+    limited = saved;
+    limited.rlim_cur = (rlim_t)ftell(system.archive.spill_file);
+    assert(setrlimit(RLIMIT_FSIZE, &limited) == 0);
+    
+    assert(retire_letters(&system) == 1);
+    assert(system.letters_size == 0);
+    assert(system.archive.size == 1 && system.archive.spilled == 0);
+    assert(system.archive.retired_counts[DELIVERED] == 1);
+    assert(check_system_aggregates(&system));
+    assert(retire_letters(&system) == 0);
+    assert(system.archive.size == 1 && system.archive.retired_counts[DELIVERED] == 1);
+    Letter archived;
+    assert(find_archived_letter(&system, 1, &archived) == SUCCESS);
+    
+    assert(setrlimit(RLIMIT_FSIZE, &saved) == 0);
+    signal(SIGXFSZ, saved_handler);
+    
+    add_letter(&system, REGULAR, 5, 1, 1, "Second");
+    process_letters_transfer(&system);
+    assert(retire_letters(&system) == 1);
+    assert(system.archive.size == 0 && system.archive.spilled == 2);
+    assert(check_system_aggregates(&system));
+    assert(find_archived_letter(&system, 1, &archived) == SUCCESS && strcmp(archived.tech_data, "First") == 0);
+    assert(find_archived_letter(&system, 2, &archived) == SUCCESS && strcmp(archived.tech_data, "Second") == 0);
+    
+    cleanup_system(&system);
+    remove(spill_filename);
+    printf("retirement spill failure tests passed!\n");
+}
+
+static int count_archived(const Letter *letter, void *context) {
+    (void)letter;
+    (*(int*)context)++;
+    return 1;
+}
+
+void test_letter_archive_file() {
+    printf("Testing columnar letter archive...\n");
+    
+    const char *archive_filename = "test_archive_blocks.bin";
+    const size_t total = ARCHIVE_BLOCK_LETTERS + 500;
+    Letter *letters = (Letter*)calloc(total, sizeof(Letter));
+    assert(letters != NULL);
+    for (size_t i = 0; i < total; i++) {
+        letters[i].id = (int)(total - i);
+        letters[i].type = i % 3 == 0 ? URGENT : REGULAR;
+        letters[i].state = i % 5 == 0 ? UNDELIVERED : DELIVERED;
+        letters[i].priority = (int)(i % 17);
+        letters[i].from_office = (int)(i % 10);
+        letters[i].to_office = (int)(i % 10) + 10;
+        letters[i].current_office = letters[i].to_office;
+        letters[i].created_tick = (int)i / 4;
+        letters[i].delivered_tick = letters[i].state == DELIVERED ? (int)i / 4 + 3 : -1;
+        letters[i].hops = 3;
+        sprintf(letters[i].tech_data, "Archived %zu", i);
+    }
+    
+    FILE *file = archive_writer_open(archive_filename);
+    assert(file != NULL);
+    assert(archive_write_block(file, letters, total) == SUCCESS);
+    long file_size = ftell(file);
+    fclose(file);
+    // Колоночное сжатие должно быть значительно компактнее сырых структур
+    assert(file_size > 0 && (size_t)file_size * 10 < total * sizeof(Letter));
+    
+    ArchiveReader reader;
+    assert(archive_open(&reader, archive_filename) == SUCCESS);
+    assert(reader.num_blocks == 2);
+    assert(reader.num_letters == total);
+    
+    Letter found;
+    for (size_t i = 0; i < total; i += 777) {
+        assert(archive_lookup(&reader, letters[i].id, &found) == SUCCESS);
+        assert(found.id == letters[i].id);
+        assert(found.type == letters[i].type && found.state == letters[i].state);
+        assert(found.priority == letters[i].priority);
+        assert(found.from_office == letters[i].from_office);
+        assert(found.delivered_tick == letters[i].delivered_tick);
+        assert(strcmp(found.tech_data, letters[i].tech_data) == 0);
+    }
+    assert(archive_lookup(&reader, (int)total + 1, &found) == ERROR_INVALID_ID);
+    
+    int visited = 0;
+    assert(archive_scan_office(&reader, 3, count_archived, &visited) == total / 10 + (total % 10 > 3));
+    assert((size_t)visited == total / 10 + (total % 10 > 3));
+    
+    size_t expected = 0;
+    for (size_t i = 0; i < total; i++) {
+        int closed = letters[i].delivered_tick >= 0 ? letters[i].delivered_tick : letters[i].created_tick;
+        if (letters[i].created_tick <= 110 && closed >= 100) {
+            expected++;
+        }
+    }
+    visited = 0;
+    assert(archive_scan_time(&reader, 100, 110, count_archived, &visited) == expected);
+    assert((size_t)visited == expected);
+    
+    archive_close(&reader);
+    free(letters);
+    remove(archive_filename);
+    printf("columnar letter archive tests passed!\n");
+}
+
+void test_bucket_queue() {
+    printf("Testing bucket priority queue...\n");
+    
+    BucketQueue queue = create_bucket_queue(8);
+    push_bucket_queue(&queue, 2, 10);
+    push_bucket_queue(&queue, 7, 11);
+    push_bucket_queue(&queue, 2, 12);
+    push_bucket_queue(&queue, 50, 13);
+    assert(size_bucket_queue(&queue) == 4);
+    
+    // Приоритеты выше последнего уровня попадают в старший уровень, внутри уровня FIFO
+    assert(peek_bucket_queue(&queue) == 11);
+    assert(pop_bucket_queue(&queue) == 11);
+    assert(pop_bucket_queue(&queue) == 13);
+    assert(remove_from_bucket_queue(&queue, 2, 10) == 1);
+    assert(remove_from_bucket_queue(&queue, 2, 10) == 0);
+    assert(pop_bucket_queue(&queue) == 12);
+    assert(pop_bucket_queue(&queue) == -1);
+    delete_bucket_queue(&queue);
+    
+    // Удаление из кольцевого буфера с переносом через границу сохраняет FIFO
+    queue = create_bucket_queue(4);
+    for (int i = 0; i < 4; i++) {
+        push_bucket_queue(&queue, 1, i);
+    }
+    assert(pop_bucket_queue(&queue) == 0);
+    assert(pop_bucket_queue(&queue) == 1);
+    push_bucket_queue(&queue, 1, 4);
+    push_bucket_queue(&queue, 1, 5);
+    assert(queue.levels[1].capacity == 4);
+    assert(remove_from_bucket_queue(&queue, 1, 3) == 1);
+    assert(remove_from_bucket_queue(&queue, 1, 2) == 1);
+    push_bucket_queue(&queue, 1, 6);
+    push_bucket_queue(&queue, 1, 7);
+    assert(remove_from_bucket_queue(&queue, 1, 6) == 1);
+    assert(pop_bucket_queue(&queue) == 4);
+    assert(pop_bucket_queue(&queue) == 5);
+    assert(pop_bucket_queue(&queue) == 7);
+    assert(size_bucket_queue(&queue) == 0);
+    delete_bucket_queue(&queue);
+    
+    SystemConfig config;
+    default_system_config(&config);
+    config.queue_kind = QUEUE_BUCKET;
+    config.max_priority = 1000;
+    MailSystem wide;
+    init_system_with_config(&wide, &config);
+    assert(wide.queue_kind == QUEUE_HEAP);
+    cleanup_system(&wide);
+    
+    config.max_priority = 15;
+    MailSystem system;
+    init_system_with_config(&system, &config);
+    system.quiet = 1;
+    assert(system.queue_kind == QUEUE_BUCKET);
+    
+    int connections[] = {1};
+    add_office(&system, 1, 10, NULL, 0);
+    add_office(&system, 2, 10, connections, 1);
+    add_letter(&system, REGULAR, 1, 1, 2, "Low");
+    add_letter(&system, URGENT, 9, 1, 2, "High");
+    add_letter(&system, REGULAR, 9, 1, 2, "High, later");
+    assert(add_letter(&system, URGENT, -1, 1, 2, "Negative") == ERROR_INVALID_PARAMETER);
+    assert(system.letters_size == 3);
+    
+    transfer_priority_letters(&system);
+    assert(find_letter(&system, 2)->current_office == 2);
+    assert(find_letter(&system, 1)->current_office == 1);
+    transfer_priority_letters(&system);
+    transfer_priority_letters(&system);
+    assert(find_letter(&system, 2)->state == DELIVERED);
+    assert(find_letter(&system, 3)->current_office == 2);
+    assert(find_letter(&system, 1)->current_office == 1);
+    
+    for (int i = 0; i < 6; i++) {
+        process_letters_transfer(&system);
+    }
+    assert(system.state_counts[DELIVERED] == 3);
+    
+    // Приоритет выше верхнего уровня попадает в верхнюю корзину, как и в куче письмо принимается
+    assert(add_letter(&system, REGULAR, 15, 1, 2, "Top") == SUCCESS);
+    assert(add_letter(&system, URGENT, 40, 1, 2, "Too high") == SUCCESS);
+    assert(find_letter(&system, 5)->priority == 40);
+    int ids[2];
+    assert(office_urgent_letters(&system, 1, ids, 2) == 2 && ids[0] == 4 && ids[1] == 5);
+    for (int i = 0; i < 6; i++) {
+        process_letters_transfer(&system);
+    }
+    assert(system.state_counts[DELIVERED] == 5);
+    assert(check_system_aggregates(&system));
+    
+    cleanup_system(&system);
+    printf("bucket priority queue tests passed!\n");
+}
+
+void test_heap_iterator() {
+    printf("Testing ordered heap iteration...\n");
+    
+    Heap heap = create_heap(4);
+    for (int i = 0; i < 100; i++) {
+        push_heap(&heap, (i * 37) % 101);
+    }
+    int snapshot[100];
+    size_t count;
+    const int *view = heap_view(&heap, &count);
+    assert(count == 100 && view == heap.data);
+    memcpy(snapshot, view, sizeof(snapshot));
+    
+    // Обход в порядке кучи, сама куча не меняется
+    HeapIterator it;
+    heap_iterator_begin(&it, &heap);
+    int value, previous = -1;
+    size_t visited = 0;
+    int status;
+    while ((status = heap_iterator_next(&it, &value)) > 0) {
+        assert(value > previous);
+        previous = value;
+        visited++;
+    }
+    heap_iterator_end(&it);
+    assert(status == 0);
+    assert(visited == 100);
+    assert(memcmp(snapshot, heap.data, sizeof(snapshot)) == 0);
+    
+    heap_iterator_begin(&it, &heap);
+    for (int i = 0; i < 5; i++) {
+        assert(heap_iterator_next(&it, &value) == 1 && value == i);
+    }
+    heap_iterator_end(&it);
+    delete_heap(&heap);
+    
+    // Куча с ключами: сначала больший приоритет, затем меньший id
+    heap = create_keyed_heap(4);
+    for (int i = 0; i < 100; i++) {
+        push_heap_keyed(&heap, i, (i * 7) % 5);
+    }
+    assert(heap_bytes(&heap) == heap.capacity * 2 * sizeof(int));
+    remove_letter_from_heap(&heap, 4);
+    heap_iterator_begin(&it, &heap);
+    int previous_key = 5;
+    previous = -1;
+    visited = 0;
+    while (heap_iterator_next(&it, &value) > 0) {
+        int key = (value * 7) % 5;
+        assert(key < previous_key || (key == previous_key && value > previous));
+        previous_key = key;
+        previous = value;
+        visited++;
+    }
+    heap_iterator_end(&it);
+    assert(visited == 99);
+    assert(pop_heap(&heap) == 2);
+    delete_heap(&heap);
+    
+    for (int kind = QUEUE_HEAP; kind <= QUEUE_BUCKET; kind++) {
+        SystemConfig config;
+        default_system_config(&config);
+        config.queue_kind = (QueueKind)kind;
+        config.max_priority = 15;
+        MailSystem system;
+        init_system_with_config(&system, &config);
+        system.quiet = 1;
+        
+        add_office(&system, 1, 100, NULL, 0);
+        add_office(&system, 2, 100, NULL, 0);
+        int priorities[] = {3, 9, 1, 9, 5, 3, 12, 0};
+        for (int i = 0; i < 8; i++) {
+            add_letter(&system, REGULAR, priorities[i], 1, 2, "Urgent view");
+        }
+        
+        int urgent[8];
+        assert(office_urgent_letters(&system, 1, urgent, 8) == 8);
+        int expected[] = {7, 2, 4, 5, 1, 6, 3, 8};
+        assert(memcmp(urgent, expected, sizeof(expected)) == 0);
+        assert(office_urgent_letters(&system, 1, urgent, 3) == 3);
+        assert(urgent[0] == 7 && urgent[1] == 2 && urgent[2] == 4);
+        assert(office_urgent_letters(&system, 99, urgent, 3) == 0);
+        assert(find_office(&system, 1)->current_letters == 8);
+        cleanup_system(&system);
+    }
+    
+    printf("ordered heap iteration tests passed!\n");
+}
+
+static MailSystem *urgent_order_system;
+
+static int urgent_order(const void *a, const void *b) {
+    const Letter *x = find_letter(urgent_order_system, *(const int*)a);
+    const Letter *y = find_letter(urgent_order_system, *(const int*)b);
+    if (x->priority != y->priority) {
+        return y->priority - x->priority;
+    }
+    return x->id - y->id;
+}
+
+static size_t queued_in_urgent_order(MailSystem *system, int *ids) {
+    size_t count = 0;
+    for (int k = 0; k < system->office_count; k++) {
+        count += office_urgent_letters(system, system->offices[k].id, ids + count, 128 - count);
+    }
+    urgent_order_system = system;
+    qsort(ids, count, sizeof(int), urgent_order);
+    return count;
+}
+
+void test_global_urgent_letters() {
+    printf("Testing global urgent letter selection...\n");
+    
+    for (int kind = QUEUE_HEAP; kind <= QUEUE_BUCKET; kind++) {
+        SystemConfig config;
+        default_system_config(&config);
+        config.queue_kind = (QueueKind)kind;
+        config.max_priority = 15;
+        MailSystem system;
+        init_system_with_config(&system, &config);
+        system.quiet = 1;
+        int chain[] = {1};
+        add_office(&system, 1, 1000, NULL, 0);
+        add_office(&system, 2, 1000, chain, 1);
+        chain[0] = 2;
+        add_office(&system, 3, 1000, chain, 1);
+        add_office(&system, 4, 1000, NULL, 0);
+        
+        // Письма из изолированного отделения 4 не могут уйти и должны пропускаться
+        unsigned int seed = 11;
+        for (int i = 0; i < 60; i++) {
+            seed = seed * 1103515245u + 12345u;
+            int from = 1 + (int)((seed >> 16) % 4);
+            int to = from == 4 ? 1 : 1 + (int)((seed >> 8) % 3);
+            add_letter(&system, REGULAR, (int)((seed >> 4) % 10) + (from == 4 ? 5 : 0), from, to, "Global");
+        }
+        
+        int expected[128], actual[128];
+        for (int tick = 0; tick < 300; tick++) {
+            if (tick == 20) {
+                add_office(&system, 5, 1000, chain, 1);
+                add_letter(&system, URGENT, 9, 5, 1, "Late");
+            }
+            if (tick == 40) {
+                remove_office(&system, 4);
+            }
+            size_t count = queued_in_urgent_order(&system, expected);
+            assert(next_urgent_letters(&system, actual, 128) == count);
+            if (kind == QUEUE_HEAP) {
+                assert(memcmp(expected, actual, count * sizeof(int)) == 0);
+                if (count > 3) {
+                    assert(next_urgent_letters(&system, actual, 3) == 3);
+                    assert(memcmp(expected, actual, 3 * sizeof(int)) == 0);
+                }
+            } else {
+                // Корзины обслуживают FIFO внутри уровня: порядок по приоритету, тот же набор писем
+                for (size_t i = 1; i < count; i++) {
+                    assert(find_letter(&system, actual[i - 1])->priority >= find_letter(&system, actual[i])->priority);
+                }
+                qsort(actual, count, sizeof(int), urgent_order);
+                assert(memcmp(expected, actual, count * sizeof(int)) == 0);
+            }
+            transfer_priority_letters(&system);
+        }
+        assert(next_urgent_letters(&system, actual, 128) == 0);
+        assert(system.state_counts[IN_TRANSIT] == 0);
+        assert(system.state_counts[DELIVERED] > 50);
+        assert(check_system_aggregates(&system));
+        cleanup_system(&system);
+    }
+    
+    printf("global urgent letter selection tests passed!\n");
+}
+
+void test_memory_budget() {
+    printf("Testing memory budget and footprint...\n");
+    
+    MailSystem system;
+    init_system(&system);
+    system.quiet = 1;
+    MemoryFootprint footprint;
+    measure_memory(&system, &footprint);
+    assert(footprint.total == 0);
+    
+    int connections[] = {1};
+    assert(add_office(&system, 1, 1000, NULL, 0) == SUCCESS);
+    assert(add_office(&system, 2, 1000, connections, 1) == SUCCESS);
+    measure_memory(&system, &footprint);
+    assert(footprint.bytes[MEMORY_OFFICES] > 0 && footprint.bytes[MEMORY_CONNECTIONS] > 0 && footprint.bytes[MEMORY_QUEUES] > 0);
+    
+    // Бюджет чуть больше текущего следа: письма принимаются, пока рост массивов помещается
+    assert(set_memory_budget(&system, footprint.total + 4096) == SUCCESS);
+    int accepted = 0;
+    StatusCode status;
+    while ((status = add_letter(&system, REGULAR, 1, 1, 2, "Budget")) == SUCCESS) {
+        accepted++;
+        measure_memory(&system, &footprint);
+        assert(footprint.total <= footprint.budget);
+    }
+    assert(status == ERROR_MEMORY_BUDGET);
+    assert(accepted > 0 && system.letters_size == (size_t)accepted);
+    assert(add_office(&system, 3, 1000, connections, 1) == ERROR_MEMORY_BUDGET);
+    measure_memory(&system, &footprint);
+    assert(footprint.rejections == 2);
+    assert(footprint.bytes[MEMORY_TECH_DATA] == system.letters_capacity * TECH_DATA_SIZE);
+    assert(check_system_aggregates(&system));
+    
+    assert(set_memory_budget(&system, 0) == SUCCESS);
+    assert(add_letter(&system, REGULAR, 1, 1, 2, "Unlimited") == SUCCESS);
+    assert(add_office(&system, 3, 1000, connections, 1) == SUCCESS);
+    for (int i = 0; i < 10; i++) {
+        process_letters_transfer(&system);
+    }
+    assert(remove_office(&system, 2) == SUCCESS);
+    assert(remove_connection(&system, 3, 1) == SUCCESS);
+    assert(check_system_aggregates(&system));
+    print_memory_report(&system, stdout);
+    cleanup_system(&system);
+    
+    // Автосоздание связей и импорт писем тоже укладываются в бюджет
+    init_system(&system);
+    system.quiet = 1;
+    assert(add_office(&system, 1, 1000, NULL, 0) == SUCCESS);
+    assert(add_office(&system, 2, 1000, NULL, 0) == SUCCESS);
+    measure_memory(&system, &footprint);
+    assert(set_memory_budget(&system, footprint.total + 4096) == SUCCESS);
+    for (int to = 1; to <= 2; to++) {
+        while (add_letter(&system, REGULAR, 1, 1, to, "Budget") == SUCCESS) {
+            measure_memory(&system, &footprint);
+            assert(footprint.total <= footprint.budget);
+        }
+    }
+    measure_memory(&system, &footprint);
+    assert(set_memory_budget(&system, footprint.total) == SUCCESS);
+    Letter incoming;
+    memset(&incoming, 0, sizeof(incoming));
+    incoming.state = IN_TRANSIT;
+    incoming.priority = 1;
+    incoming.from_office = 2;
+    incoming.to_office = 1;
+    incoming.current_office = 2;
+    size_t rejections = footprint.rejections;
+    StatusCode import_status = SUCCESS;
+    while (import_status == SUCCESS) {
+        import_status = import_letter(&system, &incoming, NULL);
+        measure_memory(&system, &footprint);
+        assert(footprint.total <= footprint.budget);
+    }
+    assert(import_status == ERROR_MEMORY_BUDGET && footprint.rejections == rejections + 1);
+    assert(check_system_aggregates(&system));
+    cleanup_system(&system);
+    
+    printf("memory budget and footprint tests passed!\n");
+}
+
+void test_capacity_hysteresis() {
+    printf("Testing capacity hysteresis and compaction...\n");
+    
+    Heap heap = create_heap(INITIAL_CAPACITY);
+    for (int i = 0; i < 1000; i++) {
+        push_heap(&heap, i);
+    }
+    size_t peak = heap.capacity;
+    assert(peak >= 1000);
+    
+    // Извлечение не перевыделяет буфер, сжатие делает только compact_system
+    while (!is_empty_heap(&heap)) {
+        pop_heap(&heap);
+        assert(heap.capacity == peak);
+    }
+    delete_heap(&heap);
+    
+    MailSystem system;
+    init_system(&system);
+    system.quiet = 1;
+    int connections[] = {2};
+    add_office(&system, 2, 100000, NULL, 0);
+    add_office(&system, 1, 100000, connections, 1);
+    set_office_service_rate(&system, 1, 5000);
+    set_office_service_rate(&system, 2, 5000);
+    set_link_properties(&system, 1, 2, 5000, 1);
+    for (int i = 0; i < 5000; i++) {
+        assert(add_letter(&system, REGULAR, i % 7, 1, 2, "Spike") == SUCCESS);
+    }
+    size_t letters_peak = system.letters_capacity;
+    size_t queue_peak = system.queue_bytes;
+    MemoryFootprint before, after;
+    measure_memory(&system, &before);
+    
+    for (int i = 0; i < 4; i++) {
+        process_network_tick(&system);
+    }
+    assert(system.state_counts[DELIVERED] == 5000);
+    assert(system.queue_bytes >= queue_peak);
+    assert(retire_letters(&system) == 5000);
+    assert(system.letters_capacity < letters_peak && system.letters_capacity == LETTER_STORE_MIN_CAPACITY);
+    assert(compact_system(&system) > 0);
+    assert(compact_system(&system) == 0);
+    assert(system.queue_bytes < queue_peak);
+    measure_memory(&system, &after);
+    assert(after.bytes[MEMORY_LETTERS] < before.bytes[MEMORY_LETTERS]);
+    assert(after.bytes[MEMORY_TECH_DATA] < before.bytes[MEMORY_TECH_DATA]);
+    assert(after.bytes[MEMORY_QUEUES] < before.bytes[MEMORY_QUEUES]);
+    assert(check_system_aggregates(&system));
+    
+    assert(add_letter(&system, URGENT, 3, 2, 1, "After spike") == SUCCESS);
+    assert(find_letter(&system, 5001) != NULL);
+    cleanup_system(&system);
+    
+    printf("capacity hysteresis and compaction tests passed!\n");
+}
+
+static int ticks_until_moved(SchedulingPolicy policy, int max_ticks) {
+    SystemConfig config;
+    default_system_config(&config);
+    config.policy = policy;
+    config.aging_ticks = 1;
+    MailSystem system;
+    init_system_with_config(&system, &config);
+    system.quiet = 1;
+    
+    add_office(&system, 1, 1000, NULL, 0);
+    add_office(&system, 2, 1000, NULL, 0);
+    add_letter(&system, REGULAR, 0, 1, 2, "Background");
+    
+    // Каждый тик приходит срочное письмо, обычное письмо не должно голодать
+    int tick;
+    for (tick = 1; tick <= max_ticks; tick++) {
+        add_letter(&system, URGENT, 10, 1, 2, "Urgent");
+        transfer_priority_letters(&system);
+        if (find_letter(&system, 1)->current_office == 2) {
+            break;
+        }
+    }
+    assert(check_system_aggregates(&system));
+    cleanup_system(&system);
+    return tick;
+}
+
+void test_scheduling_policies() {
+    printf("Testing scheduling policies...\n");
+    
+    assert(ticks_until_moved(POLICY_STRICT_PRIORITY, 200) > 200);
+    assert(ticks_until_moved(POLICY_AGING, 200) <= 25);
+    assert(ticks_until_moved(POLICY_WEIGHTED_FAIR, 200) <= 4);
+    assert(ticks_until_moved(POLICY_EARLIEST_DEADLINE, 200) <= 170);
+    
+    // Взаимная блокировка: офисы 2 и 3 заполнены, все письма паркуются до освобождения места
+    SystemConfig config;
+    default_system_config(&config);
+    config.policy = POLICY_AGING;
+    config.auto_connect = 0;
+    MailSystem system;
+    init_system_with_config(&system, &config);
+    system.quiet = 1;
+    add_office(&system, 1, 100, NULL, 0);
+    add_office(&system, 2, 1, NULL, 0);
+    add_office(&system, 3, 1, NULL, 0);
+    add_connection(&system, 1, 2, 1);
+    add_connection(&system, 2, 3, 1);
+    assert(add_letter(&system, REGULAR, 0, 3, 1, "Stuck") == SUCCESS);
+    int stuck_id = system.next_letter_id - 1;
+    assert(add_letter(&system, REGULAR, 0, 2, 3, "Blocker") == SUCCESS);
+    for (int i = 0; i < 19; i++) {
+        assert(add_letter(&system, REGULAR, 1 + i % 5, 1, 3, "Congested") == SUCCESS);
+    }
+    
+    for (int tick = 0; tick < 3; tick++) {
+        transfer_priority_letters(&system);
+    }
+    assert(system.scheduler.num_parked == 21);
+    assert(system.scheduler.classes[0].size == 0);
+    
+    Letter exported;
+    assert(export_letter(&system, stuck_id, &exported) == SUCCESS);
+    assert(system.scheduler.num_parked == 20);
+    assert(system.scheduler.classes[0].size == 1);
+    for (int tick = 0; tick < 200 && system.state_counts[DELIVERED] < 20; tick++) {
+        transfer_priority_letters(&system);
+        assert(find_office(&system, 2)->current_letters <= 1);
+        if (tick == 10) {
+            system.scheduler.classes[0].size = 0;
+            system.scheduler.rebuild = 1;
+        }
+    }
+    assert(system.state_counts[DELIVERED] == 20);
+    assert(system.scheduler.num_parked == 0);
+    assert(!system.scheduler.rebuild);
+    assert(check_system_aggregates(&system));
+    cleanup_system(&system);
+    
+    printf("scheduling policies tests passed!\n");
+}
+
+void test_network_tick() {
+    printf("Testing link bandwidth and service rate model...\n");
+    
+    MailSystem system;
+    init_system(&system);
+    system.quiet = 1;
+    
+    add_office(&system, 1, 10, NULL, 0);
+    add_office(&system, 2, 10, NULL, 0);
+    for (int i = 0; i < 3; i++) {
+        assert(add_letter(&system, REGULAR, i, 1, 2, "Over the link") == SUCCESS);
+    }
+    assert(set_office_service_rate(&system, 1, 3) == SUCCESS);
+    assert(set_link_properties(&system, 1, 2, 2, 3) == SUCCESS);
+    assert(set_link_properties(&system, 1, 99, 2, 3) == ERROR_OFFICE_NOT_FOUND);
+    assert(set_office_service_rate(&system, 1, 0) == ERROR_INVALID_PARAMETER);
+    
+    // Пропускная способность канала 2 письма за тик, задержка 3 тика
+    process_network_tick(&system);
+    PostOffice *office1 = find_office(&system, 1);
+    PostOffice *office2 = find_office(&system, 2);
+    assert(system.in_flight.size == 2);
+    assert(office1->current_letters == 1);
+    assert(office2->current_letters == 2);
+    assert(size_heap(&office2->letter_heap) == 0);
+    assert(find_letter(&system, 3)->current_office == 1);
+    
+    process_network_tick(&system);
+    assert(system.in_flight.size == 3);
+    process_network_tick(&system);
+    process_network_tick(&system);
+    assert(find_letter(&system, 3)->current_office == 2);
+    assert(find_letter(&system, 3)->hops == 1);
+    
+    for (int i = 0; i < 6; i++) {
+        process_network_tick(&system);
+    }
+    assert(system.state_counts[DELIVERED] == 3);
+    assert(system.in_flight.size == 0);
+    assert(system.total_occupancy == 0);
+    assert(system.active_offices.valid && system.active_offices.size == 0);
+    assert(check_system_aggregates(&system));
+    
+    // Отделение удалено и добавлено заново, пока письмо в пути: занятость начисляется новому
+    int back[] = {1};
+    assert(add_office(&system, 3, 10, back, 1) == SUCCESS);
+    assert(add_letter(&system, REGULAR, 1, 1, 3, "Replaced") == SUCCESS);
+    process_network_tick(&system);
+    assert(system.in_flight.size == 1 && system.total_occupancy == 1);
+    assert(remove_office(&system, 3) == SUCCESS);
+    assert(add_office(&system, 3, 10, back, 1) == SUCCESS);
+    assert(system.total_occupancy == 0);
+    for (int i = 0; i < 6; i++) {
+        process_network_tick(&system);
+    }
+    assert(system.state_counts[DELIVERED] == 4);
+    assert(system.total_occupancy == 0 && find_office(&system, 3)->current_letters == 0);
+    assert(check_system_aggregates(&system));
+    
+    cleanup_system(&system);
+    printf("link bandwidth and service rate model tests passed!\n");
+}
+
+void test_office_handles() {
+    printf("Testing dense office storage and handles...\n");
+    
+    MailSystem system;
+    init_system(&system);
+    system.quiet = 1;
+    
+    for (int id = 1; id <= 200; id++) {
+        assert(add_office(&system, id, 5, NULL, 0) == SUCCESS);
+    }
+    OfficeHandle removed = get_office_handle(&system, 2);
+    OfficeHandle moved = get_office_handle(&system, 200);
+    assert(resolve_office(&system, moved)->id == 200);
+    
+    for (int id = 2; id <= 200; id += 2) {
+        if (id != 200) {
+            assert(remove_office(&system, id) == SUCCESS);
+        }
+    }
+    assert(system.office_count == 101);
+    assert(resolve_office(&system, removed) == NULL);
+    // Хендл остаётся валидным после перестановки при удалении
+    assert(resolve_office(&system, moved) == find_office(&system, 200));
+    for (int id = 1; id <= 200; id++) {
+        PostOffice *office = find_office(&system, id);
+        assert((id % 2 == 1 || id == 200) ? (office && office->id == id) : office == NULL);
+    }
+    
+    assert(add_office(&system, 2, 5, NULL, 0) == SUCCESS);
+    assert(resolve_office(&system, removed) == NULL);
+    assert(resolve_office(&system, get_office_handle(&system, 2))->id == 2);
+    assert(check_system_aggregates(&system));
+    
+    cleanup_system(&system);
+    printf("dense office storage and handles tests passed!\n");
+}
+
+void test_remove_hub_office() {
+    printf("Testing hub office removal...\n");
+    
+    MailSystem system;
+    init_system(&system);
+    system.quiet = 1;
+    
+    for (int id = 1; id <= 4; id++) {
+        assert(add_office(&system, id, 10, NULL, 0) == SUCCESS);
+    }
+    int spokes[] = {1, 2, 3, 4};
+    assert(add_office(&system, 100, 50, spokes, 4) == SUCCESS);
+    int tail[] = {4};
+    assert(add_office(&system, 5, 10, tail, 1) == SUCCESS);
+    assert(find_office(&system, 100)->num_in_connections == 4);
+    
+    // Транзитные письма проходят через узел 100
+    for (int i = 0; i < 6; i++) {
+        assert(add_letter(&system, REGULAR, i, 1 + i % 3, 4, "via hub") == SUCCESS);
+        assert(transfer_letter_to_office(&system, system.next_letter_id - 1, 1 + i % 3, 100) == SUCCESS);
+    }
+    assert(add_letter(&system, URGENT, 9, 100, 2, "from hub") == SUCCESS);
+    int from_hub = system.next_letter_id - 1;
+    assert(find_office(&system, 100)->current_letters == 7);
+    
+    assert(remove_office(&system, 100) == SUCCESS);
+    assert(find_office(&system, 100) == NULL);
+    assert(find_letter(&system, from_hub)->state == UNDELIVERED);
+    for (int id = 1; id < from_hub; id++) {
+        Letter *letter = find_letter(&system, id);
+        assert(letter->state == IN_TRANSIT);
+        assert(letter->current_office == 4);
+    }
+    for (int k = 0; k < system.office_count; k++) {
+        PostOffice *office = &system.offices[k];
+        for (int j = 0; j < office->num_connections; j++) {
+            assert(office->connections[j] != 100);
+        }
+        for (int j = 0; j < office->num_in_connections; j++) {
+            assert(office->in_connections[j] != 100);
+        }
+    }
+    assert(check_system_aggregates(&system));
+    
+    cleanup_system(&system);
+    printf("hub office removal tests passed!\n");
+}
+
+typedef struct {
+    MailSystem *system;
+    int stop;
+    int reads;
+} TopologyReader;
+
+static void* read_topology_loop(void *context) {
+    TopologyReader *reader = (TopologyReader*)context;
+    while (!__atomic_load_n(&reader->stop, __ATOMIC_ACQUIRE)) {
+        int slot;
+        TopologySnapshot *snapshot = acquire_topology(reader->system, &slot);
+        if (!snapshot) {
+            continue;
+        }
+        int edges = 0;
+        for (int k = 0; k < snapshot->office_count; k++) {
+            int count = 0;
+            const int *neighbours = topology_neighbours(snapshot, snapshot->office_ids[k], &count);
+            for (int j = 0; j < count; j++) {
+                assert(neighbours[j] > 0);
+            }
+            edges += count;
+        }
+        assert(edges == snapshot->offsets[snapshot->office_count]);
+        release_topology(reader->system, slot);
+        __atomic_add_fetch(&reader->reads, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+void test_topology_epochs() {
+    printf("Testing epoch-based topology changes...\n");
+    
+    MailSystem system;
+    init_system(&system);
+    system.quiet = 1;
+    
+    int ring[] = {1};
+    add_office(&system, 1, 10, NULL, 0);
+    add_office(&system, 2, 10, ring, 1);
+    add_office(&system, 3, 10, ring, 1);
+    assert(apply_topology_changes(&system) == 0);
+    int before_slot, after_slot;
+    TopologySnapshot *before = acquire_topology(&system, &before_slot);
+    assert(before && before->office_count == 3);
+    
+    int count = 0;
+    const int *neighbours = topology_neighbours(before, 1, &count);
+    assert(count == 2 && neighbours[0] == 2 && neighbours[1] == 3);
+    
+    // Изменения применяются только на границе тика
+    int links[] = {1, 3};
+    assert(queue_add_office(&system, 4, 10, links, 2) == SUCCESS);
+    assert(queue_remove_office(&system, 2) == SUCCESS);
+    assert(queue_add_office(&system, 3, 10, NULL, 0) == SUCCESS);
+    assert(find_office(&system, 4) == NULL);
+    process_letters_transfer(&system);
+    assert(find_office(&system, 4) != NULL);
+    assert(find_office(&system, 2) == NULL);
+    
+    TopologySnapshot *after = acquire_topology(&system, &after_slot);
+    assert(after != before && after->epoch > before->epoch);
+    assert(topology_neighbours(after, 2, &count) == NULL && count == 0);
+    neighbours = topology_neighbours(after, 4, &count);
+    assert(count == 2 && neighbours[0] == 1 && neighbours[1] == 3);
+    // Кэш расстояний принадлежит движку и помечен эпохой снимка, сами снимки не меняются
+    assert(route_distance(&system, 4, 3) == 1);
+    assert(system.routes.valid && system.routes.epoch == after->epoch);
+    // Старый снимок остаётся согласованным, пока его держит читатель
+    neighbours = topology_neighbours(before, 1, &count);
+    assert(count == 2 && neighbours[0] == 2);
+    
+    process_letters_transfer(&system);
+    assert(system.retired_topology == before);
+    release_topology(&system, before_slot);
+    process_letters_transfer(&system);
+    assert(system.retired_topology == NULL);
+    release_topology(&system, after_slot);
+    assert(check_system_aggregates(&system));
+    
+    // Читатель в другом потоке не должен видеть освобождённый снимок
+    TopologyReader reader = {&system, 0, 0};
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, read_topology_loop, &reader) == 0);
+    for (int i = 0; i < 300 || __atomic_load_n(&reader.reads, __ATOMIC_ACQUIRE) < 100; i++) {
+        if (i % 2 == 0) {
+            assert(queue_add_connection(&system, 3, 4, 1 + i % 5) == SUCCESS);
+        } else {
+            assert(queue_remove_connection(&system, 3, 4) == SUCCESS);
+        }
+        process_letters_transfer(&system);
+    }
+    __atomic_store_n(&reader.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    process_letters_transfer(&system);
+    assert(system.retired_topology == NULL);
+    
+    cleanup_system(&system);
+    printf("epoch-based topology changes tests passed!\n");
+}
+
+void test_weighted_connections() {
+    printf("Testing weighted connection management...\n");
+    
+    SystemConfig config;
+    default_system_config(&config);
+    config.auto_connect = 0;
+    MailSystem system;
+    init_system_with_config(&system, &config);
+    system.quiet = 1;
+    
+    for (int id = 1; id <= 4; id++) {
+        add_office(&system, id, 10, NULL, 0);
+    }
+    assert(add_connection(&system, 1, 2, 1) == SUCCESS);
+    assert(add_connection(&system, 2, 4, 1) == SUCCESS);
+    assert(add_connection(&system, 1, 3, 10) == SUCCESS);
+    assert(add_connection(&system, 3, 4, 1) == SUCCESS);
+    assert(add_connection(&system, 1, 9, 1) == ERROR_OFFICE_NOT_FOUND);
+    assert(add_connection(&system, 1, 2, 0) == ERROR_INVALID_PARAMETER);
+    assert(route_distance(&system, 1, 4) == 2);
+    assert(route_distance(&system, 4, 1) == -1);
+    
+    // Без автосоединения письмо идёт по самому дешёвому пути
+    assert(add_letter(&system, REGULAR, 1, 1, 4, "routed") == SUCCESS);
+    assert(find_office(&system, 1)->num_connections == 2);
+    process_letters_transfer(&system);
+    assert(find_letter(&system, 1)->current_office == 2);
+    
+    assert(remove_connection(&system, 2, 4) == SUCCESS);
+    assert(remove_connection(&system, 2, 4) == ERROR_INVALID_PARAMETER);
+    assert(route_distance(&system, 1, 4) == 11);
+    assert(route_distance(&system, 2, 4) == -1);
+    assert(add_connection(&system, 1, 3, 2) == SUCCESS);
+    assert(route_distance(&system, 1, 4) == 3);
+    assert(check_system_aggregates(&system));
+    
+    cleanup_system(&system);
+    printf("weighted connection management tests passed!\n");
+}
+
+void test_regional_routing() {
+    printf("Testing regional routing...\n");
+    
+    SystemConfig config;
+    default_system_config(&config);
+    config.auto_connect = 0;
+    config.routing = ROUTING_REGIONAL;
+    MailSystem system;
+    init_system_with_config(&system, &config);
+    system.quiet = 1;
+    
+    for (int id = 1; id <= 6; id++) {
+        add_office(&system, id, 10, NULL, 0);
+        assert(set_office_region(&system, id, id <= 3 ? 0 : 1) == SUCCESS);
+    }
+    for (int id = 1; id < 6; id++) {
+        int weight = id == 3 ? 5 : 1;
+        assert(add_connection(&system, id, id + 1, weight) == SUCCESS);
+        assert(add_connection(&system, id + 1, id, weight) == SUCCESS);
+    }
+    assert(route_distance(&system, 1, 3) == 2);
+    assert(route_distance(&system, 1, 6) == 7);
+    assert(route_distance(&system, 6, 1) == 7);
+    
+    assert(add_letter(&system, REGULAR, 1, 1, 6, "cross-region") == SUCCESS);
+    for (int tick = 0; tick < 10 && find_letter(&system, 1)->state == IN_TRANSIT; tick++) {
+        process_network_tick(&system);
+    }
+    assert(find_letter(&system, 1)->state == DELIVERED);
+    assert(find_letter(&system, 1)->hops == 5);
+    
+    // Изменение внутри региона перестраивает только его таблицу
+    RegionalRoutes *regions = &system.regions;
+    int west = regions->region_of[find_office(&system, 1) - system.offices];
+    int east = regions->region_of[find_office(&system, 6) - system.offices];
+    assert(add_connection(&system, 5, 6, 3) == SUCCESS);
+    assert(regions->valid && regions->tables[west].intra_valid && !regions->tables[east].intra_valid);
+    assert(route_distance(&system, 4, 6) == 4);
+    cleanup_system(&system);
+    
+    init_system_with_config(&system, &config);
+    system.quiet = 1;
+    for (int id = 1; id <= 16; id++) {
+        int previous = id - 1;
+        add_office(&system, id, 10, &previous, id > 1 ? 1 : 0);
+    }
+    assert(route_distance(&system, 1, 4) == 3);
+    assert(route_distance(&system, 1, 16) > 0);
+    assert(system.regions.num_regions == 4);
+    cleanup_system(&system);
+    
+    // Растущая цепочка: новые офисы присоединяются к региону соседа
+    init_system_with_config(&system, &config);
+    system.quiet = 1;
+    for (int id = 1; id <= 400; id++) {
+        int previous = id - 1;
+        add_office(&system, id, 10, &previous, id > 1 ? 1 : 0);
+        if (id % 10 == 0) {
+            assert(route_distance(&system, 1, id) > 0);
+        }
+    }
+    assert(system.regions.valid && system.regions.num_regions <= 25);
+    assert(route_distance(&system, 1, 2) == 1);
+    int head = system.regions.region_of[find_office(&system, 1) - system.offices];
+    assert(system.regions.tables[head].intra_valid);
+    assert(remove_office(&system, 400) == SUCCESS);
+    assert(remove_office(&system, 200) == SUCCESS);
+    assert(system.regions.valid && system.regions.tables[head].intra_valid);
+    
+    // Инкрементальные таблицы совпадают с полной перестройкой
+    int pairs[][2] = {{1, 199}, {1, 201}, {399, 201}, {150, 250}, {350, 10}, {399, 1}};
+    int incremental[6];
+    for (int i = 0; i < 6; i++) {
+        incremental[i] = route_distance(&system, pairs[i][0], pairs[i][1]);
+    }
+    system.regions.valid = 0;
+    for (int i = 0; i < 6; i++) {
+        assert(route_distance(&system, pairs[i][0], pairs[i][1]) == incremental[i]);
+    }
+    cleanup_system(&system);
+    printf("regional routing tests passed!\n");
+}
+
+void test_scan_kernels() {
+    printf("Testing vectorized scan kernels...\n");
+    
+    int values[67];
+    Letter letters[37];
+    memset(letters, 0, sizeof(letters));
+    for (int i = 0; i < 67; i++) {
+        values[i] = (i * 7) % 13;
+    }
+    for (int i = 0; i < 37; i++) {
+        letters[i].state = (LetterState)(i % 5 == 0 ? DELIVERED : (i % 3 == 0 ? UNDELIVERED : IN_TRANSIT));
+    }
+    
+    ScanLevel original = scan_level();
+    // Каждая реализация должна совпадать со скалярной на всех длинах хвоста
+    for (int level = SCAN_SCALAR; level <= SCAN_AVX2; level++) {
+        scan_set_level((ScanLevel)level);
+        for (size_t count = 0; count <= 67; count++) {
+            for (int needle = -1; needle < 14; needle++) {
+                int expected_index = -1;
+                size_t expected_count = 0, expected_range = 0;
+                unsigned char marks[67];
+                memset(marks, 0, sizeof(marks));
+                for (size_t i = 0; i < count; i++) {
+                    if (values[i] == needle && expected_index < 0) {
+                        expected_index = (int)i;
+                    }
+                    expected_count += values[i] == needle;
+                    expected_range += values[i] >= needle && values[i] <= needle + 3;
+                }
+                assert(scan_find_int(values, count, needle) == expected_index);
+                assert(scan_count_int(values, count, needle) == expected_count);
+                assert(scan_mark_range(values, count, needle, needle + 3, marks) == expected_range);
+                for (size_t i = 0; i < count; i++) {
+                    assert(marks[i] == (values[i] >= needle && values[i] <= needle + 3));
+                }
+            }
+        }
+        
+        size_t counts[LETTER_STATE_COUNT] = {0, 0, 0};
+        scan_count_states(letters, 37, counts);
+        assert(counts[DELIVERED] == 8 && counts[UNDELIVERED] == 10 && counts[IN_TRANSIT] == 19);
+    }
+    scan_set_level(original);
+    printf("vectorized scan kernels tests passed (%s)!\n", scan_level_name(original));
+}
+
+void test_sharded_workload() {
+    printf("Testing sharded workload...\n");
+    
+    ShardCluster *cluster = shard_cluster_create(2, 10, 4, 4);
+    assert(cluster != NULL);
+    assert(shard_owner(cluster, 1) == 0 && shard_owner(cluster, 5) == 0);
+    assert(shard_owner(cluster, 6) == 1 && shard_owner(cluster, 10) == 1);
+    assert(shard_owner(cluster, 11) == -1);
+    ShardRing *ring = shard_ring(cluster, 0, 1);
+    Letter letter;
+    memset(&letter, 0, sizeof(letter));
+    // Кольцо должно корректно переживать переполнение индексов
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 4; i++) {
+            letter.id = round * 10 + i;
+            assert(shard_ring_push(ring, &letter));
+        }
+        assert(!shard_ring_push(ring, &letter));
+        for (int i = 0; i < 4; i++) {
+            assert(shard_ring_peek(ring)->id == round * 10 + i);
+            shard_ring_pop(ring);
+        }
+        assert(shard_ring_peek(ring) == NULL);
+    }
+    shard_cluster_destroy(cluster);
+    
+    // Гибель второго воркера от сигнала не должна оставить первого висеть на барьере
+    cluster = shard_cluster_create(2, 10, 4, 4);
+    assert(cluster != NULL);
+    fflush(NULL);
+    pid_t workers[2];
+    workers[0] = fork();
+    if (workers[0] == 0) {
+        _exit(shard_barrier(cluster) ? 0 : 1);
+    }
+    workers[1] = fork();
+    if (workers[1] == 0) {
+        raise(SIGKILL);
+        _exit(0);
+    }
+    assert(workers[0] > 0 && workers[1] > 0);
+    assert(shard_wait_workers(cluster, workers, 2) == ERROR_INVALID_PARAMETER);
+    assert(cluster->aborted);
+    shard_cluster_destroy(cluster);
+    
+    WorkloadConfig config;
+    workload_default_config(&config);
+    config.num_offices = 64;
+    config.min_capacity = 500;
+    config.max_capacity = 500;
+    config.auto_connect = 0;
+    config.injection_ticks = 40;
+    config.max_ticks = 2000;
+    
+    WorkloadReport single;
+    assert(run_workload(&config, &single) == SUCCESS);
+    assert(single.injected > 0 && single.stranded == 0);
+    for (int shards = 1; shards <= 4; shards *= 2) {
+        WorkloadReport sharded;
+        config.shards = shards;
+        assert(run_sharded_workload(&config, NULL, &sharded) == SUCCESS);
+        assert(sharded.injected == single.injected);
+        assert(sharded.rejected == single.rejected);
+        assert(sharded.delivered == single.delivered);
+        assert(sharded.stranded == 0);
+        if (shards == 1) {
+            assert(sharded.ticks == single.ticks);
+            assert(sharded.mean_hops == single.mean_hops);
+        }
+        free_workload_report(&sharded);
+    }
+    
+    config.shards = 5;
+    config.num_offices = 4;
+    WorkloadReport invalid;
+    assert(run_sharded_workload(&config, NULL, &invalid) == ERROR_INVALID_PARAMETER);
+    
+    free_workload_report(&single);
+    printf("sharded workload tests passed!\n");
+}
+
+void test_status_view() {
+    printf("Testing shared-memory status view...\n");
+    
+    MailSystem system;
+    init_system(&system);
+    system.quiet = 1;
+    for (int id = 1; id <= 3; id++) {
+        assert(add_office(&system, id, 10, NULL, 0) == SUCCESS);
+    }
+    assert(add_connection(&system, 1, 2, 1) == SUCCESS);
+    assert(add_connection(&system, 2, 3, 1) == SUCCESS);
+    assert(add_letter(&system, REGULAR, 1, 1, 3, "view") == SUCCESS);
+    assert(enable_status_view(&system, "not-a-name") == ERROR_INVALID_PARAMETER);
+    assert(enable_status_view(&system, "/mail_status_test") == SUCCESS);
+    
+    StatusView reader;
+    assert(status_view_attach(&reader, "/mail_status_test") == SUCCESS);
+    StatusSnapshot snapshot;
+    StatusOfficeEntry offices[STATUS_VIEW_MIN_OFFICES * 2];
+    int num_offices = 0;
+    assert(status_view_read(&reader, &snapshot, offices, STATUS_VIEW_MIN_OFFICES * 2, &num_offices) == SUCCESS);
+    assert(snapshot.tick == 0 && snapshot.office_count == 3 && num_offices == 3);
+    assert(snapshot.state_counts[IN_TRANSIT] == 1 && offices[0].current_letters == 1);
+    
+    process_letters_transfer(&system);
+    process_letters_transfer(&system);
+    process_letters_transfer(&system);
+    assert(status_view_read(&reader, &snapshot, offices, 2, &num_offices) == SUCCESS);
+    assert(snapshot.tick == 3 && num_offices == 2);
+    assert(snapshot.state_counts[DELIVERED] == 1 && snapshot.total_occupancy == 0);
+    
+    // Старый сегмент уже списан, а новый ещё не создан: читатель отдаёт последний снимок
+    __atomic_store_n(&system.status_view->segment->retired, 1, __ATOMIC_RELEASE);
+    shm_unlink("/mail_status_test");
+    assert(status_view_read(&reader, &snapshot, offices, 2, &num_offices) == SUCCESS);
+    assert(snapshot.tick == 3 && num_offices == 2);
+    
+    // Рост числа отделений пересоздаёт сегмент, читатель должен переподключиться
+    for (int id = 4; id <= STATUS_VIEW_MIN_OFFICES + 4; id++) {
+        assert(add_office(&system, id, 10, NULL, 0) == SUCCESS);
+    }
+    process_letters_transfer(&system);
+    assert(status_view_read(&reader, &snapshot, offices, STATUS_VIEW_MIN_OFFICES * 2, &num_offices) == SUCCESS);
+    assert(snapshot.tick == 4 && snapshot.office_count == STATUS_VIEW_MIN_OFFICES + 4);
+    assert(num_offices == STATUS_VIEW_MIN_OFFICES + 4);
+    assert(offices[num_offices - 1].id == STATUS_VIEW_MIN_OFFICES + 4);
+    
+    status_view_close(&reader);
+    cleanup_system(&system);
+    assert(status_view_attach(&reader, "/mail_status_test") == ERROR_FILE_OPERATION);
+    printf("shared-memory status view tests passed!\n");
+}
+
+static void mark_visited(void *context, size_t begin, size_t end) {
+    int *visits = (int*)context;
+    for (size_t i = begin; i < end; i++) {
+        __atomic_add_fetch(&visits[i], 1, __ATOMIC_RELAXED);
+    }
+}
+
+void test_work_stealing_executor() {
+    printf("Testing work-stealing executor...\n");
+    
+    assert(executor_create(0) == NULL);
+    Executor *executor = executor_create(4);
+    assert(executor != NULL && executor_threads(executor) == 4);
+    int visits[5000];
+    for (int round = 0; round < 20; round++) {
+        memset(visits, 0, sizeof(visits));
+        executor_for(executor, 5000, (size_t)(round % 4) + 1, mark_visited, visits);
+        for (int i = 0; i < 5000; i++) {
+            assert(visits[i] == 1);
+        }
+    }
+    executor_destroy(executor);
+    
+    // Параллельный план должен давать тот же результат, что и последовательный
+    WorkloadConfig config;
+    workload_default_config(&config);
+    config.topology = TOPOLOGY_HUB_AND_SPOKE;
+    config.num_hubs = 2;
+    config.num_offices = 120;
+    config.hub_capacity = 100000;
+    config.auto_connect = 0;
+    config.arrival_rate = 20.0;
+    config.injection_ticks = 30;
+    config.max_ticks = 400;
+    for (int engine = ENGINE_PRIORITY; engine <= ENGINE_PROCESS; engine++) {
+        WorkloadReport sequential, parallel;
+        config.engine = (EngineKind)engine;
+        config.threads = 1;
+        assert(run_workload(&config, &sequential) == SUCCESS);
+        config.threads = 3;
+        assert(run_workload(&config, &parallel) == SUCCESS);
+        assert(sequential.ticks == parallel.ticks);
+        assert(sequential.delivered == parallel.delivered);
+        assert(sequential.mean_latency == parallel.mean_latency);
+        for (size_t i = 0; i < sequential.delivered_per_tick_size; i++) {
+            assert(sequential.delivered_per_tick[i] == parallel.delivered_per_tick[i]);
+        }
+        free_workload_report(&sequential);
+        free_workload_report(&parallel);
+    }
+    printf("work-stealing executor tests passed!\n");
+}
+
+void test_trace_replay() {
+    printf("Testing trace capture and replay...\n");
+    
+    const char *trace_filename = "test_trace.txt";
+    MailSystem system;
+    init_system(&system);
+    system.quiet = 1;
+    system.retire_interval = 5;
+    assert(enable_trace_capture(&system, trace_filename) == SUCCESS);
+    record_trace_seed(&system, 7);
+    
+    int connections[] = {1};
+    assert(add_office(&system, 1, 20, NULL, 0) == SUCCESS);
+    assert(add_office(&system, 2, 20, connections, 1) == SUCCESS);
+    assert(add_office(&system, 3, 2, NULL, 0) == SUCCESS);
+    assert(add_connection(&system, 2, 3, 2) == SUCCESS);
+    assert(set_link_properties(&system, 2, 3, 2, 1) == SUCCESS);
+    assert(queue_add_office(&system, 4, 10, connections, 1) == SUCCESS);
+    for (int i = 0; i < 12; i++) {
+        add_letter(&system, i % 2 ? URGENT : REGULAR, i % 5, 1 + i % 3, 3 - i % 3, i % 4 ? "multi word\ndata" : "");
+    }
+    for (int tick = 0; tick < 15; tick++) {
+        if (tick == 3) {
+            assert(queue_remove_connection(&system, 2, 3) == SUCCESS);
+            assert(add_letter(&system, REGULAR, 1, 4, 3, "late") == SUCCESS);
+        }
+        if (tick % 3 == 0) {
+            transfer_priority_letters(&system);
+        } else if (tick % 3 == 1) {
+            process_letters_transfer(&system);
+        } else {
+            process_network_tick(&system);
+        }
+    }
+    
+    // Нельзя начать запись на непустой системе
+    assert(enable_trace_capture(&system, trace_filename) == ERROR_INVALID_PARAMETER);
+    
+    MailSystem replayed;
+    ReplayReport *report = (ReplayReport*)malloc(sizeof(ReplayReport));
+    assert(report != NULL);
+    assert(replay_trace(trace_filename, &replayed, 0, NULL, NULL, report) == SUCCESS);
+    assert(report->has_seed && report->seed == 7);
+    assert(report->ticks == 15);
+    assert(replayed.current_tick == system.current_tick);
+    assert(replayed.office_count == system.office_count);
+    assert(replayed.total_occupancy == system.total_occupancy);
+    assert(replayed.next_letter_id == system.next_letter_id);
+    assert(replayed.letters_size == system.letters_size);
+    for (int s = 0; s < LETTER_STATE_COUNT; s++) {
+        assert(replayed.state_counts[s] == system.state_counts[s]);
+    }
+    for (size_t i = 0; i < system.letters_size; i++) {
+        Letter *letter = find_letter(&replayed, system.letters[i].id);
+        assert(letter != NULL);
+        assert(letter->state == system.letters[i].state);
+        assert(letter->current_office == system.letters[i].current_office);
+        assert(letter->hops == system.letters[i].hops);
+        assert(strcmp(letter->tech_data, system.letters[i].tech_data) == 0);
+    }
+    unsigned long long phases = 0;
+    for (int p = 0; p < TICK_PHASE_COUNT; p++) {
+        phases += report->phase_ns[p];
+    }
+    assert(phases <= report->total_ns);
+    
+    cleanup_system(&replayed);
+    cleanup_system(&system);
+    free(report);
+    remove(trace_filename);
+    printf("trace capture and replay tests passed!\n");
+}
+
+static void assert_same_system(MailSystem *a, MailSystem *b) {
+    assert(a->current_tick == b->current_tick);
+    assert(a->office_count == b->office_count);
+    assert(a->total_occupancy == b->total_occupancy);
+    assert(a->letters_size == b->letters_size);
+    for (int s = 0; s < LETTER_STATE_COUNT; s++) {
+        assert(a->state_counts[s] == b->state_counts[s]);
+    }
+    for (int k = 0; k < a->office_count; k++) {
+        PostOffice *office = find_office(b, a->offices[k].id);
+        assert(office != NULL);
+        assert(office->current_letters == a->offices[k].current_letters);
+        assert(office->num_connections == a->offices[k].num_connections);
+    }
+    for (size_t i = 0; i < a->letters_size; i++) {
+        Letter *letter = find_letter(b, a->letters[i].id);
+        assert(letter != NULL);
+        assert(letter->state == a->letters[i].state);
+        assert(letter->current_office == a->letters[i].current_office);
+        assert(letter->hops == a->letters[i].hops);
+    }
+}
+
+void test_system_image() {
+    printf("Testing system startup image...\n");
+    
+    const char *image_filename = "test_system.img";
+    WorkloadConfig config;
+    workload_default_config(&config);
+    config.num_offices = 64;
+    config.arrival_rate = 6.0;
+    for (int queue = QUEUE_HEAP; queue <= QUEUE_BUCKET; queue++) {
+        config.queue_kind = (QueueKind)queue;
+        config.engine = queue == QUEUE_HEAP ? ENGINE_PROCESS : ENGINE_PRIORITY;
+        SystemConfig system_config;
+        workload_system_config(&config, &system_config);
+        
+        WorkloadRng rng;
+        workload_rng_seed(&rng, config.seed);
+        MailSystem system;
+        init_system_with_config(&system, &system_config);
+        system.quiet = 1;
+        assert(build_topology(&system, &config, &rng) == SUCCESS);
+        double carry = 0.0;
+        for (int tick = 0; tick < 20; tick++) {
+            int arrivals = workload_arrivals(&config, &rng, tick, &carry);
+            for (int a = 0; a < arrivals; a++) {
+                LetterType type;
+                int priority, from, to;
+                workload_sample_letter(&config, &rng, &type, &priority, &from, &to);
+                add_letter(&system, type, priority, from, to, "image");
+            }
+            workload_engine_tick(&config, &system);
+            if (tick == 15) {
+                assert(retire_letters(&system) > 0);
+            }
+        }
+        assert(save_system_image(&system, image_filename) == SUCCESS);
+        
+        MailSystem attached;
+        assert(init_system_from_image(&attached, image_filename) == SUCCESS);
+        attached.quiet = 1;
+        assert(attached.image != NULL);
+        assert(attached.next_letter_id == system.next_letter_id);
+        assert_same_system(&system, &attached);
+        assert(check_system_aggregates(&attached));
+        assert(attached.archive.size == system.archive.size && attached.archive.size > 0);
+        Letter archived;
+        assert(find_archived_letter(&attached, system.archive.letters[0].id, &archived) == SUCCESS);
+        assert(archived.state == system.archive.letters[0].state);
+        assert(attached.delivery_stats != NULL);
+        assert(attached.delivery_stats->overall.latency.total == system.delivery_stats->overall.latency.total);
+        
+        // После загрузки образа система должна вести себя так же, как исходная
+        for (int tick = 20; tick < 60; tick++) {
+            int arrivals = workload_arrivals(&config, &rng, tick, &carry);
+            for (int a = 0; a < arrivals; a++) {
+                LetterType type;
+                int priority, from, to;
+                workload_sample_letter(&config, &rng, &type, &priority, &from, &to);
+                assert(add_letter(&system, type, priority, from, to, "image") ==
+                       add_letter(&attached, type, priority, from, to, "image"));
+            }
+            workload_engine_tick(&config, &system);
+            workload_engine_tick(&config, &attached);
+            if (tick % 10 == 0) {
+                retire_letters(&system);
+                retire_letters(&attached);
+            }
+        }
+        assert_same_system(&system, &attached);
+        assert(add_office(&attached, 1000, 5, NULL, 0) == SUCCESS);
+        assert(remove_office(&attached, 1000) == SUCCESS);
+        
+        cleanup_system(&attached);
+        cleanup_system(&system);
+    }
+    
+    // Письма, уже сброшенные в файл архива, остаются доступны после перезапуска
+    const char *spill_filename = "test_image_spill.bin";
+    MailSystem spilling;
+    init_system(&spilling);
+    spilling.quiet = 1;
+    assert(set_archive_spill(&spilling, spill_filename, 2) == SUCCESS);
+    add_office(&spilling, 1, 10, NULL, 0);
+    for (int i = 0; i < 3; i++) {
+        add_letter(&spilling, REGULAR, 1, 1, 1, "Retired before restart");
+        process_letters_transfer(&spilling);
+    }
+    assert(retire_letters(&spilling) == 3);
+    assert(spilling.archive.spilled == 2 && spilling.archive.size == 1);
+    assert(save_system_image(&spilling, image_filename) == SUCCESS);
+    cleanup_system(&spilling);
+    
+    MailSystem restarted;
+    assert(init_system_from_image(&restarted, image_filename) == SUCCESS);
+    restarted.quiet = 1;
+    assert(check_system_aggregates(&restarted));
+    Letter retired_letter;
+    for (int id = 1; id <= 3; id++) {
+        assert(find_archived_letter(&restarted, id, &retired_letter) == SUCCESS && retired_letter.id == id);
+    }
+    add_letter(&restarted, REGULAR, 1, 1, 1, "Retired after restart");
+    process_letters_transfer(&restarted);
+    assert(retire_letters(&restarted) == 1);
+    assert(restarted.archive.spilled == 4 && restarted.archive.size == 0);
+    assert(find_archived_letter(&restarted, 4, &retired_letter) == SUCCESS);
+    assert(find_archived_letter(&restarted, 1, &retired_letter) == SUCCESS);
+    assert(check_system_aggregates(&restarted));
+    cleanup_system(&restarted);
+    remove(spill_filename);
+    
+    FILE *file = fopen(image_filename, "wb");
+    assert(file != NULL);
+    fputs("not an image", file);
+    fclose(file);
+    MailSystem broken;
+    assert(init_system_from_image(&broken, image_filename) == ERROR_FILE_OPERATION);
+    cleanup_system(&broken);
+    remove(image_filename);
+    printf("system startup image tests passed!\n");
+}
+
 int main() {
     printf("Running mail system tests...\n\n");
     
@@ -630,6 +2352,32 @@ int main() {
     test_comprehensive_scenario();
     test_remove_office_with_letters();
     test_auto_connection_creation();
+    test_workload_topologies();
+    test_workload_reproducible();
+    test_stats_counters();
+    test_delivery_tracking();
+    test_system_aggregates();
+    test_letter_retirement();
+    test_retirement_spill_failure();
+    test_letter_archive_file();
+    test_bucket_queue();
+    test_heap_iterator();
+    test_global_urgent_letters();
+    test_memory_budget();
+    test_capacity_hysteresis();
+    test_scheduling_policies();
+    test_network_tick();
+    test_office_handles();
+    test_remove_hub_office();
+    test_topology_epochs();
+    test_weighted_connections();
+    test_regional_routing();
+    test_scan_kernels();
+    test_sharded_workload();
+    test_status_view();
+    test_work_stealing_executor();
+    test_trace_replay();
+    test_system_image();
     
     printf("\nAll mail system tests completed successfully!\n");
     return 0;
@@ -0,0 +1,330 @@
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+
+static unsigned long long replay_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static int parse_queue_kind(const char *value, QueueKind *kind) {
+    for (int k = QUEUE_HEAP; k <= QUEUE_BUCKET; k++) {
+        if (strcmp(value, queue_kind_name((QueueKind)k)) == 0) {
+            *kind = (QueueKind)k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_policy(const char *value, SchedulingPolicy *policy) {
+    for (int k = POLICY_STRICT_PRIORITY; k <= POLICY_EARLIEST_DEADLINE; k++) {
+        if (strcmp(value, scheduling_policy_name((SchedulingPolicy)k)) == 0) {
+            *policy = (SchedulingPolicy)k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_routing(const char *value, RoutingMode *mode) {
+    for (int k = ROUTING_FLAT; k <= ROUTING_REGIONAL; k++) {
+        if (strcmp(value, routing_mode_name((RoutingMode)k)) == 0) {
+            *mode = (RoutingMode)k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_tick_kind(const char *value, TickKind *kind) {
+    for (int k = 0; k < TICK_KIND_COUNT; k++) {
+        if (strcmp(value, tick_kind_name((TickKind)k)) == 0) {
+            *kind = (TickKind)k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static StatusCode read_trace_header(FILE *file, SystemConfig *config, int *retire_interval) {
+    char magic[16];
+    int version;
+    if (fscanf(file, "%15s %d", magic, &version) != 2 || strcmp(magic, TRACE_MAGIC) != 0 || version != TRACE_VERSION) {
+        return ERROR_FILE_OPERATION;
+    }
+
+    char queue[16], policy[16], routing[16];
+    default_system_config(config);
+    if (fscanf(file, " config queue=%15s max_priority=%d policy=%15s aging=%d weights=%d,%d deadlines=%d,%d "
+               "service_rate=%d bandwidth=%d latency=%d auto_connect=%d routing=%15s retire=%d threads=%d",
+               queue, &config->max_priority, policy, &config->aging_ticks,
+               &config->weights[REGULAR], &config->weights[URGENT],
+               &config->deadline_ticks[REGULAR], &config->deadline_ticks[URGENT],
+               &config->service_rate, &config->link_bandwidth, &config->link_latency, &config->auto_connect,
+               routing, retire_interval, &config->worker_threads) != 15) {
+        return ERROR_FILE_OPERATION;
+    }
+    if (!parse_queue_kind(queue, &config->queue_kind) || !parse_policy(policy, &config->policy) ||
+        !parse_routing(routing, &config->routing)) {
+        return ERROR_FILE_OPERATION;
+    }
+    return SUCCESS;
+}
+
+static int read_text(FILE *file, char *text) {
+    int length;
+    if (fscanf(file, "%d", &length) != 1 || length < 0 || length >= TECH_DATA_SIZE || fgetc(file) != ' ') {
+        return 0;
+    }
+    if (fread(text, 1, (size_t)length, file) != (size_t)length) {
+        return 0;
+    }
+    text[length] = '\0';
+    return 1;
+}
+
+static StatusCode replay_office(FILE *file, MailSystem *system, int queued, StatusCode *result) {
+    int id, capacity, num_conn;
+    if (fscanf(file, "%d %d %d", &id, &capacity, &num_conn) != 3) {
+        return ERROR_FILE_OPERATION;
+    }
+    int *connections = NULL;
+    if (num_conn > 0) {
+        connections = (int*)malloc(num_conn * sizeof(int));
+        if (!connections) {
+            return ERROR_MEMORY_ALLOCATION;
+        }
+        for (int i = 0; i < num_conn; i++) {
+            if (fscanf(file, "%d", &connections[i]) != 1) {
+                free(connections);
+                return ERROR_FILE_OPERATION;
+            }
+        }
+    }
+    *result = queued ? queue_add_office(system, id, capacity, connections, num_conn)
+                     : add_office(system, id, capacity, connections, num_conn);
+    free(connections);
+    return SUCCESS;
+}
+
+static StatusCode replay_import(FILE *file, MailSystem *system, StatusCode *result) {
+    Letter letter;
+    int type, state;
+    memset(&letter, 0, sizeof(letter));
+    if (fscanf(file, "%d %d %d %d %d %d %d %d %d", &type, &state, &letter.priority,
+               &letter.from_office, &letter.to_office, &letter.current_office,
+               &letter.created_tick, &letter.hops, &letter.delivered_tick) != 9 ||
+        !read_text(file, letter.tech_data)) {
+        return ERROR_FILE_OPERATION;
+    }
+    letter.type = (LetterType)type;
+    letter.state = (LetterState)state;
+    *result = import_letter(system, &letter, NULL);
+    return SUCCESS;
+}
+
+static StatusCode replay_record(FILE *file, MailSystem *system, const char *record, ReplayReport *report) {
+    StatusCode result = SUCCESS;
+    int a, b, c, d;
+    if (strcmp(record, "office") == 0 || strcmp(record, "queue_office") == 0) {
+        StatusCode status = replay_office(file, system, record[0] == 'q', &result);
+        if (status != SUCCESS) {
+            return status;
+        }
+    } else if (strcmp(record, "letter") == 0) {
+        char tech_data[TECH_DATA_SIZE];
+        if (fscanf(file, "%d %d %d %d", &a, &b, &c, &d) != 4 || !read_text(file, tech_data)) {
+            return ERROR_FILE_OPERATION;
+        }
+        result = add_letter(system, (LetterType)a, b, c, d, tech_data);
+    } else if (strcmp(record, "import") == 0) {
+        StatusCode status = replay_import(file, system, &result);
+        if (status != SUCCESS) {
+            return status;
+        }
+    } else if (strcmp(record, "export") == 0) {
+        Letter exported;
+        if (fscanf(file, "%d", &a) != 1) {
+            return ERROR_FILE_OPERATION;
+        }
+        result = export_letter(system, a, &exported);
+    } else if (strcmp(record, "transfer") == 0) {
+        if (fscanf(file, "%d %d %d", &a, &b, &c) != 3) {
+            return ERROR_FILE_OPERATION;
+        }
+        result = transfer_letter_to_office(system, a, b, c);
+    } else if (strcmp(record, "remove_office") == 0 || strcmp(record, "queue_remove_office") == 0) {
+        if (fscanf(file, "%d", &a) != 1) {
+            return ERROR_FILE_OPERATION;
+        }
+        result = record[0] == 'q' ? queue_remove_office(system, a) : remove_office(system, a);
+    } else if (strcmp(record, "connect") == 0 || strcmp(record, "queue_connect") == 0) {
+        if (fscanf(file, "%d %d %d", &a, &b, &c) != 3) {
+            return ERROR_FILE_OPERATION;
+        }
+        result = record[0] == 'q' ? queue_add_connection(system, a, b, c) : add_connection(system, a, b, c);
+    } else if (strcmp(record, "disconnect") == 0 || strcmp(record, "queue_disconnect") == 0) {
+        if (fscanf(file, "%d %d", &a, &b) != 2) {
+            return ERROR_FILE_OPERATION;
+        }
+        result = record[0] == 'q' ? queue_remove_connection(system, a, b) : remove_connection(system, a, b);
+    } else if (strcmp(record, "region") == 0) {
+        if (fscanf(file, "%d %d", &a, &b) != 2) {
+            return ERROR_FILE_OPERATION;
+        }
+        result = set_office_region(system, a, b);
+    } else if (strcmp(record, "service_rate") == 0) {
+        if (fscanf(file, "%d %d", &a, &b) != 2) {
+            return ERROR_FILE_OPERATION;
+        }
+        result = set_office_service_rate(system, a, b);
+    } else if (strcmp(record, "link") == 0) {
+        if (fscanf(file, "%d %d %d %d", &a, &b, &c, &d) != 4) {
+            return ERROR_FILE_OPERATION;
+        }
+        result = set_link_properties(system, a, b, c, d);
+    } else if (strcmp(record, "budget") == 0) {
+        size_t bytes;
+        if (fscanf(file, "%zu", &bytes) != 1) {
+            return ERROR_FILE_OPERATION;
+        }
+        result = set_memory_budget(system, bytes);
+    } else if (strcmp(record, "retire") == 0) {
+        retire_letters(system);
+    } else if (strcmp(record, "compact") == 0) {
+        compact_system(system);
+    } else if (strcmp(record, "seed") == 0) {
+        if (fscanf(file, "%llu", &report->seed) != 1) {
+            return ERROR_FILE_OPERATION;
+        }
+        report->has_seed = 1;
+    } else {
+        return ERROR_FILE_OPERATION;
+    }
+
+    if (result != SUCCESS) {
+        report->rejected++;
+    }
+    return SUCCESS;
+}
+
+static StatusCode replay_tick(FILE *file, MailSystem *system, ReplayTickFn on_tick, void *context, ReplayReport *report) {
+    char name[TRACE_RECORD_SIZE];
+    ReplayTick tick;
+    if (fscanf(file, "%31s", name) != 1 || !parse_tick_kind(name, &tick.kind)) {
+        return ERROR_FILE_OPERATION;
+    }
+
+    unsigned long long counters[STAT_COUNT];
+    get_stat_counters(counters);
+    unsigned long long transfers = counters[STAT_TRANSFERS];
+    size_t delivered = system->state_counts[DELIVERED];
+    unsigned long long start = replay_now_ns();
+    switch (tick.kind) {
+        case TICK_PRIORITY_TRANSFER:
+            transfer_priority_letters(system);
+            break;
+        case TICK_PROCESS_TRANSFER:
+            process_letters_transfer(system);
+            break;
+        case TICK_NETWORK_TRANSFER:
+        case TICK_KIND_COUNT:
+            process_network_tick(system);
+            break;
+    }
+    tick.total_ns = replay_now_ns() - start;
+    get_stat_counters(counters);
+
+    tick.tick = system->current_tick;
+    memcpy(tick.phase_ns, system->tick_phases, sizeof(tick.phase_ns));
+    tick.transfers = counters[STAT_TRANSFERS] - transfers;
+    tick.deliveries = system->state_counts[DELIVERED] - delivered;
+    tick.live_letters = system->letters_size;
+    tick.occupancy = system->total_occupancy;
+
+    report->ticks++;
+    report->total_ns += tick.total_ns;
+    for (int p = 0; p < TICK_PHASE_COUNT; p++) {
+        report->phase_ns[p] += tick.phase_ns[p];
+    }
+    histogram_record(&report->tick_ns, tick.total_ns);
+    if (on_tick) {
+        on_tick(context, &tick);
+    }
+    return SUCCESS;
+}
+
+StatusCode replay_trace(const char *path, MailSystem *system, int worker_threads,
+                        ReplayTickFn on_tick, void *context, ReplayReport *report) {
+    if (!path || !system || !report) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    memset(report, 0, sizeof(*report));
+    init_system(system);
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return ERROR_FILE_OPERATION;
+    }
+    SystemConfig config;
+    int retire_interval = 0;
+    StatusCode status = read_trace_header(file, &config, &retire_interval);
+    if (status != SUCCESS) {
+        fclose(file);
+        return status;
+    }
+    if (worker_threads > 0) {
+        config.worker_threads = worker_threads;
+    }
+
+    cleanup_system(system);
+    init_system_with_config(system, &config);
+    system->quiet = 1;
+    system->retire_interval = retire_interval;
+    system->profile_ticks = 1;
+
+    char record[TRACE_RECORD_SIZE];
+    while (status == SUCCESS && fscanf(file, "%31s", record) == 1) {
+        report->records++;
+        if (strcmp(record, "tick") == 0) {
+            status = replay_tick(file, system, on_tick, context, report);
+        } else {
+            status = replay_record(file, system, record, report);
+        }
+    }
+    if (status == SUCCESS && !feof(file)) {
+        status = ERROR_FILE_OPERATION;
+    }
+    fclose(file);
+    return status;
+}
+
+void print_replay_report(FILE *out, const ReplayReport *report) {
+    if (!out || !report) {
+        return;
+    }
+
+    fprintf(out, "Replayed %zu records, %d ticks, %zu rejected calls", report->records, report->ticks, report->rejected);
+    if (report->has_seed) {
+        fprintf(out, " (seed %llu)", report->seed);
+    }
+    fprintf(out, "\n");
+    if (report->ticks == 0) {
+        return;
+    }
+
+    const LatencyHistogram *ticks = &report->tick_ns;
+    fprintf(out, "Tick time: total %.3f ms, mean %.1f us, p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+            report->total_ns / 1e6, report->total_ns / 1000.0 / report->ticks,
+            histogram_percentile(ticks, 0.50) / 1000.0,
+            histogram_percentile(ticks, 0.90) / 1000.0,
+            histogram_percentile(ticks, 0.99) / 1000.0,
+            ticks->max / 1000.0);
+    fprintf(out, "Phase breakdown:");
+    for (int p = 0; p < TICK_PHASE_COUNT; p++) {
+        fprintf(out, " %s %.3f ms (%.1f%%)", tick_phase_name((TickPhase)p), report->phase_ns[p] / 1e6,
+                report->total_ns ? 100.0 * report->phase_ns[p] / report->total_ns : 0.0);
+    }
+    fprintf(out, "\n");
+}
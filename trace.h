@@ -0,0 +1,36 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "funcs.h"
+
+#define TRACE_RECORD_SIZE 32
+
+typedef struct {
+    int tick;
+    TickKind kind;
+    unsigned long long total_ns;
+    unsigned long long phase_ns[TICK_PHASE_COUNT];
+    unsigned long long transfers;
+    unsigned long long deliveries;
+    size_t live_letters;
+    long long occupancy;
+} ReplayTick;
+
+typedef void (*ReplayTickFn)(void *context, const ReplayTick *tick);
+
+typedef struct {
+    unsigned long long seed;
+    int has_seed;
+    size_t records;
+    size_t rejected;
+    int ticks;
+    unsigned long long total_ns;
+    unsigned long long phase_ns[TICK_PHASE_COUNT];
+    LatencyHistogram tick_ns;
+} ReplayReport;
+
+StatusCode replay_trace(const char *path, MailSystem *system, int worker_threads,
+                        ReplayTickFn on_tick, void *context, ReplayReport *report);
+void print_replay_report(FILE *out, const ReplayReport *report);
+
+#endif
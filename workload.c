@@ -0,0 +1,701 @@
+#include "workload.h"
+#include <math.h>
+
+void workload_rng_seed(WorkloadRng *rng, uint64_t seed) {
+    if (!rng) {
+        return;
+    }
+    rng->state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+uint64_t workload_rng_next(WorkloadRng *rng) {
+    uint64_t z = (rng->state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+double workload_rng_uniform(WorkloadRng *rng) {
+    return (double)(workload_rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int workload_rng_range(WorkloadRng *rng, int lo, int hi) {
+    if (hi <= lo) {
+        return lo;
+    }
+    return lo + (int)(workload_rng_next(rng) % (uint64_t)(hi - lo + 1));
+}
+
+void workload_default_config(WorkloadConfig *config) {
+    if (!config) {
+        return;
+    }
+
+    config->seed = 42;
+    config->topology = TOPOLOGY_GRID;
+    config->num_offices = 64;
+    config->min_capacity = 20;
+    config->max_capacity = 50;
+    config->hub_capacity = 500;
+    config->num_hubs = 0;
+    config->geometric_radius = 0.0;
+    config->scale_free_links = 2;
+    config->arrival = ARRIVAL_POISSON;
+    config->arrival_rate = 2.0;
+    config->burst_period = 20;
+    config->burst_length = 5;
+    config->injection_ticks = 100;
+    config->priority_dist = PRIORITY_UNIFORM;
+    config->max_priority = 31;
+    config->urgent_fraction = 0.1;
+    config->engine = ENGINE_PROCESS;
+    config->queue_kind = QUEUE_HEAP;
+    config->policy = POLICY_STRICT_PRIORITY;
+    config->service_rate = DEFAULT_SERVICE_RATE;
+    config->link_bandwidth = DEFAULT_LINK_BANDWIDTH;
+    config->link_latency = DEFAULT_LINK_LATENCY;
+    config->auto_connect = 0;
+    config->routing = ROUTING_FLAT;
+    config->max_ticks = 10000;
+    config->retire_interval = 1;
+    config->compact_interval = 0;
+    config->shards = 1;
+    config->threads = 1;
+    config->memory_budget = 0;
+    config->status_name = NULL;
+    config->trace_path = NULL;
+}
+
+const char* topology_name(TopologyKind kind) {
+    switch (kind) {
+        case TOPOLOGY_GRID: return "grid";
+        case TOPOLOGY_RANDOM_GEOMETRIC: return "geometric";
+        case TOPOLOGY_SCALE_FREE: return "scale-free";
+        case TOPOLOGY_HUB_AND_SPOKE: return "hub-and-spoke";
+    }
+    return "unknown";
+}
+
+const char* arrival_name(ArrivalKind kind) {
+    switch (kind) {
+        case ARRIVAL_CONSTANT: return "constant";
+        case ARRIVAL_POISSON: return "poisson";
+        case ARRIVAL_BURSTY: return "bursty";
+    }
+    return "unknown";
+}
+
+const char* priority_dist_name(PriorityDistribution dist) {
+    switch (dist) {
+        case PRIORITY_UNIFORM: return "uniform";
+        case PRIORITY_SKEWED: return "skewed";
+        case PRIORITY_BIMODAL: return "bimodal";
+    }
+    return "unknown";
+}
+
+const char* engine_name(EngineKind kind) {
+    switch (kind) {
+        case ENGINE_PRIORITY: return "priority";
+        case ENGINE_PROCESS: return "process";
+        case ENGINE_NETWORK: return "network";
+    }
+    return "unknown";
+}
+
+static int office_capacity(const WorkloadConfig *config, WorkloadRng *rng) {
+    return workload_rng_range(rng, config->min_capacity, config->max_capacity);
+}
+
+static StatusCode add_office_linked(MailSystem *system, int *degree, int index, int capacity, int *links, int num_links) {
+    int ids[MAX_CONNECTIONS];
+    int count = 0;
+
+    for (int i = 0; i < num_links && count < MAX_CONNECTIONS; i++) {
+        if (degree[links[i]] >= MAX_CONNECTIONS) {
+            continue;
+        }
+        ids[count++] = links[i] + 1;
+        degree[links[i]]++;
+    }
+    degree[index] = count;
+    return add_office(system, index + 1, capacity, ids, count);
+}
+
+static StatusCode build_grid(MailSystem *system, const WorkloadConfig *config, WorkloadRng *rng, int *degree) {
+    int side = (int)ceil(sqrt((double)config->num_offices));
+
+    for (int i = 0; i < config->num_offices; i++) {
+        int links[2];
+        int count = 0;
+        if (i % side > 0) {
+            links[count++] = i - 1;
+        }
+        if (i >= side) {
+            links[count++] = i - side;
+        }
+        StatusCode status = add_office_linked(system, degree, i, office_capacity(config, rng), links, count);
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+    return SUCCESS;
+}
+
+static StatusCode build_geometric(MailSystem *system, const WorkloadConfig *config, WorkloadRng *rng, int *degree) {
+    int n = config->num_offices;
+    double radius = config->geometric_radius;
+    if (radius <= 0.0) {
+        radius = sqrt(5.0 / (3.14159265358979 * n));
+    }
+
+    int cells = (int)(1.0 / radius);
+    if (cells < 1) {
+        cells = 1;
+    }
+    double *x = malloc(n * sizeof(double));
+    double *y = malloc(n * sizeof(double));
+    int *next = malloc(n * sizeof(int));
+    int *head = malloc((size_t)cells * cells * sizeof(int));
+    if (!x || !y || !next || !head) {
+        free(x);
+        free(y);
+        free(next);
+        free(head);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    for (int c = 0; c < cells * cells; c++) {
+        head[c] = -1;
+    }
+
+    StatusCode status = SUCCESS;
+    for (int i = 0; i < n && status == SUCCESS; i++) {
+        x[i] = workload_rng_uniform(rng);
+        y[i] = workload_rng_uniform(rng);
+        int cx = (int)(x[i] * cells);
+        int cy = (int)(y[i] * cells);
+        if (cx >= cells) cx = cells - 1;
+        if (cy >= cells) cy = cells - 1;
+
+        int links[MAX_CONNECTIONS];
+        int count = 0;
+        int nearest = -1;
+        double nearest_dist = 0.0;
+        for (int gx = cx - 1; gx <= cx + 1; gx++) {
+            for (int gy = cy - 1; gy <= cy + 1; gy++) {
+                if (gx < 0 || gy < 0 || gx >= cells || gy >= cells) {
+                    continue;
+                }
+                for (int j = head[gx * cells + gy]; j >= 0; j = next[j]) {
+                    double dx = x[i] - x[j];
+                    double dy = y[i] - y[j];
+                    double dist = dx * dx + dy * dy;
+                    if (dist <= radius * radius && count < MAX_CONNECTIONS) {
+                        links[count++] = j;
+                    }
+                    if (nearest < 0 || dist < nearest_dist) {
+                        nearest = j;
+                        nearest_dist = dist;
+                    }
+                }
+            }
+        }
+        if (count == 0 && i > 0) {
+            links[count++] = nearest >= 0 ? nearest : i - 1;
+        }
+
+        status = add_office_linked(system, degree, i, office_capacity(config, rng), links, count);
+        next[i] = head[cx * cells + cy];
+        head[cx * cells + cy] = i;
+    }
+
+    free(x);
+    free(y);
+    free(next);
+    free(head);
+    return status;
+}
+
+static StatusCode build_scale_free(MailSystem *system, const WorkloadConfig *config, WorkloadRng *rng, int *degree) {
+    int n = config->num_offices;
+    int m = config->scale_free_links > 0 ? config->scale_free_links : 1;
+    if (m > MAX_CONNECTIONS / 2) {
+        m = MAX_CONNECTIONS / 2;
+    }
+
+    size_t endpoints_capacity = (size_t)2 * m * n + 2;
+    int *endpoints = malloc(endpoints_capacity * sizeof(int));
+    if (!endpoints) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+    size_t num_endpoints = 0;
+
+    StatusCode status = SUCCESS;
+    for (int i = 0; i < n && status == SUCCESS; i++) {
+        int links[MAX_CONNECTIONS];
+        int count = 0;
+        int capacity = office_capacity(config, rng);
+
+        if (i <= m) {
+            for (int j = 0; j < i; j++) {
+                links[count++] = j;
+            }
+            capacity = config->hub_capacity;
+        } else {
+            for (int attempt = 0; attempt < 8 * m && count < m; attempt++) {
+                int target = endpoints[workload_rng_next(rng) % num_endpoints];
+                int duplicate = degree[target] >= MAX_CONNECTIONS;
+                for (int k = 0; k < count && !duplicate; k++) {
+                    duplicate = links[k] == target;
+                }
+                if (!duplicate) {
+                    links[count++] = target;
+                }
+            }
+        }
+
+        status = add_office_linked(system, degree, i, capacity, links, count);
+        for (int k = 0; k < count && num_endpoints + 2 <= endpoints_capacity; k++) {
+            endpoints[num_endpoints++] = i;
+            endpoints[num_endpoints++] = links[k];
+        }
+    }
+
+    free(endpoints);
+    return status;
+}
+
+static StatusCode build_hub_and_spoke(MailSystem *system, const WorkloadConfig *config, WorkloadRng *rng, int *degree) {
+    int n = config->num_offices;
+    int hubs = config->num_hubs > 0 ? config->num_hubs : (n + 63) / 64;
+    if (hubs > n) {
+        hubs = n;
+    }
+    if (hubs > MAX_CONNECTIONS / 2) {
+        hubs = MAX_CONNECTIONS / 2;
+    }
+
+    StatusCode status = SUCCESS;
+    for (int i = 0; i < n && status == SUCCESS; i++) {
+        int links[MAX_CONNECTIONS];
+        int count = 0;
+        int capacity;
+
+        if (i < hubs) {
+            for (int j = 0; j < i; j++) {
+                links[count++] = j;
+            }
+            capacity = config->hub_capacity;
+        } else {
+            int hub = i % hubs;
+            if (degree[hub] >= MAX_CONNECTIONS) {
+                hub = workload_rng_range(rng, hubs, i - 1);
+            }
+            links[count++] = hub;
+            capacity = office_capacity(config, rng);
+        }
+        status = add_office_linked(system, degree, i, capacity, links, count);
+    }
+    return status;
+}
+
+StatusCode build_topology(MailSystem *system, const WorkloadConfig *config, WorkloadRng *rng) {
+    if (!system || !config || !rng || config->num_offices <= 0 ||
+        config->min_capacity <= 0 || config->max_capacity < config->min_capacity) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    int *degree = calloc(config->num_offices, sizeof(int));
+    if (!degree) {
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    StatusCode status;
+    switch (config->topology) {
+        case TOPOLOGY_GRID:
+            status = build_grid(system, config, rng, degree);
+            break;
+        case TOPOLOGY_RANDOM_GEOMETRIC:
+            status = build_geometric(system, config, rng, degree);
+            break;
+        case TOPOLOGY_SCALE_FREE:
+            status = build_scale_free(system, config, rng, degree);
+            break;
+        case TOPOLOGY_HUB_AND_SPOKE:
+            status = build_hub_and_spoke(system, config, rng, degree);
+            break;
+        default:
+            status = ERROR_INVALID_PARAMETER;
+            break;
+    }
+    free(degree);
+    return status;
+}
+
+static int poisson_sample(WorkloadRng *rng, double lambda) {
+    if (lambda <= 0.0) {
+        return 0;
+    }
+    if (lambda > 30.0) {
+        double u1 = workload_rng_uniform(rng);
+        double u2 = workload_rng_uniform(rng);
+        double gauss = sqrt(-2.0 * log(u1 > 0.0 ? u1 : 1e-300)) * cos(2.0 * 3.14159265358979 * u2);
+        double value = lambda + sqrt(lambda) * gauss + 0.5;
+        return value < 0.0 ? 0 : (int)value;
+    }
+
+    double limit = exp(-lambda);
+    double product = workload_rng_uniform(rng);
+    int count = 0;
+    while (product > limit) {
+        product *= workload_rng_uniform(rng);
+        count++;
+    }
+    return count;
+}
+
+int workload_arrivals(const WorkloadConfig *config, WorkloadRng *rng, int tick, double *carry) {
+    switch (config->arrival) {
+        case ARRIVAL_CONSTANT: {
+            *carry += config->arrival_rate;
+            int count = (int)*carry;
+            *carry -= count;
+            return count;
+        }
+        case ARRIVAL_POISSON:
+            return poisson_sample(rng, config->arrival_rate);
+        case ARRIVAL_BURSTY: {
+            int period = config->burst_period > 0 ? config->burst_period : 1;
+            int length = config->burst_length > 0 && config->burst_length <= period ? config->burst_length : period;
+            if (tick % period >= length) {
+                return 0;
+            }
+            return poisson_sample(rng, config->arrival_rate * period / length);
+        }
+    }
+    return 0;
+}
+
+static void sample_letter(const WorkloadConfig *config, WorkloadRng *rng, LetterType *type, int *priority) {
+    int max_priority = config->max_priority > 0 ? config->max_priority : 0;
+    *type = workload_rng_uniform(rng) < config->urgent_fraction ? URGENT : REGULAR;
+
+    switch (config->priority_dist) {
+        case PRIORITY_SKEWED: {
+            double u = workload_rng_uniform(rng);
+            *priority = (int)(max_priority * u * u * u);
+            break;
+        }
+        case PRIORITY_BIMODAL:
+            if (*type == URGENT) {
+                *priority = workload_rng_range(rng, max_priority - max_priority / 4, max_priority);
+            } else {
+                *priority = workload_rng_range(rng, 0, max_priority / 4);
+            }
+            break;
+        case PRIORITY_UNIFORM:
+        default:
+            *priority = workload_rng_range(rng, 0, max_priority);
+            break;
+    }
+}
+
+void workload_sample_letter(const WorkloadConfig *config, WorkloadRng *rng, LetterType *type, int *priority, int *from, int *to) {
+    *from = workload_rng_range(rng, 1, config->num_offices);
+    *to = workload_rng_range(rng, 1, config->num_offices - 1);
+    if (config->num_offices == 1) {
+        *to = *from;
+    } else if (*to >= *from) {
+        (*to)++;
+    }
+    sample_letter(config, rng, type, priority);
+}
+
+void workload_system_config(const WorkloadConfig *config, SystemConfig *system_config) {
+    default_system_config(system_config);
+    system_config->queue_kind = config->queue_kind;
+    system_config->max_priority = config->max_priority;
+    system_config->policy = config->policy;
+    system_config->service_rate = config->service_rate;
+    system_config->link_bandwidth = config->link_bandwidth;
+    system_config->link_latency = config->link_latency;
+    system_config->auto_connect = config->auto_connect;
+    system_config->routing = config->routing;
+    system_config->worker_threads = config->threads;
+    system_config->memory_budget = config->memory_budget;
+}
+
+void workload_engine_tick(const WorkloadConfig *config, MailSystem *system) {
+    if (config->engine == ENGINE_PRIORITY) {
+        transfer_priority_letters(system);
+    } else if (config->engine == ENGINE_NETWORK) {
+        process_network_tick(system);
+    } else {
+        process_letters_transfer(system);
+    }
+}
+
+static int append_int(int **values, size_t *size, size_t *capacity, int value) {
+    if (*size >= *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 64;
+        int *grown = realloc(*values, new_capacity * sizeof(int));
+        if (!grown) {
+            return 0;
+        }
+        *values = grown;
+        *capacity = new_capacity;
+    }
+    (*values)[(*size)++] = value;
+    return 1;
+}
+
+static int record_depth(WorkloadReport *report, int depth) {
+    if ((size_t)depth >= report->depth_histogram_size) {
+        size_t new_size = report->depth_histogram_size ? report->depth_histogram_size : 16;
+        while (new_size <= (size_t)depth) {
+            new_size *= 2;
+        }
+        long long *grown = realloc(report->depth_histogram, new_size * sizeof(long long));
+        if (!grown) {
+            return 0;
+        }
+        memset(grown + report->depth_histogram_size, 0, (new_size - report->depth_histogram_size) * sizeof(long long));
+        report->depth_histogram = grown;
+        report->depth_histogram_size = new_size;
+    }
+    report->depth_histogram[depth]++;
+    if (depth > report->max_depth) {
+        report->max_depth = depth;
+    }
+    return 1;
+}
+
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static int percentile_sorted(const int *values, size_t count, double fraction) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t rank = (size_t)ceil(fraction * count);
+    return values[rank > 0 ? rank - 1 : 0];
+}
+
+static double mean_of(const int *values, size_t count) {
+    if (count == 0) {
+        return 0.0;
+    }
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        sum += values[i];
+    }
+    return sum / count;
+}
+
+static int depth_percentile(const WorkloadReport *report, long long total, double fraction) {
+    long long rank = (long long)ceil(fraction * total);
+    long long seen = 0;
+    for (size_t depth = 0; depth < report->depth_histogram_size; depth++) {
+        seen += report->depth_histogram[depth];
+        if (seen >= rank && seen > 0) {
+            return (int)depth;
+        }
+    }
+    return report->max_depth;
+}
+
+StatusCode run_workload(const WorkloadConfig *config, WorkloadReport *report) {
+    if (!config || !report || config->num_offices <= 0 || config->max_ticks <= 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+    memset(report, 0, sizeof(*report));
+
+    WorkloadRng rng;
+    workload_rng_seed(&rng, config->seed);
+
+    SystemConfig system_config;
+    workload_system_config(config, &system_config);
+
+    MailSystem system;
+    init_system_with_config(&system, &system_config);
+    system.quiet = 1;
+
+    StatusCode status = SUCCESS;
+    if (config->trace_path) {
+        status = enable_trace_capture(&system, config->trace_path);
+        record_trace_seed(&system, config->seed);
+    }
+    if (status == SUCCESS) {
+        status = build_topology(&system, config, &rng);
+    }
+    if (status == SUCCESS && config->status_name) {
+        status = enable_status_view(&system, config->status_name);
+    }
+    if (status != SUCCESS) {
+        cleanup_system(&system);
+        return status;
+    }
+
+    int *hops = NULL, *latency = NULL;
+    size_t hops_size = 0, hops_capacity = 0;
+    size_t latency_size = 0, latency_capacity = 0;
+    report->delivered_per_tick = malloc(config->max_ticks * sizeof(int));
+    if (!report->delivered_per_tick) {
+        cleanup_system(&system);
+        return ERROR_MEMORY_ALLOCATION;
+    }
+
+    double carry = 0.0;
+    long long depth_samples = 0;
+    double depth_sum = 0.0;
+    int tick;
+    for (tick = 0; tick < config->max_ticks && status == SUCCESS; tick++) {
+        if (tick < config->injection_ticks) {
+            int arrivals = workload_arrivals(config, &rng, tick, &carry);
+            for (int a = 0; a < arrivals; a++) {
+                LetterType type;
+                int priority, from, to;
+                workload_sample_letter(config, &rng, &type, &priority, &from, &to);
+
+                if (add_letter(&system, type, priority, from, to, "synthetic") != SUCCESS) {
+                    report->rejected++;
+                    continue;
+                }
+                report->injected++;
+            }
+        }
+
+        workload_engine_tick(config, &system);
+
+        int delivered_now = 0;
+        report->undelivered = (int)system.state_counts[UNDELIVERED];
+        for (size_t i = 0; i < system.letters_size; i++) {
+            const Letter *letter = &system.letters[i];
+            if (letter->state == DELIVERED && letter->delivered_tick == system.current_tick) {
+                delivered_now++;
+                if (!append_int(&hops, &hops_size, &hops_capacity, letter->hops) ||
+                    !append_int(&latency, &latency_size, &latency_capacity, letter->delivered_tick - letter->created_tick)) {
+                    status = ERROR_MEMORY_ALLOCATION;
+                }
+            }
+        }
+        if (config->retire_interval > 0 && tick % config->retire_interval == 0) {
+            retire_letters(&system);
+        }
+        if (config->compact_interval > 0 && tick % config->compact_interval == 0) {
+            compact_system(&system);
+        }
+        report->delivered += delivered_now;
+        report->delivered_per_tick[tick] = delivered_now;
+        measure_memory(&system, &report->memory);
+        if (report->memory.total > report->peak_memory) {
+            report->peak_memory = report->memory.total;
+        }
+
+        for (int k = 0; k < system.office_count; k++) {
+            PostOffice *office = &system.offices[k];
+            if (!record_depth(report, office->current_letters)) {
+                status = ERROR_MEMORY_ALLOCATION;
+                break;
+            }
+            depth_sum += office->current_letters;
+            depth_samples++;
+        }
+
+        int in_flight = report->injected - report->delivered - report->undelivered;
+        if (tick + 1 >= config->injection_ticks && in_flight == 0) {
+            tick++;
+            break;
+        }
+    }
+
+    report->ticks = tick;
+    report->delivered_per_tick_size = (size_t)tick;
+    report->stranded = report->injected - report->delivered - report->undelivered;
+
+    qsort(hops, hops_size, sizeof(int), compare_ints);
+    qsort(latency, latency_size, sizeof(int), compare_ints);
+    report->mean_hops = mean_of(hops, hops_size);
+    report->p99_hops = percentile_sorted(hops, hops_size, 0.99);
+    report->mean_latency = mean_of(latency, latency_size);
+    report->p99_latency = percentile_sorted(latency, latency_size, 0.99);
+    report->mean_depth = depth_samples ? depth_sum / depth_samples : 0.0;
+    report->p50_depth = depth_percentile(report, depth_samples, 0.50);
+    report->p99_depth = depth_percentile(report, depth_samples, 0.99);
+
+    free(hops);
+    free(latency);
+    cleanup_system(&system);
+    if (status != SUCCESS) {
+        free_workload_report(report);
+    }
+    return status;
+}
+
+void free_workload_report(WorkloadReport *report) {
+    if (!report) {
+        return;
+    }
+
+    free(report->delivered_per_tick);
+    report->delivered_per_tick = NULL;
+    report->delivered_per_tick_size = 0;
+    free(report->depth_histogram);
+    report->depth_histogram = NULL;
+    report->depth_histogram_size = 0;
+}
+
+void print_workload_report(FILE *out, const WorkloadConfig *config, const WorkloadReport *report) {
+    if (!out || !config || !report) {
+        return;
+    }
+
+    int peak = 0;
+    for (size_t i = 0; i < report->delivered_per_tick_size; i++) {
+        if (report->delivered_per_tick[i] > peak) {
+            peak = report->delivered_per_tick[i];
+        }
+    }
+
+    fprintf(out, "Workload: topology=%s offices=%d arrival=%s rate=%.2f priorities=%s engine=%s queue=%s policy=%s routing=%s seed=%llu\n",
+            topology_name(config->topology), config->num_offices, arrival_name(config->arrival),
+            config->arrival_rate, priority_dist_name(config->priority_dist), engine_name(config->engine),
+            queue_kind_name(config->queue_kind), scheduling_policy_name(config->policy),
+            routing_mode_name(config->routing), (unsigned long long)config->seed);
+    fprintf(out, "Ticks: %d, Injected: %d, Rejected: %d\n", report->ticks, report->injected, report->rejected);
+    fprintf(out, "Delivered: %d, Undelivered: %d, Stranded: %d\n", report->delivered, report->undelivered, report->stranded);
+    fprintf(out, "Delivered per tick: mean %.3f, peak %d\n",
+            report->ticks ? (double)report->delivered / report->ticks : 0.0, peak);
+    fprintf(out, "Hops: mean %.2f, p99 %d\n", report->mean_hops, report->p99_hops);
+    fprintf(out, "Latency (ticks): mean %.2f, p99 %d\n", report->mean_latency, report->p99_latency);
+    fprintf(out, "Queue depth: mean %.2f, p50 %d, p99 %d, max %d\n",
+            report->mean_depth, report->p50_depth, report->p99_depth, report->max_depth);
+
+    if (report->memory.total > 0) {
+        fprintf(out, "Memory: %zu bytes, peak %zu", report->memory.total, report->peak_memory);
+        if (report->memory.budget > 0) {
+            fprintf(out, ", budget %zu, rejections %zu", report->memory.budget, report->memory.rejections);
+        }
+        fprintf(out, "\n ");
+        for (int c = 0; c < MEMORY_CATEGORY_COUNT; c++) {
+            fprintf(out, " %s %zu", memory_category_name((MemoryCategory)c), report->memory.bytes[c]);
+        }
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "Queue depth distribution:\n");
+    size_t lo = 0;
+    for (size_t hi = 1; lo < report->depth_histogram_size && (int)lo <= report->max_depth; hi *= 2) {
+        long long count = 0;
+        for (size_t d = lo; d < hi && d < report->depth_histogram_size; d++) {
+            count += report->depth_histogram[d];
+        }
+        if (count > 0) {
+            fprintf(out, "  [%zu, %zu): %lld\n", lo, hi, count);
+        }
+        lo = hi;
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdint.h>
+#include "funcs.h"
+
+typedef enum {
+    TOPOLOGY_GRID,
+    TOPOLOGY_RANDOM_GEOMETRIC,
+    TOPOLOGY_SCALE_FREE,
+    TOPOLOGY_HUB_AND_SPOKE
+} TopologyKind;
+
+typedef enum {
+    ARRIVAL_CONSTANT,
+    ARRIVAL_POISSON,
+    ARRIVAL_BURSTY
+} ArrivalKind;
+
+typedef enum {
+    PRIORITY_UNIFORM,
+    PRIORITY_SKEWED,
+    PRIORITY_BIMODAL
+} PriorityDistribution;
+
+typedef enum {
+    ENGINE_PRIORITY,
+    ENGINE_PROCESS,
+    ENGINE_NETWORK
+} EngineKind;
+
+typedef struct {
+    uint64_t state;
+} WorkloadRng;
+
+typedef struct {
+    uint64_t seed;
+
+    TopologyKind topology;
+    int num_offices;
+    int min_capacity;
+    int max_capacity;
+    int hub_capacity;
+    int num_hubs;
+    double geometric_radius;
+    int scale_free_links;
+
+    ArrivalKind arrival;
+    double arrival_rate;
+    int burst_period;
+    int burst_length;
+    int injection_ticks;
+
+    PriorityDistribution priority_dist;
+    int max_priority;
+    double urgent_fraction;
+
+    EngineKind engine;
+    QueueKind queue_kind;
+    SchedulingPolicy policy;
+    int service_rate;
+    int link_bandwidth;
+    int link_latency;
+    int auto_connect;
+    RoutingMode routing;
+    int max_ticks;
+    int retire_interval;
+    int compact_interval;
+    int shards;
+    int threads;
+    size_t memory_budget;
+    const char *status_name;
+    const char *trace_path;
+} WorkloadConfig;
+
+typedef struct {
+    int ticks;
+    int injected;
+    int rejected;
+    int delivered;
+    int undelivered;
+    int stranded;
+
+    int *delivered_per_tick;
+    size_t delivered_per_tick_size;
+
+    double mean_hops;
+    int p99_hops;
+    double mean_latency;
+    int p99_latency;
+
+    long long *depth_histogram;
+    size_t depth_histogram_size;
+    double mean_depth;
+    int p50_depth;
+    int p99_depth;
+    int max_depth;
+
+    MemoryFootprint memory;
+    size_t peak_memory;
+} WorkloadReport;
+
+void workload_rng_seed(WorkloadRng *rng, uint64_t seed);
+uint64_t workload_rng_next(WorkloadRng *rng);
+double workload_rng_uniform(WorkloadRng *rng);
+int workload_rng_range(WorkloadRng *rng, int lo, int hi);
+
+void workload_default_config(WorkloadConfig *config);
+StatusCode build_topology(MailSystem *system, const WorkloadConfig *config, WorkloadRng *rng);
+int workload_arrivals(const WorkloadConfig *config, WorkloadRng *rng, int tick, double *carry);
+void workload_sample_letter(const WorkloadConfig *config, WorkloadRng *rng, LetterType *type, int *priority, int *from, int *to);
+void workload_system_config(const WorkloadConfig *config, SystemConfig *system_config);
+void workload_engine_tick(const WorkloadConfig *config, MailSystem *system);
+StatusCode run_workload(const WorkloadConfig *config, WorkloadReport *report);
+void free_workload_report(WorkloadReport *report);
+void print_workload_report(FILE *out, const WorkloadConfig *config, const WorkloadReport *report);
+
+const char* topology_name(TopologyKind kind);
+const char* arrival_name(ArrivalKind kind);
+const char* priority_dist_name(PriorityDistribution dist);
+const char* engine_name(EngineKind kind);
+
+#endif